@@ -0,0 +1,507 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ *	Reporting and synthetic font generation for the benchmark programs
+ */
+#include "config.h"
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#	include <linux/perf_event.h>
+#	include <sys/syscall.h>
+#	define HAVE_PERF_EVENT 1
+#endif
+#include <libHX/defs.h>
+#include "bench.hpp"
+#include "vfalib.hpp"
+
+using namespace vfalib;
+
+namespace bench {
+
+enum {
+	PCF_PROPERTIES    = 0x1U,
+	PCF_ACCELERATORS  = 0x2U,
+	PCF_METRICS       = 0x4U,
+	PCF_BITMAPS       = 0x8U,
+	PCF_BDF_ENCODINGS = 0x20U,
+	/* MSByte first, MSBit first, rows padded to 1 byte, 1-byte scan unit */
+	PCF_FORMAT_BE     = 0x4U | 0x8U,
+};
+
+struct deleter {
+	void operator()(FILE *f) { fclose(f); }
+};
+
+pmu::pmu()
+{
+	std::fill(std::begin(m_fd), std::end(m_fd), -1);
+#ifdef HAVE_PERF_EVENT
+	static const struct {
+		uint32_t type;
+		uint64_t config;
+	} evdef[] = {
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+		{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+		 PERF_COUNT_HW_CACHE_OP_READ << 8 |
+		 PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	};
+	static_assert(std::size(evdef) == PMU_MAX);
+	int err = 0;
+	for (unsigned int ev = 0; ev < PMU_MAX; ++ev) {
+		struct perf_event_attr attr{};
+		attr.size           = sizeof(attr);
+		attr.type           = evdef[ev].type;
+		attr.config         = evdef[ev].config;
+		attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED |
+		                      PERF_FORMAT_TOTAL_TIME_RUNNING;
+		/* worker threads of parallel_for, and palcomp child processes */
+		attr.inherit        = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv     = 1;
+		m_fd[ev] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+		if (m_fd[ev] < 0)
+			err = errno;
+	}
+	if (!available())
+		fprintf(stderr, "Hardware counters unavailable: %s\n", strerror(err));
+#else
+	fprintf(stderr, "Hardware counters are not supported on this platform\n");
+#endif
+}
+
+pmu::~pmu()
+{
+	for (auto fd : m_fd)
+		if (fd >= 0)
+			close(fd);
+}
+
+bool pmu::available() const
+{
+	return std::any_of(std::begin(m_fd), std::end(m_fd), [](int fd) { return fd >= 0; });
+}
+
+const char *pmu::name(unsigned int ev)
+{
+	static const char *const names[] = {
+		"cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses",
+	};
+	static_assert(std::size(names) == PMU_MAX);
+	return ev < PMU_MAX ? names[ev] : "";
+}
+
+/*
+ * The counters run continuously; start() and stop() merely take snapshots
+ * of value, time enabled and time running.
+ */
+void pmu::start()
+{
+	for (unsigned int ev = 0; ev < PMU_MAX; ++ev)
+		if (m_fd[ev] >= 0 && read(m_fd[ev], m_begin[ev], sizeof(m_begin[ev])) !=
+		    sizeof(m_begin[ev]))
+			memset(m_begin[ev], 0, sizeof(m_begin[ev]));
+}
+
+void pmu::stop(double (&total)[PMU_MAX])
+{
+	for (unsigned int ev = 0; ev < PMU_MAX; ++ev) {
+		uint64_t now[3];
+		if (m_fd[ev] < 0 || read(m_fd[ev], now, sizeof(now)) != sizeof(now))
+			continue;
+		double value = now[0] - m_begin[ev][0];
+		auto enabled = now[1] - m_begin[ev][1], running = now[2] - m_begin[ev][2];
+		if (running > 0 && running < enabled)
+			value *= static_cast<double>(enabled) / running;
+		total[ev] += value;
+	}
+}
+
+double result::pct(double p) const
+{
+	if (ns.size() == 0)
+		return 0;
+	/* nearest-rank */
+	size_t rank = p / 100 * ns.size() + 0.5;
+	return ns[std::min(rank > 0 ? rank - 1 : 0, ns.size() - 1)];
+}
+
+static std::string json_escape(const std::string &s)
+{
+	std::string out;
+	for (auto c : s) {
+		if (c == '"' || c == '\\')
+			out += '\\';
+		out += c;
+	}
+	return out;
+}
+
+void reporter::emit(const result &r)
+{
+	auto med = r.median();
+	double per_item = r.items > 0 ? med / r.items : 0;
+	double items_s = r.items > 0 && med > 0 ? r.items / med * 1e9 : 0;
+	double mbps = r.bytes > 0 && med > 0 ? r.bytes / med * 1e9 / 1048576 : 0;
+	if (m_opts.json) {
+		printf("%s{\"suite\": \"%s\", \"name\": \"%s\", \"reps\": %zu, "
+		       "\"items\": %zu, \"bytes\": %zu, \"min_ns\": %.0f, "
+		       "\"median_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f, "
+		       "\"max_ns\": %.0f, \"ns_per_item\": %.2f, "
+		       "\"items_per_s\": %.0f, \"mb_per_s\": %.2f",
+		       m_count == 0 ? "[\n" : ",\n",
+		       json_escape(r.suite).c_str(), json_escape(r.name).c_str(),
+		       r.ns.size(), r.items, r.bytes, r.pct(0), med, r.pct(90),
+		       r.pct(99), r.pct(100), per_item, items_s, mbps);
+		for (const auto &e : r.extra)
+			printf(", \"%s\": %.2f", json_escape(e.first).c_str(), e.second);
+		for (const auto &e : r.pmu) {
+			printf(", \"%s\": %.0f", e.first.c_str(), e.second);
+			if (r.items > 0)
+				printf(", \"%s_per_item\": %.2f", e.first.c_str(), e.second / r.items);
+		}
+		printf("}");
+	} else {
+		if (m_count == 0)
+			printf("%-8s %-28s %12s %12s %12s %10s %12s %9s\n",
+			       "suite", "name", "median/us", "p90/us", "p99/us",
+			       "ns/item", "items/s", "MB/s");
+		printf("%-8s %-28s %12.2f %12.2f %12.2f %10.2f %12.0f ",
+		       r.suite.c_str(), r.name.c_str(), med / 1000,
+		       r.pct(90) / 1000, r.pct(99) / 1000, per_item, items_s);
+		if (r.bytes > 0)
+			printf("%9.1f", mbps);
+		else
+			printf("%9s", "-");
+		for (const auto &e : r.extra)
+			printf("  %s=%.2f", e.first.c_str(), e.second);
+		for (const auto &e : r.pmu)
+			printf("  %s/item=%.2f", e.first.c_str(),
+			       e.second / std::max<size_t>(r.items, 1));
+		printf("\n");
+	}
+	++m_count;
+	fflush(stdout);
+}
+
+void reporter::finish()
+{
+	if (m_done)
+		return;
+	m_done = true;
+	if (m_opts.json)
+		printf(m_count == 0 ? "[]\n" : "\n]\n");
+}
+
+/**
+ * Parse a list like "8x8,8x16,32x64".
+ */
+std::vector<vfsize> parse_sizes(const char *s)
+{
+	std::vector<vfsize> v;
+	while (*s != '\0') {
+		char *end = nullptr;
+		auto w = strtoul(s, &end, 10);
+		if (end == s || *end != 'x')
+			break;
+		s = end + 1;
+		auto h = strtoul(s, &end, 10);
+		if (end == s)
+			break;
+		if (w > 0 && h > 0)
+			v.emplace_back(w, h);
+		s = end;
+		if (*s == ',')
+			++s;
+	}
+	return v;
+}
+
+/**
+ * Parse a list like "bdf,psf". Returns 0 on unknown names.
+ */
+unsigned int parse_formats(const char *s)
+{
+	static const struct {
+		const char *name;
+		unsigned int bit;
+	} fmtnames[] = {
+		{"all", GEN_ALL}, {"bdf", GEN_BDF}, {"clt", GEN_CLT},
+		{"fnt", GEN_FNT}, {"hex", GEN_HEX}, {"pcf", GEN_PCF},
+		{"psf", GEN_PSF},
+	};
+	unsigned int mask = 0;
+	while (*s != '\0') {
+		auto len = strcspn(s, ",");
+		unsigned int bit = 0;
+		for (const auto &e : fmtnames)
+			if (strlen(e.name) == len && strncmp(e.name, s, len) == 0)
+				bit = e.bit;
+		if (bit == 0) {
+			fprintf(stderr, "Unknown format \"%.*s\"\n", static_cast<int>(len), s);
+			return 0;
+		}
+		mask |= bit;
+		s += len;
+		if (*s == ',')
+			++s;
+	}
+	return mask;
+}
+
+std::string sizename(const vfsize &sz)
+{
+	return std::to_string(sz.w) + "x" + std::to_string(sz.h);
+}
+
+/**
+ * Produce a deterministic font with @count glyphs of the given size. Pixels
+ * are set with roughly 1/3 probability. Glyphs are mapped to consecutive
+ * codepoints from U+0020, skipping the surrogate range.
+ */
+font synth_font(const vfsize &size, unsigned int count, uint32_t seed)
+{
+	font f;
+	f.m_unicode_map = std::make_shared<unicode_map>();
+	f.m_glyph.reserve(count);
+	uint64_t x = 0x9E3779B97F4A7C15ULL ^ seed;
+	char32_t cp = 0x20;
+	for (unsigned int i = 0; i < count; ++i) {
+		glyph g(size);
+		for (auto &c : g.m_data) {
+			/* xorshift64 */
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			c = (x & (x >> 8)) | ((x >> 16) & (x >> 24) & (x >> 32));
+		}
+		/* Clear the padding bits beyond w*h */
+		auto bits = size.w * size.h;
+		if (bits % 8 != 0)
+			g.m_data.back() &= 0xFF << (8 - bits % 8);
+		f.m_glyph.push_back(std::move(g));
+		if (cp == 0xD800)
+			cp = 0xE000;
+		f.m_unicode_map->add_i2u(i, cp++);
+	}
+	return f;
+}
+
+static void put32le(std::string &s, uint32_t v)
+{
+	v = cpu_to_le32(v);
+	s.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static void put32be(std::string &s, uint32_t v)
+{
+	s += static_cast<char>(v >> 24);
+	s += static_cast<char>(v >> 16);
+	s += static_cast<char>(v >> 8);
+	s += static_cast<char>(v);
+}
+
+static void put16be(std::string &s, uint16_t v)
+{
+	s += static_cast<char>(v >> 8);
+	s += static_cast<char>(v);
+}
+
+static void pad4(std::string &s)
+{
+	while (s.size() % 4 != 0)
+		s += '\0';
+}
+
+/**
+ * Emit a glyph metrics record (uncompressed form).
+ */
+static void pcf_metric(std::string &s, const vfsize &sz)
+{
+	put16be(s, 0);
+	put16be(s, sz.w);
+	put16be(s, sz.w);
+	put16be(s, sz.h - sz.h / 4);
+	put16be(s, sz.h / 4);
+	put16be(s, 0);
+}
+
+/**
+ * Write a minimal X11 Portable Compiled Format file with properties,
+ * accelerators, metrics, bitmaps and BDF encodings (BMP codepoints only).
+ */
+int save_pcf(const font &f, const char *file)
+{
+	vfsize sz0;
+	if (f.m_glyph.size() > 0)
+		sz0 = f.m_glyph[0].m_size;
+	auto ascent = sz0.h - sz0.h / 4, descent = sz0.h / 4;
+
+	/* Properties */
+	std::string props, strtab;
+	put32le(props, PCF_FORMAT_BE);
+	static const char *const sprops[][2] = {
+		{"FONT", "-misc-synthetic-medium-r-normal--0-0-75-75-c-0-iso10646-1"},
+		{"SPACING", "C"},
+		{"CHARSET_REGISTRY", "ISO10646"},
+		{"CHARSET_ENCODING", "1"},
+	};
+	const std::pair<const char *, unsigned int> iprops[] = {
+		{"PIXEL_SIZE", sz0.h}, {"FONT_ASCENT", ascent},
+		{"FONT_DESCENT", descent},
+	};
+	put32be(props, std::size(sprops) + std::size(iprops));
+	for (const auto &p : sprops) {
+		put32be(props, strtab.size());
+		strtab.append(p[0], strlen(p[0]) + 1);
+		props += '\1';
+		put32be(props, strtab.size());
+		strtab.append(p[1], strlen(p[1]) + 1);
+	}
+	for (const auto &p : iprops) {
+		put32be(props, strtab.size());
+		strtab.append(p.first, strlen(p.first) + 1);
+		props += '\0';
+		put32be(props, p.second);
+	}
+	pad4(props);
+	put32be(props, strtab.size());
+	props += strtab;
+	pad4(props);
+
+	/* Accelerators */
+	std::string accel;
+	put32le(accel, PCF_FORMAT_BE);
+	accel += std::string("\1\1\1\1\1\0\0\0", 8);
+	put32be(accel, ascent);
+	put32be(accel, descent);
+	put32be(accel, 0);
+	pcf_metric(accel, sz0);
+	pcf_metric(accel, sz0);
+
+	/* Metrics */
+	std::string metrics;
+	put32le(metrics, PCF_FORMAT_BE);
+	put32be(metrics, f.m_glyph.size());
+	for (const auto &g : f.m_glyph)
+		pcf_metric(metrics, g.m_size);
+
+	/* Bitmaps */
+	std::string bitmaps, bmdata;
+	put32le(bitmaps, PCF_FORMAT_BE);
+	put32be(bitmaps, f.m_glyph.size());
+	for (const auto &g : f.m_glyph) {
+		put32be(bitmaps, bmdata.size());
+		bmdata += g.as_rowpad();
+	}
+	for (unsigned int pad = 1; pad <= 8; pad <<= 1) {
+		/* What the bitmap size would be with 1/2/4/8-byte row padding */
+		size_t z = 0;
+		for (const auto &g : f.m_glyph)
+			z += g.m_size.h * (((g.m_size.w + 7) / 8 + pad - 1) / pad * pad);
+		put32be(bitmaps, z);
+	}
+	bitmaps += bmdata;
+	pad4(bitmaps);
+
+	/* Encodings */
+	unsigned int min2 = 0xFF, max2 = 0, min1 = 0xFF, max1 = 0;
+	for (const auto &pair : f.m_unicode_map->m_u2i) {
+		if (pair.first > 0xFFFF)
+			break;
+		min1 = std::min(min1, static_cast<unsigned int>(pair.first >> 8));
+		max1 = std::max(max1, static_cast<unsigned int>(pair.first >> 8));
+		min2 = std::min(min2, static_cast<unsigned int>(pair.first & 0xFF));
+		max2 = std::max(max2, static_cast<unsigned int>(pair.first & 0xFF));
+	}
+	if (min1 > max1)
+		min1 = max1 = min2 = max2 = 0;
+	auto cols = max2 - min2 + 1;
+	std::vector<uint16_t> idx((max1 - min1 + 1) * cols, 0xFFFF);
+	for (const auto &pair : f.m_unicode_map->m_u2i) {
+		if (pair.first > 0xFFFF)
+			break;
+		if (pair.second < f.m_glyph.size())
+			idx[((pair.first >> 8) - min1) * cols + (pair.first & 0xFF) - min2] = pair.second;
+	}
+	std::string enc;
+	put32le(enc, PCF_FORMAT_BE);
+	put16be(enc, min2);
+	put16be(enc, max2);
+	put16be(enc, min1);
+	put16be(enc, max1);
+	put16be(enc, 0);
+	for (auto i : idx)
+		put16be(enc, i);
+	pad4(enc);
+
+	const std::pair<unsigned int, const std::string *> tables[] = {
+		{PCF_PROPERTIES, &props}, {PCF_ACCELERATORS, &accel},
+		{PCF_METRICS, &metrics}, {PCF_BITMAPS, &bitmaps},
+		{PCF_BDF_ENCODINGS, &enc},
+	};
+	std::string out = "\1fcp";
+	put32le(out, std::size(tables));
+	uint32_t offset = 8 + 16 * std::size(tables);
+	for (const auto &t : tables) {
+		put32le(out, t.first);
+		put32le(out, PCF_FORMAT_BE);
+		put32le(out, t.second->size());
+		put32le(out, offset);
+		offset += t.second->size();
+	}
+	for (const auto &t : tables)
+		out += *t.second;
+
+	std::unique_ptr<FILE, deleter> fp(fopen(file, "wb"));
+	if (fp == nullptr)
+		return -errno;
+	if (fwrite(out.c_str(), out.size(), 1, fp.get()) != 1)
+		return -EIO;
+	return 0;
+}
+
+/**
+ * Write @f in every format selected by @formats to @stem.bdf, @stem.psf,
+ * @stem.fnt, @stem.hex, @stem.pcf and the @stem.clt/ directory. .hex is
+ * skipped for cell sizes it cannot hold.
+ */
+int generate(const font &f0, const std::string &stem, unsigned int formats)
+{
+	/* The savers are not const, since they may consult/fill in props */
+	auto f = f0;
+	int ret = 0;
+	if (ret >= 0 && (formats & GEN_BDF))
+		ret = f.save_bdf((stem + ".bdf").c_str());
+	if (ret >= 0 && (formats & GEN_PSF))
+		ret = f.save_psf((stem + ".psf").c_str());
+	if (ret >= 0 && (formats & GEN_FNT))
+		ret = f.save_fnt((stem + ".fnt").c_str());
+	if (ret >= 0 && (formats & GEN_HEX) && f.m_glyph.size() > 0 &&
+	    hexable(f.m_glyph[0].m_size))
+		ret = f.save_hex((stem + ".hex").c_str());
+	if (ret >= 0 && (formats & GEN_PCF))
+		ret = save_pcf(f, (stem + ".pcf").c_str());
+	if (ret >= 0 && (formats & GEN_CLT)) {
+		auto dir = stem + ".clt";
+		if (mkdir(dir.c_str(), S_IRWXUGO) < 0 && errno != EEXIST)
+			return -errno;
+		ret = f.save_clt(dir.c_str());
+	}
+	return ret;
+}
+
+} /* namespace bench */
@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ *	Timing harness and synthetic corpus shared by the benchmark programs
+ */
+#ifndef BENCH_HPP
+#define BENCH_HPP 1
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include "vfalib.hpp"
+
+namespace bench {
+
+enum pmu_event {
+	PMU_CYCLES = 0,
+	PMU_INSTRUCTIONS,
+	PMU_BRANCH_MISSES,
+	PMU_L1D_MISSES,
+	PMU_LLC_MISSES,
+	PMU_MAX,
+};
+
+/**
+ * Hardware performance counters (perf_event_open) for the calling thread and
+ * the threads and processes it starts afterwards. Events the system refuses
+ * (no PMU, containers, perf_event_paranoid) are left out individually.
+ * start()/stop() add the counts in between to the running totals,
+ * scaled up if the kernel had to multiplex the counters.
+ */
+class pmu {
+	public:
+	pmu();
+	~pmu();
+	bool available() const;
+	bool has(unsigned int ev) const { return m_fd[ev] >= 0; }
+	void start();
+	void stop(double (&total)[PMU_MAX]);
+	static const char *name(unsigned int ev);
+
+	private:
+	int m_fd[PMU_MAX];
+	uint64_t m_begin[PMU_MAX][3]{};
+};
+
+/*
+ * @counters:	when non-null, collect hardware counters for the timed runs
+ */
+struct options {
+	unsigned int warmup = 3, reps = 25;
+	bool json = false;
+	pmu *counters = nullptr;
+};
+
+/**
+ * @items:	work units (glyphs, colors, ...) processed by one repetition
+ * @bytes:	bytes consumed or produced by one repetition (0 = n/a)
+ * @ns:		per-repetition wall time, sorted ascending
+ * @extra:	additional named figures reported alongside the timings
+ * @pmu:	per-repetition hardware counter means; event names as per
+ * 		pmu::name(), only those that could be collected
+ */
+struct result {
+	std::string suite, name;
+	size_t items = 0, bytes = 0;
+	std::vector<double> ns;
+	std::vector<std::pair<std::string, double>> extra, pmu;
+
+	double pct(double p) const;
+	double median() const { return pct(50); }
+};
+
+/**
+ * Collects results and prints them either as a human-readable table or as a
+ * JSON array with one object per line.
+ */
+class reporter {
+	public:
+	reporter(const options &o) : m_opts(o) {}
+	~reporter() { finish(); }
+	void emit(const result &);
+	void finish();
+
+	private:
+	const options &m_opts;
+	unsigned int m_count = 0;
+	bool m_done = false;
+};
+
+enum gen_format {
+	GEN_BDF = 1 << 0,
+	GEN_CLT = 1 << 1,
+	GEN_FNT = 1 << 2,
+	GEN_HEX = 1 << 3,
+	GEN_PCF = 1 << 4,
+	GEN_PSF = 1 << 5,
+	GEN_ALL = GEN_BDF | GEN_CLT | GEN_FNT | GEN_HEX | GEN_PCF | GEN_PSF,
+};
+
+/*
+ * Keep the compiler from discarding a computation whose result is
+ * otherwise unused.
+ */
+template<typename T> static inline void keep(const T &v)
+{
+	asm volatile("" : : "g" (&v) : "memory");
+}
+
+/**
+ * Run @body @o.warmup times untimed, then @o.reps times timed. @setup is run
+ * before every repetition and is not part of the measurement.
+ */
+template<typename S, typename F> result run(const options &o,
+    const char *suite, std::string name, size_t items, S &&setup, F &&body)
+{
+	result r;
+	r.suite = suite;
+	r.name  = std::move(name);
+	r.items = items;
+	for (unsigned int i = 0; i < o.warmup; ++i) {
+		setup();
+		body();
+	}
+	r.ns.reserve(o.reps);
+	double counts[PMU_MAX]{};
+	for (unsigned int i = 0; i < o.reps; ++i) {
+		setup();
+		/* Counter reads sit outside the clock, but inside the counts */
+		if (o.counters != nullptr)
+			o.counters->start();
+		auto start = std::chrono::steady_clock::now();
+		body();
+		auto stop = std::chrono::steady_clock::now();
+		if (o.counters != nullptr)
+			o.counters->stop(counts);
+		r.ns.push_back(std::chrono::duration<double, std::nano>(stop - start).count());
+	}
+	std::sort(r.ns.begin(), r.ns.end());
+	if (o.counters != nullptr)
+		for (unsigned int ev = 0; ev < PMU_MAX; ++ev)
+			if (o.counters->has(ev))
+				r.pmu.emplace_back(pmu::name(ev), counts[ev] / o.reps);
+	return r;
+}
+
+template<typename F> result run(const options &o, const char *suite,
+    std::string name, size_t items, F &&body)
+{
+	return run(o, suite, std::move(name), items, []() {}, std::forward<F>(body));
+}
+
+/* Cell sizes that font::save_hex accepts */
+static inline bool hexable(const vfalib::vfsize &sz)
+{
+	return sz.h == 16 && sz.w % 8 == 0 && sz.w >= 8 && sz.w <= 32;
+}
+
+extern std::vector<vfalib::vfsize> parse_sizes(const char *);
+extern unsigned int parse_formats(const char *);
+extern std::string sizename(const vfalib::vfsize &);
+extern vfalib::font synth_font(const vfalib::vfsize &, unsigned int count, uint32_t seed = 1);
+extern int generate(const vfalib::font &, const std::string &stem, unsigned int formats);
+extern int save_pcf(const vfalib::font &, const char *file);
+
+} /* namespace bench */
+
+#endif /* BENCH_HPP */
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ *	Instruction set selection for the vectorized kernels
+ */
+#ifndef CPUISA_HPP
+#define CPUISA_HPP 1
+
+#include <cerrno>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	define HAVE_X86_KERNELS 1
+#endif
+
+namespace vfalib {
+
+/* Ordered: every level implies the ones before it */
+enum cpu_isa {
+	ISA_SCALAR = 0,
+	ISA_SSE2,
+	ISA_SSSE3,
+	ISA_AVX2,
+	ISA_AVX512, /* F + BW */
+	ISA_MAX,
+};
+
+inline const char *isa_name(enum cpu_isa i)
+{
+	static const char *const names[] = {"scalar", "sse2", "ssse3", "avx2", "avx512"};
+	return i < ISA_MAX ? names[i] : "";
+}
+
+inline enum cpu_isa isa_detect()
+{
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return ISA_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return ISA_AVX2;
+	if (__builtin_cpu_supports("ssse3"))
+		return ISA_SSSE3;
+	if (__builtin_cpu_supports("sse2"))
+		return ISA_SSE2;
+#endif
+	return ISA_SCALAR;
+}
+
+/*
+ * The level the kernel tables are built for. It is read when a program first
+ * uses a kernel, so overrides must happen before that.
+ */
+inline enum cpu_isa &isa_active()
+{
+	static enum cpu_isa level = isa_detect();
+	return level;
+}
+
+/**
+ * Handle a --kernels= argument: "auto", "scalar" or an ISA name. Levels the
+ * CPU does not have are refused with -EOPNOTSUPP, unknown names with
+ * -EINVAL.
+ */
+inline int isa_select(const char *name)
+{
+	auto have = isa_detect();
+	if (strcmp(name, "auto") == 0) {
+		isa_active() = have;
+		return 0;
+	}
+	for (unsigned int i = 0; i < ISA_MAX; ++i) {
+		if (strcmp(name, isa_name(static_cast<enum cpu_isa>(i))) != 0)
+			continue;
+		if (i > have)
+			return -EOPNOTSUPP;
+		isa_active() = static_cast<enum cpu_isa>(i);
+		return 0;
+	}
+	return -EINVAL;
+}
+
+} /* namespace vfalib */
+
+#endif /* CPUISA_HPP */
@@ -0,0 +1,297 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ *	Benchmarks for palcomp: startup, color conversion, contrast and eval
+ */
+#include "config.h"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <babl/babl.h>
+#include <libHX/misc.h>
+#include <libHX/option.h>
+#include "bench.hpp"
+#include "pallib.hpp"
+
+using namespace pallib;
+
+extern char **environ;
+
+static unsigned int g_counters, g_ncolors = 4096, g_reps = 25, g_table, g_warmup = 3;
+static char *g_exe;
+static constexpr HXoption g_bench_options[] = {
+	{{}, 'N', HXTYPE_UINT, &g_ncolors, {}, {}, {}, "Colors for the conversion benchmarks (default: 4096)", "N"},
+	{{}, 'n', HXTYPE_UINT, &g_reps, {}, {}, {}, "Timed repetitions (default: 25)", "N"},
+	{{}, 'P', HXTYPE_NONE, &g_counters, {}, {}, {}, "Also report hardware performance counters"},
+	{{}, 'p', HXTYPE_STRING, &g_exe, {}, {}, {}, "palcomp executable for the startup benchmark (default: ./palcomp)", "PATH"},
+	{{}, 't', HXTYPE_NONE, &g_table, {}, {}, {}, "Emit a table instead of JSON"},
+	{{}, 'w', HXTYPE_UINT, &g_warmup, {}, {}, {}, "Untimed warm-up runs (default: 3)", "N"},
+	HXOPT_AUTOHELP,
+	HXOPT_TABLEEND,
+};
+
+namespace {
+
+struct ctx {
+	bench::options opts;
+	bench::reporter *rpt = nullptr;
+	unsigned int failures = 0;
+};
+
+}
+
+/*
+ * Native sRGB <-> CIE LCh(ab) conversion for comparison with babl. Like babl,
+ * this goes through D50-adapted XYZ (Bradford), which is the white point
+ * babl uses for CIE Lab.
+ */
+static constexpr double d50_white[] = {0.964212, 1.0, 0.825188};
+static constexpr double lab_eps = 216.0 / 24389, lab_kappa = 24389.0 / 27;
+
+static double lab_f(double t)
+{
+	return t > lab_eps ? cbrt(t) : (lab_kappa * t + 16) / 116;
+}
+
+static double lab_finv(double t)
+{
+	auto t3 = t * t * t;
+	return t3 > lab_eps ? t3 : (116 * t - 16) / lab_kappa;
+}
+
+static lch native_to_lch(const srgb888 &i)
+{
+	auto r = gamma_expand(i.r / 255.0), g = gamma_expand(i.g / 255.0),
+	     b = gamma_expand(i.b / 255.0);
+	auto x = 0.4360747 * r + 0.3850649 * g + 0.1430804 * b;
+	auto y = 0.2225045 * r + 0.7168786 * g + 0.0606169 * b;
+	auto z = 0.0139322 * r + 0.0971045 * g + 0.7141733 * b;
+	auto fx = lab_f(x / d50_white[0]), fy = lab_f(y / d50_white[1]),
+	     fz = lab_f(z / d50_white[2]);
+	auto la = 500 * (fx - fy), lb = 200 * (fy - fz);
+	auto h = atan2(lb, la) * 180 / M_PI;
+	return {116 * fy - 16, hypot(la, lb), h < 0 ? h + 360 : h};
+}
+
+static uint8_t to_u8(double c)
+{
+	c = gamma_compress(std::clamp(c, 0.0, 1.0)) * 255 + 0.5;
+	return std::clamp(c, 0.0, 255.0);
+}
+
+static srgb888 native_to_srgb888(const lch &i)
+{
+	auto la = i.c * cos(i.h * M_PI / 180), lb = i.c * sin(i.h * M_PI / 180);
+	auto fy = (i.l + 16) / 116, fx = fy + la / 500, fz = fy - lb / 200;
+	auto x = lab_finv(fx) * d50_white[0], y = lab_finv(fy) * d50_white[1],
+	     z = lab_finv(fz) * d50_white[2];
+	return {to_u8( 3.1338561 * x - 1.6168667 * y - 0.4906146 * z),
+	        to_u8(-0.9787684 * x + 1.9161415 * y + 0.0334540 * z),
+	        to_u8( 0.0719453 * x - 0.2289914 * y + 1.4052427 * z)};
+}
+
+static std::vector<srgb888> random_palette(size_t n, uint32_t seed = 1)
+{
+	std::vector<srgb888> pal(n);
+	uint32_t x = 2463534242U ^ seed;
+	for (auto &e : pal) {
+		/* xorshift32 */
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		e = {static_cast<uint8_t>(x), static_cast<uint8_t>(x >> 8),
+		     static_cast<uint8_t>(x >> 16)};
+	}
+	return pal;
+}
+
+/**
+ * Time a complete palcomp process: exec, babl initialization, and the given
+ * commands. Output goes to /dev/null.
+ */
+static void bench_startup(ctx &c, const char *exe, const char *name,
+    std::vector<const char *> args)
+{
+	if (access(exe, X_OK) != 0) {
+		fprintf(stderr, "%s: %s; skipping startup benchmark\n", exe, strerror(errno));
+		return;
+	}
+	args.insert(args.begin(), exe);
+	args.push_back(nullptr);
+	posix_spawn_file_actions_t fa;
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+	posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+	bool failed = false;
+	c.rpt->emit(bench::run(c.opts, "startup", name, 1, [&]() {
+		pid_t pid;
+		int status = 0;
+		if (posix_spawn(&pid, exe, &fa, nullptr,
+		    const_cast<char **>(args.data()), environ) != 0 ||
+		    waitpid(pid, &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed = true;
+	}));
+	posix_spawn_file_actions_destroy(&fa);
+	if (failed) {
+		fprintf(stderr, "startup/%s: %s did not exit successfully\n", name, exe);
+		++c.failures;
+	}
+}
+
+static void suite_startup(ctx &c)
+{
+	auto exe = g_exe != nullptr ? g_exe : "./palcomp";
+	bench_startup(c, exe, "noop", {});
+	bench_startup(c, exe, "vga_cxa", {"vga", "cxa"});
+	bench_startup(c, exe, "vga_eval_xfce", {"vga", "l=l*1.1", "xfce"});
+}
+
+static void suite_convert(ctx &c)
+{
+	auto rgb = random_palette(g_ncolors);
+	auto lab = to_lch(rgb);
+	auto n = rgb.size();
+	auto r = bench::run(c.opts, "convert", "srgb888_to_lch/babl", n, [&]() {
+		bench::keep(to_lch(rgb));
+	});
+	r.bytes = n * sizeof(srgb888);
+	c.rpt->emit(r);
+	r = bench::run(c.opts, "convert", "srgb888_to_lch/native", n, [&]() {
+		std::vector<lch> out(rgb.size());
+		for (size_t i = 0; i < rgb.size(); ++i)
+			out[i] = native_to_lch(rgb[i]);
+		bench::keep(out);
+	});
+	r.bytes = n * sizeof(srgb888);
+	/* How far apart the two implementations are (in L, c, h units) */
+	double dmax = 0;
+	for (size_t i = 0; i < n; ++i) {
+		auto a = native_to_lch(rgb[i]);
+		dmax = std::max({dmax, fabs(a.l - lab[i].l), fabs(a.c - lab[i].c)});
+		if (lab[i].c > 1)
+			dmax = std::max(dmax, fabs(HX_flpr(a.h - lab[i].h + 180, 360) - 180));
+	}
+	r.extra = {{"max_diff_vs_babl", dmax}};
+	c.rpt->emit(r);
+
+	r = bench::run(c.opts, "convert", "lch_to_srgb888/babl", n, [&]() {
+		bench::keep(to_srgb888(lab));
+	});
+	r.bytes = n * sizeof(lch);
+	c.rpt->emit(r);
+	r = bench::run(c.opts, "convert", "lch_to_srgb888/native", n, [&]() {
+		std::vector<srgb888> out(lab.size());
+		for (size_t i = 0; i < lab.size(); ++i)
+			out[i] = native_to_srgb888(lab[i]);
+		bench::keep(out);
+	});
+	r.bytes = n * sizeof(lch);
+	unsigned int umax = 0;
+	auto back = to_srgb888(lab);
+	for (size_t i = 0; i < n; ++i) {
+		auto a = native_to_srgb888(lab[i]);
+		umax = std::max({umax, static_cast<unsigned int>(abs(a.r - back[i].r)),
+		                static_cast<unsigned int>(abs(a.g - back[i].g)),
+		                static_cast<unsigned int>(abs(a.b - back[i].b))});
+	}
+	r.extra = {{"max_diff_vs_babl", static_cast<double>(umax)}};
+	c.rpt->emit(r);
+}
+
+/* cxa/cxl only ever look at the 16 colors of a terminal palette */
+static void suite_contrast(ctx &c)
+{
+	auto rgb = random_palette(16);
+	auto lab = to_lch(rgb);
+	c.rpt->emit(bench::run(c.opts, "contrast", "cxa_compute/16", 16,
+		[&]() { bench::keep(cxa_compute(rgb)); }));
+	c.rpt->emit(bench::run(c.opts, "contrast", "cxl_compute/16", 16,
+		[&]() { bench::keep(cxl_compute(lab)); }));
+}
+
+static void suite_eval(ctx &c)
+{
+	static const char *const exprs[] = {
+		"l=l*1.1", "h=h+30", "r=255-r", "c=c*0.8,h=h+15",
+		"x=l,l=100-x", "(l=(l/100)^0.8*100)",
+	};
+	for (unsigned int n : {16, 256}) {
+		mpalette orig, mp;
+		orig.ra = random_palette(n);
+		orig.mod_ra();
+		for (auto e : exprs) {
+			int ret = 0;
+			auto name = std::string(e) + "/" + std::to_string(n);
+			c.rpt->emit(bench::run(c.opts, "eval", name, n,
+				[&]() { mp = orig; },
+				[&]() { ret = do_eval(e, mp); bench::keep(mp); }));
+			if (ret != 0) {
+				fprintf(stderr, "eval/%s failed\n", name.c_str());
+				++c.failures;
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (HX_getopt5(g_bench_options, argv, &argc, &argv,
+	    HXOPT_USAGEONERR) != HXOPT_ERR_SUCCESS)
+		return EXIT_FAILURE;
+	struct bb_guard {
+		bb_guard() { ::babl_init(); }
+		~bb_guard() { ::babl_exit(); }
+	};
+	bb_guard bbg;
+	if (palcomp_init() != 0)
+		return EXIT_FAILURE;
+	ctx c;
+	c.opts.warmup = g_warmup;
+	c.opts.reps   = g_reps > 0 ? g_reps : 1;
+	c.opts.json   = !g_table;
+	std::unique_ptr<bench::pmu> pmu;
+	if (g_counters) {
+		pmu = std::make_unique<bench::pmu>();
+		if (pmu->available())
+			c.opts.counters = pmu.get();
+	}
+	if (g_ncolors == 0)
+		g_ncolors = 1;
+	bench::reporter rpt(c.opts);
+	c.rpt = &rpt;
+
+	std::vector<std::string> suites;
+	for (int i = 1; i < argc; ++i)
+		suites.emplace_back(argv[i]);
+	if (suites.empty())
+		suites = {"startup", "convert", "contrast", "eval"};
+	for (const auto &s : suites) {
+		void (*func)(ctx &) = nullptr;
+		if (s == "startup")
+			func = suite_startup;
+		else if (s == "convert")
+			func = suite_convert;
+		else if (s == "contrast")
+			func = suite_contrast;
+		else if (s == "eval")
+			func = suite_eval;
+		if (func == nullptr) {
+			fprintf(stderr, "Unknown suite \"%s\"\n", s.c_str());
+			return EXIT_FAILURE;
+		}
+		func(c);
+	}
+	rpt.finish();
+	return c.failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,85 +1,41 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 // SPDX-FileCopyrightText: 2022–2024 Jan Engelhardt
 #include <algorithm>
+#include <array>
 #include <functional>
+#include <iterator>
 #include <cctype>
 #include <cerrno>
+#include <climits>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <memory>
+#include <numeric>
+#include <random>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <utility>
-#include <variant>
 #include <vector>
 #include <babl/babl.h>
 #include <Eigen/LU>
 #include <libHX/ctype_helper.h>
 #include <libHX/misc.h>
 #include <libHX/option.h>
+#include "cpuisa.hpp"
+#include "pallib.hpp"
+#include "vfalib.hpp"
 
-namespace {
-struct srgb888 { uint8_t r = 0, g = 0, b = 0; };
-struct srgb { double r = 0, g = 0, b = 0; };
-struct lrgb { double r = 0, g = 0, b = 0; };
-struct xy0 { double x = 0, y = 0; }; // CIE1391 xyY colorspace (but without Y) [chromaticity plane]
-struct xyz { double x = 0, y = 0, z = 0; }; // CIE1391 XYZ colorspace [tristimulus]
-struct lch { double l = 0, c = 0, h = 0; };
-struct hsl { double h = 0, s = 0, l = 0; };
-
-/***
- * Keep multiple numeric representations of the palette, to reduce accumulation
- * of conversion errors.
- */
-struct mpalette {
-	std::vector<srgb888> ra;
-	std::vector<lch> la;
-	double x = 0, y = 0, z = 0;
-
-	void mod_la();
-	void mod_ra();
-};
-
-/**
- * Statistics for one grid view (e.g. 8x8 / 16x8 / ...).
- *
- * @pairs:      pairs that have contributed to @sum
- * @penalized:  number of penalized pairs
- * @sum:        sum of deltas
- * @avg:        @sum divided by @pairs
- * @adj_sum:    @sum adjusted for penalized pairs
- * @adj_avg:    adjusted average
- */
-struct gvstat {
-	unsigned int pairs = 0, penalized = 0;
-	double sum = 0, avg = 0, adj_sum = 0, adj_avg = 0;
-};
-
-struct palstat {
-	public:
-	bool (*penalize)(double) = nullptr;
-	double delta[16][16]{};
-	gvstat x1616{}, x816{}, x88{};
+using namespace pallib;
 
-	void compute_sums();
-
-	protected:
-	void compute_sums(unsigned int xlim, unsigned int ylim, gvstat &);
-};
-
-enum class token_type { none, reg, imm, grp, op };
-struct token_entry;
-using token_value = std::variant<char, double, std::vector<token_entry>>;
-struct token_entry {
-	token_type type = token_type::none;
-	token_value val{};
-	std::string repr() const;
+namespace {
+struct deleter {
+	void operator()(FILE *f) { fclose(f); }
 };
-using token_vector = std::vector<token_entry>;
-
 }
 
 static constexpr srgb888 vga_palette[] = {
@@ -102,11 +58,10 @@ static constexpr srgb888 win_palette[] = {
 };
 
 static unsigned int xterm_fg, xterm_bg, xterm_bd, g_verbose;
-static double g_continuous_gamma;
-static const Babl *lch_space, *srgb_space, *srgb888_space;
-static Eigen::Matrix3d xyz_to_lrgb_matrix;
+static char *g_kernels;
 
 static constexpr HXoption g_options_table[] = {
+	{"kernels", 0, HXTYPE_STRING, &g_kernels, {}, {}, {}, "Vector kernels to use: auto, scalar, sse2, ssse3, avx2, avx512", "ISA"},
 	{{}, 'v', HXTYPE_NONE, &g_verbose, {}, {}, {}, "Debugging"},
 	HXOPT_AUTOHELP,
 	HXOPT_TABLEEND,
@@ -142,22 +97,6 @@ static int hexcolor_split(const char *p, srgb888 &o)
 	return 6 + zaun;
 }
 
-static hsl to_hsl(const srgb &i)
-{
-	hsl c;
-	double vmin = std::min({i.r, i.g, i.b}), vmax = std::max({i.r, i.g, i.b});
-	c.l = (vmin + vmax) / 2;
-	if (vmax == vmin)
-		return c;
-	auto d = vmax - vmin;
-	c.s = c.l > 0.5 ? d / (2 - vmax - vmin) : d / (vmax + vmin);
-	if (vmax == i.r) c.h = (i.g - i.b) / d + (i.g < i.b ? 6 : 0);
-	if (vmax == i.g) c.h = (i.b - i.r) / d + 2;
-	if (vmax == i.b) c.h = (i.r - i.g) / d + 4;
-	c.h *= 60;
-	return c;
-}
-
 static std::string to_hex(const srgb888 &e)
 {
 	char t[8];
@@ -165,44 +104,6 @@ static std::string to_hex(const srgb888 &e)
 	return t;
 }
 
-static srgb888 to_srgb888(const srgb &e)
-{
-	auto r = std::max(std::min(round(e.r * 255.0), 255.0), 0.0);
-	auto g = std::max(std::min(round(e.g * 255.0), 255.0), 0.0);
-	auto b = std::max(std::min(round(e.b * 255.0), 255.0), 0.0);
-	return {static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b)};
-}
-
-static double huetorgb(double p, double q, double t)
-{
-	if (t < 0)
-		t += 360;
-	if (t > 360)
-		t -= 360;
-	if (t < 60)
-		return p + (q - p) * t / 60;
-	if (t < 180)
-		return q;
-	if (t < 240)
-		return p + (q - p) * (4 - t / 60);
-	return p;
-}
-
-static srgb to_srgb(const hsl &in)
-{
-	if (in.s <= 0.0)
-		return {in.l, in.l, in.l};
-	auto q = in.l < 0.5 ? in.l * (1 + in.s) : in.l + in.s - in.l * in.s;
-	auto p = 2 * in.l - q;
-	return {huetorgb(p, q, in.h + 120),
-		huetorgb(p, q, in.h), huetorgb(p, q, in.h - 120)};
-}
-
-static srgb to_srgb(const srgb888 &e)
-{
-	return {e.r / 255.0, e.g / 255.0, e.b / 255.0};
-}
-
 static hsl parse_hsl(const char *str)
 {
 	hsl c;
@@ -222,43 +123,6 @@ static hsl parse_hsl(const char *str)
 	return c;
 }
 
-static srgb888 to_srgb888(const lch &i)
-{
-	srgb888 o{};
-	babl_process(babl_fish(lch_space, srgb888_space), &i, &o, 1);
-	return o;
-}
-
-static lch to_lch(const srgb888 &i)
-{
-	lch o{};
-	babl_process(babl_fish(srgb888_space, lch_space), &i, &o, 1);
-	return o;
-}
-
-static lch to_lch(const srgb &i)
-{
-	lch o{};
-	babl_process(babl_fish(srgb_space, lch_space), &i, &o, 1);
-	return o;
-}
-
-static std::vector<lch> to_lch(const std::vector<srgb888> &in)
-{
-	std::vector<lch> out;
-	for (const auto &color : in)
-		out.push_back(to_lch(color));
-	return out;
-}
-
-static std::vector<srgb888> to_srgb888(const std::vector<lch> &in)
-{
-	std::vector<srgb888> out;
-	for (const auto &color : in)
-		out.push_back(to_srgb888(color));
-	return out;
-}
-
 static void emit_xfce(const std::vector<srgb888> &pal)
 {
 	printf("ColorPalette=");
@@ -267,9 +131,6 @@ static void emit_xfce(const std::vector<srgb888> &pal)
 	printf("\n");
 }
 
-void mpalette::mod_la() { ra = to_srgb888(la); }
-void mpalette::mod_ra() { la = to_lch(ra); }
-
 static void emit_xterm(const std::vector<srgb888> &pal)
 {
 	for (unsigned int idx = 0; idx < 16; ++idx)
@@ -368,189 +229,241 @@ static void colortable_16(std::function<void(int, int, int)> pr = nullptr)
 	       "\e[8mhidden\e[0m \e[9mstrikethrough\e[0m\n");
 }
 
-void palstat::compute_sums(unsigned int xlim, unsigned int ylim, gvstat &gs)
+static void cx_report(const gvstat &o, const char *desc)
 {
-	gs.pairs = gs.penalized = 0;
-	gs.sum = gs.avg = 0;
-	for (unsigned int y = 0; y < ylim; ++y) {
-		for (unsigned int x = 0; x < xlim; ++x) {
-			if (x == y)
-				continue;
-			++gs.pairs;
-			gs.sum += delta[y][x];
-			if (penalize != nullptr && penalize(delta[y][x]))
-				++gs.penalized;
-			else
-				gs.adj_sum += delta[y][x];
-		}
-	}
-	gs.avg = gs.sum / gs.pairs;
-	gs.adj_avg = gs.adj_sum / (gs.pairs - gs.penalized);
+	printf("[%-5s] contrast Σ %.0f", desc, o.sum);
+	printf(" // minus %u penalties:\tΣ %.0f\n",
+		o.penalized, o.adj_sum);
 }
 
-void palstat::compute_sums()
+static void cx_report(const palstat &o)
 {
-	compute_sums(16, 16, x1616);
-	compute_sums(8, 16, x816);
-	compute_sums(8, 8, x88);
+	cx_report(o.x1616, "16x16");
+	cx_report(o.x816, "16x8 ");
+	cx_report(o.x88, " 8x8 ");
 }
 
-static palstat cxl_compute(const std::vector<lch> &pal)
+static void cxl_command(const std::vector<lch> &lch_pal)
 {
-	palstat o;
-	o.penalize = [](double x) { return x < 7.0; };
-	for (unsigned int bg = 0; bg < 16; ++bg)
-		for (unsigned int fg = 0; fg < 16; ++fg)
-			o.delta[bg][fg] = fabs(pal[fg].l - pal[bg].l);
-	o.compute_sums();
-	return o;
+	printf("\e[1m════ Difference of the L components ════\e[0m\n");
+	auto sb = cxl_compute(lch_pal);
+	colortable_16([&](int bg, int fg, int special) {
+		if (special || fg >= 16 || bg >= 16 || fg == bg)
+			printf("   ");
+		else
+			printf("%3.0f", sb.delta[bg][fg]);
+	});
+	cx_report(sb);
 }
 
-static double gamma_expand(double c)
+static void cxa_command(const std::vector<srgb888> &pal)
 {
-	if (g_continuous_gamma != 0)
-		return pow(c, g_continuous_gamma);
-	/*
-	 * To avoid zero slope, part of the range gets a linear mapping /
-	 * gamma of 1.0.
-	 */
-	if (c <= 0.04045)
-		return c / 12.92;
-	/*
-	 * The rest of the curve is a 2.4 gamma (instead of 2.2) to compensate
-	 * for the prior linear section. The 2.4 curve approximates the 2.2
-	 * curve in the input value range that is of interest.
-	 */
-	return std::min(1.0, pow((c + 0.055) / 1.055, 12 / 5.0));
+	printf("\e[1m════ APCA lightness contrast ════\e[0m\n");
+	auto sb = cxa_compute(pal);
+	colortable_16([&](int bg, int fg, int special) {
+		if (special || fg >= 16 || bg >= 16 || fg == bg) {
+			printf("    ");
+			return;
+		}
+		printf("%3.0f ", sb.delta[bg][fg]);
+	});
+	cx_report(sb);
 }
 
-static double gamma_compress(double c)
-{
-	return c <= (0.04045 / 12.92) ? c * 12.92 :
-	       pow(c, 5 / 12.0) * 1.055 - 0.055;
-}
+namespace {
+/* Ink of one glyph; @stroke is the median stroke width over its ink pixels */
+struct ink_stat {
+	unsigned int ink = 0;
+	double density = 0, stroke = 0;
+};
 
-/* This function only makes sense for white */
-static constexpr xyz to_xyz(const xy0 &e)
-{
-	return {e.x / e.y, 1, (1 - e.x - e.y) / e.y};
+struct font_ink_stat {
+	size_t glyphs = 0;
+	double density = 0, stroke = 0;
+};
 }
 
-/**
- * Cf. https://en.wikipedia.org/wiki/Standard_illuminant#Computation
- *
- * @t: black-body temperature in Kelvin (e.g. 5000, 5500, 6500)
+/*
+ * Minimum APCA Lc for fluent (body) text, by font size in px and weight
+ * 100..900, after the APCA font lookup table. 120 marks sizes/weights that
+ * are not readable at any contrast.
  */
-static constexpr xy0 illuminant_d(double t)
-{
-	double x = t <= 7000 ?
-	           0.244063 + 0.09911 * 1000 / t + 2.9678 * 1000000 / (t * t) -
-	           4.6070 * 1000000000 / (t * t * t) :
-	           0.237040 + 0.24748 * 1000 / t + 1.9018 * 1000000 / (t * t) -
-	           2.0064 * 1000000000 / (t * t * t);
-	return {x, -3.0 * x * x + 2.87 * x - 0.275};
-}
-
-static lrgb to_lrgb(const srgb &e)
-{
-	return {gamma_expand(e.r), gamma_expand(e.g), gamma_expand(e.b)};
-}
-
-static double trivial_lightness(const lrgb &k)
-{
-	const auto &dm = xyz_to_lrgb_matrix;
-	return dm(1, 0) * k.r + dm(1, 1) * k.g + dm(1, 2) * k.b;
-}
-
-static Eigen::Matrix3d make_lrgb_matrix(const xyz &white_raw)
-{
-	/* https://mina86.com/2019/srgb-xyz-matrix/ */
-	static constexpr xy0 red = {0.64, 0.33}, green = {0.30, 0.60}, blue = {0.15, 0.06};
-	const Eigen::Matrix3d M_prime{
-		{red.x / red.y, green.x / green.y, blue.x / blue.y},
-		{1, 1, 1},
-		{(1 - red.x - red.y) / red.y, (1 - green.x - green.y) / green.y, (1 - blue.x - blue.y) / blue.y},
-	};
-	const Eigen::Vector3d W{white_raw.x, white_raw.y, white_raw.z};
-	return M_prime * (M_prime.inverse() * W).asDiagonal();
-}
-
 static constexpr struct {
-	double normbg = 0.56, normtxt = 0.57, revtxt = 0.62, revbg = 0.65,
-		black_thresh = 0.022, black_clamp = 1.414,
-		scale_bow = 1.14, scale_wob = 1.14,
-		lo_offset = 0.027,
-		delta_y_min = 0.0005, lo_clip = 0.1;
-} sa_param; /* SAPC/APCA ver 0.0.98G */
+	unsigned int px;
+	uint8_t lc[9];
+} apca_font_table[] = {
+	{15, {120, 120, 100, 90, 75, 70, 60, 55, 50}},
+	{16, {120, 120, 90, 75, 70, 60, 55, 50, 45}},
+	{18, {120, 100, 75, 70, 60, 55, 50, 45, 40}},
+	{21, {120, 90, 70, 60, 55, 50, 45, 40, 35}},
+	{24, {120, 75, 60, 55, 50, 45, 40, 35, 30}},
+	{28, {100, 70, 55, 50, 45, 40, 35, 30, 30}},
+	{32, {90, 60, 50, 45, 40, 35, 30, 30, 30}},
+	{36, {75, 55, 45, 40, 35, 30, 30, 30, 30}},
+	{42, {70, 50, 40, 35, 30, 30, 30, 30, 30}},
+	{48, {60, 45, 35, 30, 30, 30, 30, 30, 30}},
+	{60, {55, 40, 30, 30, 30, 30, 30, 30, 30}},
+	{72, {50, 35, 30, 30, 30, 30, 30, 30, 30}},
+	{96, {45, 30, 30, 30, 30, 30, 30, 30, 30}},
+};
 
-static double apca_contrast(double ytx, double ybg)
-{
-	if (ytx <= sa_param.black_thresh)
-		ytx += pow(sa_param.black_thresh - ytx, sa_param.black_clamp);
-	if (ybg <= sa_param.black_thresh)
-		ybg += pow(sa_param.black_thresh - ybg, sa_param.black_clamp);
-	if (fabs(ybg - ytx) < sa_param.delta_y_min)
-		return 0;
-	double oc;
-	/* SAPC = S-LUV Advanced Predictive Colour */
-	if (ybg > ytx) {
-		auto sapc = (pow(ybg, sa_param.normbg) - pow(ytx, sa_param.normtxt)) * sa_param.scale_bow;
-		oc = std::max(sapc - sa_param.lo_offset, 0.0);
-	} else {
-		auto sapc = (pow(ybg, sa_param.revbg) - pow(ytx, sa_param.revtxt)) * sa_param.scale_wob;
-		oc = std::min(sapc + sa_param.lo_offset, 0.0);
-	}
-	return 100 * fabs(oc);
-}
+/*
+ * Stem width as a fraction of the em for weights 100..900, approximating
+ * common grotesque typefaces.
+ */
+static constexpr double stem_ratio[] = {0.03, 0.045, 0.06, 0.085, 0.10, 0.12, 0.14, 0.165, 0.19};
 
-static palstat cxa_compute(const std::vector<srgb888> &pal)
+static double stroke_to_weight(double ratio)
 {
-	/* APCA W3 contrast calculation */
-	/* History: https://github.com/w3c/wcag/issues/695 */
-	/* Implementation: https://git.apcacontrast.com/documentation/README */
-	palstat o;
-	o.penalize = [](double d) { return d < 7.3; };
-	std::vector<double> ell(pal.size());
-	for (unsigned int i = 0; i < pal.size(); ++i)
-		ell[i] = trivial_lightness(to_lrgb(to_srgb(pal[i])));
-	for (unsigned int bg = 0; bg < 16; ++bg)
-		for (unsigned int fg = 0; fg < 16; ++fg)
-			o.delta[bg][fg] = apca_contrast(ell[fg], ell[bg]);
-	o.compute_sums();
-	return o;
+	if (ratio <= stem_ratio[0])
+		return 100;
+	for (unsigned int i = 1; i < std::size(stem_ratio); ++i)
+		if (ratio <= stem_ratio[i])
+			return 100 * i + 100 * (ratio - stem_ratio[i-1]) /
+			       (stem_ratio[i] - stem_ratio[i-1]);
+	return 900;
 }
 
-static void cx_report(const gvstat &o, const char *desc)
+/* Bilinear lookup in apca_font_table; out-of-range sizes use the edge rows */
+static double apca_required_lc(double px, double weight)
 {
-	printf("[%-5s] contrast Σ %.0f", desc, o.sum);
-	printf(" // minus %u penalties:\tΣ %.0f\n",
-		o.penalized, o.adj_sum);
+	auto wt = std::clamp((weight - 100) / 100, 0.0, 8.0);
+	auto wi = std::min(static_cast<unsigned int>(wt), 7U);
+	auto wf = wt - wi;
+	auto row = [&](unsigned int r) {
+		const auto &lc = apca_font_table[r].lc;
+		return lc[wi] + (lc[wi+1] - lc[wi]) * wf;
+	};
+	auto last = std::size(apca_font_table) - 1;
+	if (px <= apca_font_table[0].px)
+		return row(0);
+	if (px >= apca_font_table[last].px)
+		return row(last);
+	unsigned int r = 1;
+	while (apca_font_table[r].px < px)
+		++r;
+	double p0 = apca_font_table[r-1].px, p1 = apca_font_table[r].px;
+	return row(r - 1) + (row(r) - row(r - 1)) * (px - p0) / (p1 - p0);
 }
 
-static void cx_report(const palstat &o)
+/**
+ * Count ink with popcount, then scan the rows and columns for runs of ink.
+ * The stroke width at a pixel is the shorter of the horizontal and vertical
+ * run through it, so stems and bars both measure their thickness.
+ */
+static ink_stat glyph_ink(const vfalib::glyph &g)
 {
-	cx_report(o.x1616, "16x16");
-	cx_report(o.x816, "16x8 ");
-	cx_report(o.x88, " 8x8 ");
+	ink_stat s;
+	for (auto c : g.m_data)
+		s.ink += __builtin_popcount(static_cast<uint8_t>(c));
+	if (s.ink == 0)
+		return s;
+	auto w = g.m_size.w, h = g.m_size.h;
+	s.density = static_cast<double>(s.ink) / (w * h);
+	std::vector<uint8_t> px(w * h);
+	std::vector<unsigned int> run(w * h, UINT_MAX);
+	for (size_t i = 0; i < px.size(); ++i)
+		px[i] = (static_cast<uint8_t>(g.m_data[i / CHAR_BIT]) >> (CHAR_BIT - 1 - i % CHAR_BIT)) & 1;
+	auto scan = [&](size_t start, size_t step, unsigned int len) {
+		for (unsigned int i = 0; i < len; ) {
+			if (!px[start+i*step]) {
+				++i;
+				continue;
+			}
+			auto i0 = i;
+			while (i < len && px[start+i*step])
+				++i;
+			for (auto j = i0; j < i; ++j)
+				run[start+j*step] = std::min(run[start+j*step], i - i0);
+		}
+	};
+	for (unsigned int y = 0; y < h; ++y)
+		scan(y * w, 1, w);
+	for (unsigned int x = 0; x < w; ++x)
+		scan(x, w, h);
+	/* Median, since junctions and corners give longer runs */
+	std::vector<unsigned int> ink_run;
+	for (size_t i = 0; i < px.size(); ++i)
+		if (px[i])
+			ink_run.push_back(run[i]);
+	auto mid = ink_run.begin() + ink_run.size() / 2;
+	std::nth_element(ink_run.begin(), mid, ink_run.end());
+	s.stroke = *mid;
+	return s;
 }
 
-static void cxl_command(const std::vector<lch> &lch_pal)
+/**
+ * Ink statistics over the glyphs of U+0021..U+007E (or indices 0x21..0x7E
+ * without a unicode map), which is what running text mostly consists of;
+ * fonts without ink there are measured over all glyphs.
+ */
+static font_ink_stat font_ink(const vfalib::font &f)
 {
-	printf("\e[1m════ Difference of the L components ════\e[0m\n");
-	auto sb = cxl_compute(lch_pal);
-	colortable_16([&](int bg, int fg, int special) {
-		if (special || fg >= 16 || bg >= 16 || fg == bg)
-			printf("   ");
-		else
-			printf("%3.0f", sb.delta[bg][fg]);
-	});
-	cx_report(sb);
+	std::vector<size_t> idx;
+	for (char32_t cp = 0x21; cp < 0x7F; ++cp) {
+		ssize_t i = f.m_unicode_map != nullptr ? f.m_unicode_map->to_index(cp) : cp;
+		if (i >= 0 && static_cast<size_t>(i) < f.m_glyph.size())
+			idx.push_back(i);
+	}
+	font_ink_stat fs;
+	for (unsigned int pass = 0; pass < 2 && fs.glyphs == 0; ++pass) {
+		if (pass == 1) {
+			idx.resize(f.m_glyph.size());
+			std::iota(idx.begin(), idx.end(), 0);
+		}
+		std::vector<ink_stat> st(idx.size());
+		vfalib::parallel_for(idx.size(), [&](size_t i) { st[i] = glyph_ink(f.m_glyph[idx[i]]); });
+		unsigned long ink = 0;
+		for (const auto &s : st) {
+			if (s.ink == 0)
+				continue;
+			++fs.glyphs;
+			fs.density += s.density;
+			fs.stroke += s.stroke * s.ink;
+			ink += s.ink;
+		}
+		if (fs.glyphs > 0) {
+			fs.density /= fs.glyphs;
+			fs.stroke /= ink;
+		}
+	}
+	return fs;
 }
 
-static void cxa_command(const std::vector<srgb888> &pal)
+/**
+ * APCA contrast for text set in the font @file at @px pixels (0: the cell
+ * height). The font's stroke width yields an equivalent weight; each Lc is
+ * scaled by how much less (or more) contrast that weight needs than regular
+ * (400) text per the APCA font table.
+ */
+static int cxf_command(const std::vector<srgb888> &pal, const char *file, unsigned int px)
 {
-	printf("\e[1m════ APCA lightness contrast ════\e[0m\n");
-	auto sb = cxa_compute(pal);
+	vfalib::font f;
+	auto ret = f.load_any(file);
+	if (ret < 0) {
+		fprintf(stderr, "cxf: %s: %s\n", file, strerror(-ret));
+		return ret;
+	}
+	if (f.m_glyph.empty()) {
+		fprintf(stderr, "cxf: %s: no glyphs\n", file);
+		return -EINVAL;
+	}
+	auto cell = f.m_glyph[0].m_size;
+	if (px == 0)
+		px = cell.h;
+	auto fs = font_ink(f);
+	auto weight = stroke_to_weight(fs.stroke / cell.h);
+	auto need = apca_required_lc(px, weight);
+	auto scale = apca_required_lc(px, 400) / need;
+
+	printf("\e[1m════ APCA contrast for %s (%ux%u at %u px) ════\e[0m\n",
+	       file, cell.w, cell.h, px);
+	printf("# %zu glyphs: ink density %.3f, stroke %.2f px (%.3f of height), ~weight %.0f\n",
+	       fs.glyphs, fs.density, fs.stroke, fs.stroke / cell.h, weight);
+	printf("# body text needs Lc %.0f; values below are scaled by %.2f to regular-weight Lc\n",
+	       need, scale);
+	auto sb = cxa_compute(pal, scale);
+	unsigned int fluent = 0;
 	colortable_16([&](int bg, int fg, int special) {
 		if (special || fg >= 16 || bg >= 16 || fg == bg) {
 			printf("    ");
@@ -558,7 +471,13 @@ static void cxa_command(const std::vector<srgb888> &pal)
 		}
 		printf("%3.0f ", sb.delta[bg][fg]);
 	});
+	for (unsigned int bg = 0; bg < 16; ++bg)
+		for (unsigned int fg = 0; fg < 16; ++fg)
+			if (fg != bg && sb.delta[bg][fg] / scale >= need)
+				++fluent;
 	cx_report(sb);
+	printf("Pairs with body text contrast: %u of 240\n", fluent);
+	return 0;
 }
 
 static std::vector<lch> equalize(std::vector<lch> la, unsigned int sbl_size,
@@ -645,268 +564,416 @@ static int loadpal(const char *file, std::vector<srgb888> &ra)
 	return EXIT_SUCCESS;
 }
 
-template<typename T> T do_blend(const T &a, double amult, const T &b, double bmult)
+/**
+ * Read a binary PPM (P6) or PAM (P7) image into a colour histogram of 15-bit
+ * bins, each holding the pixel count and the component sums (so that its
+ * mean colour does not suffer from the binning). Fully transparent PAM
+ * pixels are skipped.
+ */
+static int loadimg_hist(const char *file, std::vector<uint32_t> &count,
+    std::vector<std::array<double, 3>> &sum)
 {
-	auto max = std::max(a.size(), b.size());
-	T out(max);
-	for (size_t x = 0; x < max; ++x) {
-		out[x].r = a[x].r * amult + b[x].r * bmult;
-		out[x].g = a[x].g * amult + b[x].g * bmult;
-		out[x].b = a[x].b * amult + b[x].b * bmult;
+	std::unique_ptr<FILE, deleter> fp(fopen(file, "rb"));
+	if (fp == nullptr) {
+		fprintf(stderr, "Could not open %s: %s\n", file, strerror(errno));
+		return -errno;
 	}
-	return out;
+	auto f = fp.get();
+	unsigned int width = 0, height = 0, depth = 3, maxval = 0;
+	char magic[3]{};
+	if (fread(magic, 2, 1, f) != 1 || magic[0] != 'P' ||
+	    (magic[1] != '6' && magic[1] != '7')) {
+		fprintf(stderr, "%s: not a binary PPM/PAM image\n", file);
+		return -EINVAL;
+	}
+	auto number = [&]() {
+		int c;
+		while ((c = fgetc(f)) != EOF) {
+			if (c == '#')
+				while ((c = fgetc(f)) != EOF && c != '\n')
+					;
+			else if (!HX_isspace(c))
+				break;
+		}
+		unsigned int v = 0;
+		for (; c != EOF && HX_isdigit(c); c = fgetc(f))
+			v = v * 10 + c - '0';
+		return v;
+	};
+	if (magic[1] == '6') {
+		width  = number();
+		height = number();
+		maxval = number();
+	} else {
+		char line[80];
+		while (fgets(line, sizeof(line), f) != nullptr) {
+			if (strncmp(line, "ENDHDR", 6) == 0)
+				break;
+			else if (strncmp(line, "WIDTH ", 6) == 0)
+				width = strtoul(&line[6], nullptr, 10);
+			else if (strncmp(line, "HEIGHT ", 7) == 0)
+				height = strtoul(&line[7], nullptr, 10);
+			else if (strncmp(line, "DEPTH ", 6) == 0)
+				depth = strtoul(&line[6], nullptr, 10);
+			else if (strncmp(line, "MAXVAL ", 7) == 0)
+				maxval = strtoul(&line[7], nullptr, 10);
+		}
+	}
+	if (width == 0 || height == 0 || maxval == 0 || maxval > 65535 ||
+	    depth == 0 || depth > 4) {
+		fprintf(stderr, "%s: unsupported image header\n", file);
+		return -EINVAL;
+	}
+	bool has_alpha = depth == 2 || depth == 4;
+	unsigned int bps = maxval > 255 ? 2 : 1;
+	std::vector<uint8_t> row(width * depth * bps);
+	count.assign(32768, 0);
+	sum.assign(32768, {});
+	for (unsigned int y = 0; y < height; ++y) {
+		if (fread(row.data(), row.size(), 1, f) != 1) {
+			fprintf(stderr, "%s: image data truncated\n", file);
+			return -EINVAL;
+		}
+		for (unsigned int x = 0; x < width; ++x) {
+			unsigned int v[4];
+			for (unsigned int c = 0; c < depth; ++c) {
+				auto p = &row[(x * depth + c) * bps];
+				unsigned int sample = bps == 2 ? p[0] << 8 | p[1] : p[0];
+				v[c] = std::min(maxval, sample) * 255 / maxval;
+			}
+			if (has_alpha && v[depth-1] < 128)
+				continue;
+			unsigned int r = v[0], g = depth >= 3 ? v[1] : r, b = depth >= 3 ? v[2] : r;
+			unsigned int bin = (r >> 3) << 10 | (g >> 3) << 5 | b >> 3;
+			++count[bin];
+			sum[bin][0] += r;
+			sum[bin][1] += g;
+			sum[bin][2] += b;
+		}
+	}
+	return 0;
+}
+
+namespace {
+
+/*
+ * Points in CIELAB (L, a=c*cos h, b=c*sin h), structure-of-arrays and padded
+ * to a multiple of the vector width; padding has weight 0.
+ */
+struct lab_points {
+	static constexpr size_t lanes = 8;
+	std::vector<float> l, a, b, w;
+	size_t n = 0;
+};
+
+typedef float v8f __attribute__((vector_size(32)));
+typedef int32_t v8i __attribute__((vector_size(32)));
+
 }
 
-std::string repr(const token_vector &tokens)
+/**
+ * Nearest of @k centres for the 8 points from @i on, as a GCC vector
+ * extension kernel: every centre is tested against all eight lanes at once
+ * with a compare-and-select, which maps to SSE/AVX/NEON without intrinsics.
+ */
+static inline __attribute__((always_inline)) void
+lab_nearest8_body(const lab_points &pt, size_t i, const float *cl,
+    const float *ca, const float *cb, unsigned int k, v8i &best, v8f &dist)
 {
-	std::string out = "(";
-	for (const auto &e : tokens)
-		out += e.repr();
-	return out += ")";
+	v8f l, a, b;
+	memcpy(&l, &pt.l[i], sizeof(l));
+	memcpy(&a, &pt.a[i], sizeof(a));
+	memcpy(&b, &pt.b[i], sizeof(b));
+	dist = v8f{} + HUGE_VALF;
+	best = v8i{};
+	for (unsigned int c = 0; c < k; ++c) {
+		auto dl = l - cl[c], da = a - ca[c], db = b - cb[c];
+		auto d = dl * dl + da * da + db * db;
+		auto closer = d < dist;
+		dist = closer ? d : dist;
+		best = closer ? v8i{} + static_cast<int32_t>(c) : best;
+	}
 }
 
-std::string token_entry::repr() const
+static void lab_nearest8_scalar(const lab_points &pt, size_t i, const float *cl,
+    const float *ca, const float *cb, unsigned int k, v8i &best, v8f &dist)
 {
-	switch (type) {
-	case token_type::op:
-	case token_type::reg: { char x = std::get<char>(val); return std::string(&x, 1); }
-	case token_type::imm: return std::to_string(std::get<double>(val));
-	case token_type::grp: return ::repr(std::get<token_vector>(val));
-	default: return "?";
+	for (unsigned int j = 0; j < lab_points::lanes; ++j) {
+		float bd = HUGE_VALF;
+		int32_t bc = 0;
+		for (unsigned int c = 0; c < k; ++c) {
+			float dl = pt.l[i+j] - cl[c], da = pt.a[i+j] - ca[c], db = pt.b[i+j] - cb[c];
+			float d = dl * dl + da * da + db * db;
+			if (d < bd) {
+				bd = d;
+				bc = c;
+			}
+		}
+		dist[j] = bd;
+		best[j] = bc;
 	}
 }
 
-static int eval_help(const char *expr, const char *ptr, const char *reason)
+static void lab_nearest8_vec(const lab_points &pt, size_t i, const float *cl,
+    const float *ca, const float *cb, unsigned int k, v8i &best, v8f &dist)
 {
-	fprintf(stderr, "Evaluation of expression/subexpression failed at\n\t%s\n\t%-*s^\n%s\n",
-		expr, static_cast<int>(ptr - expr), "", reason);
-	return 1;
+	lab_nearest8_body(pt, i, cl, ca, cb, k, best, dist);
 }
 
-static int eval_help(const char *complaint, const token_vector &tokens)
+#ifdef HAVE_X86_KERNELS
+/*
+ * One ymm register per coordinate instead of two xmm halves. FMA is left
+ * out on purpose so that distances, and thereby the palette, come out the
+ * same on every kernel.
+ */
+__attribute__((target("avx2"))) static void
+lab_nearest8_avx2(const lab_points &pt, size_t i, const float *cl,
+    const float *ca, const float *cb, unsigned int k, v8i &best, v8f &dist)
 {
-	fprintf(stderr, "%s:\n\t%s\n", complaint, repr(tokens).c_str());
-	return 1;
+	lab_nearest8_body(pt, i, cl, ca, cb, k, best, dist);
 }
+#endif
+
+using lab_nearest8_fn = void (*)(const lab_points &, size_t, const float *,
+      const float *, const float *, unsigned int, v8i &, v8f &);
 
-static constexpr char EVAL_REGS[] = "bcghlrsxyz";
-static int eval_tokenize(const char *ptr, char **super_end, token_vector &tokens)
+static lab_nearest8_fn lab_nearest8_select()
 {
-	auto cmd = ptr;
-	/* Section 1 */
-	token_type last_type = token_type::none;
-	while (true) {
-		while (HX_isspace(*ptr))
-			++ptr;
-		if (*ptr == '\0' || *ptr == ')')
-			break;
-		char *end = nullptr;
-		auto imm = strtod(ptr, &end);
-		if (end == nullptr) {
-			return eval_help(cmd, ptr, "strtod failed hard");
-		} else if (strchr("*/+,-=^", *ptr) != nullptr) {
-			if (last_type == token_type::none || last_type == token_type::op)
-				return eval_help(cmd, ptr, "Cannot use operator here (note: no unary operators supported)");
-			tokens.push_back(token_entry{token_type::op, token_value{*ptr}});
-			++ptr;
-		} else if (strchr(EVAL_REGS, *ptr) != nullptr) {
-			if (last_type != token_type::none && last_type != token_type::op)
-				return eval_help(cmd, ptr, "Cannot use identifier here");
-			auto reg = *ptr;
-			if (reg == 's')
-				reg = 'c';
-			tokens.push_back(token_entry{token_type::reg, token_value{reg}});
-			++ptr;
-		} else if (*ptr == '(') {
-			if (last_type != token_type::none && last_type != token_type::op)
-				return eval_help(cmd, ptr, "Cannot use opening parenthesis here");
-			++ptr;
-			token_vector newgrp;
-			auto ret = eval_tokenize(ptr, &end, newgrp);
-			if (ret != 0)
-				return ret;
-			ptr = end;
-			if (*end != ')')
-				return eval_help(cmd, ptr, "Expected closing parenthesis");
-			++ptr;
-			tokens.push_back(token_entry{token_type::grp, token_value{std::move(newgrp)}});
-		} else if (end != ptr) {
-			if (last_type != token_type::none && last_type != token_type::op)
-				return eval_help(cmd, ptr, "Cannot use immediate value here");
-			tokens.push_back(token_entry{token_type::imm, token_value{imm}});
-			ptr = end;
-		} else {
-			return eval_help(cmd, ptr, "Unexpected character");
+	auto isa = vfalib::isa_active();
+	if (isa == vfalib::ISA_SCALAR)
+		return lab_nearest8_scalar;
+#ifdef HAVE_X86_KERNELS
+	if (isa >= vfalib::ISA_AVX2)
+		return lab_nearest8_avx2;
+#endif
+	return lab_nearest8_vec;
+}
+
+/**
+ * Weighted k-means over @pt with k-means++ seeding. The assignment step is
+ * split over all CPUs, each thread accumulating its own per-cluster sums.
+ * The weighted sum of squared distances is left in @inertia.
+ */
+static std::vector<lch> kmeans_lab(const lab_points &pt, unsigned int k,
+    std::mt19937 &rng, double &inertia)
+{
+	std::vector<float> cl, ca, cb;
+	std::vector<double> d2(pt.n, HUGE_VAL);
+	auto pick = [&](size_t i) {
+		cl.push_back(pt.l[i]);
+		ca.push_back(pt.a[i]);
+		cb.push_back(pt.b[i]);
+	};
+	{
+		std::discrete_distribution<size_t> first(pt.w.begin(), pt.w.begin() + pt.n);
+		pick(first(rng));
+	}
+	while (cl.size() < k) {
+		auto c = cl.size() - 1;
+		std::vector<double> prob(pt.n);
+		for (size_t i = 0; i < pt.n; ++i) {
+			double dl = pt.l[i] - cl[c], da = pt.a[i] - ca[c], db = pt.b[i] - cb[c];
+			d2[i] = std::min(d2[i], dl * dl + da * da + db * db);
+			prob[i] = d2[i] * pt.w[i];
 		}
-		last_type = tokens.back().type;
+		if (std::all_of(prob.cbegin(), prob.cend(), [](double x) { return x == 0; }))
+			break; /* fewer distinct colours than @k */
+		std::discrete_distribution<size_t> next(prob.begin(), prob.end());
+		pick(next(rng));
 	}
+	k = cl.size();
 
-	/* Section 2 */
-	if (tokens.empty())
-		return eval_help(cmd, ptr, "No tokens were parsed -- empty parenthesis?");
-	assert(tokens.front().type != token_type::op);
-	if (tokens.back().type == token_type::op)
-		return eval_help(cmd, ptr, "Last token cannot be an operator");
-	if (super_end != nullptr)
-		*super_end = const_cast<char *>(ptr);
-
-	/* Section 3: Precedence maker */
-	static constexpr const char *op_prec[] = {"^", "*/", "+-", "=", ","};
-	for (auto op_group : op_prec) {
-		bool right_assoc = *op_group == '=';
-		if (right_assoc)
-			std::reverse(tokens.begin(), tokens.end());
-		for (size_t i = 1; i < tokens.size(); ) {
-			if (tokens[i].type != token_type::op) {
-				++i;
-				continue;
+	struct partial {
+		std::vector<double> l, a, b, w;
+		double inertia = 0;
+	};
+	auto nthr = std::max(1U, std::thread::hardware_concurrency());
+	auto nblocks = pt.l.size() / lab_points::lanes;
+	nthr = std::min<size_t>(nthr, nblocks);
+	std::vector<partial> part(nthr);
+	static const auto lab_nearest8 = lab_nearest8_select();
+	for (unsigned int iter = 0; iter < 100; ++iter) {
+		auto worker = [&](unsigned int t) {
+			auto &p = part[t];
+			p.l.assign(k, 0);
+			p.a.assign(k, 0);
+			p.b.assign(k, 0);
+			p.w.assign(k, 0);
+			p.inertia = 0;
+			for (size_t blk = t; blk < nblocks; blk += nthr) {
+				v8i best;
+				v8f dist;
+				auto i = blk * lab_points::lanes;
+				lab_nearest8(pt, i, cl.data(), ca.data(), cb.data(), k, best, dist);
+				for (unsigned int j = 0; j < lab_points::lanes; ++j) {
+					auto c = best[j];
+					auto w = pt.w[i+j];
+					p.l[c] += w * pt.l[i+j];
+					p.a[c] += w * pt.a[i+j];
+					p.b[c] += w * pt.b[i+j];
+					p.w[c] += w;
+					p.inertia += w * dist[j];
+				}
 			}
-			auto op = std::get<char>(tokens[i].val);
-			if (strchr(op_group, op) == nullptr) {
-				++i;
-				continue;
+		};
+		std::vector<std::thread> thr;
+		for (unsigned int t = 1; t < nthr; ++t)
+			thr.emplace_back(worker, t);
+		worker(0);
+		for (auto &t : thr)
+			t.join();
+
+		double moved = 0;
+		inertia = 0;
+		for (const auto &p : part)
+			inertia += p.inertia;
+		for (unsigned int c = 0; c < k; ++c) {
+			double l = 0, a = 0, b = 0, w = 0;
+			for (const auto &p : part) {
+				l += p.l[c];
+				a += p.a[c];
+				b += p.b[c];
+				w += p.w[c];
 			}
-			assert(i < tokens.size() - 1);
-			token_vector newgrp;
-			newgrp.emplace_back(std::move(tokens[i-1]));
-			newgrp.emplace_back(std::move(tokens[i]));
-			newgrp.emplace_back(std::move(tokens[i+1]));
-			if (right_assoc)
-				std::reverse(newgrp.begin(), newgrp.end());
-			tokens[i-1].type = token_type::grp;
-			tokens[i-1].val  = std::move(newgrp);
-			tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
-			/* Redo at current position i */
+			if (w == 0)
+				continue; /* keep an orphaned centre where it is */
+			l /= w;
+			a /= w;
+			b /= w;
+			moved = std::max(moved, std::hypot(l - cl[c], a - ca[c], b - cb[c]));
+			cl[c] = l;
+			ca[c] = a;
+			cb[c] = b;
 		}
-		if (right_assoc)
-			std::reverse(tokens.begin(), tokens.end());
+		if (g_verbose)
+			fprintf(stderr, "# kmeans iteration %u: max centre shift %f, inertia %g\n",
+			        iter, moved, inertia);
+		if (moved < 0.01)
+			break;
 	}
-	return 0;
-}
-
-static double eval_rd(mpalette &mpal, size_t idx, char reg)
-{
-	switch (reg) {
-	case 'r': return mpal.ra[idx].r;
-	case 'g': return mpal.ra[idx].g;
-	case 'b': return mpal.ra[idx].b;
-	case 'l': return mpal.la[idx].l;
-	case 'c': return mpal.la[idx].c;
-	case 'h': return mpal.la[idx].h;
-	case 'x': return mpal.x;
-	case 'y': return mpal.y;
-	case 'z': return mpal.z;
-	default: throw -1;
+	std::vector<lch> out(k);
+	for (unsigned int c = 0; c < k; ++c) {
+		out[c].l = cl[c];
+		out[c].c = std::hypot(ca[c], cb[c]);
+		out[c].h = fmod(atan2(cb[c], ca[c]) * 180 / M_PI + 360, 360);
 	}
+	return out;
 }
 
-static token_entry eval_grp(const token_vector &tokens, mpalette &mpal, size_t idx);
-
-static std::pair<token_entry, double>
-eval_arg(const token_entry &token, mpalette &mpal, size_t idx)
+static double lab_dist(const lch &x, const lch &y)
 {
-	if (token.type == token_type::imm) {
-		return {token, std::get<double>(token.val)};
-	} else if (token.type == token_type::reg) {
-		return {token, eval_rd(mpal, idx, std::get<char>(token.val))};
-	} else if (token.type == token_type::grp) {
-		auto categ = eval_grp(std::get<token_vector>(token.val), mpal, idx);
-		if (categ.type == token_type::imm) {
-			return {categ, std::get<double>(categ.val)};
-		} else if (categ.type == token_type::reg) {
-			return {categ, eval_rd(mpal, idx, std::get<char>(categ.val))};
-		}
-	}
-	throw "Unhandled subexpr";
+	double xh = x.h * M_PI / 180, yh = y.h * M_PI / 180;
+	return std::hypot(x.l - y.l, x.c * cos(xh) - y.c * cos(yh),
+	       x.c * sin(xh) - y.c * sin(yh));
 }
 
-static token_entry eval_grp(const token_vector &tokens, mpalette &mpal, size_t idx)
+/**
+ * Derive an @ncolors palette from the image in @file. For 16 colours, the
+ * clusters are handed to the VGA palette slots closest to them (greedily, by
+ * CIELAB distance), so that "red" ends up at index 1 and so on as far as the
+ * image allows; otherwise they are sorted by lightness. The palette always
+ * ends up with 16 entries: when there are fewer clusters (because @ncolors
+ * was smaller, or the image has fewer distinct colours), the last one is
+ * repeated.
+ */
+static int imgpal(const char *file, unsigned int ncolors, mpalette &mpal)
 {
-	if (tokens.size() == 1) {
-		if (tokens[0].type != token_type::grp)
-			return tokens[0];
-		return eval_grp(std::get<token_vector>(tokens[0].val), mpal, idx);
-	} else if (tokens.size() != 3) {
-		eval_help("Expected a group with 3 tokens", tokens);
-		return {};
-	} else if (tokens[1].type != token_type::op) {
-		eval_help("Expected middle token to be an operator", tokens);
+	std::vector<uint32_t> count;
+	std::vector<std::array<double, 3>> sum;
+	auto ret = loadimg_hist(file, count, sum);
+	if (ret < 0)
+		return ret;
+	std::vector<srgb> mean;
+	std::vector<float> weight;
+	for (size_t i = 0; i < count.size(); ++i) {
+		if (count[i] == 0)
+			continue;
+		mean.push_back({sum[i][0] / count[i] / 255, sum[i][1] / count[i] / 255,
+			sum[i][2] / count[i] / 255});
+		weight.push_back(count[i]);
 	}
-
-	auto op = std::get<char>(tokens[1].val);
+	if (mean.size() == 0) {
+		fprintf(stderr, "%s: no opaque pixels\n", file);
+		return -EINVAL;
+	}
+	std::vector<lch> lc(mean.size());
+	babl_process(babl_fish(srgb_space, lch_space), mean.data(), lc.data(), mean.size());
+	lab_points pt;
+	pt.n = mean.size();
+	auto padded = (pt.n + lab_points::lanes - 1) / lab_points::lanes * lab_points::lanes;
+	pt.l.resize(padded);
+	pt.a.resize(padded);
+	pt.b.resize(padded);
+	pt.w.resize(padded);
+	for (size_t i = 0; i < pt.n; ++i) {
+		pt.l[i] = lc[i].l;
+		pt.a[i] = lc[i].c * cos(lc[i].h * M_PI / 180);
+		pt.b[i] = lc[i].c * sin(lc[i].h * M_PI / 180);
+		pt.w[i] = weight[i];
+	}
+	if (g_verbose)
+		fprintf(stderr, "# %s: %zu distinct colour bins\n", file, pt.n);
 	/*
-	 * Evaluation order! Take notes from https://en.cppreference.com/w/cpp/language/eval_order .
-	 * For ',', we need lhs before rhs.
+	 * k-means only finds a local optimum; keep the best of a few seedings.
+	 * The seed is fixed, so the result is reproducible.
 	 */
-	auto [lhs, lhv] = eval_arg(tokens[0], mpal, idx);
-	auto [rhs, rhv] = eval_arg(tokens[2], mpal, idx);
-
-	switch (op) {
-	case '+': return {token_type::imm, lhv + rhv};
-	case '-': return {token_type::imm, lhv - rhv};
-	case '*': return {token_type::imm, lhv * rhv};
-	case '/': return {token_type::imm, lhv / rhv};
-	case '^': return {token_type::imm, pow(std::max(0.0, lhv), rhv)};
-	case ',': return rhs;
-	case '=': break;
-	default:
-		fprintf(stderr, "Unhandled op '%c' in subexpr: %s\n", op, repr(tokens).c_str());
-		return {};
+	std::mt19937 rng(0x5eed);
+	std::vector<lch> cent;
+	double best = HUGE_VAL;
+	for (unsigned int trial = 0; trial < 8; ++trial) {
+		double inertia = 0;
+		auto c = kmeans_lab(pt, ncolors, rng, inertia);
+		if (inertia < best) {
+			best = inertia;
+			cent = std::move(c);
+		}
 	}
 
-	if (lhs.type != token_type::reg) {
-		fprintf(stderr, "Left-hand side of subexpr needs to be a register: %s\n", repr(tokens).c_str());
-		return {};
-	}
-	bool mod_la = false, mod_ra = false;
-	auto reg = std::get<char>(lhs.val);
-	switch (reg) {
-	case 'r': mpal.ra[idx].r = rhv; mod_ra = true; break;
-	case 'g': mpal.ra[idx].g = rhv; mod_ra = true; break;
-	case 'b': mpal.ra[idx].b = rhv; mod_ra = true; break;
-	case 'l': mpal.la[idx].l = rhv; mod_la = true; break;
-	case 'c': mpal.la[idx].c = rhv; mod_la = true; break;
-	case 'h': mpal.la[idx].h = HX_flpr(rhv, 360); mod_la = true; break;
-	case 'x': mpal.x = rhv; break;
-	case 'y': mpal.y = rhv; break;
-	case 'z': mpal.z = rhv; break;
-	default:
-		fprintf(stderr, "Left-hand side of subexpr needs to be a register: %s\n", repr(tokens).c_str());
-		return {};
+	if (ncolors == 16) {
+		cent.resize(16, cent.back());
+		auto ref = to_lch(std::vector<srgb888>(std::begin(vga_palette), std::end(vga_palette)));
+		std::vector<lch> out(16);
+		std::vector<bool> cent_used(16), slot_used(16);
+		for (unsigned int round = 0; round < 16; ++round) {
+			unsigned int bc = 0, bs = 0;
+			double bd = HUGE_VAL;
+			for (unsigned int c = 0; c < 16; ++c) {
+				if (cent_used[c])
+					continue;
+				for (unsigned int s = 0; s < 16; ++s) {
+					if (slot_used[s])
+						continue;
+					auto d = lab_dist(cent[c], ref[s]);
+					if (d < bd) {
+						bd = d;
+						bc = c;
+						bs = s;
+					}
+				}
+			}
+			cent_used[bc] = slot_used[bs] = true;
+			out[bs] = cent[bc];
+		}
+		cent = std::move(out);
+	} else {
+		std::sort(cent.begin(), cent.end(),
+			[](const lch &x, const lch &y) { return x.l < y.l; });
+		cent.resize(16, cent.back());
 	}
-	if (mod_la)
-		mpal.mod_la();
-	if (mod_ra)
-		mpal.mod_ra();
-	return lhs;
+	mpal.la = std::move(cent);
+	return 0;
 }
 
-static int do_eval(const char *cmd, mpalette &mpal, const std::vector<size_t> &indices = {})
+template<typename T> T do_blend(const T &a, double amult, const T &b, double bmult)
 {
-	token_vector tokens;
-	auto ret = eval_tokenize(cmd, nullptr, tokens);
-	if (ret != 0)
-		return ret;
-	if (g_verbose)
-		fprintf(stderr, "# expr parsed as: %s\n", repr(tokens).c_str());
-	if (mpal.la.size() != mpal.ra.size())
-		throw "Programming error";
-	if (indices.empty()) {
-		for (size_t i = 0; i < mpal.la.size(); ++i) {
-			auto d = eval_grp(tokens, mpal, i);
-			if (d.type == token_type::none)
-				return -1;
-		}
-	} else {
-		for (auto i : indices) {
-			if (i >= mpal.la.size())
-				continue;
-			auto d = eval_grp(tokens, mpal, i);
-			if (d.type == token_type::none)
-				return -1;
-		}
+	auto max = std::max(a.size(), b.size());
+	T out(max);
+	for (size_t x = 0; x < max; ++x) {
+		out[x].r = a[x].r * amult + b[x].r * bmult;
+		out[x].g = a[x].g * amult + b[x].g * bmult;
+		out[x].b = a[x].b * amult + b[x].b * bmult;
 	}
-	return 0;
+	return out;
 }
 
 std::vector<size_t> parse_range(const char *s_input)
@@ -956,23 +1023,18 @@ int main(int argc, char **argv)
 	if (HX_getopt5(g_options_table, argv, &argc, &argv,
 	    HXOPT_RQ_ORDER | HXOPT_USAGEONERR) != HXOPT_ERR_SUCCESS)
 		return EXIT_FAILURE;
-
-	xyz_to_lrgb_matrix = make_lrgb_matrix(to_xyz(illuminant_d(6500)));
-	srgb888_space = babl_format_with_space("R'G'B' u8", babl_space("sRGB"));
-	if (srgb888_space == nullptr) {
-		fprintf(stderr, "BABL does not know sRGB888\n");
-		return EXIT_FAILURE;
-	}
-	srgb_space = babl_format_with_space("R'G'B' double", babl_space("sRGB"));
-	if (srgb_space == nullptr) {
-		fprintf(stderr, "BABL does not know sRGB\n");
-		return EXIT_FAILURE;
+	if (g_kernels != nullptr) {
+		auto ret = vfalib::isa_select(g_kernels);
+		if (ret < 0) {
+			fprintf(stderr, "--kernels=%s: %s\n", g_kernels, strerror(-ret));
+			return EXIT_FAILURE;
+		}
 	}
-	lch_space = babl_format_with_space("CIE LCH(ab) double", babl_space("sRGB"));
-	if (lch_space == nullptr) {
-		fprintf(stderr, "BABL does not know LCh\n");
+	if (g_verbose)
+		fprintf(stderr, "Kernels: %s\n", vfalib::isa_name(vfalib::isa_active()));
+
+	if (palcomp_init() != 0)
 		return EXIT_FAILURE;
-	}
 
 	while (*++argv != nullptr) {
 		auto ptr = strchr(*argv, '=');
@@ -992,6 +1054,31 @@ int main(int argc, char **argv)
 			if (loadpal(&argv[0][8], mpal.ra) != 0)
 				return EXIT_FAILURE;
 			mod_ra = true;
+		} else if (strncmp(*argv, "imgpal=", 7) == 0) {
+			char *end = nullptr;
+			unsigned int n = strtoul(&argv[0][7], &end, 0);
+			auto file = &argv[0][7];
+			if (end != file && *end == ',')
+				file = end + 1;
+			else
+				n = 16;
+			if (n == 0 || n > 16) {
+				fprintf(stderr, "imgpal: color count must be 1..16\n");
+				return EXIT_FAILURE;
+			}
+			if (imgpal(file, n, mpal) != 0)
+				return EXIT_FAILURE;
+			mod_la = true;
+		} else if (strncmp(*argv, "cxf=", 4) == 0) {
+			char *end = nullptr;
+			unsigned int px = strtoul(&argv[0][4], &end, 0);
+			auto file = &argv[0][4];
+			if (end != file && *end == ',')
+				file = end + 1;
+			else
+				px = 0;
+			if (cxf_command(mpal.ra, file, px) != 0)
+				return EXIT_FAILURE;
 		} else if (strncmp(*argv, "loadreg=", 8) == 0) {
 			mpal = allpal[&argv[0][8]];
 		} else if (strncmp(*argv, "savereg=", 8) == 0) {
@@ -1015,14 +1102,14 @@ int main(int argc, char **argv)
 			if (eqsign != nullptr) {
 				*eqsign++ = '\0';
 				auto indices = parse_range(&argv[0][5]);
-				if (do_eval(eqsign, mpal, indices) != 0)
+				if (do_eval(eqsign, mpal, indices, g_verbose) != 0)
 					break;
 			}
 		} else if (strncmp(*argv, "eval=", 5) == 0) {
-			if (do_eval(&argv[0][5], mpal) != 0)
+			if (do_eval(&argv[0][5], mpal, {}, g_verbose) != 0)
 				break;
 		} else if (**argv == '(' || (strchr(EVAL_REGS, **argv) && argv[0][1] == '=')) {
-			if (do_eval(argv[0], mpal) != 0)
+			if (do_eval(argv[0], mpal, {}, g_verbose) != 0)
 				break;
 		} else if (strncmp(*argv, "ild=", 4) == 0) {
 			fprintf(stderr, "New white_point D_%.2f:\n", arg1 / 100);
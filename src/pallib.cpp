@@ -0,0 +1,540 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// SPDX-FileCopyrightText: 2022–2024 Jan Engelhardt
+/*
+ *	Color conversion, contrast and palette expressions for palcomp
+ */
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+#include <babl/babl.h>
+#include <Eigen/LU>
+#include <libHX/ctype_helper.h>
+#include <libHX/misc.h>
+#include "pallib.hpp"
+
+using namespace pallib;
+
+namespace {
+enum class token_type { none, reg, imm, grp, op };
+struct token_entry;
+using token_value = std::variant<char, double, std::vector<token_entry>>;
+struct token_entry {
+	token_type type = token_type::none;
+	token_value val{};
+	std::string repr() const;
+};
+using token_vector = std::vector<token_entry>;
+}
+
+double pallib::g_continuous_gamma;
+const Babl *pallib::lch_space, *pallib::srgb_space, *pallib::srgb888_space;
+Eigen::Matrix3d pallib::xyz_to_lrgb_matrix;
+
+hsl pallib::to_hsl(const srgb &i)
+{
+	hsl c;
+	double vmin = std::min({i.r, i.g, i.b}), vmax = std::max({i.r, i.g, i.b});
+	c.l = (vmin + vmax) / 2;
+	if (vmax == vmin)
+		return c;
+	auto d = vmax - vmin;
+	c.s = c.l > 0.5 ? d / (2 - vmax - vmin) : d / (vmax + vmin);
+	if (vmax == i.r) c.h = (i.g - i.b) / d + (i.g < i.b ? 6 : 0);
+	if (vmax == i.g) c.h = (i.b - i.r) / d + 2;
+	if (vmax == i.b) c.h = (i.r - i.g) / d + 4;
+	c.h *= 60;
+	return c;
+}
+
+srgb888 pallib::to_srgb888(const srgb &e)
+{
+	auto r = std::max(std::min(round(e.r * 255.0), 255.0), 0.0);
+	auto g = std::max(std::min(round(e.g * 255.0), 255.0), 0.0);
+	auto b = std::max(std::min(round(e.b * 255.0), 255.0), 0.0);
+	return {static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b)};
+}
+
+static double huetorgb(double p, double q, double t)
+{
+	if (t < 0)
+		t += 360;
+	if (t > 360)
+		t -= 360;
+	if (t < 60)
+		return p + (q - p) * t / 60;
+	if (t < 180)
+		return q;
+	if (t < 240)
+		return p + (q - p) * (4 - t / 60);
+	return p;
+}
+
+srgb pallib::to_srgb(const hsl &in)
+{
+	if (in.s <= 0.0)
+		return {in.l, in.l, in.l};
+	auto q = in.l < 0.5 ? in.l * (1 + in.s) : in.l + in.s - in.l * in.s;
+	auto p = 2 * in.l - q;
+	return {huetorgb(p, q, in.h + 120),
+		huetorgb(p, q, in.h), huetorgb(p, q, in.h - 120)};
+}
+
+srgb pallib::to_srgb(const srgb888 &e)
+{
+	return {e.r / 255.0, e.g / 255.0, e.b / 255.0};
+}
+
+srgb888 pallib::to_srgb888(const lch &i)
+{
+	srgb888 o{};
+	babl_process(babl_fish(lch_space, srgb888_space), &i, &o, 1);
+	return o;
+}
+
+lch pallib::to_lch(const srgb888 &i)
+{
+	lch o{};
+	babl_process(babl_fish(srgb888_space, lch_space), &i, &o, 1);
+	return o;
+}
+
+lch pallib::to_lch(const srgb &i)
+{
+	lch o{};
+	babl_process(babl_fish(srgb_space, lch_space), &i, &o, 1);
+	return o;
+}
+
+std::vector<lch> pallib::to_lch(const std::vector<srgb888> &in)
+{
+	std::vector<lch> out;
+	for (const auto &color : in)
+		out.push_back(to_lch(color));
+	return out;
+}
+
+std::vector<srgb888> pallib::to_srgb888(const std::vector<lch> &in)
+{
+	std::vector<srgb888> out;
+	for (const auto &color : in)
+		out.push_back(to_srgb888(color));
+	return out;
+}
+
+void mpalette::mod_la() { ra = to_srgb888(la); }
+void mpalette::mod_ra() { la = to_lch(ra); }
+
+void palstat::compute_sums(unsigned int xlim, unsigned int ylim, gvstat &gs)
+{
+	gs.pairs = gs.penalized = 0;
+	gs.sum = gs.avg = 0;
+	for (unsigned int y = 0; y < ylim; ++y) {
+		for (unsigned int x = 0; x < xlim; ++x) {
+			if (x == y)
+				continue;
+			++gs.pairs;
+			gs.sum += delta[y][x];
+			if (penalize != nullptr && penalize(delta[y][x]))
+				++gs.penalized;
+			else
+				gs.adj_sum += delta[y][x];
+		}
+	}
+	gs.avg = gs.sum / gs.pairs;
+	gs.adj_avg = gs.adj_sum / (gs.pairs - gs.penalized);
+}
+
+void palstat::compute_sums()
+{
+	compute_sums(16, 16, x1616);
+	compute_sums(8, 16, x816);
+	compute_sums(8, 8, x88);
+}
+
+palstat pallib::cxl_compute(const std::vector<lch> &pal)
+{
+	palstat o;
+	o.penalize = [](double x) { return x < 7.0; };
+	for (unsigned int bg = 0; bg < 16; ++bg)
+		for (unsigned int fg = 0; fg < 16; ++fg)
+			o.delta[bg][fg] = fabs(pal[fg].l - pal[bg].l);
+	o.compute_sums();
+	return o;
+}
+
+double pallib::gamma_expand(double c)
+{
+	if (g_continuous_gamma != 0)
+		return pow(c, g_continuous_gamma);
+	/*
+	 * To avoid zero slope, part of the range gets a linear mapping /
+	 * gamma of 1.0.
+	 */
+	if (c <= 0.04045)
+		return c / 12.92;
+	/*
+	 * The rest of the curve is a 2.4 gamma (instead of 2.2) to compensate
+	 * for the prior linear section. The 2.4 curve approximates the 2.2
+	 * curve in the input value range that is of interest.
+	 */
+	return std::min(1.0, pow((c + 0.055) / 1.055, 12 / 5.0));
+}
+
+double pallib::gamma_compress(double c)
+{
+	return c <= (0.04045 / 12.92) ? c * 12.92 :
+	       pow(c, 5 / 12.0) * 1.055 - 0.055;
+}
+
+lrgb pallib::to_lrgb(const srgb &e)
+{
+	return {gamma_expand(e.r), gamma_expand(e.g), gamma_expand(e.b)};
+}
+
+double pallib::trivial_lightness(const lrgb &k)
+{
+	const auto &dm = xyz_to_lrgb_matrix;
+	return dm(1, 0) * k.r + dm(1, 1) * k.g + dm(1, 2) * k.b;
+}
+
+Eigen::Matrix3d pallib::make_lrgb_matrix(const xyz &white_raw)
+{
+	/* https://mina86.com/2019/srgb-xyz-matrix/ */
+	static constexpr xy0 red = {0.64, 0.33}, green = {0.30, 0.60}, blue = {0.15, 0.06};
+	const Eigen::Matrix3d M_prime{
+		{red.x / red.y, green.x / green.y, blue.x / blue.y},
+		{1, 1, 1},
+		{(1 - red.x - red.y) / red.y, (1 - green.x - green.y) / green.y, (1 - blue.x - blue.y) / blue.y},
+	};
+	const Eigen::Vector3d W{white_raw.x, white_raw.y, white_raw.z};
+	return M_prime * (M_prime.inverse() * W).asDiagonal();
+}
+
+static constexpr struct {
+	double normbg = 0.56, normtxt = 0.57, revtxt = 0.62, revbg = 0.65,
+		black_thresh = 0.022, black_clamp = 1.414,
+		scale_bow = 1.14, scale_wob = 1.14,
+		lo_offset = 0.027,
+		delta_y_min = 0.0005, lo_clip = 0.1;
+} sa_param; /* SAPC/APCA ver 0.0.98G */
+
+double pallib::apca_contrast(double ytx, double ybg)
+{
+	if (ytx <= sa_param.black_thresh)
+		ytx += pow(sa_param.black_thresh - ytx, sa_param.black_clamp);
+	if (ybg <= sa_param.black_thresh)
+		ybg += pow(sa_param.black_thresh - ybg, sa_param.black_clamp);
+	if (fabs(ybg - ytx) < sa_param.delta_y_min)
+		return 0;
+	double oc;
+	/* SAPC = S-LUV Advanced Predictive Colour */
+	if (ybg > ytx) {
+		auto sapc = (pow(ybg, sa_param.normbg) - pow(ytx, sa_param.normtxt)) * sa_param.scale_bow;
+		oc = std::max(sapc - sa_param.lo_offset, 0.0);
+	} else {
+		auto sapc = (pow(ybg, sa_param.revbg) - pow(ytx, sa_param.revtxt)) * sa_param.scale_wob;
+		oc = std::min(sapc + sa_param.lo_offset, 0.0);
+	}
+	return 100 * fabs(oc);
+}
+
+/* @scale: factor for the Lc values (font weight adjustment, see cxf) */
+palstat pallib::cxa_compute(const std::vector<srgb888> &pal, double scale)
+{
+	/* APCA W3 contrast calculation */
+	/* History: https://github.com/w3c/wcag/issues/695 */
+	/* Implementation: https://git.apcacontrast.com/documentation/README */
+	palstat o;
+	o.penalize = [](double d) { return d < 7.3; };
+	std::vector<double> ell(pal.size());
+	for (unsigned int i = 0; i < pal.size(); ++i)
+		ell[i] = trivial_lightness(to_lrgb(to_srgb(pal[i])));
+	for (unsigned int bg = 0; bg < 16; ++bg)
+		for (unsigned int fg = 0; fg < 16; ++fg)
+			o.delta[bg][fg] = apca_contrast(ell[fg], ell[bg]) * scale;
+	o.compute_sums();
+	return o;
+}
+
+static std::string repr(const token_vector &tokens)
+{
+	std::string out = "(";
+	for (const auto &e : tokens)
+		out += e.repr();
+	return out += ")";
+}
+
+std::string token_entry::repr() const
+{
+	switch (type) {
+	case token_type::op:
+	case token_type::reg: { char x = std::get<char>(val); return std::string(&x, 1); }
+	case token_type::imm: return std::to_string(std::get<double>(val));
+	case token_type::grp: return ::repr(std::get<token_vector>(val));
+	default: return "?";
+	}
+}
+
+static int eval_help(const char *expr, const char *ptr, const char *reason)
+{
+	fprintf(stderr, "Evaluation of expression/subexpression failed at\n\t%s\n\t%-*s^\n%s\n",
+		expr, static_cast<int>(ptr - expr), "", reason);
+	return 1;
+}
+
+static int eval_help(const char *complaint, const token_vector &tokens)
+{
+	fprintf(stderr, "%s:\n\t%s\n", complaint, repr(tokens).c_str());
+	return 1;
+}
+
+static int eval_tokenize(const char *ptr, char **super_end, token_vector &tokens)
+{
+	auto cmd = ptr;
+	/* Section 1 */
+	token_type last_type = token_type::none;
+	while (true) {
+		while (HX_isspace(*ptr))
+			++ptr;
+		if (*ptr == '\0' || *ptr == ')')
+			break;
+		char *end = nullptr;
+		auto imm = strtod(ptr, &end);
+		if (end == nullptr) {
+			return eval_help(cmd, ptr, "strtod failed hard");
+		} else if (strchr("*/+,-=^", *ptr) != nullptr) {
+			if (last_type == token_type::none || last_type == token_type::op)
+				return eval_help(cmd, ptr, "Cannot use operator here (note: no unary operators supported)");
+			tokens.push_back(token_entry{token_type::op, token_value{*ptr}});
+			++ptr;
+		} else if (strchr(EVAL_REGS, *ptr) != nullptr) {
+			if (last_type != token_type::none && last_type != token_type::op)
+				return eval_help(cmd, ptr, "Cannot use identifier here");
+			auto reg = *ptr;
+			if (reg == 's')
+				reg = 'c';
+			tokens.push_back(token_entry{token_type::reg, token_value{reg}});
+			++ptr;
+		} else if (*ptr == '(') {
+			if (last_type != token_type::none && last_type != token_type::op)
+				return eval_help(cmd, ptr, "Cannot use opening parenthesis here");
+			++ptr;
+			token_vector newgrp;
+			auto ret = eval_tokenize(ptr, &end, newgrp);
+			if (ret != 0)
+				return ret;
+			ptr = end;
+			if (*end != ')')
+				return eval_help(cmd, ptr, "Expected closing parenthesis");
+			++ptr;
+			tokens.push_back(token_entry{token_type::grp, token_value{std::move(newgrp)}});
+		} else if (end != ptr) {
+			if (last_type != token_type::none && last_type != token_type::op)
+				return eval_help(cmd, ptr, "Cannot use immediate value here");
+			tokens.push_back(token_entry{token_type::imm, token_value{imm}});
+			ptr = end;
+		} else {
+			return eval_help(cmd, ptr, "Unexpected character");
+		}
+		last_type = tokens.back().type;
+	}
+
+	/* Section 2 */
+	if (tokens.empty())
+		return eval_help(cmd, ptr, "No tokens were parsed -- empty parenthesis?");
+	assert(tokens.front().type != token_type::op);
+	if (tokens.back().type == token_type::op)
+		return eval_help(cmd, ptr, "Last token cannot be an operator");
+	if (super_end != nullptr)
+		*super_end = const_cast<char *>(ptr);
+
+	/* Section 3: Precedence maker */
+	static constexpr const char *op_prec[] = {"^", "*/", "+-", "=", ","};
+	for (auto op_group : op_prec) {
+		bool right_assoc = *op_group == '=';
+		if (right_assoc)
+			std::reverse(tokens.begin(), tokens.end());
+		for (size_t i = 1; i < tokens.size(); ) {
+			if (tokens[i].type != token_type::op) {
+				++i;
+				continue;
+			}
+			auto op = std::get<char>(tokens[i].val);
+			if (strchr(op_group, op) == nullptr) {
+				++i;
+				continue;
+			}
+			assert(i < tokens.size() - 1);
+			token_vector newgrp;
+			newgrp.emplace_back(std::move(tokens[i-1]));
+			newgrp.emplace_back(std::move(tokens[i]));
+			newgrp.emplace_back(std::move(tokens[i+1]));
+			if (right_assoc)
+				std::reverse(newgrp.begin(), newgrp.end());
+			tokens[i-1].type = token_type::grp;
+			tokens[i-1].val  = std::move(newgrp);
+			tokens.erase(tokens.begin() + i, tokens.begin() + i + 2);
+			/* Redo at current position i */
+		}
+		if (right_assoc)
+			std::reverse(tokens.begin(), tokens.end());
+	}
+	return 0;
+}
+
+static double eval_rd(mpalette &mpal, size_t idx, char reg)
+{
+	switch (reg) {
+	case 'r': return mpal.ra[idx].r;
+	case 'g': return mpal.ra[idx].g;
+	case 'b': return mpal.ra[idx].b;
+	case 'l': return mpal.la[idx].l;
+	case 'c': return mpal.la[idx].c;
+	case 'h': return mpal.la[idx].h;
+	case 'x': return mpal.x;
+	case 'y': return mpal.y;
+	case 'z': return mpal.z;
+	default: throw -1;
+	}
+}
+
+static token_entry eval_grp(const token_vector &tokens, mpalette &mpal, size_t idx);
+
+static std::pair<token_entry, double>
+eval_arg(const token_entry &token, mpalette &mpal, size_t idx)
+{
+	if (token.type == token_type::imm) {
+		return {token, std::get<double>(token.val)};
+	} else if (token.type == token_type::reg) {
+		return {token, eval_rd(mpal, idx, std::get<char>(token.val))};
+	} else if (token.type == token_type::grp) {
+		auto categ = eval_grp(std::get<token_vector>(token.val), mpal, idx);
+		if (categ.type == token_type::imm) {
+			return {categ, std::get<double>(categ.val)};
+		} else if (categ.type == token_type::reg) {
+			return {categ, eval_rd(mpal, idx, std::get<char>(categ.val))};
+		}
+	}
+	throw "Unhandled subexpr";
+}
+
+static token_entry eval_grp(const token_vector &tokens, mpalette &mpal, size_t idx)
+{
+	if (tokens.size() == 1) {
+		if (tokens[0].type != token_type::grp)
+			return tokens[0];
+		return eval_grp(std::get<token_vector>(tokens[0].val), mpal, idx);
+	} else if (tokens.size() != 3) {
+		eval_help("Expected a group with 3 tokens", tokens);
+		return {};
+	} else if (tokens[1].type != token_type::op) {
+		eval_help("Expected middle token to be an operator", tokens);
+	}
+
+	auto op = std::get<char>(tokens[1].val);
+	/*
+	 * Evaluation order! Take notes from https://en.cppreference.com/w/cpp/language/eval_order .
+	 * For ',', we need lhs before rhs.
+	 */
+	auto [lhs, lhv] = eval_arg(tokens[0], mpal, idx);
+	auto [rhs, rhv] = eval_arg(tokens[2], mpal, idx);
+
+	switch (op) {
+	case '+': return {token_type::imm, lhv + rhv};
+	case '-': return {token_type::imm, lhv - rhv};
+	case '*': return {token_type::imm, lhv * rhv};
+	case '/': return {token_type::imm, lhv / rhv};
+	case '^': return {token_type::imm, pow(std::max(0.0, lhv), rhv)};
+	case ',': return rhs;
+	case '=': break;
+	default:
+		fprintf(stderr, "Unhandled op '%c' in subexpr: %s\n", op, repr(tokens).c_str());
+		return {};
+	}
+
+	if (lhs.type != token_type::reg) {
+		fprintf(stderr, "Left-hand side of subexpr needs to be a register: %s\n", repr(tokens).c_str());
+		return {};
+	}
+	bool mod_la = false, mod_ra = false;
+	auto reg = std::get<char>(lhs.val);
+	switch (reg) {
+	case 'r': mpal.ra[idx].r = rhv; mod_ra = true; break;
+	case 'g': mpal.ra[idx].g = rhv; mod_ra = true; break;
+	case 'b': mpal.ra[idx].b = rhv; mod_ra = true; break;
+	case 'l': mpal.la[idx].l = rhv; mod_la = true; break;
+	case 'c': mpal.la[idx].c = rhv; mod_la = true; break;
+	case 'h': mpal.la[idx].h = HX_flpr(rhv, 360); mod_la = true; break;
+	case 'x': mpal.x = rhv; break;
+	case 'y': mpal.y = rhv; break;
+	case 'z': mpal.z = rhv; break;
+	default:
+		fprintf(stderr, "Left-hand side of subexpr needs to be a register: %s\n", repr(tokens).c_str());
+		return {};
+	}
+	if (mod_la)
+		mpal.mod_la();
+	if (mod_ra)
+		mpal.mod_ra();
+	return lhs;
+}
+
+int pallib::do_eval(const char *cmd, mpalette &mpal, const std::vector<size_t> &indices,
+    bool verbose)
+{
+	token_vector tokens;
+	auto ret = eval_tokenize(cmd, nullptr, tokens);
+	if (ret != 0)
+		return ret;
+	if (verbose)
+		fprintf(stderr, "# expr parsed as: %s\n", repr(tokens).c_str());
+	if (mpal.la.size() != mpal.ra.size())
+		throw "Programming error";
+	if (indices.empty()) {
+		for (size_t i = 0; i < mpal.la.size(); ++i) {
+			auto d = eval_grp(tokens, mpal, i);
+			if (d.type == token_type::none)
+				return -1;
+		}
+	} else {
+		for (auto i : indices) {
+			if (i >= mpal.la.size())
+				continue;
+			auto d = eval_grp(tokens, mpal, i);
+			if (d.type == token_type::none)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Set up the colorspace state. babl_init must have been called.
+ */
+int pallib::palcomp_init()
+{
+	xyz_to_lrgb_matrix = make_lrgb_matrix(to_xyz(illuminant_d(6500)));
+	srgb888_space = babl_format_with_space("R'G'B' u8", babl_space("sRGB"));
+	if (srgb888_space == nullptr) {
+		fprintf(stderr, "BABL does not know sRGB888\n");
+		return -1;
+	}
+	srgb_space = babl_format_with_space("R'G'B' double", babl_space("sRGB"));
+	if (srgb_space == nullptr) {
+		fprintf(stderr, "BABL does not know sRGB\n");
+		return -1;
+	}
+	lch_space = babl_format_with_space("CIE LCH(ab) double", babl_space("sRGB"));
+	if (lch_space == nullptr) {
+		fprintf(stderr, "BABL does not know LCh\n");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ *	Color conversion, contrast and palette expressions shared by palcomp
+ *	and palcomp-bench
+ */
+#ifndef PALLIB_HPP
+#define PALLIB_HPP 1
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <babl/babl.h>
+#include <Eigen/Core>
+
+namespace pallib {
+
+struct srgb888 { uint8_t r = 0, g = 0, b = 0; };
+struct srgb { double r = 0, g = 0, b = 0; };
+struct lrgb { double r = 0, g = 0, b = 0; };
+struct xy0 { double x = 0, y = 0; }; // CIE1391 xyY colorspace (but without Y) [chromaticity plane]
+struct xyz { double x = 0, y = 0, z = 0; }; // CIE1391 XYZ colorspace [tristimulus]
+struct lch { double l = 0, c = 0, h = 0; };
+struct hsl { double h = 0, s = 0, l = 0; };
+
+/***
+ * Keep multiple numeric representations of the palette, to reduce accumulation
+ * of conversion errors.
+ */
+struct mpalette {
+	std::vector<srgb888> ra;
+	std::vector<lch> la;
+	double x = 0, y = 0, z = 0;
+
+	void mod_la();
+	void mod_ra();
+};
+
+/**
+ * Statistics for one grid view (e.g. 8x8 / 16x8 / ...).
+ *
+ * @pairs:      pairs that have contributed to @sum
+ * @penalized:  number of penalized pairs
+ * @sum:        sum of deltas
+ * @avg:        @sum divided by @pairs
+ * @adj_sum:    @sum adjusted for penalized pairs
+ * @adj_avg:    adjusted average
+ */
+struct gvstat {
+	unsigned int pairs = 0, penalized = 0;
+	double sum = 0, avg = 0, adj_sum = 0, adj_avg = 0;
+};
+
+struct palstat {
+	public:
+	bool (*penalize)(double) = nullptr;
+	double delta[16][16]{};
+	gvstat x1616{}, x816{}, x88{};
+
+	void compute_sums();
+
+	protected:
+	void compute_sums(unsigned int xlim, unsigned int ylim, gvstat &);
+};
+
+/* This function only makes sense for white */
+constexpr xyz to_xyz(const xy0 &e)
+{
+	return {e.x / e.y, 1, (1 - e.x - e.y) / e.y};
+}
+
+/**
+ * Cf. https://en.wikipedia.org/wiki/Standard_illuminant#Computation
+ *
+ * @t: black-body temperature in Kelvin (e.g. 5000, 5500, 6500)
+ */
+constexpr xy0 illuminant_d(double t)
+{
+	double x = t <= 7000 ?
+	           0.244063 + 0.09911 * 1000 / t + 2.9678 * 1000000 / (t * t) -
+	           4.6070 * 1000000000 / (t * t * t) :
+	           0.237040 + 0.24748 * 1000 / t + 1.9018 * 1000000 / (t * t) -
+	           2.0064 * 1000000000 / (t * t * t);
+	return {x, -3.0 * x * x + 2.87 * x - 0.275};
+}
+
+/* Registers that palette expressions can refer to */
+static constexpr char EVAL_REGS[] = "bcghlrsxyz";
+
+/*
+ * @g_continuous_gamma:	if non-zero, gamma_expand uses this plain power curve
+ * 			instead of the sRGB one
+ * @xyz_to_lrgb_matrix:	white point adaptation for trivial_lightness
+ * The babl formats and the matrix are set up by palcomp_init.
+ */
+extern double g_continuous_gamma;
+extern const Babl *lch_space, *srgb_space, *srgb888_space;
+extern Eigen::Matrix3d xyz_to_lrgb_matrix;
+
+extern int palcomp_init();
+extern hsl to_hsl(const srgb &);
+extern srgb to_srgb(const hsl &);
+extern srgb to_srgb(const srgb888 &);
+extern srgb888 to_srgb888(const srgb &);
+extern srgb888 to_srgb888(const lch &);
+extern std::vector<srgb888> to_srgb888(const std::vector<lch> &);
+extern lch to_lch(const srgb888 &);
+extern lch to_lch(const srgb &);
+extern std::vector<lch> to_lch(const std::vector<srgb888> &);
+extern double gamma_expand(double);
+extern double gamma_compress(double);
+extern lrgb to_lrgb(const srgb &);
+extern double trivial_lightness(const lrgb &);
+extern Eigen::Matrix3d make_lrgb_matrix(const xyz &white_raw);
+extern double apca_contrast(double ytx, double ybg);
+extern palstat cxl_compute(const std::vector<lch> &);
+extern palstat cxa_compute(const std::vector<srgb888> &, double scale = 1);
+extern int do_eval(const char *cmd, mpalette &, const std::vector<size_t> &indices = {}, bool verbose = false);
+
+} /* namespace pallib */
+
+#endif /* PALLIB_HPP */
@@ -0,0 +1,739 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ *	Microbenchmarks for the glyph and font routines of vfalib
+ */
+#include "config.h"
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <libHX/defs.h>
+#include <libHX/io.h>
+#include <libHX/option.h>
+#include "bench.hpp"
+#include "cpuisa.hpp"
+#include "vfalib.hpp"
+
+using namespace vfalib;
+
+static unsigned int g_compare, g_counters, g_json, g_nglyphs = 512, g_reps = 25, g_warmup = 3;
+static char *g_input, *g_kernels, *g_sizes;
+static constexpr HXoption g_options_table[] = {
+	{"kernels", 0, HXTYPE_STRING, &g_kernels, {}, {}, {}, "Vector kernels to use: auto, scalar, sse2, ssse3, avx2, avx512", "ISA"},
+	{{}, 'c', HXTYPE_NONE, &g_compare, {}, {}, {}, "Also run the scalar reference kernels and verify results"},
+	{{}, 'g', HXTYPE_UINT, &g_nglyphs, {}, {}, {}, "Glyphs per synthetic font (default: 512)", "N"},
+	{{}, 'i', HXTYPE_STRING, &g_input, {}, {}, {}, "Also run the vector suite over the glyphs of this font", "FILE"},
+	{{}, 'j', HXTYPE_NONE, &g_json, {}, {}, {}, "Emit results as JSON"},
+	{{}, 'n', HXTYPE_UINT, &g_reps, {}, {}, {}, "Timed repetitions (default: 25)", "N"},
+	{{}, 'P', HXTYPE_NONE, &g_counters, {}, {}, {}, "Also report hardware performance counters"},
+	{{}, 's', HXTYPE_STRING, &g_sizes, {}, {}, {}, "Cell sizes (default: 8x8,8x14,8x16,9x16,12x24,16x32,32x64)", "WxH,..."},
+	{{}, 'w', HXTYPE_UINT, &g_warmup, {}, {}, {}, "Untimed warm-up runs (default: 3)", "N"},
+	HXOPT_AUTOHELP,
+	HXOPT_TABLEEND,
+};
+
+namespace {
+
+/*
+ * Reference implementations: straightforward pixel-at-a-time loops that
+ * define the expected output of the vfalib kernels.
+ */
+struct refbit {
+	size_t byte;
+	unsigned char mask;
+	refbit(size_t n) : byte(n / CHAR_BIT), mask(1 << (CHAR_BIT - 1 - n % CHAR_BIT)) {}
+};
+
+static inline bool ref_get(const glyph &g, unsigned int x, unsigned int y)
+{
+	refbit p = y * g.m_size.w + x;
+	return g.m_data[p.byte] & p.mask;
+}
+
+static inline void ref_set(glyph &g, unsigned int x, unsigned int y, bool v)
+{
+	refbit p = y * g.m_size.w + x;
+	if (v)
+		g.m_data[p.byte] |= p.mask;
+	else
+		g.m_data[p.byte] &= ~p.mask;
+}
+
+static glyph ref_flip(const glyph &g, bool fx, bool fy)
+{
+	glyph ng(g.m_size);
+	for (unsigned int y = 0; y < g.m_size.h; ++y)
+		for (unsigned int x = 0; x < g.m_size.w; ++x)
+			ref_set(ng, fx ? g.m_size.w - x - 1 : x,
+			        fy ? g.m_size.h - y - 1 : y, ref_get(g, x, y));
+	return ng;
+}
+
+static glyph ref_upscale(const glyph &g, const vfsize &f)
+{
+	glyph ng(vfsize(g.m_size.w * f.w, g.m_size.h * f.h));
+	for (unsigned int y = 0; y < ng.m_size.h; ++y)
+		for (unsigned int x = 0; x < ng.m_size.w; ++x)
+			ref_set(ng, x, y, ref_get(g, x / f.w, y / f.h));
+	return ng;
+}
+
+static glyph ref_copy_rect_to(const glyph &g, const vfrect &sof,
+    const glyph &other, const vfrect &pof, bool overwrite)
+{
+	glyph out = other;
+	for (unsigned int y = sof.y; y < sof.y + sof.h && y < g.m_size.h; ++y) {
+		for (unsigned int x = sof.x; x < sof.x + sof.w && x < g.m_size.w; ++x) {
+			int ox = pof.x + x - sof.x, oy = pof.y + y - sof.y;
+			if (ox < 0 || oy < 0 || static_cast<unsigned int>(ox) >= pof.w ||
+			    static_cast<unsigned int>(oy) >= pof.h)
+				continue;
+			if (ref_get(g, x, y))
+				ref_set(out, ox, oy, true);
+			else if (overwrite)
+				ref_set(out, ox, oy, false);
+		}
+	}
+	return out;
+}
+
+static glyph ref_overstrike(const glyph &g, unsigned int px)
+{
+	glyph c(g.m_size);
+	for (unsigned int x = 0; x <= px; ++x)
+		c = ref_copy_rect_to(g, vfpos(0, 0) | g.m_size, c, vfpos(x, 0) | g.m_size, false);
+	return c;
+}
+
+static std::string ref_as_rowpad(const glyph &g)
+{
+	auto bpl = (g.m_size.w + 7) / 8;
+	std::string ret(g.m_size.h * bpl, '\0');
+	for (unsigned int y = 0; y < g.m_size.h; ++y)
+		for (unsigned int x = 0; x < g.m_size.w; ++x)
+			if (ref_get(g, x, y))
+				ret[y * bpl + x / 8] |= 0x80 >> (x % 8);
+	return ret;
+}
+
+static glyph ref_create_from_rpad(const vfsize &size, const char *buf)
+{
+	glyph ng(size);
+	auto bpl = (size.w + 7) / 8;
+	for (unsigned int y = 0; y < size.h; ++y)
+		for (unsigned int x = 0; x < size.w; ++x)
+			if (buf[y * bpl + x / 8] & (0x80 >> (x % 8)))
+				ref_set(ng, x, y, true);
+	return ng;
+}
+
+static void ref_lge(glyph &g, unsigned int adj)
+{
+	if (g.m_size.w < adj + 1)
+		return;
+	for (unsigned int y = 0; y < g.m_size.h; ++y)
+		ref_set(g, g.m_size.w - 1, y, ref_get(g, g.m_size.w - 1 - adj, y));
+}
+
+/* Renumbering by a full pass over both sides of the map */
+static void ref_swap_idx(unicode_map &m, unsigned int a, unsigned int b)
+{
+	decltype(m.m_i2u) i2u;
+	for (auto &e : m.m_u2i) {
+		if (e.second == a)
+			e.second = b;
+		else if (e.second == b)
+			e.second = a;
+	}
+	for (auto &e : m.m_i2u)
+		i2u.emplace(e.first == a ? b : e.first == b ? a : e.first, std::move(e.second));
+	m.m_i2u = std::move(i2u);
+}
+
+struct ctx {
+	bench::options opts;
+	bench::reporter *rpt = nullptr;
+	unsigned int failures = 0;
+};
+
+}
+
+template<typename F> static void check(ctx &c, const char *what,
+    const vfsize &sz, const std::vector<glyph> &in, F &&ref_and_cmp)
+{
+	for (size_t i = 0; i < in.size(); ++i) {
+		if (ref_and_cmp(in[i]))
+			continue;
+		fprintf(stderr, "MISMATCH: %s/%s glyph %zu differs from reference\n",
+		        what, bench::sizename(sz).c_str(), i);
+		++c.failures;
+		return;
+	}
+}
+
+/**
+ * Time a per-glyph operation @op over all glyphs of @src, and optionally the
+ * matching reference implementation @ref.
+ */
+template<typename Op, typename Ref> static void glyph_op(ctx &c,
+    const char *what, const vfsize &sz, const std::vector<glyph> &src,
+    Op &&op, Ref &&ref)
+{
+	auto name = std::string(what) + "/" + bench::sizename(sz);
+	c.rpt->emit(bench::run(c.opts, "glyph", name, src.size(), [&]() {
+		for (const auto &g : src)
+			bench::keep(op(g));
+	}));
+	if (!g_compare)
+		return;
+	c.rpt->emit(bench::run(c.opts, "glyph", name + "/ref", src.size(), [&]() {
+		for (const auto &g : src)
+			bench::keep(ref(g));
+	}));
+	check(c, what, sz, src, [&](const glyph &g) {
+		return op(g).m_data == ref(g).m_data;
+	});
+}
+
+static void suite_glyph(ctx &c, const vfsize &sz)
+{
+	auto f = bench::synth_font(sz, g_nglyphs);
+	const auto &src = f.m_glyph;
+	auto full = vfpos() | sz;
+	auto inner = vfpos(1, 1) | vfsize(sz.w > 2 ? sz.w - 2 : 1, sz.h > 2 ? sz.h - 2 : 1);
+	auto big = vfpos() | vfsize(sz.w + 3, sz.h + 5);
+
+	glyph_op(c, "flip_x", sz, src,
+		[](const glyph &g) { return g.flip(true, false); },
+		[](const glyph &g) { return ref_flip(g, true, false); });
+	glyph_op(c, "flip_y", sz, src,
+		[](const glyph &g) { return g.flip(false, true); },
+		[](const glyph &g) { return ref_flip(g, false, true); });
+	glyph_op(c, "flip_xy", sz, src,
+		[](const glyph &g) { return g.flip(true, true); },
+		[](const glyph &g) { return ref_flip(g, true, true); });
+	glyph_op(c, "upscale_2x2", sz, src,
+		[](const glyph &g) { return g.upscale(vfsize(2, 2)); },
+		[](const glyph &g) { return ref_upscale(g, vfsize(2, 2)); });
+	glyph_op(c, "upscale_3x1", sz, src,
+		[](const glyph &g) { return g.upscale(vfsize(3, 1)); },
+		[](const glyph &g) { return ref_upscale(g, vfsize(3, 1)); });
+	glyph_op(c, "crop", sz, src,
+		[&](const glyph &g) { return g.copy_rect_to(inner, glyph(vfpos() | inner), vfpos() | inner); },
+		[&](const glyph &g) { return ref_copy_rect_to(g, inner, glyph(vfpos() | inner), vfpos() | inner, true); });
+	glyph_op(c, "canvas", sz, src,
+		[&](const glyph &g) { return g.copy_rect_to(full, glyph(big), big); },
+		[&](const glyph &g) { return ref_copy_rect_to(g, full, glyph(big), big, true); });
+	glyph_op(c, "move_1_1", sz, src,
+		[&](const glyph &g) { return g.copy_rect_to(full, glyph(sz), vfpos(1, 1) | sz); },
+		[&](const glyph &g) { return ref_copy_rect_to(g, full, glyph(sz), vfpos(1, 1) | sz, true); });
+	glyph_op(c, "blit_or", sz, src,
+		[&](const glyph &g) { return g.copy_rect_to(inner, g, vfpos(0, 0) | sz, false); },
+		[&](const glyph &g) { return ref_copy_rect_to(g, inner, g, vfpos(0, 0) | sz, false); });
+	glyph_op(c, "overstrike_1", sz, src,
+		[](const glyph &g) { return g.overstrike(1); },
+		[](const glyph &g) { return ref_overstrike(g, 1); });
+	glyph_op(c, "lge", sz, src,
+		[](const glyph &g) { auto n = g; n.lge(); return n; },
+		[](const glyph &g) { auto n = g; ref_lge(n, 1); return n; });
+	glyph_op(c, "lge_2", sz, src,
+		[](const glyph &g) { auto n = g; n.lge(2); return n; },
+		[](const glyph &g) { auto n = g; ref_lge(n, 2); return n; });
+
+	/* Conversions to and from the row-padded layout */
+	auto name = "as_rowpad/" + bench::sizename(sz);
+	c.rpt->emit(bench::run(c.opts, "glyph", name, src.size(), [&]() {
+		for (const auto &g : src)
+			bench::keep(g.as_rowpad());
+	}));
+	if (g_compare) {
+		c.rpt->emit(bench::run(c.opts, "glyph", name + "/ref", src.size(), [&]() {
+			for (const auto &g : src)
+				bench::keep(ref_as_rowpad(g));
+		}));
+		check(c, "as_rowpad", sz, src, [](const glyph &g) {
+			return g.as_rowpad() == ref_as_rowpad(g);
+		});
+	}
+
+	std::vector<std::string> rpad;
+	for (const auto &g : src)
+		rpad.push_back(g.as_rowpad());
+	name = "create_from_rpad/" + bench::sizename(sz);
+	c.rpt->emit(bench::run(c.opts, "glyph", name, rpad.size(), [&]() {
+		for (const auto &r : rpad)
+			bench::keep(glyph::create_from_rpad(sz, r.c_str(), r.size()));
+	}));
+	if (g_compare) {
+		c.rpt->emit(bench::run(c.opts, "glyph", name + "/ref", rpad.size(), [&]() {
+			for (const auto &r : rpad)
+				bench::keep(ref_create_from_rpad(sz, r.c_str()));
+		}));
+		for (size_t i = 0; i < rpad.size(); ++i) {
+			if (glyph::create_from_rpad(sz, rpad[i].c_str(), rpad[i].size()).m_data ==
+			    ref_create_from_rpad(sz, rpad[i].c_str()).m_data)
+				continue;
+			fprintf(stderr, "MISMATCH: create_from_rpad/%s glyph %zu differs from reference\n",
+			        bench::sizename(sz).c_str(), i);
+			++c.failures;
+			break;
+		}
+	}
+}
+
+/**
+ * Font-level transforms, as invoked by the vfontas commands. The font is
+ * copied (untimed) before every repetition since the operations are in-place.
+ */
+template<typename Op> static void font_op(ctx &c, const char *what,
+    const font &orig, Op &&op)
+{
+	font f;
+	auto name = std::string(what) + "/" + bench::sizename(orig.m_glyph[0].m_size);
+	c.rpt->emit(bench::run(c.opts, "font", name, orig.m_glyph.size(),
+		[&]() { f = orig; }, [&]() { op(f); bench::keep(f); }));
+}
+
+/**
+ * unicode_map::swap_idx against ref_swap_idx on small random maps built with
+ * add_i2u, which leaves a reassigned codepoint listed under its old index
+ * too, so that codepoints shared between the swapped indices come up often.
+ */
+static void check_swap_idx(ctx &c)
+{
+	std::mt19937 rng(0x5a4);
+	for (unsigned int iter = 0; iter < 10000; ++iter) {
+		unicode_map m;
+		auto nidx = 2 + rng() % 6;
+		for (unsigned int i = rng() % 16; i > 0; --i)
+			m.add_i2u(rng() % nidx, 0x40 + rng() % 8);
+		unsigned int a = rng() % nidx, b = rng() % nidx;
+		auto r = m;
+		m.swap_idx(a, b);
+		ref_swap_idx(r, a, b);
+		if (m.m_u2i == r.m_u2i && m.m_i2u == r.m_i2u)
+			continue;
+		fprintf(stderr, "MISMATCH: swap_idx(%u, %u) differs from reference (map %u)\n", a, b, iter);
+		++c.failures;
+		return;
+	}
+}
+
+static void suite_font(ctx &c, const vfsize &sz)
+{
+	static bool map_checked;
+	if (g_compare && !map_checked) {
+		check_swap_idx(c);
+		map_checked = true;
+	}
+	auto orig = bench::synth_font(sz, g_nglyphs);
+	auto full = vfpos() | sz;
+	font_op(c, "fliph", orig, [](font &f) { f.flip(true, false); });
+	font_op(c, "flipv", orig, [](font &f) { f.flip(false, true); });
+	font_op(c, "upscale_2x2", orig, [](font &f) { f.upscale(vfsize(2, 2)); });
+	font_op(c, "canvas", orig, [&](font &f) {
+		f.copy_to_blank(full, vfpos() | vfsize(sz.w + 1, sz.h + 2));
+	});
+	font_op(c, "crop", orig, [&](font &f) {
+		f.copy_to_blank(vfpos(1, 1) | sz, vfpos() | vfsize(sz.w / 2 + 1, sz.h / 2 + 1));
+	});
+	font_op(c, "xlat", orig, [&](font &f) { f.copy_to_blank(full, vfpos(1, -1) | sz); });
+	font_op(c, "invert", orig, [](font &f) { f.invert(); });
+	font_op(c, "overstrike_1", orig, [](font &f) { f.overstrike(1); });
+	font_op(c, "lge", orig, [](font &f) { f.lge(); });
+	font_op(c, "lger_all", orig, [](font &f) { f.lge(0, 0x10FFFF, 1); });
+}
+
+/**
+ * Size of a file, or the summed size of the files in a directory.
+ */
+static size_t path_size(const std::string &path)
+{
+	struct stat sb;
+	if (stat(path.c_str(), &sb) < 0)
+		return 0;
+	if (!S_ISDIR(sb.st_mode))
+		return sb.st_size;
+	struct HXdir *d = HXdir_open(path.c_str());
+	if (d == nullptr)
+		return 0;
+	size_t total = 0;
+	const char *de;
+	while ((de = HXdir_read(d)) != nullptr)
+		if (*de != '.' && stat((path + "/" + de).c_str(), &sb) == 0)
+			total += sb.st_size;
+	HXdir_close(d);
+	return total;
+}
+
+/**
+ * Time one loader over @file. Fails the run if the loader reports an error or
+ * produces a different number of glyphs than were generated.
+ */
+template<typename L> static void load_stage(ctx &c, const char *what,
+    const vfsize &sz, const std::string &file, size_t nglyphs, L &&load,
+    bool count_glyphs = true)
+{
+	font f;
+	int ret = 0;
+	auto r = bench::run(c.opts, "pipeline", std::string(what) + "/" + bench::sizename(sz),
+	         nglyphs, [&]() { f = font(); }, [&]() { ret = load(f, file.c_str()); });
+	r.bytes = path_size(file);
+	if (ret < 0) {
+		fprintf(stderr, "%s %s: %s\n", what, file.c_str(), strerror(-ret));
+		++c.failures;
+		return;
+	}
+	if (count_glyphs && f.m_glyph.size() != nglyphs) {
+		fprintf(stderr, "%s %s: got %zu glyphs, expected %zu\n", what,
+		        file.c_str(), f.m_glyph.size(), nglyphs);
+		++c.failures;
+	}
+	c.rpt->emit(r);
+}
+
+/**
+ * Time one saver. The output size, measured after the run, is reported as
+ * the byte count.
+ */
+template<typename S> static void save_stage(ctx &c, const char *what,
+    const vfsize &sz, font &f, const std::string &out, S &&save)
+{
+	int ret = 0;
+	auto r = bench::run(c.opts, "pipeline", std::string(what) + "/" + bench::sizename(sz),
+	         f.m_glyph.size(), [&]() { ret = save(f, out.c_str()); });
+	if (ret < 0) {
+		fprintf(stderr, "%s %s: %s\n", what, out.c_str(), strerror(-ret));
+		++c.failures;
+		return;
+	}
+	r.bytes = path_size(out);
+	c.rpt->emit(r);
+}
+
+/* File name -> contents of every file in @path */
+static std::map<std::string, std::string> dir_contents(const std::string &path)
+{
+	std::map<std::string, std::string> out;
+	struct HXdir *d = HXdir_open(path.c_str());
+	if (d == nullptr)
+		return out;
+	async_io io(AIO_SYNC);
+	const char *de;
+	while ((de = HXdir_read(d)) != nullptr) {
+		std::string data;
+		if (*de != '.' && io.fetch(io.prefetch(path + "/" + de), data) == 0)
+			out.emplace(de, std::move(data));
+	}
+	HXdir_close(d);
+	return out;
+}
+
+/**
+ * syncclt into an empty directory must produce what saveclt does, also for
+ * codepoints that the map lists under more than one glyph.
+ */
+static void check_sync_clt(ctx &c, const vfsize &sz, const font &orig, const std::string &dir)
+{
+	font f = orig;
+	f.m_unicode_map = std::make_shared<unicode_map>();
+	for (size_t i = 0; i < f.m_glyph.size(); ++i) {
+		f.m_unicode_map->add_i2u(i, 0x100 + i);
+		if (i % 7 == 1)
+			f.m_unicode_map->add_i2u(i, 0x100 + i - 1);
+	}
+	auto a = dir + "/chk-save", b = dir + "/chk-sync";
+	sync_stats st;
+	int ret = mkdir(a.c_str(), S_IRWXUGO) == 0 && mkdir(b.c_str(), S_IRWXUGO) == 0 ? 0 : -errno;
+	if (ret == 0)
+		ret = f.save_clt(a.c_str());
+	if (ret >= 0)
+		ret = f.sync_clt(b.c_str(), st);
+	if (ret < 0) {
+		fprintf(stderr, "syncclt check/%s: %s\n", bench::sizename(sz).c_str(), strerror(-ret));
+		++c.failures;
+		return;
+	}
+	if (dir_contents(a) == dir_contents(b))
+		return;
+	fprintf(stderr, "MISMATCH: syncclt/%s differs from saveclt\n", bench::sizename(sz).c_str());
+	++c.failures;
+}
+
+/**
+ * End-to-end vfontas stages over a generated corpus: load each input format,
+ * run a few transforms, and save to each output format.
+ */
+static void suite_pipeline(ctx &c, const vfsize &sz)
+{
+	char tmpl[] = "/tmp/vfa-bench.XXXXXX";
+	if (mkdtemp(tmpl) == nullptr) {
+		fprintf(stderr, "mkdtemp: %s\n", strerror(errno));
+		++c.failures;
+		return;
+	}
+	std::string dir = tmpl, stem = dir + "/in";
+	auto orig = bench::synth_font(sz, g_nglyphs);
+	auto n = orig.m_glyph.size();
+	auto ret = bench::generate(orig, stem, bench::GEN_ALL);
+	if (ret < 0) {
+		fprintf(stderr, "generate %s: %s\n", stem.c_str(), strerror(-ret));
+		++c.failures;
+		HX_rrmdir(dir.c_str());
+		return;
+	}
+
+	load_stage(c, "loadbdf", sz, stem + ".bdf", n,
+		[](font &f, const char *p) { return f.load_bdf(p); });
+	load_stage(c, "loadpsf", sz, stem + ".psf", n,
+		[](font &f, const char *p) { return f.load_psf(p); });
+	load_stage(c, "loadraw", sz, stem + ".fnt", n,
+		[&](font &f, const char *p) { return f.load_fnt(p, sz.w, sz.h); });
+	bool hexable = bench::hexable(sz);
+	if (hexable)
+		load_stage(c, "loadhex", sz, stem + ".hex", n,
+			[](font &f, const char *p) { return f.load_hex(p); });
+	load_stage(c, "loadclt", sz, stem + ".clt", n,
+		[](font &f, const char *p) { return f.load_clt(p); });
+	/*
+	 * load_pcf only parses the tables and does not produce glyphs yet.
+	 */
+	load_stage(c, "loadpcf", sz, stem + ".pcf", n,
+		[](font &f, const char *p) { return f.load_pcf(p); }, false);
+
+	font f;
+	auto full = vfpos() | sz;
+	auto xform = [&](const char *what, auto &&op) {
+		c.rpt->emit(bench::run(c.opts, "pipeline",
+			std::string(what) + "/" + bench::sizename(sz), n,
+			[&]() { f = orig; }, [&]() { op(f); bench::keep(f); }));
+	};
+	xform("fliph", [](font &x) { x.flip(true, false); });
+	xform("flipv", [](font &x) { x.flip(false, true); });
+	xform("overstrike", [](font &x) { x.overstrike(1); });
+	xform("xlat", [&](font &x) { x.copy_to_blank(full, vfpos(1, -1) | sz); });
+
+	f = orig;
+	auto out = dir + "/out";
+	save_stage(c, "savebdf", sz, f, out + ".bdf",
+		[](font &x, const char *p) { return x.save_bdf(p); });
+	save_stage(c, "savepsf", sz, f, out + ".psf",
+		[](font &x, const char *p) { return x.save_psf(p); });
+	save_stage(c, "saveraw", sz, f, out + ".fnt",
+		[](font &x, const char *p) { return x.save_fnt(p); });
+	if (hexable)
+		save_stage(c, "savehex", sz, f, out + ".hex",
+			[](font &x, const char *p) { return x.save_hex(p); });
+	save_stage(c, "savemap", sz, f, out + ".map",
+		[](font &x, const char *p) { return x.save_map(p); });
+	if (mkdir((out + ".clt").c_str(), S_IRWXUGO) == 0)
+		save_stage(c, "saveclt", sz, f, out + ".clt",
+			[](font &x, const char *p) { return x.save_clt(p); });
+	if (g_compare)
+		check_sync_clt(c, sz, orig, dir);
+	HX_rrmdir(dir.c_str());
+}
+
+/**
+ * Whole-file writes and reads of one small file per glyph through each
+ * async_io backend; the read-back is compared with what was written.
+ */
+static void suite_io(ctx &c, const vfsize &sz)
+{
+	char tmpl[] = "/tmp/vfa-bench.XXXXXX";
+	if (mkdtemp(tmpl) == nullptr) {
+		fprintf(stderr, "mkdtemp: %s\n", strerror(errno));
+		++c.failures;
+		return;
+	}
+	std::string dir = tmpl;
+	auto f = bench::synth_font(sz, g_nglyphs);
+	std::vector<std::string> names, data;
+	size_t bytes = 0;
+	for (size_t i = 0; i < f.m_glyph.size(); ++i) {
+		char name[24];
+		snprintf(name, sizeof(name), "/%04zx.txt", i);
+		names.push_back(dir + name);
+		data.push_back(f.m_glyph[i].as_pclt());
+		bytes += data.back().size();
+	}
+	static const struct {
+		const char *name;
+		enum aio_backend kind;
+	} backends[] = {
+		{"sync", AIO_SYNC}, {"threads", AIO_THREADS}, {"uring", AIO_URING},
+	};
+	for (const auto &b : backends) {
+		if (async_io(b.kind).backend() != b.kind) {
+			fprintf(stderr, "io: %s backend not available, skipped\n", b.name);
+			continue;
+		}
+		int ret = 0;
+		auto r = bench::run(c.opts, "io", std::string("write/") + b.name + "/" +
+		         bench::sizename(sz), names.size(), [&]() {
+			async_io io(b.kind);
+			for (size_t i = 0; i < names.size(); ++i)
+				io.write_ref(names[i], data[i].data(), data[i].size());
+			ret = io.flush();
+		});
+		r.bytes = bytes;
+		c.rpt->emit(r);
+		if (ret < 0) {
+			fprintf(stderr, "io write/%s: %s\n", b.name, strerror(-ret));
+			++c.failures;
+			continue;
+		}
+		size_t bad = 0;
+		r = bench::run(c.opts, "io", std::string("read/") + b.name + "/" +
+		    bench::sizename(sz), names.size(), [&]() {
+			async_io io(b.kind);
+			std::vector<size_t> tk;
+			for (const auto &n : names)
+				tk.push_back(io.prefetch(n));
+			std::string buf;
+			bad = 0;
+			for (size_t i = 0; i < tk.size(); ++i)
+				if (io.fetch(tk[i], buf) < 0 || buf != data[i])
+					++bad;
+		});
+		r.bytes = bytes;
+		c.rpt->emit(r);
+		if (bad > 0) {
+			fprintf(stderr, "io read/%s: %zu files differ\n", b.name, bad);
+			++c.failures;
+		}
+	}
+	HX_rrmdir(dir.c_str());
+}
+
+static const struct {
+	const char *name;
+	enum vectoalg alg;
+} vecto_algs[] = {
+	{"simple", V_SIMPLE}, {"n1", V_N1}, {"n2", V_N2}, {"n2ev", V_N2EV},
+};
+
+/**
+ * Run every vectorizer at ssf 1/1, 2/2 and 4/4 over @src. Besides the
+ * timings, the edges fed into overlap removal and the resulting points and
+ * contours are reported per glyph.
+ */
+static void vector_set(ctx &c, const std::string &label,
+    const std::vector<glyph> &src)
+{
+	for (const auto &a : vecto_algs) {
+		for (int ssf : {1, 2, 4}) {
+			auto name = std::string(a.name) + "/ssf" + std::to_string(ssf) + "/" + label;
+			auto r = bench::run(c.opts, "vector", name, src.size(), [&]() {
+				for (const auto &g : src)
+					bench::keep(vectorize(g, a.alg, 0, 2 * ssf, 2 * ssf));
+			});
+			size_t edges = 0, points = 0, contours = 0;
+			for (const auto &g : src) {
+				auto pmap = vectorize(g, a.alg, 0, 2 * ssf, 2 * ssf, &edges);
+				contours += pmap.size();
+				for (const auto &poly : pmap)
+					points += poly.size();
+			}
+			double n = src.size();
+			r.extra = {{"edges_per_glyph", edges / n},
+			          {"points_per_glyph", points / n},
+			          {"contours_per_glyph", contours / n}};
+			c.rpt->emit(r);
+		}
+	}
+}
+
+static void suite_vector(ctx &c, const vfsize &sz)
+{
+	vector_set(c, bench::sizename(sz), bench::synth_font(sz, g_nglyphs).m_glyph);
+}
+
+/**
+ * Vectorize a real font, grouped by glyph size.
+ */
+static void suite_vector_input(ctx &c, const char *file)
+{
+	font f;
+	auto ret = f.load_any(file);
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s\n", file, strerror(-ret));
+		++c.failures;
+		return;
+	}
+	std::map<std::pair<unsigned int, unsigned int>, std::vector<glyph>> bysize;
+	for (const auto &g : f.m_glyph)
+		bysize[{g.m_size.w, g.m_size.h}].push_back(g);
+	for (const auto &pair : bysize)
+		vector_set(c, "input-" + bench::sizename(pair.second[0].m_size), pair.second);
+}
+
+int main(int argc, char **argv)
+{
+	if (HX_getopt5(g_options_table, argv, &argc, &argv,
+	    HXOPT_USAGEONERR) != HXOPT_ERR_SUCCESS)
+		return EXIT_FAILURE;
+	if (g_kernels != nullptr) {
+		auto ret = isa_select(g_kernels);
+		if (ret < 0) {
+			fprintf(stderr, "--kernels=%s: %s\n", g_kernels, strerror(-ret));
+			return EXIT_FAILURE;
+		}
+	}
+	auto sizes = bench::parse_sizes(g_sizes != nullptr ? g_sizes :
+	             "8x8,8x14,8x16,9x16,12x24,16x32,32x64");
+	if (sizes.empty() || g_nglyphs == 0) {
+		fprintf(stderr, "Nothing to do.\n");
+		return EXIT_FAILURE;
+	}
+	ctx c;
+	c.opts.warmup = g_warmup;
+	c.opts.reps   = g_reps > 0 ? g_reps : 1;
+	c.opts.json   = g_json;
+	std::unique_ptr<bench::pmu> pmu;
+	if (g_counters) {
+		pmu = std::make_unique<bench::pmu>();
+		if (pmu->available())
+			c.opts.counters = pmu.get();
+	}
+	bench::reporter rpt(c.opts);
+	c.rpt = &rpt;
+
+	std::vector<std::string> suites;
+	for (int i = 1; i < argc; ++i)
+		suites.emplace_back(argv[i]);
+	if (suites.empty())
+		suites = {"glyph", "font"};
+	for (const auto &s : suites) {
+		void (*func)(ctx &, const vfsize &) = nullptr;
+		if (s == "glyph")
+			func = suite_glyph;
+		else if (s == "font")
+			func = suite_font;
+		else if (s == "pipeline")
+			func = suite_pipeline;
+		else if (s == "vector")
+			func = suite_vector;
+		else if (s == "io")
+			func = suite_io;
+		if (func == nullptr) {
+			fprintf(stderr, "Unknown suite \"%s\"\n", s.c_str());
+			return EXIT_FAILURE;
+		}
+		for (const auto &sz : sizes)
+			func(c, sz);
+		if (s == "vector" && g_input != nullptr)
+			suite_vector_input(c, g_input);
+	}
+	rpt.finish();
+	return c.failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ *	Generator for deterministic synthetic font corpora
+ */
+#include "config.h"
+#include <string>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <libHX/defs.h>
+#include <libHX/option.h>
+#include "bench.hpp"
+#include "vfalib.hpp"
+
+using namespace vfalib;
+
+static unsigned int g_nglyphs = 65536, g_seed = 1;
+static char *g_formats, *g_outdir, *g_sizes;
+static constexpr HXoption g_options_table[] = {
+	{{}, 'f', HXTYPE_STRING, &g_formats, {}, {}, {}, "Formats to write (default: all)", "bdf,clt,fnt,hex,pcf,psf"},
+	{{}, 'g', HXTYPE_UINT, &g_nglyphs, {}, {}, {}, "Glyphs per font (default: 65536)", "N"},
+	{{}, 'o', HXTYPE_STRING, &g_outdir, {}, {}, {}, "Output directory (default: .)", "DIR"},
+	{{}, 'S', HXTYPE_UINT, &g_seed, {}, {}, {}, "Seed for the pixel generator (default: 1)", "N"},
+	{{}, 's', HXTYPE_STRING, &g_sizes, {}, {}, {}, "Cell sizes (default: 8x16,16x16)", "WxH,..."},
+	HXOPT_AUTOHELP,
+	HXOPT_TABLEEND,
+};
+
+int main(int argc, char **argv)
+{
+	if (HX_getopt5(g_options_table, argv, &argc, &argv,
+	    HXOPT_USAGEONERR) != HXOPT_ERR_SUCCESS)
+		return EXIT_FAILURE;
+	auto formats = bench::parse_formats(g_formats != nullptr ? g_formats : "all");
+	auto sizes = bench::parse_sizes(g_sizes != nullptr ? g_sizes : "8x16,16x16");
+	if (formats == 0 || sizes.empty() || g_nglyphs == 0) {
+		fprintf(stderr, "Nothing to do.\n");
+		return EXIT_FAILURE;
+	}
+	std::string outdir = g_outdir != nullptr ? g_outdir : ".";
+	if (mkdir(outdir.c_str(), S_IRWXUGO) < 0 && errno != EEXIST) {
+		fprintf(stderr, "mkdir %s: %s\n", outdir.c_str(), strerror(errno));
+		return EXIT_FAILURE;
+	}
+	for (const auto &sz : sizes) {
+		auto stem = outdir + "/synth-" + bench::sizename(sz);
+		auto f = bench::synth_font(sz, g_nglyphs, g_seed);
+		auto ret = bench::generate(f, stem, formats);
+		if (ret < 0) {
+			fprintf(stderr, "Error writing %s.*: %s\n", stem.c_str(), strerror(-ret));
+			return EXIT_FAILURE;
+		}
+		printf("%s.*: %u glyphs of %s\n", stem.c_str(), g_nglyphs,
+		       bench::sizename(sz).c_str());
+	}
+	return EXIT_SUCCESS;
+}
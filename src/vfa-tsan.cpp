@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ *	Concurrency check for vfalib; built with -fsanitize=thread
+ */
+#include "config.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <libHX/defs.h>
+#include <libHX/io.h>
+#include <libHX/option.h>
+#include "bench.hpp"
+#include "vfalib.hpp"
+
+using namespace vfalib;
+
+static unsigned int g_nglyphs = 64, g_rounds = 1, g_threads = 8;
+static char *g_vfontas;
+static constexpr HXoption g_options_table[] = {
+	{{}, 'g', HXTYPE_UINT, &g_nglyphs, {}, {}, {}, "Glyphs per synthetic font (default: 64)", "N"},
+	{{}, 'r', HXTYPE_UINT, &g_rounds, {}, {}, {}, "Copies of each job per thread (default: 1)", "N"},
+	{{}, 't', HXTYPE_UINT, &g_threads, {}, {}, {}, "Worker threads (default: 8)", "N"},
+	{{}, 'x', HXTYPE_STRING, &g_vfontas, {}, {}, {}, "vfontas to run -xcpi with (default: ./vfontas-tsan; empty: skip)", "PATH"},
+	HXOPT_AUTOHELP,
+	HXOPT_TABLEEND,
+};
+
+namespace {
+
+/* One input font, read back through one loader */
+struct job {
+	std::string stem, tag, loader;
+	vfsize size;
+};
+
+}
+
+/* Named fonts, so that the savers do not print their naming hints */
+static void set_names(font &f, const std::string &name)
+{
+	for (const char *key : {"FontName", "FamilyName", "FullName"})
+		f.props[key] = name;
+}
+
+/**
+ * Load, transform and save one font into @outdir/@j.tag.*. The PCF loader
+ * only parses the tables, so it is run for its own sake next to the others.
+ */
+static int run_job(const job &j, const std::string &outdir)
+{
+	font p;
+	auto ret = p.load_pcf((j.stem + ".pcf").c_str());
+	if (ret < 0)
+		return ret;
+	font f;
+	ret = f.load_any((j.stem + "." + j.loader).c_str());
+	if (ret < 0)
+		return ret;
+	auto full = vfpos() | j.size;
+	f.flip(true, false);
+	f.overstrike(1);
+	f.copy_to_blank(full, vfpos(1, -1) | j.size);
+	f.lge();
+	f.reorder();
+	set_names(f, "vfa-tsan-" + j.tag);
+	f.props["ssf"] = "3/2";
+	auto out = outdir + "/" + j.tag;
+	ret = f.save_bdf((out + ".bdf").c_str());
+	if (ret >= 0)
+		ret = f.save_sfd((out + ".sfd").c_str(), V_N2);
+	if (ret >= 0 && bench::hexable(j.size))
+		ret = f.save_hex((out + ".hex").c_str());
+	if (ret >= 0) {
+		auto dir = out + ".clt";
+		ret = mkdir(dir.c_str(), S_IRWXUGO) == 0 ? f.save_clt(dir.c_str()) : -errno;
+	}
+	return ret;
+}
+
+/* Relative path -> contents of every file below @path */
+static void tree_contents(const std::string &path, const std::string &rel,
+    std::map<std::string, std::string> &out)
+{
+	struct HXdir *d = HXdir_open(path.c_str());
+	if (d == nullptr)
+		return;
+	async_io io(AIO_SYNC);
+	const char *de;
+	while ((de = HXdir_read(d)) != nullptr) {
+		if (*de == '.')
+			continue;
+		auto sub = path + "/" + de;
+		struct stat sb;
+		if (stat(sub.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode)) {
+			tree_contents(sub, rel + de + "/", out);
+			continue;
+		}
+		std::string data;
+		if (io.fetch(io.prefetch(sub), data) == 0)
+			out.emplace(rel + de, std::move(data));
+	}
+	HXdir_close(d);
+}
+
+static std::map<std::string, std::string> tree_contents(const std::string &path)
+{
+	std::map<std::string, std::string> out;
+	tree_contents(path, "", out);
+	return out;
+}
+
+/**
+ * Run the jobs once on one thread for reference output, then @g_rounds
+ * times per thread all at once; every concurrent copy must match.
+ */
+static unsigned int check_pipeline(const std::vector<job> &jobs, const std::string &dir)
+{
+	unsigned int failures = 0;
+	auto refdir = dir + "/ref";
+	if (mkdir(refdir.c_str(), S_IRWXUGO) < 0) {
+		fprintf(stderr, "mkdir %s: %s\n", refdir.c_str(), strerror(errno));
+		return 1;
+	}
+	for (const auto &j : jobs) {
+		auto ret = run_job(j, refdir);
+		if (ret < 0) {
+			fprintf(stderr, "%s: %s\n", j.tag.c_str(), strerror(-ret));
+			++failures;
+		}
+	}
+	if (failures > 0)
+		return failures;
+	auto expect = tree_contents(refdir);
+
+	auto ncopies = g_threads * g_rounds;
+	std::vector<std::string> outdirs(ncopies);
+	for (size_t k = 0; k < ncopies; ++k) {
+		outdirs[k] = dir + "/t" + std::to_string(k);
+		if (mkdir(outdirs[k].c_str(), S_IRWXUGO) < 0) {
+			fprintf(stderr, "mkdir %s: %s\n", outdirs[k].c_str(), strerror(errno));
+			return 1;
+		}
+	}
+	std::vector<int> result(ncopies * jobs.size());
+	parallel_for(result.size(), [&](size_t i) {
+		result[i] = run_job(jobs[i % jobs.size()], outdirs[i / jobs.size()]);
+	}, g_threads);
+	for (size_t i = 0; i < result.size(); ++i) {
+		if (result[i] >= 0)
+			continue;
+		fprintf(stderr, "%s (copy %zu): %s\n", jobs[i % jobs.size()].tag.c_str(),
+		        i / jobs.size(), strerror(-result[i]));
+		++failures;
+	}
+	for (const auto &d : outdirs) {
+		if (tree_contents(d) == expect)
+			continue;
+		fprintf(stderr, "MISMATCH: %s differs from %s\n", d.c_str(), refdir.c_str());
+		++failures;
+	}
+	return failures;
+}
+
+/**
+ * All threads save one shared font: the savers must only read it, even
+ * where they consult props.
+ */
+static unsigned int check_shared(const font &orig, const std::string &dir)
+{
+	font f = orig;
+	set_names(f, "vfa-tsan-shared");
+	f.props["ssf"] = "1/2";
+	auto outdir = dir + "/shared";
+	if (mkdir(outdir.c_str(), S_IRWXUGO) < 0) {
+		fprintf(stderr, "mkdir %s: %s\n", outdir.c_str(), strerror(errno));
+		return 1;
+	}
+	std::vector<int> result(g_threads * g_rounds);
+	parallel_for(result.size(), [&](size_t i) {
+		auto out = outdir + "/" + std::to_string(i);
+		result[i] = f.save_sfd((out + ".sfd").c_str(), V_N1);
+		if (result[i] >= 0)
+			result[i] = f.save_bdf((out + ".bdf").c_str());
+	}, g_threads);
+	unsigned int failures = 0;
+	for (size_t i = 0; i < result.size(); ++i) {
+		if (result[i] >= 0)
+			continue;
+		fprintf(stderr, "shared save %zu: %s\n", i, strerror(-result[i]));
+		++failures;
+	}
+	auto got = tree_contents(outdir);
+	for (size_t i = 1; i < result.size(); ++i)
+		for (const char *ext : {".sfd", ".bdf"})
+			if (got[std::to_string(i) + ext] != got[std::string("0") + ext]) {
+				fprintf(stderr, "MISMATCH: shared/%zu%s differs from copy 0\n", i, ext);
+				++failures;
+			}
+	return failures;
+}
+
+static int spawn_wait(const std::vector<std::string> &args)
+{
+	std::vector<char *> argv;
+	for (const auto &a : args)
+		argv.push_back(const_cast<char *>(a.c_str()));
+	argv.push_back(nullptr);
+	/* Only the exit status matters; sanitizer reports go to stderr */
+	posix_spawn_file_actions_t fa;
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+	pid_t pid;
+	auto ret = posix_spawn(&pid, argv[0], &fa, nullptr, argv.data(), environ);
+	posix_spawn_file_actions_destroy(&fa);
+	if (ret != 0)
+		return -ret;
+	int status = 0;
+	if (waitpid(pid, &status, 0) < 0)
+		return -errno;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/**
+ * Several CPI files extracted by one vfontas -xcpi run, whose inputs are
+ * processed concurrently; once into a directory tree and once into a tar.
+ */
+static unsigned int check_xcpi(const std::string &vfontas, const std::string &dir)
+{
+	font_set fs;
+	std::shared_ptr<unicode_map> map;
+	for (auto h : {8U, 14U, 16U}) {
+		auto f = bench::synth_font(vfsize(8, h), 256, h);
+		if (map == nullptr)
+			map = f.m_unicode_map;
+		f.m_unicode_map = map;
+		auto ret = fs.add(std::move(f));
+		if (ret < 0) {
+			fprintf(stderr, "font_set::add: %s\n", strerror(-ret));
+			return 1;
+		}
+	}
+	/* Same file names in different directories must not collide */
+	auto cpidir = dir + "/cpi";
+	static const std::vector<unsigned int> cplists[] = {{437}, {850}, {437, 850}, {850, 437, 865}};
+	size_t nmembers = 0;
+	for (size_t i = 0; i < std::size(cplists); ++i) {
+		auto sub = cpidir + "/" + std::to_string(i);
+		auto file = sub + "/ega.cpi";
+		auto ret = HX_mkdir(sub.c_str(), S_IRWXUGO);
+		if (ret >= 0)
+			ret = fs.save_cpi(file.c_str(), cplists[i]);
+		if (ret < 0) {
+			fprintf(stderr, "save_cpi %s: %s\n", file.c_str(), strerror(-ret));
+			return 1;
+		}
+		nmembers += cplists[i].size() * fs.m_strike.size();
+	}
+	unsigned int failures = 0;
+	for (const auto &out : {dir + "/xcpi/", dir + "/xcpi.tar"}) {
+		auto ret = spawn_wait({vfontas, "-xcpi", cpidir + "/*/ega.cpi", out});
+		if (ret == 0)
+			continue;
+		if (ret < 0)
+			fprintf(stderr, "%s: %s\n", vfontas.c_str(), strerror(-ret));
+		else
+			fprintf(stderr, "%s -xcpi ... %s: exit status %d\n",
+			        vfontas.c_str(), out.c_str(), ret);
+		++failures;
+	}
+	auto got = tree_contents(dir + "/xcpi").size();
+	if (failures == 0 && got != nmembers) {
+		fprintf(stderr, "MISMATCH: -xcpi wrote %zu files, expected %zu\n", got, nmembers);
+		++failures;
+	}
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	if (HX_getopt5(g_options_table, argv, &argc, &argv,
+	    HXOPT_USAGEONERR) != HXOPT_ERR_SUCCESS)
+		return EXIT_FAILURE;
+	if (g_nglyphs == 0 || g_threads == 0 || g_rounds == 0) {
+		fprintf(stderr, "Nothing to do.\n");
+		return EXIT_FAILURE;
+	}
+	char tmpl[] = "/tmp/vfa-tsan.XXXXXX";
+	if (mkdtemp(tmpl) == nullptr) {
+		fprintf(stderr, "mkdtemp: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	std::string dir = tmpl;
+	std::vector<job> jobs;
+	font shared;
+	unsigned int failures = 0;
+	uint32_t seed = 1;
+	for (const auto &sz : bench::parse_sizes("8x8,8x16,12x24,16x16")) {
+		auto name = bench::sizename(sz);
+		auto stem = dir + "/in-" + name;
+		auto f = bench::synth_font(sz, g_nglyphs, seed++);
+		auto ret = bench::generate(f, stem, bench::GEN_ALL);
+		if (ret < 0) {
+			fprintf(stderr, "generate %s: %s\n", stem.c_str(), strerror(-ret));
+			++failures;
+			break;
+		}
+		for (const char *ld : {"bdf", "psf", "hex", "clt"})
+			if (strcmp(ld, "hex") != 0 || bench::hexable(sz))
+				jobs.push_back(job{stem, name + "-" + ld, ld, sz});
+		if (sz.w == 8 && sz.h == 16)
+			shared = std::move(f);
+	}
+	if (failures == 0) {
+		failures += check_pipeline(jobs, dir);
+		failures += check_shared(shared, dir);
+	}
+	std::string vfontas = g_vfontas != nullptr ? g_vfontas : "./vfontas-tsan";
+	if (failures == 0 && !vfontas.empty())
+		failures += check_xcpi(vfontas, dir);
+	if (failures == 0)
+		HX_rrmdir(dir.c_str());
+	else
+		fprintf(stderr, "%u failure(s); files kept in %s\n", failures, dir.c_str());
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
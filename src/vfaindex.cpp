@@ -0,0 +1,653 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ *	Codepoint coverage index over a collection of fonts
+ */
+#include "config.h"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libHX/defs.h>
+#include <libHX/io.h>
+#include <libHX/option.h>
+#include "vfalib.hpp"
+#define MMAP_NONE reinterpret_cast<void *>(-1)
+
+using namespace vfalib;
+
+/*
+ * Index file layout. All integers are little-endian; all sections are 8-byte
+ * aligned.
+ *
+ *	vfi_header
+ *	vfi_font[nfonts]	sorted by path
+ *	vfi_chunk[nchunks]	per font, sorted by key
+ *	container data
+ *	string table		paths and "key=value\n" property lines
+ */
+struct vfi_header {
+	char magic[8];
+	uint32_t version, nfonts, nchunks, pad;
+	uint64_t font_off, chunk_off, data_off, data_size, str_off, str_size;
+};
+
+struct vfi_font {
+	uint32_t path_off, path_len, props_off, props_len;
+	uint16_t width, height;
+	uint32_t nglyphs, ncodepoints, first_chunk, nchunks, pad;
+};
+
+/**
+ * One 64K block of the codepoint space, roaring-style. @key is the upper
+ * 16 bits of the codepoints. The container is either a sorted uint16_t array
+ * of the lower 16 bits (up to 4096 entries), or a 65536-bit bitmap.
+ */
+struct vfi_chunk {
+	uint16_t key, type;
+	uint32_t card;
+	uint64_t offset; /* relative to data_off */
+};
+
+enum {
+	VFI_VERSION = 1,
+	VFI_ARRAY = 0,
+	VFI_BITMAP = 1,
+	VFI_ARRAY_MAX = 4096,
+	VFI_BITMAP_WORDS = 65536 / 64,
+};
+
+static constexpr char vfi_magic[8] = {'V', 'F', 'A', 'I', 'D', 'X', '\0', '\0'};
+
+namespace {
+
+/* In-memory container; contents are kept little-endian like on disk. */
+struct container {
+	uint16_t key = 0, type = VFI_ARRAY;
+	uint32_t card = 0;
+	std::vector<uint16_t> arr;
+	std::vector<uint64_t> bits;
+};
+
+/* Read-only view on a container, either in memory or in the mapped index */
+struct cview {
+	uint16_t key, type;
+	uint32_t card;
+	const uint16_t *arr;
+	const uint64_t *bits;
+};
+
+struct font_record {
+	std::string path, props;
+	vfsize size;
+	uint32_t nglyphs = 0, ncodepoints = 0;
+	std::vector<container> cov;
+	bool ok = false;
+};
+
+struct deleter {
+	void operator()(FILE *f) { fclose(f); }
+	void operator()(HXdir *d) { HXdir_close(d); }
+};
+
+/**
+ * The mapped index file. All offsets are validated in open(), so the
+ * accessors need no further checks.
+ */
+class index_map {
+	public:
+	~index_map();
+	int open(const char *file);
+	uint32_t nfonts() const { return le32_to_cpu(m_hdr->nfonts); }
+	const vfi_font &font(size_t i) const { return m_fonts[i]; }
+	std::string path(const vfi_font &) const;
+	std::string props(const vfi_font &) const;
+	cview chunk(const vfi_font &, size_t i) const;
+
+	private:
+	void *m_map = MMAP_NONE;
+	size_t m_size = 0;
+	const vfi_header *m_hdr = nullptr;
+	const vfi_font *m_fonts = nullptr;
+	const vfi_chunk *m_chunks = nullptr;
+	const char *m_data = nullptr, *m_str = nullptr;
+};
+
+}
+
+static unsigned int g_coverage, g_jobs;
+static char *g_index, *g_size, *g_text;
+static constexpr HXoption g_options_table[] = {
+	{{}, 'c', HXTYPE_NONE, &g_coverage, {}, {}, {}, "query: print coverage of every font instead of only the fonts that cover everything"},
+	{{}, 'f', HXTYPE_STRING, &g_index, {}, {}, {}, "Index file", "FILE"},
+	{{}, 'j', HXTYPE_UINT, &g_jobs, {}, {}, {}, "build: number of loader threads (default: all CPUs)", "N"},
+	{{}, 's', HXTYPE_STRING, &g_size, {}, {}, {}, "query: only consider fonts of this cell size", "WxH"},
+	{{}, 't', HXTYPE_STRING, &g_text, {}, {}, {}, "query: codepoints of this UTF-8 text", "TEXT"},
+	HXOPT_AUTOHELP,
+	HXOPT_TABLEEND,
+};
+
+/**
+ * Build roaring-style containers from a sorted list of codepoints.
+ */
+static std::vector<container> make_coverage(const std::vector<char32_t> &cps)
+{
+	std::vector<container> cov;
+	for (size_t i = 0; i < cps.size(); ) {
+		auto key = cps[i] >> 16;
+		auto j = i;
+		while (j < cps.size() && cps[j] >> 16 == key)
+			++j;
+		container c;
+		c.key  = key;
+		c.card = j - i;
+		if (c.card <= VFI_ARRAY_MAX) {
+			c.type = VFI_ARRAY;
+			for (auto k = i; k < j; ++k)
+				c.arr.push_back(cpu_to_le16(cps[k] & 0xFFFF));
+		} else {
+			c.type = VFI_BITMAP;
+			std::vector<uint64_t> bits(VFI_BITMAP_WORDS);
+			for (auto k = i; k < j; ++k)
+				bits[(cps[k] & 0xFFFF) / 64] |= UINT64_C(1) << (cps[k] % 64);
+			for (auto &w : bits)
+				w = cpu_to_le64(w);
+			c.bits = std::move(bits);
+		}
+		cov.push_back(std::move(c));
+		i = j;
+	}
+	return cov;
+}
+
+static cview view_of(const container &c)
+{
+	return {c.key, c.type, c.card, c.arr.data(), c.bits.data()};
+}
+
+static inline bool bitmap_test(const uint64_t *bits, uint16_t v)
+{
+	return le64_to_cpu(bits[v / 64]) & (UINT64_C(1) << (v % 64));
+}
+
+/**
+ * Number of codepoints present in both containers (same key assumed).
+ */
+static uint32_t intersect_card(const cview &a, const cview &b)
+{
+	uint32_t n = 0;
+	if (a.type == VFI_BITMAP && b.type == VFI_BITMAP) {
+		for (unsigned int i = 0; i < VFI_BITMAP_WORDS; ++i)
+			n += __builtin_popcountll(a.bits[i] & b.bits[i]);
+	} else if (a.type == VFI_BITMAP || b.type == VFI_BITMAP) {
+		auto &bm = a.type == VFI_BITMAP ? a : b;
+		auto &ar = a.type == VFI_BITMAP ? b : a;
+		for (uint32_t i = 0; i < ar.card; ++i)
+			n += bitmap_test(bm.bits, le16_to_cpu(ar.arr[i]));
+	} else {
+		uint32_t i = 0, j = 0;
+		while (i < a.card && j < b.card) {
+			auto x = le16_to_cpu(a.arr[i]), y = le16_to_cpu(b.arr[j]);
+			if (x < y) {
+				++i;
+			} else if (x > y) {
+				++j;
+			} else {
+				++n;
+				++i;
+				++j;
+			}
+		}
+	}
+	return n;
+}
+
+/**
+ * Load one font (by its file extension, see font::load_any) and compute its
+ * record. Fonts without a unicode map are taken to cover the codepoints
+ * equal to their glyph indices, as the vfontas savers do.
+ */
+static int index_font(font_record &rec)
+{
+	font f;
+	auto ret = f.load_any(rec.path.c_str());
+	if (ret < 0)
+		return ret;
+	if (f.m_glyph.size() > 0)
+		rec.size = f.m_glyph[0].m_size;
+	rec.nglyphs = f.m_glyph.size();
+	for (const auto &p : f.props)
+		rec.props += p.first + "=" + p.second + "\n";
+
+	std::vector<char32_t> cps;
+	if (f.m_unicode_map == nullptr) {
+		for (uint32_t i = 0; i < rec.nglyphs; ++i)
+			cps.push_back(i);
+	} else {
+		for (const auto &pair : f.m_unicode_map->m_u2i)
+			if (pair.second < rec.nglyphs)
+				cps.push_back(pair.first);
+	}
+	rec.ncodepoints = cps.size();
+	rec.cov = make_coverage(cps);
+	rec.ok = true;
+	return 0;
+}
+
+static bool is_font_name(const char *name)
+{
+	auto ext = strrchr(name, '.');
+	if (ext == nullptr)
+		return false;
+	return strcmp(ext, ".bdf") == 0 || strcmp(ext, ".fnt") == 0 ||
+	       strcmp(ext, ".hex") == 0 || strcmp(ext, ".psf") == 0 ||
+	       strcmp(ext, ".psfu") == 0;
+}
+
+/**
+ * Collect font files (and .clt directories) below @dir. Symlinks are not
+ * followed.
+ */
+static void scan_tree(const std::string &dir, std::vector<std::string> &out)
+{
+	std::unique_ptr<HXdir, deleter> dh(HXdir_open(dir.c_str()));
+	if (dh == nullptr) {
+		fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+		return;
+	}
+	const char *de;
+	while ((de = HXdir_read(dh.get())) != nullptr) {
+		if (*de == '.')
+			continue;
+		auto path = dir + "/" + de;
+		struct stat sb;
+		if (lstat(path.c_str(), &sb) < 0)
+			continue;
+		if (S_ISDIR(sb.st_mode)) {
+			auto ext = strrchr(de, '.');
+			if (ext != nullptr && strcmp(ext, ".clt") == 0)
+				out.push_back(std::move(path));
+			else
+				scan_tree(path, out);
+		} else if (S_ISREG(sb.st_mode) && is_font_name(de)) {
+			out.push_back(std::move(path));
+		}
+	}
+}
+
+static void pad8(std::string &s)
+{
+	s.append((8 - s.size() % 8) % 8, '\0');
+}
+
+static int write_index(const char *file, const std::vector<font_record> &recs)
+{
+	std::string fonts, chunks, data, strtab;
+	uint32_t nfonts = 0, nchunks = 0;
+	for (const auto &r : recs) {
+		if (!r.ok)
+			continue;
+		vfi_font vf{};
+		vf.path_off    = cpu_to_le32(strtab.size());
+		vf.path_len    = cpu_to_le32(r.path.size());
+		strtab += r.path;
+		vf.props_off   = cpu_to_le32(strtab.size());
+		vf.props_len   = cpu_to_le32(r.props.size());
+		strtab += r.props;
+		vf.width       = cpu_to_le16(r.size.w);
+		vf.height      = cpu_to_le16(r.size.h);
+		vf.nglyphs     = cpu_to_le32(r.nglyphs);
+		vf.ncodepoints = cpu_to_le32(r.ncodepoints);
+		vf.first_chunk = cpu_to_le32(nchunks);
+		vf.nchunks     = cpu_to_le32(r.cov.size());
+		fonts.append(reinterpret_cast<const char *>(&vf), sizeof(vf));
+		++nfonts;
+		for (const auto &c : r.cov) {
+			vfi_chunk vc{};
+			vc.key    = cpu_to_le16(c.key);
+			vc.type   = cpu_to_le16(c.type);
+			vc.card   = cpu_to_le32(c.card);
+			vc.offset = cpu_to_le64(data.size());
+			chunks.append(reinterpret_cast<const char *>(&vc), sizeof(vc));
+			++nchunks;
+			if (c.type == VFI_BITMAP)
+				data.append(reinterpret_cast<const char *>(c.bits.data()), c.bits.size() * sizeof(uint64_t));
+			else
+				data.append(reinterpret_cast<const char *>(c.arr.data()), c.arr.size() * sizeof(uint16_t));
+			pad8(data);
+		}
+	}
+	pad8(fonts);
+	pad8(strtab);
+
+	vfi_header hdr{};
+	memcpy(hdr.magic, vfi_magic, sizeof(hdr.magic));
+	hdr.version   = cpu_to_le32(VFI_VERSION);
+	hdr.nfonts    = cpu_to_le32(nfonts);
+	hdr.nchunks   = cpu_to_le32(nchunks);
+	uint64_t off  = sizeof(hdr);
+	hdr.font_off  = cpu_to_le64(off);
+	off += fonts.size();
+	hdr.chunk_off = cpu_to_le64(off);
+	off += chunks.size();
+	hdr.data_off  = cpu_to_le64(off);
+	hdr.data_size = cpu_to_le64(data.size());
+	off += data.size();
+	hdr.str_off   = cpu_to_le64(off);
+	hdr.str_size  = cpu_to_le64(strtab.size());
+
+	/* Write to a temporary file and rename, so readers never see half an index */
+	auto tmp = std::string(file) + ".tmp";
+	std::unique_ptr<FILE, deleter> fp(fopen(tmp.c_str(), "wb"));
+	if (fp == nullptr)
+		return -errno;
+	if (fwrite(&hdr, sizeof(hdr), 1, fp.get()) != 1 ||
+	    (fonts.size() > 0 && fwrite(fonts.data(), fonts.size(), 1, fp.get()) != 1) ||
+	    (chunks.size() > 0 && fwrite(chunks.data(), chunks.size(), 1, fp.get()) != 1) ||
+	    (data.size() > 0 && fwrite(data.data(), data.size(), 1, fp.get()) != 1) ||
+	    (strtab.size() > 0 && fwrite(strtab.data(), strtab.size(), 1, fp.get()) != 1) ||
+	    fflush(fp.get()) != 0) {
+		auto se = errno;
+		unlink(tmp.c_str());
+		return -se;
+	}
+	fp.reset();
+	if (rename(tmp.c_str(), file) < 0) {
+		auto se = errno;
+		unlink(tmp.c_str());
+		return -se;
+	}
+	return 0;
+}
+
+static int do_build(int argc, char **argv)
+{
+	std::vector<std::string> paths;
+	for (int i = 0; i < argc; ++i) {
+		struct stat sb;
+		if (stat(argv[i], &sb) == 0 && S_ISDIR(sb.st_mode) &&
+		    !(strlen(argv[i]) > 4 && strcmp(argv[i] + strlen(argv[i]) - 4, ".clt") == 0))
+			scan_tree(argv[i], paths);
+		else
+			paths.emplace_back(argv[i]);
+	}
+	std::sort(paths.begin(), paths.end());
+	std::vector<font_record> recs(paths.size());
+	for (size_t i = 0; i < paths.size(); ++i)
+		recs[i].path = std::move(paths[i]);
+
+	parallel_for(recs.size(), [&](size_t i) {
+		auto ret = index_font(recs[i]);
+		if (ret < 0)
+			fprintf(stderr, "%s: %s (skipped)\n", recs[i].path.c_str(), strerror(-ret));
+	}, g_jobs);
+
+	auto ret = write_index(g_index, recs);
+	if (ret < 0) {
+		fprintf(stderr, "Error writing %s: %s\n", g_index, strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	size_t ok = std::count_if(recs.cbegin(), recs.cend(), [](const font_record &r) { return r.ok; });
+	fprintf(stderr, "Indexed %zu of %zu fonts\n", ok, recs.size());
+	return EXIT_SUCCESS;
+}
+
+index_map::~index_map()
+{
+	if (m_map != MMAP_NONE)
+		munmap(m_map, m_size);
+}
+
+/**
+ * Map the index and check that every table, chunk and string lies within
+ * the file.
+ */
+int index_map::open(const char *file)
+{
+	auto fd = ::open(file, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	struct stat sb;
+	if (fstat(fd, &sb) < 0) {
+		auto se = errno;
+		close(fd);
+		return -se;
+	}
+	m_size = sb.st_size;
+	if (m_size < sizeof(vfi_header)) {
+		close(fd);
+		return -EINVAL;
+	}
+	m_map = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m_map == MMAP_NONE)
+		return -errno;
+	auto base = static_cast<const char *>(m_map);
+	m_hdr = static_cast<const vfi_header *>(m_map);
+	if (memcmp(m_hdr->magic, vfi_magic, sizeof(vfi_magic)) != 0 ||
+	    le32_to_cpu(m_hdr->version) != VFI_VERSION)
+		return -EINVAL;
+	auto within = [&](uint64_t off, uint64_t len) {
+		return off <= m_size && len <= m_size - off && off % 8 == 0;
+	};
+	uint64_t nfonts = le32_to_cpu(m_hdr->nfonts), nchunks = le32_to_cpu(m_hdr->nchunks);
+	uint64_t font_off = le64_to_cpu(m_hdr->font_off), chunk_off = le64_to_cpu(m_hdr->chunk_off);
+	uint64_t data_off = le64_to_cpu(m_hdr->data_off), data_size = le64_to_cpu(m_hdr->data_size);
+	uint64_t str_off = le64_to_cpu(m_hdr->str_off), str_size = le64_to_cpu(m_hdr->str_size);
+	if (!within(font_off, nfonts * sizeof(vfi_font)) ||
+	    !within(chunk_off, nchunks * sizeof(vfi_chunk)) ||
+	    !within(data_off, data_size) || !within(str_off, str_size))
+		return -EINVAL;
+	m_fonts  = reinterpret_cast<const vfi_font *>(base + font_off);
+	m_chunks = reinterpret_cast<const vfi_chunk *>(base + chunk_off);
+	m_data   = base + data_off;
+	m_str    = base + str_off;
+	for (uint64_t i = 0; i < nchunks; ++i) {
+		const auto &c = m_chunks[i];
+		uint64_t off = le64_to_cpu(c.offset), card = le32_to_cpu(c.card);
+		auto type = le16_to_cpu(c.type);
+		uint64_t len = type == VFI_BITMAP ? VFI_BITMAP_WORDS * sizeof(uint64_t) :
+		               card * sizeof(uint16_t);
+		if ((type != VFI_ARRAY && type != VFI_BITMAP) ||
+		    (type == VFI_ARRAY && card > VFI_ARRAY_MAX) ||
+		    off > data_size || len > data_size - off || off % 8 != 0)
+			return -EINVAL;
+	}
+	for (uint64_t i = 0; i < nfonts; ++i) {
+		const auto &f = m_fonts[i];
+		uint64_t fc = le32_to_cpu(f.first_chunk), nc = le32_to_cpu(f.nchunks);
+		uint64_t po = le32_to_cpu(f.path_off), pl = le32_to_cpu(f.path_len);
+		uint64_t qo = le32_to_cpu(f.props_off), ql = le32_to_cpu(f.props_len);
+		if (fc > nchunks || nc > nchunks - fc || po > str_size ||
+		    pl > str_size - po || qo > str_size || ql > str_size - qo)
+			return -EINVAL;
+	}
+	return 0;
+}
+
+std::string index_map::path(const vfi_font &f) const
+{
+	return std::string(m_str + le32_to_cpu(f.path_off), le32_to_cpu(f.path_len));
+}
+
+std::string index_map::props(const vfi_font &f) const
+{
+	return std::string(m_str + le32_to_cpu(f.props_off), le32_to_cpu(f.props_len));
+}
+
+cview index_map::chunk(const vfi_font &f, size_t i) const
+{
+	const auto &c = m_chunks[le32_to_cpu(f.first_chunk) + i];
+	auto p = m_data + le64_to_cpu(c.offset);
+	return {le16_to_cpu(c.key), le16_to_cpu(c.type), le32_to_cpu(c.card),
+	        reinterpret_cast<const uint16_t *>(p),
+	        reinterpret_cast<const uint64_t *>(p)};
+}
+
+/**
+ * Decode one UTF-8 sequence at @s into @cp and advance @s past it. Stray
+ * continuation bytes, truncated or overlong sequences, surrogates and values
+ * beyond U+10FFFF yield false; the caller skips them.
+ */
+static bool utf8_next(const char *&s, char32_t &cp)
+{
+	static const char32_t min[] = {0, 0x80, 0x800, 0x10000};
+	auto c = static_cast<unsigned char>(*s++);
+	if (c < 0x80) {
+		cp = c;
+		return true;
+	}
+	unsigned int more = c >= 0xF8 ? 0 : c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+	if (more == 0)
+		return false;
+	cp = c & (0x3F >> more);
+	for (unsigned int i = 0; i < more; ++i) {
+		/* Truncated: the byte that ended it is decoded afresh */
+		if ((*s & 0xC0) != 0x80)
+			return false;
+		cp = (cp << 6) | (*s++ & 0x3F);
+	}
+	return cp >= min[more] && cp <= 0x10FFFF && (cp < 0xD800 || cp > 0xDFFF);
+}
+
+/**
+ * Parse "U+XXXX", "U+XXXX-U+YYYY" or plain hex forms thereof.
+ */
+static bool parse_cprange(const char *s, std::vector<char32_t> &out)
+{
+	if (strncasecmp(s, "U+", 2) == 0)
+		s += 2;
+	char *end = nullptr;
+	auto lo = strtoul(s, &end, 16);
+	if (end == s)
+		return false;
+	auto hi = lo;
+	if (*end == '-') {
+		s = end + 1;
+		if (strncasecmp(s, "U+", 2) == 0)
+			s += 2;
+		hi = strtoul(s, &end, 16);
+		if (end == s)
+			return false;
+	}
+	if (*end != '\0' || hi < lo || hi > 0x10FFFF)
+		return false;
+	for (auto c = lo; c <= hi; ++c)
+		out.push_back(c);
+	return true;
+}
+
+static int do_query(int argc, char **argv)
+{
+	std::vector<char32_t> cps;
+	for (int i = 0; i < argc; ++i) {
+		if (!parse_cprange(argv[i], cps)) {
+			fprintf(stderr, "Unparsable codepoint range \"%s\"\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (g_text != nullptr) {
+		for (const char *p = g_text; *p != '\0'; ) {
+			char32_t cp;
+			if (utf8_next(p, cp))
+				cps.push_back(cp);
+		}
+	}
+	std::sort(cps.begin(), cps.end());
+	cps.erase(std::unique(cps.begin(), cps.end()), cps.end());
+	unsigned int sw = 0, sh = 0;
+	if (g_size != nullptr && sscanf(g_size, "%ux%u", &sw, &sh) != 2) {
+		fprintf(stderr, "Unparsable size \"%s\"\n", g_size);
+		return EXIT_FAILURE;
+	}
+
+	index_map idx;
+	auto ret = idx.open(g_index);
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s\n", g_index, strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	auto query = make_coverage(cps);
+	std::vector<std::pair<uint32_t, uint32_t>> hits; /* covered, font index */
+	for (uint32_t i = 0; i < idx.nfonts(); ++i) {
+		const auto &f = idx.font(i);
+		if (g_size != nullptr && (le16_to_cpu(f.width) != sw ||
+		    le16_to_cpu(f.height) != sh))
+			continue;
+		/* Both chunk lists are sorted by key */
+		uint32_t covered = 0, nc = le32_to_cpu(f.nchunks);
+		size_t j = 0;
+		for (const auto &q : query) {
+			while (j < nc && idx.chunk(f, j).key < q.key)
+				++j;
+			if (j < nc && idx.chunk(f, j).key == q.key)
+				covered += intersect_card(view_of(q), idx.chunk(f, j));
+		}
+		if (g_coverage || covered == cps.size())
+			hits.emplace_back(covered, i);
+	}
+	if (g_coverage)
+		std::stable_sort(hits.begin(), hits.end(),
+			[](const auto &a, const auto &b) { return a.first > b.first; });
+	for (const auto &h : hits) {
+		const auto &f = idx.font(h.second);
+		if (g_coverage)
+			printf("%u/%zu\t", h.first, cps.size());
+		printf("%ux%u\t%s\n", le16_to_cpu(f.width), le16_to_cpu(f.height),
+		       idx.path(f).c_str());
+	}
+	return EXIT_SUCCESS;
+}
+
+static int do_list()
+{
+	index_map idx;
+	auto ret = idx.open(g_index);
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s\n", g_index, strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	for (uint32_t i = 0; i < idx.nfonts(); ++i) {
+		const auto &f = idx.font(i);
+		printf("%ux%u\t%u glyphs\t%u codepoints\t%s\n",
+		       le16_to_cpu(f.width), le16_to_cpu(f.height),
+		       le32_to_cpu(f.nglyphs), le32_to_cpu(f.ncodepoints),
+		       idx.path(f).c_str());
+		auto props = idx.props(f);
+		for (size_t p = 0, q; p < props.size(); p = q + 1) {
+			q = props.find('\n', p);
+			if (q == props.npos)
+				q = props.size();
+			printf("\t%.*s\n", static_cast<int>(q - p), &props[p]);
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	if (HX_getopt5(g_options_table, argv, &argc, &argv,
+	    HXOPT_USAGEONERR) != HXOPT_ERR_SUCCESS)
+		return EXIT_FAILURE;
+	if (argc < 2 || g_index == nullptr) {
+		fprintf(stderr, "Usage: vfaindex -f index.vfi {build DIR...|query [U+XXXX[-U+YYYY]...]|list}\n");
+		return EXIT_FAILURE;
+	}
+	if (strcmp(argv[1], "build") == 0)
+		return do_build(argc - 2, argv + 2);
+	else if (strcmp(argv[1], "query") == 0)
+		return do_query(argc - 2, argv + 2);
+	else if (strcmp(argv[1], "list") == 0)
+		return do_list();
+	fprintf(stderr, "Unknown command \"%s\"\n", argv[1]);
+	return EXIT_FAILURE;
+}
@@ -5,31 +5,52 @@
  */
 #include "config.h"
 #include <algorithm>
-#include <iomanip>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <numeric>
 #include <set>
-#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <cerrno>
 #include <climits>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <iconv.h>
 #include <unistd.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#	include <linux/io_uring.h>
+#	include <sys/syscall.h>
+#	ifdef IO_URING_OP_SUPPORTED
+#		define HAVE_IO_URING 1
+#	endif
+#endif
 #include <libHX/ctype_helper.h>
 #include <libHX/defs.h>
 #include <libHX/io.h>
 #include <libHX/string.h>
+#include "cpuisa.hpp"
 #include "vfalib.hpp"
+#ifdef HAVE_X86_KERNELS
+#	include <immintrin.h>
+#endif
 
 using namespace vfalib;
 
@@ -85,6 +106,48 @@ struct deleter {
 	void operator()(HXdir *d) { HXdir_close(d); }
 };
 
+/**
+ * Bump allocator for short-lived temporaries of one glyph or record.
+ * Deallocation is a no-op; everything is reclaimed at once when the outermost
+ * scratch_scope of the thread ends. Requests that do not fit the block are
+ * served from the heap, and the block is enlarged on the next reset, so in
+ * steady state there are no malloc calls left.
+ */
+class scratch_arena final : public std::pmr::memory_resource {
+	public:
+	static scratch_arena &local();
+	void reset();
+	unsigned int m_depth = 0;
+
+	protected:
+	void *do_allocate(size_t, size_t) override;
+	void do_deallocate(void *, size_t, size_t) override {}
+	bool do_is_equal(const std::pmr::memory_resource &o) const noexcept override { return this == &o; }
+
+	private:
+	struct spill { void *ptr; size_t size, align; };
+	std::unique_ptr<char[]> m_block;
+	size_t m_size = 0, m_used = 0, m_spilled = 0;
+	std::vector<spill> m_spill;
+};
+
+struct scratch_scope {
+	scratch_scope() : m_arena(scratch_arena::local()) { ++m_arena.m_depth; }
+	~scratch_scope() { if (--m_arena.m_depth == 0) m_arena.reset(); }
+	operator std::pmr::memory_resource *() { return &m_arena; }
+	scratch_arena &m_arena;
+};
+
+struct aio_job {
+	bool write = false, done = false;
+	/* 0: not started, 1: opening, 2: transferring */
+	unsigned int stage = 0;
+	int fd = -1, err = 0;
+	std::string path, data;
+	const char *wbuf = nullptr;
+	size_t size = 0, pos = 0;
+};
+
 struct pcf_table {
 	uint32_t type, format, size, offset;
 };
@@ -94,12 +157,29 @@ struct psf2_header {
 	uint32_t version, headersize, flags, length, charsize, height, width;
 };
 
+/*
+ * Span file: header, codepoint index (sorted {cp, glyph} pairs), glyph table
+ * (num_glyphs+1 offsets into the span array), span array. All little-endian
+ * and 4-byte aligned, so that the file can be used straight from mmap.
+ */
+struct span_header {
+	char magic[8]; /* "vfaspan1" */
+	uint16_t width, height;
+	uint32_t num_cps, num_glyphs, num_spans;
+};
+
+/* Pixels [x, x+len) of rows [y, y+rows) */
+struct span_entry {
+	uint8_t y, x, len, rows;
+};
+
 class vectorizer final {
 	public:
-	vectorizer(const glyph &, int descent = 0);
-	std::vector<std::vector<edge>> simple();
-	std::vector<std::vector<edge>> n1();
-	std::vector<std::vector<edge>> n2(unsigned int flags = 0);
+	vectorizer(const glyph &, int descent, std::pmr::memory_resource *scratch,
+		std::pmr::memory_resource *out);
+	std::pmr::vector<polygon> simple();
+	std::pmr::vector<polygon> n1();
+	std::pmr::vector<polygon> n2(unsigned int flags = 0);
 
 	/*
 	 * A distance of one pixel is mapped to this many vector font units.
@@ -113,18 +193,23 @@ class vectorizer final {
 	static constexpr int default_scale_factor = 2;
 	int scale_factor_x = default_scale_factor, scale_factor_y = default_scale_factor;
 	static const unsigned int P_ISTHMUS = 1 << 1;
+	/* Number of edges that entered overlap removal (for statistics) */
+	size_t m_edges = 0;
 
 	private:
 	void make_squares();
 	void internal_edge_delete();
-	unsigned int neigh_edges(unsigned int dir, const vertex &, std::set<edge>::iterator &, std::set<edge>::iterator &) const;
-	std::set<edge>::iterator next_edge(unsigned int dir, const edge &, unsigned int flags) const;
-	std::vector<edge> pop_poly(unsigned int flags);
+	using edge_set = std::pmr::set<edge>;
+	unsigned int neigh_edges(unsigned int dir, const vertex &, edge_set::iterator &, edge_set::iterator &) const;
+	edge_set::iterator next_edge(unsigned int dir, const edge &, unsigned int flags) const;
+	polygon pop_poly(unsigned int flags);
 	void set(int, int);
 
 	const glyph &m_glyph;
 	int m_descent = 0;
-	std::set<edge> emap;
+	/* @m_scratch: internal temporaries; @m_out: returned polygons */
+	std::pmr::memory_resource *m_scratch, *m_out;
+	edge_set emap;
 	static const unsigned int P_SIMPLIFY_LINES = 1 << 0;
 };
 
@@ -145,6 +230,489 @@ static FILE *vfopen(const char *name, const char *mode)
 	return nullptr;
 }
 
+scratch_arena &scratch_arena::local()
+{
+	thread_local scratch_arena arena;
+	return arena;
+}
+
+void *scratch_arena::do_allocate(size_t size, size_t align)
+{
+	if (m_block != nullptr) {
+		auto base = reinterpret_cast<uintptr_t>(m_block.get());
+		auto p = (base + m_used + align - 1) & ~(align - 1);
+		if (p + size <= base + m_size) {
+			m_used = p + size - base;
+			return reinterpret_cast<void *>(p);
+		}
+	}
+	auto ptr = std::pmr::new_delete_resource()->allocate(size, align);
+	m_spill.push_back({ptr, size, align});
+	m_spilled += size + align;
+	return ptr;
+}
+
+void scratch_arena::reset()
+{
+	for (const auto &e : m_spill)
+		std::pmr::new_delete_resource()->deallocate(e.ptr, e.size, e.align);
+	m_spill.clear();
+	if (m_spilled > 0) {
+		/* Size the block for what the last round needed in total */
+		m_size = std::max(2 * m_size, m_used + m_spilled);
+		m_block.reset(new char[m_size]);
+	}
+	m_used = m_spilled = 0;
+}
+
+/*
+ * Background whole-file I/O. Jobs live in a deque owned by the backend, so
+ * their addresses stay stable while the kernel or a worker thread holds them.
+ */
+struct async_io::impl {
+	virtual ~impl() = default;
+	virtual void submit(aio_job *) = 0;
+	virtual void wait(aio_job *) = 0;
+
+	enum aio_backend m_kind = AIO_SYNC;
+	std::deque<aio_job> m_jobs;
+	std::vector<aio_job *> m_writes;
+	std::unordered_map<std::string, aio_job *> m_pending;
+};
+
+namespace {
+
+static void aio_finish(aio_job &j, int err)
+{
+	if (j.fd >= 0) {
+		if (close(j.fd) < 0 && j.write && err == 0)
+			err = -errno;
+		j.fd = -1;
+	}
+	j.err = err;
+	if (j.write) {
+		j.data.clear();
+		j.data.shrink_to_fit();
+	}
+}
+
+/* Plain blocking open/read/write, used by the sync and thread backends */
+static void aio_run(aio_job &j)
+{
+	j.fd = j.write ? open(j.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUGO | S_IWUGO) :
+	       open(j.path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (j.fd < 0) {
+		aio_finish(j, -errno);
+		return;
+	}
+	if (!j.write) {
+		struct stat sb;
+		if (fstat(j.fd, &sb) < 0) {
+			aio_finish(j, -errno);
+			return;
+		}
+		j.size = sb.st_size;
+		j.data.resize(j.size);
+	}
+	auto buf = j.write ? j.wbuf : &j.data[0];
+	while (j.pos < j.size) {
+		auto ret = j.write ? ::write(j.fd, buf + j.pos, j.size - j.pos) :
+		           ::read(j.fd, &j.data[j.pos], j.size - j.pos);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			aio_finish(j, -errno);
+			return;
+		}
+		if (ret == 0)
+			break;
+		j.pos += ret;
+	}
+	if (!j.write)
+		j.data.resize(j.pos);
+	aio_finish(j, j.write && j.pos < j.size ? -EIO : 0);
+}
+
+class aio_sync final : public async_io::impl {
+	public:
+	aio_sync() { m_kind = AIO_SYNC; }
+	void submit(aio_job *j) override { aio_run(*j); j->done = true; }
+	void wait(aio_job *) override {}
+};
+
+class aio_threads final : public async_io::impl {
+	public:
+	aio_threads(unsigned int n) : m_nthr(n) { m_kind = AIO_THREADS; }
+	~aio_threads();
+	void submit(aio_job *) override;
+	void wait(aio_job *) override;
+
+	private:
+	void worker();
+
+	unsigned int m_nthr;
+	std::mutex m_lock;
+	std::condition_variable m_work, m_done;
+	std::deque<aio_job *> m_queue;
+	std::vector<std::thread> m_thr;
+	bool m_stop = false;
+};
+
+aio_threads::~aio_threads()
+{
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+		m_stop = true;
+	}
+	m_work.notify_all();
+	for (auto &t : m_thr)
+		t.join();
+}
+
+void aio_threads::submit(aio_job *j)
+{
+	/* Workers are started on first use */
+	if (m_thr.size() < m_nthr)
+		m_thr.emplace_back(&aio_threads::worker, this);
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+		m_queue.push_back(j);
+	}
+	m_work.notify_one();
+}
+
+void aio_threads::wait(aio_job *j)
+{
+	std::unique_lock<std::mutex> lk(m_lock);
+	m_done.wait(lk, [&]() { return j->done; });
+}
+
+void aio_threads::worker()
+{
+	std::unique_lock<std::mutex> lk(m_lock);
+	while (true) {
+		m_work.wait(lk, [&]() { return m_stop || !m_queue.empty(); });
+		if (m_queue.empty())
+			return;
+		auto j = m_queue.front();
+		m_queue.pop_front();
+		lk.unlock();
+		aio_run(*j);
+		lk.lock();
+		j->done = true;
+		m_done.notify_all();
+	}
+}
+
+#ifdef HAVE_IO_URING
+/**
+ * io_uring driven directly through the system calls. Each job runs as
+ * OPENAT, then READ/WRITE until complete; fstat and close are done inline
+ * since the inode is hot by then. The ring is only serviced from the owning
+ * thread, whenever new jobs are submitted or a result is waited for.
+ */
+class aio_uring final : public async_io::impl {
+	public:
+	static std::unique_ptr<aio_uring> create(unsigned int entries);
+	~aio_uring();
+	void submit(aio_job *) override;
+	void wait(aio_job *) override;
+
+	private:
+	aio_uring() { m_kind = AIO_URING; }
+	void queue_op(aio_job *);
+	void advance(aio_job *, int res);
+	void pump(bool block);
+
+	int m_fd = -1;
+	unsigned int m_entries = 0, m_inflight = 0, m_tosubmit = 0;
+	bool m_broken = false;
+	void *m_sq_ptr = MAP_FAILED, *m_cq_ptr = MAP_FAILED;
+	size_t m_sq_size = 0, m_cq_size = 0, m_sqe_size = 0;
+	unsigned int *m_sq_tail = nullptr, *m_sq_mask = nullptr, *m_sq_array = nullptr;
+	unsigned int *m_cq_head = nullptr, *m_cq_tail = nullptr, *m_cq_mask = nullptr;
+	struct io_uring_sqe *m_sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+	struct io_uring_cqe *m_cqes = nullptr;
+	std::deque<aio_job *> m_backlog;
+};
+
+std::unique_ptr<aio_uring> aio_uring::create(unsigned int entries)
+{
+	std::unique_ptr<aio_uring> u(new aio_uring);
+	struct io_uring_params p{};
+	u->m_fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->m_fd < 0)
+		return nullptr;
+	/* All three opcodes are needed, or we are better off with threads */
+	std::unique_ptr<char[]> pbuf(new char[sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op)]());
+	auto probe = reinterpret_cast<struct io_uring_probe *>(pbuf.get());
+	if (syscall(__NR_io_uring_register, u->m_fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+		return nullptr;
+	for (auto op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE})
+		if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+			return nullptr;
+
+	u->m_entries  = p.sq_entries;
+	u->m_sq_size  = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->m_cq_size  = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->m_sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->m_sq_size = u->m_cq_size = std::max(u->m_sq_size, u->m_cq_size);
+	u->m_sq_ptr = mmap(nullptr, u->m_sq_size, PROT_READ | PROT_WRITE,
+	              MAP_SHARED | MAP_POPULATE, u->m_fd, IORING_OFF_SQ_RING);
+	if (u->m_sq_ptr == MAP_FAILED)
+		return nullptr;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->m_cq_ptr = u->m_sq_ptr;
+	} else {
+		u->m_cq_ptr = mmap(nullptr, u->m_cq_size, PROT_READ | PROT_WRITE,
+		              MAP_SHARED | MAP_POPULATE, u->m_fd, IORING_OFF_CQ_RING);
+		if (u->m_cq_ptr == MAP_FAILED)
+			return nullptr;
+	}
+	u->m_sqes = static_cast<struct io_uring_sqe *>(mmap(nullptr, u->m_sqe_size,
+	            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->m_fd, IORING_OFF_SQES));
+	if (u->m_sqes == MAP_FAILED)
+		return nullptr;
+	auto sq = static_cast<char *>(u->m_sq_ptr), cq = static_cast<char *>(u->m_cq_ptr);
+	u->m_sq_tail  = reinterpret_cast<unsigned int *>(sq + p.sq_off.tail);
+	u->m_sq_mask  = reinterpret_cast<unsigned int *>(sq + p.sq_off.ring_mask);
+	u->m_sq_array = reinterpret_cast<unsigned int *>(sq + p.sq_off.array);
+	u->m_cq_head  = reinterpret_cast<unsigned int *>(cq + p.cq_off.head);
+	u->m_cq_tail  = reinterpret_cast<unsigned int *>(cq + p.cq_off.tail);
+	u->m_cq_mask  = reinterpret_cast<unsigned int *>(cq + p.cq_off.ring_mask);
+	u->m_cqes     = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+	return u;
+}
+
+aio_uring::~aio_uring()
+{
+	if (m_sqes != MAP_FAILED)
+		munmap(m_sqes, m_sqe_size);
+	if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+		munmap(m_cq_ptr, m_cq_size);
+	if (m_sq_ptr != MAP_FAILED)
+		munmap(m_sq_ptr, m_sq_size);
+	if (m_fd >= 0)
+		close(m_fd);
+}
+
+void aio_uring::submit(aio_job *j)
+{
+	m_backlog.push_back(j);
+	/* Batch a few submissions per syscall */
+	if (m_backlog.size() + m_tosubmit >= 16)
+		pump(false);
+}
+
+void aio_uring::wait(aio_job *j)
+{
+	while (!j->done) {
+		if (m_broken) {
+			/* The ring is gone; whatever it held will not complete */
+			if (j->fd >= 0)
+				close(j->fd);
+			j->fd = -1;
+			j->err = -EIO;
+			j->done = true;
+			break;
+		}
+		pump(true);
+	}
+}
+
+void aio_uring::queue_op(aio_job *j)
+{
+	if (m_inflight >= m_entries) {
+		m_backlog.push_front(j);
+		return;
+	}
+	auto tail = *m_sq_tail;
+	auto idx  = tail & *m_sq_mask;
+	auto sqe  = &m_sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	if (j->stage == 0) {
+		sqe->opcode     = IORING_OP_OPENAT;
+		sqe->fd         = AT_FDCWD;
+		sqe->addr       = reinterpret_cast<uintptr_t>(j->path.c_str());
+		sqe->open_flags = j->write ? O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC : O_RDONLY | O_CLOEXEC;
+		sqe->len        = j->write ? S_IRUGO | S_IWUGO : 0;
+		j->stage = 1;
+	} else {
+		auto buf    = j->write ? j->wbuf : &j->data[0];
+		sqe->opcode = j->write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd     = j->fd;
+		sqe->addr   = reinterpret_cast<uintptr_t>(buf + j->pos);
+		sqe->len    = std::min(j->size - j->pos, static_cast<size_t>(1) << 30);
+		sqe->off    = j->pos;
+	}
+	sqe->user_data = reinterpret_cast<uintptr_t>(j);
+	m_sq_array[idx] = idx;
+	__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++m_inflight;
+	++m_tosubmit;
+}
+
+void aio_uring::advance(aio_job *j, int res)
+{
+	if (j->stage == 1) {
+		if (res < 0) {
+			aio_finish(*j, res);
+			j->done = true;
+			return;
+		}
+		j->fd = res;
+		j->stage = 2;
+		if (!j->write) {
+			struct stat sb;
+			if (fstat(j->fd, &sb) < 0) {
+				aio_finish(*j, -errno);
+				j->done = true;
+				return;
+			}
+			j->size = sb.st_size;
+			j->data.resize(j->size);
+		}
+	} else if (res == -EINTR || res == -EAGAIN) {
+		/* retry */
+	} else if (res < 0) {
+		aio_finish(*j, res);
+		j->done = true;
+		return;
+	} else if (res == 0) {
+		if (!j->write)
+			j->data.resize(j->pos);
+		aio_finish(*j, j->write ? -EIO : 0);
+		j->done = true;
+		return;
+	} else {
+		j->pos += res;
+	}
+	if (j->pos >= j->size) {
+		aio_finish(*j, 0);
+		j->done = true;
+		return;
+	}
+	queue_op(j);
+}
+
+void aio_uring::pump(bool block)
+{
+	while (!m_backlog.empty() && m_inflight < m_entries) {
+		auto j = m_backlog.front();
+		m_backlog.pop_front();
+		queue_op(j);
+	}
+	unsigned int min_complete = block && m_inflight > 0 ? 1 : 0;
+	if (m_tosubmit > 0 || min_complete > 0) {
+		auto ret = syscall(__NR_io_uring_enter, m_fd, m_tosubmit, min_complete,
+		           min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+		if (ret >= 0)
+			m_tosubmit -= ret;
+		else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			m_broken = true;
+	}
+	auto head = *m_cq_head;
+	while (head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+		auto &cqe = m_cqes[head & *m_cq_mask];
+		auto j = reinterpret_cast<aio_job *>(static_cast<uintptr_t>(cqe.user_data));
+		auto res = cqe.res;
+		__atomic_store_n(m_cq_head, ++head, __ATOMIC_RELEASE);
+		--m_inflight;
+		advance(j, res);
+	}
+}
+#endif /* HAVE_IO_URING */
+
+}
+
+async_io::async_io(enum aio_backend kind)
+{
+#ifdef HAVE_IO_URING
+	if (kind == AIO_AUTO || kind == AIO_URING)
+		m_impl = aio_uring::create(64);
+#endif
+	if (m_impl == nullptr && kind != AIO_SYNC)
+		m_impl = std::make_unique<aio_threads>(16);
+	if (m_impl == nullptr)
+		m_impl = std::make_unique<aio_sync>();
+}
+
+async_io::~async_io()
+{
+	flush();
+	for (auto &j : m_impl->m_jobs)
+		if (!j.done)
+			m_impl->wait(&j);
+}
+
+enum aio_backend async_io::backend() const
+{
+	return m_impl->m_kind;
+}
+
+size_t async_io::prefetch(std::string path)
+{
+	auto &j = m_impl->m_jobs.emplace_back();
+	j.path = std::move(path);
+	m_impl->submit(&j);
+	return m_impl->m_jobs.size() - 1;
+}
+
+int async_io::fetch(size_t ticket, std::string &out)
+{
+	auto &j = m_impl->m_jobs.at(ticket);
+	m_impl->wait(&j);
+	out = std::move(j.data);
+	j.data = {};
+	return j.err;
+}
+
+void async_io::write(std::string path, std::string data)
+{
+	auto &j = m_impl->m_jobs.emplace_back();
+	j.data = std::move(data);
+	write_job(std::move(path), j.data.data(), j.data.size());
+}
+
+void async_io::write_ref(std::string path, const char *buf, size_t size)
+{
+	m_impl->m_jobs.emplace_back();
+	write_job(std::move(path), buf, size);
+}
+
+void async_io::write_job(std::string &&path, const char *buf, size_t size)
+{
+	auto &j  = m_impl->m_jobs.back();
+	j.write  = true;
+	j.path   = std::move(path);
+	j.wbuf   = buf;
+	j.size   = size;
+	/* A second write to the same file must not overtake the first */
+	auto &prev = m_impl->m_pending[j.path];
+	if (prev != nullptr && !prev->done)
+		m_impl->wait(prev);
+	prev = &j;
+	m_impl->m_writes.push_back(&j);
+	m_impl->submit(&j);
+}
+
+int async_io::flush(std::string *failed)
+{
+	int ret = 0;
+	for (auto j : m_impl->m_writes) {
+		m_impl->wait(j);
+		if (j->err < 0 && ret == 0) {
+			ret = j->err;
+			if (failed != nullptr)
+				*failed = j->path;
+		}
+	}
+	m_impl->m_writes.clear();
+	m_impl->m_pending.clear();
+	return ret;
+}
+
 static unsigned int bytes_per_glyph(const vfsize &size)
 {
 	/* A 9x16 glyph occupy 18 chars in our internal representation */
@@ -157,6 +725,29 @@ static unsigned int bytes_per_glyph_rpad(const vfsize &size)
 	return size.h * ((size.w + 7) / 8);
 }
 
+/**
+ * Read @n (at most 57) bits starting at bit @off, right-aligned. Rows of
+ * glyphs up to that width are handled as one word this way.
+ */
+static uint64_t bits_get(const std::string &d, size_t off, unsigned int n)
+{
+	uint64_t v = 0;
+	auto p = off / CHAR_BIT, end = std::min(d.size(), p + 8);
+	for (size_t i = p; i < end; ++i)
+		v |= static_cast<uint64_t>(static_cast<uint8_t>(d[i])) << (56 - 8 * (i - p));
+	return (v << (off % CHAR_BIT)) >> (64 - n);
+}
+
+/* OR the right-aligned @n-bit value @v into @d at bit @off */
+static void bits_or(std::string &d, size_t off, unsigned int n, uint64_t v)
+{
+	auto sh = off % CHAR_BIT;
+	v <<= 64 - n - sh;
+	auto p = off / CHAR_BIT, end = std::min(d.size(), p + (sh + n + 7) / 8);
+	for (size_t i = p; i < end; ++i)
+		d[i] |= static_cast<char>(v >> (56 - 8 * (i - p)));
+}
+
 void unicode_map::add_i2u(unsigned int idx, char32_t uc)
 {
 	auto &set = m_i2u.emplace(idx, decltype(m_i2u)::mapped_type{}).first->second;
@@ -239,19 +830,67 @@ ssize_t unicode_map::to_index(char32_t uc) const
 
 void unicode_map::swap_idx(unsigned int a, unsigned int b)
 {
-	decltype(m_i2u) new_i2u;
-	decltype(m_u2i) new_u2i;
-	for (auto &e : m_u2i) {
-		if (e.second == a)
-			e.second = b;
-		else if (e.second == b)
-			e.second = a;
+	if (a == b)
+		return;
+	auto ia = m_i2u.find(a), ib = m_i2u.find(b);
+	/*
+	 * Only the codepoints of @a and @b can refer to either index. One
+	 * codepoint may be listed under both, so collect all entries before
+	 * retargeting any.
+	 */
+	std::vector<decltype(m_u2i)::iterator> to_a, to_b;
+	auto collect = [&](decltype(ia) it) {
+		if (it == m_i2u.end())
+			return;
+		for (auto uc : it->second) {
+			auto j = m_u2i.find(uc);
+			if (j == m_u2i.end())
+				continue;
+			if (j->second == a)
+				to_b.push_back(j);
+			else if (j->second == b)
+				to_a.push_back(j);
+		}
+	};
+	collect(ia);
+	collect(ib);
+	for (auto j : to_b)
+		j->second = b;
+	for (auto j : to_a)
+		j->second = a;
+	if (ia != m_i2u.end() && ib != m_i2u.end()) {
+		std::swap(ia->second, ib->second);
+	} else if (ia != m_i2u.end()) {
+		m_i2u.emplace(b, std::move(ia->second));
+		m_i2u.erase(ia);
+	} else if (ib != m_i2u.end()) {
+		m_i2u.emplace(a, std::move(ib->second));
+		m_i2u.erase(ib);
+	}
+}
+
+/**
+ * Renumber glyph indices: @newidx[i] is the new index of glyph i; larger
+ * indices are kept and must exceed all new ones. Both sides of the map are
+ * rewritten in one pass each; m_i2u nodes are moved over, not copied.
+ */
+void unicode_map::permute(const std::vector<unsigned int> &newidx)
+{
+	auto n = newidx.size();
+	for (auto &e : m_u2i)
+		if (e.second < n)
+			e.second = newidx[e.second];
+	std::vector<decltype(m_i2u)::node_type> node(n);
+	auto it = m_i2u.begin();
+	while (it != m_i2u.end() && it->first < n) {
+		auto nh = m_i2u.extract(it++);
+		nh.key() = newidx[nh.key()];
+		node[nh.key()] = std::move(nh);
 	}
-	for (const auto &e : m_i2u)
-		new_i2u.emplace(e.first == a ? b :
-		                e.first == b ? a :
-		                e.first, std::move(e.second));
-	m_i2u = std::move(new_i2u);
+	/* Everything left is >= n, so @it is the hint for ascending inserts */
+	for (auto &nh : node)
+		if (!nh.empty())
+			m_i2u.insert(it, std::move(nh));
 }
 
 font::font() :
@@ -264,6 +903,13 @@ font::font() :
 	}
 {}
 
+const std::string &font::prop(const char *key) const
+{
+	static const std::string empty;
+	auto it = props.find(key);
+	return it != props.end() ? it->second : empty;
+}
+
 void font::init_256_blanks()
 {
 	m_glyph = std::vector<glyph>(256, glyph(vfsize(8, 16)));
@@ -276,6 +922,37 @@ void font::lge()
 		m_glyph[k].lge();
 }
 
+/**
+ * Resolve the codepoint ranges to glyph indices first (last range wins for a
+ * glyph reachable from several codepoints), then run the column kernel once
+ * per glyph. Without a unicode map, glyph indices are taken as codepoints.
+ */
+void font::lge_ranges(const lge_range *rt, size_t nr)
+{
+	std::vector<unsigned int> adj(m_glyph.size());
+	for (size_t r = 0; r < nr; ++r) {
+		if (m_unicode_map == nullptr) {
+			for (auto idx = rt[r].first; idx <= rt[r].last && idx < adj.size(); ++idx)
+				adj[idx] = rt[r].adj;
+			continue;
+		}
+		auto &u2i = m_unicode_map->m_u2i;
+		for (auto it = u2i.lower_bound(rt[r].first);
+		     it != u2i.end() && it->first <= rt[r].last; ++it)
+			if (it->second < adj.size())
+				adj[it->second] = rt[r].adj;
+	}
+	for (size_t idx = 0; idx < adj.size(); ++idx)
+		if (adj[idx] != 0)
+			m_glyph[idx].lge(adj[idx]);
+}
+
+void font::lge(char32_t first, char32_t last, unsigned int adj)
+{
+	lge_range r = {first, last, adj};
+	lge_ranges(&r, 1);
+}
+
 void font::lgeu()
 {
 	static constexpr uint16_t cand[] = {
@@ -293,30 +970,22 @@ void font::lgeu()
 		fprintf(stderr, "This font has no unicode map, can't perform LGEU command.\n");
 		return;
 	}
-	auto &map = *m_unicode_map;
-	for (auto uc : cand) {
-		auto it = map.m_u2i.find(uc);
-		if (it != map.m_u2i.end())
-			m_glyph[it->second].lge();
-	}
+	lge_range rt[std::size(cand)];
+	for (size_t i = 0; i < std::size(cand); ++i)
+		rt[i] = {cand[i], cand[i], 1};
+	lge_ranges(rt, std::size(rt));
 }
 
 void font::lgeuf()
 {
+	static constexpr lge_range rt[] = {
+		{0x2500, 0x2591, 1}, {0x2591, 0x2594, 2}, {0x2594, 0x2600, 1},
+	};
 	if (m_unicode_map == nullptr) {
 		fprintf(stderr, "This font has no unicode map, can't perform LGEU command.\n");
 		return;
 	}
-	auto &map = *m_unicode_map;
-	for (auto it = map.m_u2i.lower_bound(0x2500);
-	     it != map.m_u2i.upper_bound(0x2591); ++it)
-		m_glyph[it->second].lge();
-	for (auto it = map.m_u2i.lower_bound(0x2591);
-	     it != map.m_u2i.upper_bound(0x2594); ++it)
-		m_glyph[it->second].lge(2);
-	for (auto it = map.m_u2i.lower_bound(0x2594);
-	     it != map.m_u2i.upper_bound(0x2600); ++it)
-		m_glyph[it->second].lge();
+	lge_ranges(rt, std::size(rt));
 }
 
 void font::overstrike(unsigned int px)
@@ -325,6 +994,825 @@ void font::overstrike(unsigned int px)
 		g = g.overstrike(px);
 }
 
+/**
+ * Permute the glyphs into codepoint order, so that the savers which walk
+ * m_u2i go through m_glyph front to back. A glyph takes the rank of its
+ * lowest codepoint; glyphs not reached that way precede them in their
+ * previous order.
+ */
+void font::reorder()
+{
+	if (m_unicode_map == nullptr)
+		return;
+	auto n = m_glyph.size();
+	std::vector<unsigned int> reached;
+	std::vector<bool> seen(n);
+	for (const auto &e : m_unicode_map->m_u2i)
+		if (e.second < n && !seen[e.second]) {
+			seen[e.second] = true;
+			reached.push_back(e.second);
+		}
+	/*
+	 * Glyphs that m_u2i does not reach go first: a codepoint listed under
+	 * several glyphs is resolved by index order on PSF load, and its
+	 * m_u2i glyph has to stay the last of them.
+	 */
+	std::vector<unsigned int> newidx(n);
+	unsigned int next = 0;
+	for (size_t i = 0; i < n; ++i)
+		if (!seen[i])
+			newidx[i] = next++;
+	for (auto i : reached)
+		newidx[i] = next++;
+	bool ident = true;
+	for (size_t i = 0; i < n && ident; ++i)
+		ident = newidx[i] == i;
+	if (ident)
+		return;
+	std::vector<glyph> ng(n);
+	for (size_t i = 0; i < n; ++i)
+		ng[newidx[i]] = std::move(m_glyph[i]);
+	m_glyph = std::move(ng);
+	/* Other fonts (strikes of a set) may hold the same map */
+	if (m_unicode_map.use_count() > 1)
+		m_unicode_map = std::make_shared<unicode_map>(*m_unicode_map);
+	m_unicode_map->permute(newidx);
+}
+
+vfrect font::ink_bounds() const
+{
+	if (m_glyph.size() == 0)
+		return {};
+	return ink_bounds(m_glyph[0].m_size);
+}
+
+/**
+ * Smallest rectangle holding the ink of all glyphs of size @sz (others are
+ * skipped). The glyph bitmaps are ORed together 64 bits at a time, so only
+ * the union is looked at pixel by pixel. Inkless glyphs yield a zero-sized
+ * rectangle.
+ */
+vfrect font::ink_bounds(const vfsize &sz) const
+{
+	size_t bpg = bytes_per_glyph(sz);
+	std::vector<uint64_t> acc((bpg + 7) / 8);
+	for (const auto &g : m_glyph) {
+		if (g.m_size.w != sz.w || g.m_size.h != sz.h || g.m_data.size() < bpg)
+			continue;
+		uint64_t word;
+		size_t i = 0;
+		for (; i + 8 <= bpg; i += 8) {
+			memcpy(&word, &g.m_data[i], sizeof(word));
+			acc[i / 8] |= word;
+		}
+		if (i < bpg) {
+			word = 0;
+			memcpy(&word, &g.m_data[i], bpg - i);
+			acc[i / 8] |= word;
+		}
+	}
+	auto u = reinterpret_cast<const unsigned char *>(acc.data());
+	unsigned int x0 = sz.w, x1 = 0, y0 = sz.h, y1 = 0;
+	for (unsigned int y = 0; y < sz.h; ++y) {
+		for (unsigned int x = 0; x < sz.w; ++x) {
+			bitpos pos = y * sz.w + x;
+			if (!(u[pos.byte] & pos.mask))
+				continue;
+			x0 = std::min(x0, x);
+			x1 = std::max(x1, x);
+			y0 = std::min(y0, y);
+			y1 = y;
+		}
+	}
+	if (x0 > x1)
+		return {};
+	return vfrect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+/**
+ * Crop all glyphs to the ink_bounds() of their size, so that the glyphs of
+ * each size in a mixed-size font are cropped alike. With @keep_base, rows are
+ * only removed from the top, so the distance of the baseline from the bottom
+ * stays. Sizes without any ink are left alone.
+ */
+void font::autocrop(bool keep_base)
+{
+	std::vector<std::pair<vfsize, vfrect>> bounds;
+	for (auto &g : m_glyph) {
+		auto sz = g.m_size;
+		auto it = std::find_if(bounds.begin(), bounds.end(),
+			[&](const auto &e) { return e.first.w == sz.w && e.first.h == sz.h; });
+		if (it == bounds.end()) {
+			auto r = ink_bounds(sz);
+			if (keep_base && r.w != 0)
+				r.h = sz.h - r.y;
+			it = bounds.emplace(bounds.end(), sz, r);
+		}
+		const auto &r = it->second;
+		if (r.w == 0)
+			continue;
+		g = g.copy_rect_to(vfpos(r.x, r.y) | sz, glyph(r), vfpos() | static_cast<vfsize>(r));
+	}
+}
+
+/**
+ * Canonical decompositions of the precomposed Latin letters (Latin-1 through
+ * Latin Extended-B, and Latin Extended Additional, which has Vietnamese) into
+ * a base and one combining mark, from Unicode 14 UnicodeData.txt.
+ */
+static const struct decomp_entry {
+	char32_t cp, base, mark;
+} builtin_decomp[] = {
+	{0x00C0, 0x0041, 0x0300}, {0x00C1, 0x0041, 0x0301}, {0x00C2, 0x0041, 0x0302},
+	{0x00C3, 0x0041, 0x0303}, {0x00C4, 0x0041, 0x0308}, {0x00C5, 0x0041, 0x030A},
+	{0x00C7, 0x0043, 0x0327}, {0x00C8, 0x0045, 0x0300}, {0x00C9, 0x0045, 0x0301},
+	{0x00CA, 0x0045, 0x0302}, {0x00CB, 0x0045, 0x0308}, {0x00CC, 0x0049, 0x0300},
+	{0x00CD, 0x0049, 0x0301}, {0x00CE, 0x0049, 0x0302}, {0x00CF, 0x0049, 0x0308},
+	{0x00D1, 0x004E, 0x0303}, {0x00D2, 0x004F, 0x0300}, {0x00D3, 0x004F, 0x0301},
+	{0x00D4, 0x004F, 0x0302}, {0x00D5, 0x004F, 0x0303}, {0x00D6, 0x004F, 0x0308},
+	{0x00D9, 0x0055, 0x0300}, {0x00DA, 0x0055, 0x0301}, {0x00DB, 0x0055, 0x0302},
+	{0x00DC, 0x0055, 0x0308}, {0x00DD, 0x0059, 0x0301}, {0x00E0, 0x0061, 0x0300},
+	{0x00E1, 0x0061, 0x0301}, {0x00E2, 0x0061, 0x0302}, {0x00E3, 0x0061, 0x0303},
+	{0x00E4, 0x0061, 0x0308}, {0x00E5, 0x0061, 0x030A}, {0x00E7, 0x0063, 0x0327},
+	{0x00E8, 0x0065, 0x0300}, {0x00E9, 0x0065, 0x0301}, {0x00EA, 0x0065, 0x0302},
+	{0x00EB, 0x0065, 0x0308}, {0x00EC, 0x0069, 0x0300}, {0x00ED, 0x0069, 0x0301},
+	{0x00EE, 0x0069, 0x0302}, {0x00EF, 0x0069, 0x0308}, {0x00F1, 0x006E, 0x0303},
+	{0x00F2, 0x006F, 0x0300}, {0x00F3, 0x006F, 0x0301}, {0x00F4, 0x006F, 0x0302},
+	{0x00F5, 0x006F, 0x0303}, {0x00F6, 0x006F, 0x0308}, {0x00F9, 0x0075, 0x0300},
+	{0x00FA, 0x0075, 0x0301}, {0x00FB, 0x0075, 0x0302}, {0x00FC, 0x0075, 0x0308},
+	{0x00FD, 0x0079, 0x0301}, {0x00FF, 0x0079, 0x0308}, {0x0100, 0x0041, 0x0304},
+	{0x0101, 0x0061, 0x0304}, {0x0102, 0x0041, 0x0306}, {0x0103, 0x0061, 0x0306},
+	{0x0104, 0x0041, 0x0328}, {0x0105, 0x0061, 0x0328}, {0x0106, 0x0043, 0x0301},
+	{0x0107, 0x0063, 0x0301}, {0x0108, 0x0043, 0x0302}, {0x0109, 0x0063, 0x0302},
+	{0x010A, 0x0043, 0x0307}, {0x010B, 0x0063, 0x0307}, {0x010C, 0x0043, 0x030C},
+	{0x010D, 0x0063, 0x030C}, {0x010E, 0x0044, 0x030C}, {0x010F, 0x0064, 0x030C},
+	{0x0112, 0x0045, 0x0304}, {0x0113, 0x0065, 0x0304}, {0x0114, 0x0045, 0x0306},
+	{0x0115, 0x0065, 0x0306}, {0x0116, 0x0045, 0x0307}, {0x0117, 0x0065, 0x0307},
+	{0x0118, 0x0045, 0x0328}, {0x0119, 0x0065, 0x0328}, {0x011A, 0x0045, 0x030C},
+	{0x011B, 0x0065, 0x030C}, {0x011C, 0x0047, 0x0302}, {0x011D, 0x0067, 0x0302},
+	{0x011E, 0x0047, 0x0306}, {0x011F, 0x0067, 0x0306}, {0x0120, 0x0047, 0x0307},
+	{0x0121, 0x0067, 0x0307}, {0x0122, 0x0047, 0x0327}, {0x0123, 0x0067, 0x0327},
+	{0x0124, 0x0048, 0x0302}, {0x0125, 0x0068, 0x0302}, {0x0128, 0x0049, 0x0303},
+	{0x0129, 0x0069, 0x0303}, {0x012A, 0x0049, 0x0304}, {0x012B, 0x0069, 0x0304},
+	{0x012C, 0x0049, 0x0306}, {0x012D, 0x0069, 0x0306}, {0x012E, 0x0049, 0x0328},
+	{0x012F, 0x0069, 0x0328}, {0x0130, 0x0049, 0x0307}, {0x0134, 0x004A, 0x0302},
+	{0x0135, 0x006A, 0x0302}, {0x0136, 0x004B, 0x0327}, {0x0137, 0x006B, 0x0327},
+	{0x0139, 0x004C, 0x0301}, {0x013A, 0x006C, 0x0301}, {0x013B, 0x004C, 0x0327},
+	{0x013C, 0x006C, 0x0327}, {0x013D, 0x004C, 0x030C}, {0x013E, 0x006C, 0x030C},
+	{0x0143, 0x004E, 0x0301}, {0x0144, 0x006E, 0x0301}, {0x0145, 0x004E, 0x0327},
+	{0x0146, 0x006E, 0x0327}, {0x0147, 0x004E, 0x030C}, {0x0148, 0x006E, 0x030C},
+	{0x014C, 0x004F, 0x0304}, {0x014D, 0x006F, 0x0304}, {0x014E, 0x004F, 0x0306},
+	{0x014F, 0x006F, 0x0306}, {0x0150, 0x004F, 0x030B}, {0x0151, 0x006F, 0x030B},
+	{0x0154, 0x0052, 0x0301}, {0x0155, 0x0072, 0x0301}, {0x0156, 0x0052, 0x0327},
+	{0x0157, 0x0072, 0x0327}, {0x0158, 0x0052, 0x030C}, {0x0159, 0x0072, 0x030C},
+	{0x015A, 0x0053, 0x0301}, {0x015B, 0x0073, 0x0301}, {0x015C, 0x0053, 0x0302},
+	{0x015D, 0x0073, 0x0302}, {0x015E, 0x0053, 0x0327}, {0x015F, 0x0073, 0x0327},
+	{0x0160, 0x0053, 0x030C}, {0x0161, 0x0073, 0x030C}, {0x0162, 0x0054, 0x0327},
+	{0x0163, 0x0074, 0x0327}, {0x0164, 0x0054, 0x030C}, {0x0165, 0x0074, 0x030C},
+	{0x0168, 0x0055, 0x0303}, {0x0169, 0x0075, 0x0303}, {0x016A, 0x0055, 0x0304},
+	{0x016B, 0x0075, 0x0304}, {0x016C, 0x0055, 0x0306}, {0x016D, 0x0075, 0x0306},
+	{0x016E, 0x0055, 0x030A}, {0x016F, 0x0075, 0x030A}, {0x0170, 0x0055, 0x030B},
+	{0x0171, 0x0075, 0x030B}, {0x0172, 0x0055, 0x0328}, {0x0173, 0x0075, 0x0328},
+	{0x0174, 0x0057, 0x0302}, {0x0175, 0x0077, 0x0302}, {0x0176, 0x0059, 0x0302},
+	{0x0177, 0x0079, 0x0302}, {0x0178, 0x0059, 0x0308}, {0x0179, 0x005A, 0x0301},
+	{0x017A, 0x007A, 0x0301}, {0x017B, 0x005A, 0x0307}, {0x017C, 0x007A, 0x0307},
+	{0x017D, 0x005A, 0x030C}, {0x017E, 0x007A, 0x030C}, {0x01A0, 0x004F, 0x031B},
+	{0x01A1, 0x006F, 0x031B}, {0x01AF, 0x0055, 0x031B}, {0x01B0, 0x0075, 0x031B},
+	{0x01CD, 0x0041, 0x030C}, {0x01CE, 0x0061, 0x030C}, {0x01CF, 0x0049, 0x030C},
+	{0x01D0, 0x0069, 0x030C}, {0x01D1, 0x004F, 0x030C}, {0x01D2, 0x006F, 0x030C},
+	{0x01D3, 0x0055, 0x030C}, {0x01D4, 0x0075, 0x030C}, {0x01D5, 0x00DC, 0x0304},
+	{0x01D6, 0x00FC, 0x0304}, {0x01D7, 0x00DC, 0x0301}, {0x01D8, 0x00FC, 0x0301},
+	{0x01D9, 0x00DC, 0x030C}, {0x01DA, 0x00FC, 0x030C}, {0x01DB, 0x00DC, 0x0300},
+	{0x01DC, 0x00FC, 0x0300}, {0x01DE, 0x00C4, 0x0304}, {0x01DF, 0x00E4, 0x0304},
+	{0x01E0, 0x0226, 0x0304}, {0x01E1, 0x0227, 0x0304}, {0x01E2, 0x00C6, 0x0304},
+	{0x01E3, 0x00E6, 0x0304}, {0x01E6, 0x0047, 0x030C}, {0x01E7, 0x0067, 0x030C},
+	{0x01E8, 0x004B, 0x030C}, {0x01E9, 0x006B, 0x030C}, {0x01EA, 0x004F, 0x0328},
+	{0x01EB, 0x006F, 0x0328}, {0x01EC, 0x01EA, 0x0304}, {0x01ED, 0x01EB, 0x0304},
+	{0x01EE, 0x01B7, 0x030C}, {0x01EF, 0x0292, 0x030C}, {0x01F0, 0x006A, 0x030C},
+	{0x01F4, 0x0047, 0x0301}, {0x01F5, 0x0067, 0x0301}, {0x01F8, 0x004E, 0x0300},
+	{0x01F9, 0x006E, 0x0300}, {0x01FA, 0x00C5, 0x0301}, {0x01FB, 0x00E5, 0x0301},
+	{0x01FC, 0x00C6, 0x0301}, {0x01FD, 0x00E6, 0x0301}, {0x01FE, 0x00D8, 0x0301},
+	{0x01FF, 0x00F8, 0x0301}, {0x0200, 0x0041, 0x030F}, {0x0201, 0x0061, 0x030F},
+	{0x0202, 0x0041, 0x0311}, {0x0203, 0x0061, 0x0311}, {0x0204, 0x0045, 0x030F},
+	{0x0205, 0x0065, 0x030F}, {0x0206, 0x0045, 0x0311}, {0x0207, 0x0065, 0x0311},
+	{0x0208, 0x0049, 0x030F}, {0x0209, 0x0069, 0x030F}, {0x020A, 0x0049, 0x0311},
+	{0x020B, 0x0069, 0x0311}, {0x020C, 0x004F, 0x030F}, {0x020D, 0x006F, 0x030F},
+	{0x020E, 0x004F, 0x0311}, {0x020F, 0x006F, 0x0311}, {0x0210, 0x0052, 0x030F},
+	{0x0211, 0x0072, 0x030F}, {0x0212, 0x0052, 0x0311}, {0x0213, 0x0072, 0x0311},
+	{0x0214, 0x0055, 0x030F}, {0x0215, 0x0075, 0x030F}, {0x0216, 0x0055, 0x0311},
+	{0x0217, 0x0075, 0x0311}, {0x0218, 0x0053, 0x0326}, {0x0219, 0x0073, 0x0326},
+	{0x021A, 0x0054, 0x0326}, {0x021B, 0x0074, 0x0326}, {0x021E, 0x0048, 0x030C},
+	{0x021F, 0x0068, 0x030C}, {0x0226, 0x0041, 0x0307}, {0x0227, 0x0061, 0x0307},
+	{0x0228, 0x0045, 0x0327}, {0x0229, 0x0065, 0x0327}, {0x022A, 0x00D6, 0x0304},
+	{0x022B, 0x00F6, 0x0304}, {0x022C, 0x00D5, 0x0304}, {0x022D, 0x00F5, 0x0304},
+	{0x022E, 0x004F, 0x0307}, {0x022F, 0x006F, 0x0307}, {0x0230, 0x022E, 0x0304},
+	{0x0231, 0x022F, 0x0304}, {0x0232, 0x0059, 0x0304}, {0x0233, 0x0079, 0x0304},
+	{0x1E00, 0x0041, 0x0325}, {0x1E01, 0x0061, 0x0325}, {0x1E02, 0x0042, 0x0307},
+	{0x1E03, 0x0062, 0x0307}, {0x1E04, 0x0042, 0x0323}, {0x1E05, 0x0062, 0x0323},
+	{0x1E06, 0x0042, 0x0331}, {0x1E07, 0x0062, 0x0331}, {0x1E08, 0x00C7, 0x0301},
+	{0x1E09, 0x00E7, 0x0301}, {0x1E0A, 0x0044, 0x0307}, {0x1E0B, 0x0064, 0x0307},
+	{0x1E0C, 0x0044, 0x0323}, {0x1E0D, 0x0064, 0x0323}, {0x1E0E, 0x0044, 0x0331},
+	{0x1E0F, 0x0064, 0x0331}, {0x1E10, 0x0044, 0x0327}, {0x1E11, 0x0064, 0x0327},
+	{0x1E12, 0x0044, 0x032D}, {0x1E13, 0x0064, 0x032D}, {0x1E14, 0x0112, 0x0300},
+	{0x1E15, 0x0113, 0x0300}, {0x1E16, 0x0112, 0x0301}, {0x1E17, 0x0113, 0x0301},
+	{0x1E18, 0x0045, 0x032D}, {0x1E19, 0x0065, 0x032D}, {0x1E1A, 0x0045, 0x0330},
+	{0x1E1B, 0x0065, 0x0330}, {0x1E1C, 0x0228, 0x0306}, {0x1E1D, 0x0229, 0x0306},
+	{0x1E1E, 0x0046, 0x0307}, {0x1E1F, 0x0066, 0x0307}, {0x1E20, 0x0047, 0x0304},
+	{0x1E21, 0x0067, 0x0304}, {0x1E22, 0x0048, 0x0307}, {0x1E23, 0x0068, 0x0307},
+	{0x1E24, 0x0048, 0x0323}, {0x1E25, 0x0068, 0x0323}, {0x1E26, 0x0048, 0x0308},
+	{0x1E27, 0x0068, 0x0308}, {0x1E28, 0x0048, 0x0327}, {0x1E29, 0x0068, 0x0327},
+	{0x1E2A, 0x0048, 0x032E}, {0x1E2B, 0x0068, 0x032E}, {0x1E2C, 0x0049, 0x0330},
+	{0x1E2D, 0x0069, 0x0330}, {0x1E2E, 0x00CF, 0x0301}, {0x1E2F, 0x00EF, 0x0301},
+	{0x1E30, 0x004B, 0x0301}, {0x1E31, 0x006B, 0x0301}, {0x1E32, 0x004B, 0x0323},
+	{0x1E33, 0x006B, 0x0323}, {0x1E34, 0x004B, 0x0331}, {0x1E35, 0x006B, 0x0331},
+	{0x1E36, 0x004C, 0x0323}, {0x1E37, 0x006C, 0x0323}, {0x1E38, 0x1E36, 0x0304},
+	{0x1E39, 0x1E37, 0x0304}, {0x1E3A, 0x004C, 0x0331}, {0x1E3B, 0x006C, 0x0331},
+	{0x1E3C, 0x004C, 0x032D}, {0x1E3D, 0x006C, 0x032D}, {0x1E3E, 0x004D, 0x0301},
+	{0x1E3F, 0x006D, 0x0301}, {0x1E40, 0x004D, 0x0307}, {0x1E41, 0x006D, 0x0307},
+	{0x1E42, 0x004D, 0x0323}, {0x1E43, 0x006D, 0x0323}, {0x1E44, 0x004E, 0x0307},
+	{0x1E45, 0x006E, 0x0307}, {0x1E46, 0x004E, 0x0323}, {0x1E47, 0x006E, 0x0323},
+	{0x1E48, 0x004E, 0x0331}, {0x1E49, 0x006E, 0x0331}, {0x1E4A, 0x004E, 0x032D},
+	{0x1E4B, 0x006E, 0x032D}, {0x1E4C, 0x00D5, 0x0301}, {0x1E4D, 0x00F5, 0x0301},
+	{0x1E4E, 0x00D5, 0x0308}, {0x1E4F, 0x00F5, 0x0308}, {0x1E50, 0x014C, 0x0300},
+	{0x1E51, 0x014D, 0x0300}, {0x1E52, 0x014C, 0x0301}, {0x1E53, 0x014D, 0x0301},
+	{0x1E54, 0x0050, 0x0301}, {0x1E55, 0x0070, 0x0301}, {0x1E56, 0x0050, 0x0307},
+	{0x1E57, 0x0070, 0x0307}, {0x1E58, 0x0052, 0x0307}, {0x1E59, 0x0072, 0x0307},
+	{0x1E5A, 0x0052, 0x0323}, {0x1E5B, 0x0072, 0x0323}, {0x1E5C, 0x1E5A, 0x0304},
+	{0x1E5D, 0x1E5B, 0x0304}, {0x1E5E, 0x0052, 0x0331}, {0x1E5F, 0x0072, 0x0331},
+	{0x1E60, 0x0053, 0x0307}, {0x1E61, 0x0073, 0x0307}, {0x1E62, 0x0053, 0x0323},
+	{0x1E63, 0x0073, 0x0323}, {0x1E64, 0x015A, 0x0307}, {0x1E65, 0x015B, 0x0307},
+	{0x1E66, 0x0160, 0x0307}, {0x1E67, 0x0161, 0x0307}, {0x1E68, 0x1E62, 0x0307},
+	{0x1E69, 0x1E63, 0x0307}, {0x1E6A, 0x0054, 0x0307}, {0x1E6B, 0x0074, 0x0307},
+	{0x1E6C, 0x0054, 0x0323}, {0x1E6D, 0x0074, 0x0323}, {0x1E6E, 0x0054, 0x0331},
+	{0x1E6F, 0x0074, 0x0331}, {0x1E70, 0x0054, 0x032D}, {0x1E71, 0x0074, 0x032D},
+	{0x1E72, 0x0055, 0x0324}, {0x1E73, 0x0075, 0x0324}, {0x1E74, 0x0055, 0x0330},
+	{0x1E75, 0x0075, 0x0330}, {0x1E76, 0x0055, 0x032D}, {0x1E77, 0x0075, 0x032D},
+	{0x1E78, 0x0168, 0x0301}, {0x1E79, 0x0169, 0x0301}, {0x1E7A, 0x016A, 0x0308},
+	{0x1E7B, 0x016B, 0x0308}, {0x1E7C, 0x0056, 0x0303}, {0x1E7D, 0x0076, 0x0303},
+	{0x1E7E, 0x0056, 0x0323}, {0x1E7F, 0x0076, 0x0323}, {0x1E80, 0x0057, 0x0300},
+	{0x1E81, 0x0077, 0x0300}, {0x1E82, 0x0057, 0x0301}, {0x1E83, 0x0077, 0x0301},
+	{0x1E84, 0x0057, 0x0308}, {0x1E85, 0x0077, 0x0308}, {0x1E86, 0x0057, 0x0307},
+	{0x1E87, 0x0077, 0x0307}, {0x1E88, 0x0057, 0x0323}, {0x1E89, 0x0077, 0x0323},
+	{0x1E8A, 0x0058, 0x0307}, {0x1E8B, 0x0078, 0x0307}, {0x1E8C, 0x0058, 0x0308},
+	{0x1E8D, 0x0078, 0x0308}, {0x1E8E, 0x0059, 0x0307}, {0x1E8F, 0x0079, 0x0307},
+	{0x1E90, 0x005A, 0x0302}, {0x1E91, 0x007A, 0x0302}, {0x1E92, 0x005A, 0x0323},
+	{0x1E93, 0x007A, 0x0323}, {0x1E94, 0x005A, 0x0331}, {0x1E95, 0x007A, 0x0331},
+	{0x1E96, 0x0068, 0x0331}, {0x1E97, 0x0074, 0x0308}, {0x1E98, 0x0077, 0x030A},
+	{0x1E99, 0x0079, 0x030A}, {0x1E9B, 0x017F, 0x0307}, {0x1EA0, 0x0041, 0x0323},
+	{0x1EA1, 0x0061, 0x0323}, {0x1EA2, 0x0041, 0x0309}, {0x1EA3, 0x0061, 0x0309},
+	{0x1EA4, 0x00C2, 0x0301}, {0x1EA5, 0x00E2, 0x0301}, {0x1EA6, 0x00C2, 0x0300},
+	{0x1EA7, 0x00E2, 0x0300}, {0x1EA8, 0x00C2, 0x0309}, {0x1EA9, 0x00E2, 0x0309},
+	{0x1EAA, 0x00C2, 0x0303}, {0x1EAB, 0x00E2, 0x0303}, {0x1EAC, 0x1EA0, 0x0302},
+	{0x1EAD, 0x1EA1, 0x0302}, {0x1EAE, 0x0102, 0x0301}, {0x1EAF, 0x0103, 0x0301},
+	{0x1EB0, 0x0102, 0x0300}, {0x1EB1, 0x0103, 0x0300}, {0x1EB2, 0x0102, 0x0309},
+	{0x1EB3, 0x0103, 0x0309}, {0x1EB4, 0x0102, 0x0303}, {0x1EB5, 0x0103, 0x0303},
+	{0x1EB6, 0x1EA0, 0x0306}, {0x1EB7, 0x1EA1, 0x0306}, {0x1EB8, 0x0045, 0x0323},
+	{0x1EB9, 0x0065, 0x0323}, {0x1EBA, 0x0045, 0x0309}, {0x1EBB, 0x0065, 0x0309},
+	{0x1EBC, 0x0045, 0x0303}, {0x1EBD, 0x0065, 0x0303}, {0x1EBE, 0x00CA, 0x0301},
+	{0x1EBF, 0x00EA, 0x0301}, {0x1EC0, 0x00CA, 0x0300}, {0x1EC1, 0x00EA, 0x0300},
+	{0x1EC2, 0x00CA, 0x0309}, {0x1EC3, 0x00EA, 0x0309}, {0x1EC4, 0x00CA, 0x0303},
+	{0x1EC5, 0x00EA, 0x0303}, {0x1EC6, 0x1EB8, 0x0302}, {0x1EC7, 0x1EB9, 0x0302},
+	{0x1EC8, 0x0049, 0x0309}, {0x1EC9, 0x0069, 0x0309}, {0x1ECA, 0x0049, 0x0323},
+	{0x1ECB, 0x0069, 0x0323}, {0x1ECC, 0x004F, 0x0323}, {0x1ECD, 0x006F, 0x0323},
+	{0x1ECE, 0x004F, 0x0309}, {0x1ECF, 0x006F, 0x0309}, {0x1ED0, 0x00D4, 0x0301},
+	{0x1ED1, 0x00F4, 0x0301}, {0x1ED2, 0x00D4, 0x0300}, {0x1ED3, 0x00F4, 0x0300},
+	{0x1ED4, 0x00D4, 0x0309}, {0x1ED5, 0x00F4, 0x0309}, {0x1ED6, 0x00D4, 0x0303},
+	{0x1ED7, 0x00F4, 0x0303}, {0x1ED8, 0x1ECC, 0x0302}, {0x1ED9, 0x1ECD, 0x0302},
+	{0x1EDA, 0x01A0, 0x0301}, {0x1EDB, 0x01A1, 0x0301}, {0x1EDC, 0x01A0, 0x0300},
+	{0x1EDD, 0x01A1, 0x0300}, {0x1EDE, 0x01A0, 0x0309}, {0x1EDF, 0x01A1, 0x0309},
+	{0x1EE0, 0x01A0, 0x0303}, {0x1EE1, 0x01A1, 0x0303}, {0x1EE2, 0x01A0, 0x0323},
+	{0x1EE3, 0x01A1, 0x0323}, {0x1EE4, 0x0055, 0x0323}, {0x1EE5, 0x0075, 0x0323},
+	{0x1EE6, 0x0055, 0x0309}, {0x1EE7, 0x0075, 0x0309}, {0x1EE8, 0x01AF, 0x0301},
+	{0x1EE9, 0x01B0, 0x0301}, {0x1EEA, 0x01AF, 0x0300}, {0x1EEB, 0x01B0, 0x0300},
+	{0x1EEC, 0x01AF, 0x0309}, {0x1EED, 0x01B0, 0x0309}, {0x1EEE, 0x01AF, 0x0303},
+	{0x1EEF, 0x01B0, 0x0303}, {0x1EF0, 0x01AF, 0x0323}, {0x1EF1, 0x01B0, 0x0323},
+	{0x1EF2, 0x0059, 0x0300}, {0x1EF3, 0x0079, 0x0300}, {0x1EF4, 0x0059, 0x0323},
+	{0x1EF5, 0x0079, 0x0323}, {0x1EF6, 0x0059, 0x0309}, {0x1EF7, 0x0079, 0x0309},
+	{0x1EF8, 0x0059, 0x0303}, {0x1EF9, 0x0079, 0x0303},
+};
+
+/* Spacing forms that stand in for combining marks a font does not have */
+static const std::pair<char32_t, char32_t> mark_spacing[] = {
+	{0x0300, 0x0060}, {0x0301, 0x00B4}, {0x0302, 0x005E}, {0x0303, 0x007E},
+	{0x0304, 0x00AF}, {0x0306, 0x02D8}, {0x0307, 0x02D9}, {0x0308, 0x00A8},
+	{0x030A, 0x02DA}, {0x030B, 0x02DD}, {0x030C, 0x02C7}, {0x0323, 0x002E},
+	{0x0324, 0x00A8}, {0x0325, 0x02DA}, {0x0326, 0x002C}, {0x0327, 0x00B8},
+	{0x0328, 0x02DB}, {0x032D, 0x005E}, {0x032E, 0x02D8}, {0x0330, 0x007E},
+	{0x0331, 0x00AF},
+};
+
+enum mark_place {
+	MARK_ABOVE, MARK_BELOW, MARK_ATTACH_BELOW, MARK_ATTACH_BELOW_RIGHT,
+	MARK_ATTACH_RIGHT,
+};
+
+static enum mark_place mark_place_of(char32_t m)
+{
+	switch (m) {
+	case 0x031B: return MARK_ATTACH_RIGHT;
+	case 0x0327: return MARK_ATTACH_BELOW;
+	case 0x0328: return MARK_ATTACH_BELOW_RIGHT;
+	}
+	return (m >= 0x0316 && m <= 0x0333) || (m >= 0x0339 && m <= 0x033C) ?
+	       MARK_BELOW : MARK_ABOVE;
+}
+
+/**
+ * Place @mark relative to the ink box of @base and OR it in. Marks above and
+ * below keep one empty row to the base when the cell has room for it, and
+ * are pushed back into the cell when it does not.
+ */
+static glyph compose_glyph(const glyph &base, const glyph *mark, enum mark_place place)
+{
+	glyph out = base;
+	if (mark == nullptr)
+		return out;
+	auto m = mark->ink_bounds();
+	if (m.w == 0)
+		return out;
+	auto b = base.ink_bounds();
+	if (b.w == 0)
+		b = vfpos() | base.m_size;
+	int W = base.m_size.w, H = base.m_size.h;
+	int mtop = m.y, mbot = m.y + m.h, mleft = m.x, mright = m.x + m.w;
+	int dx = b.x + (static_cast<int>(b.w) - static_cast<int>(m.w)) / 2 - mleft, dy = 0;
+	switch (place) {
+	case MARK_ABOVE:
+		dy = b.y - 1 - mbot;
+		if (dy + mtop < 0)
+			++dy;
+		break;
+	case MARK_BELOW:
+		dy = b.y + b.h + 1 - mtop;
+		if (dy + mbot > H)
+			--dy;
+		break;
+	case MARK_ATTACH_BELOW:
+		dy = b.y + b.h - mtop;
+		break;
+	case MARK_ATTACH_BELOW_RIGHT:
+		dx = b.x + b.w - mright;
+		dy = b.y + b.h - mtop;
+		break;
+	case MARK_ATTACH_RIGHT:
+		dx = b.x + b.w - mleft;
+		dy = b.y - mtop;
+		break;
+	}
+	dx = std::max(-mleft, std::min(dx, W - mright));
+	dy = std::max(-mtop, std::min(dy, H - mbot));
+	out.blit_or(*mark, dx, dy);
+	return out;
+}
+
+/**
+ * Read the canonical decompositions from a UnicodeData.txt-style file
+ * (field 0: codepoint, field 5: decomposition). Compatibility
+ * decompositions (<tag>...) are skipped.
+ */
+static int load_decomp(const char *file, std::map<char32_t, std::pair<char32_t, char32_t>> &dm)
+{
+	std::unique_ptr<FILE, deleter> fp(vfopen(file, "r"));
+	if (fp == nullptr)
+		return -errno;
+	hxmc_t *line = nullptr;
+	auto lineclean = make_scope_success([&]() { HXmc_free(line); });
+	while (HX_getl(&line, fp.get()) != nullptr) {
+		char *end;
+		char32_t cp = strtoul(line, &end, 16);
+		if (end == line || *end != ';')
+			continue;
+		const char *f = end;
+		for (unsigned int i = 0; i < 4 && f != nullptr; ++i)
+			f = strchr(f + 1, ';');
+		if (f == nullptr || *++f == '<' || *f == ';')
+			continue;
+		char32_t base = strtoul(f, &end, 16), mark = 0;
+		if (end == f)
+			continue;
+		if (*end == ' ')
+			mark = strtoul(end + 1, &end, 16);
+		dm[cp] = {base, mark};
+	}
+	return 0;
+}
+
+/**
+ * Synthesize every precomposed character of the decomposition table that the
+ * font lacks, but whose base and mark it has (marks fall back to their spacing
+ * forms). Each round composes all currently reachable characters in
+ * parallel; further rounds pick up those whose base was only just made
+ * (Vietnamese letters with two marks, for example). Returns the number of
+ * glyphs added.
+ */
+int font::compose(const char *file)
+{
+	if (m_unicode_map == nullptr) {
+		fprintf(stderr, "This font has no unicode map, can't perform COMPOSE command.\n");
+		return -EINVAL;
+	}
+	std::map<char32_t, std::pair<char32_t, char32_t>> dm;
+	if (file != nullptr) {
+		auto ret = load_decomp(file, dm);
+		if (ret < 0)
+			return ret;
+	} else {
+		for (const auto &e : builtin_decomp)
+			dm[e.cp] = {e.base, e.mark};
+	}
+	auto find_mark = [&](char32_t mk) -> ssize_t {
+		auto idx = m_unicode_map->to_index(mk);
+		if (idx >= 0)
+			return idx;
+		for (const auto &e : mark_spacing)
+			if (e.first == mk)
+				return m_unicode_map->to_index(e.second);
+		return -1;
+	};
+
+	struct job { char32_t cp; size_t base; ssize_t mark; char32_t mark_cp; };
+	int added = 0;
+	while (true) {
+		std::vector<job> todo;
+		for (const auto &[cp, bm] : dm) {
+			if (m_unicode_map->to_index(cp) >= 0)
+				continue;
+			auto b = m_unicode_map->to_index(bm.first);
+			auto mk = bm.second != 0 ? find_mark(bm.second) : -1;
+			if (b < 0 || (bm.second != 0 && mk < 0))
+				continue;
+			todo.push_back({cp, static_cast<size_t>(b), mk, bm.second});
+		}
+		if (todo.empty())
+			break;
+		std::vector<glyph> out(todo.size());
+		parallel_for(todo.size(), [&](size_t i) {
+			const auto &j = todo[i];
+			out[i] = compose_glyph(m_glyph[j.base], j.mark >= 0 ? &m_glyph[j.mark] : nullptr,
+			         mark_place_of(j.mark_cp));
+		});
+		for (size_t i = 0; i < todo.size(); ++i) {
+			m_unicode_map->add_i2u(m_glyph.size(), todo[i].cp);
+			m_glyph.push_back(std::move(out[i]));
+		}
+		added += todo.size();
+	}
+	return added;
+}
+
+namespace {
+
+/* One glyph under construction, as a bitmask per row (MSB side is x=0) */
+struct rowcanvas {
+	rowcanvas(const vfsize &s) : w(s.w), h(s.h), row(s.h) {}
+	void fill(int x0, int y0, int x1, int y1);
+	glyph to_glyph() const;
+	int w, h;
+	std::vector<uint64_t> row;
+};
+
+}
+
+/* Set the pixels of [@x0,@x1) x [@y0,@y1), clipped to the cell */
+void rowcanvas::fill(int x0, int y0, int x1, int y1)
+{
+	x0 = std::max(x0, 0);
+	x1 = std::min(x1, w);
+	y0 = std::max(y0, 0);
+	y1 = std::min(y1, h);
+	if (x0 >= x1)
+		return;
+	uint64_t span = ((~0ULL) >> (64 - (x1 - x0))) << (w - x1);
+	for (int y = y0; y < y1; ++y)
+		row[y] |= span;
+}
+
+glyph rowcanvas::to_glyph() const
+{
+	glyph g(vfsize(w, h));
+	for (int y = 0; y < h; ++y)
+		if (row[y] != 0)
+			bits_or(g.m_data, y * w, w, row[y]);
+	return g;
+}
+
+/*
+ * Arms of U+2500..U+257F as nibbles left/up/right/down: 0 none, 1 light,
+ * 2 heavy, 3 double. Arcs and diagonals are 0 and drawn separately.
+ */
+static const uint16_t box_arms[] = {
+	0x1010, 0x2020, 0x0101, 0x0202, 0x1010, 0x2020, 0x0101, 0x0202, /* U+2500 */
+	0x1010, 0x2020, 0x0101, 0x0202, 0x0011, 0x0021, 0x0012, 0x0022, /* U+2508 */
+	0x1001, 0x2001, 0x1002, 0x2002, 0x0110, 0x0120, 0x0210, 0x0220, /* U+2510 */
+	0x1100, 0x2100, 0x1200, 0x2200, 0x0111, 0x0121, 0x0211, 0x0112, /* U+2518 */
+	0x0212, 0x0221, 0x0122, 0x0222, 0x1101, 0x2101, 0x1201, 0x1102, /* U+2520 */
+	0x1202, 0x2201, 0x2102, 0x2202, 0x1011, 0x2011, 0x1021, 0x2021, /* U+2528 */
+	0x1012, 0x2012, 0x1022, 0x2022, 0x1110, 0x2110, 0x1120, 0x2120, /* U+2530 */
+	0x1210, 0x2210, 0x1220, 0x2220, 0x1111, 0x2111, 0x1121, 0x2121, /* U+2538 */
+	0x1211, 0x1112, 0x1212, 0x2211, 0x1221, 0x2112, 0x1122, 0x2221, /* U+2540 */
+	0x2122, 0x2212, 0x1222, 0x2222, 0x1010, 0x2020, 0x0101, 0x0202, /* U+2548 */
+	0x3030, 0x0303, 0x0031, 0x0013, 0x0033, 0x3001, 0x1003, 0x3003, /* U+2550 */
+	0x0130, 0x0310, 0x0330, 0x3100, 0x1300, 0x3300, 0x0131, 0x0313, /* U+2558 */
+	0x0333, 0x3101, 0x1303, 0x3303, 0x3031, 0x1013, 0x3033, 0x3130, /* U+2560 */
+	0x1310, 0x3330, 0x3131, 0x1313, 0x3333, 0x0000, 0x0000, 0x0000, /* U+2568 */
+	0x0000, 0x0000, 0x0000, 0x0000, 0x1000, 0x0100, 0x0010, 0x0001, /* U+2570 */
+	0x2000, 0x0200, 0x0020, 0x0002, 0x1020, 0x0102, 0x2010, 0x0201, /* U+2578 */
+};
+
+namespace {
+
+struct box_metrics {
+	box_metrics(const vfsize &s) :
+		w(s.w), h(s.h), cx((s.w - 1) / 2), cy((s.h - 1) / 2),
+		t(std::max(1U, (std::min(s.w, s.h / 2) + 4) / 8))
+	{}
+	/* Line thickness by arm weight; a double line is drawn as a 3t band with a t gap */
+	int thick(unsigned int wt) const { return wt == 1 ? t : wt == 2 ? 2 * t : 3 * t; }
+	static int lo(int c, int th) { return c - (th - 1) / 2; }
+	int w, h, cx, cy, t;
+};
+
+}
+
+/**
+ * Draw the arms in @arms whose weight is accepted by @sel, each from the cell
+ * edge to the far side of the perpendicular strokes. @th gives the thickness
+ * per weight, for the drawn and the perpendicular strokes alike.
+ */
+template<typename Sel, typename Th> static void box_draw_arms(rowcanvas &c,
+    const box_metrics &m, unsigned int arms, Sel &&sel, Th &&th)
+{
+	unsigned int l = (arms >> 12) & 0xF, u = (arms >> 8) & 0xF;
+	unsigned int r = (arms >> 4) & 0xF, d = arms & 0xF;
+	/* Extent of the vertical and horizontal strokes, if any */
+	int vlo = INT_MAX, vhi = INT_MIN, hlo = INT_MAX, hhi = INT_MIN;
+	for (auto wt : {u, d})
+		if (wt != 0) {
+			vlo = std::min(vlo, box_metrics::lo(m.cx, th(wt)));
+			vhi = std::max(vhi, box_metrics::lo(m.cx, th(wt)) + th(wt));
+		}
+	for (auto wt : {l, r})
+		if (wt != 0) {
+			hlo = std::min(hlo, box_metrics::lo(m.cy, th(wt)));
+			hhi = std::max(hhi, box_metrics::lo(m.cy, th(wt)) + th(wt));
+		}
+	/* A half line (╴╵╶╷) ends at the far side of its own stroke */
+	if (vlo > vhi) {
+		vlo = box_metrics::lo(m.cx, m.t);
+		vhi = vlo + m.t;
+	}
+	if (hlo > hhi) {
+		hlo = box_metrics::lo(m.cy, m.t);
+		hhi = hlo + m.t;
+	}
+	auto hband = [&](unsigned int wt, int x0, int x1) {
+		auto y = box_metrics::lo(m.cy, th(wt));
+		c.fill(x0, y, x1, y + th(wt));
+	};
+	auto vband = [&](unsigned int wt, int y0, int y1) {
+		auto x = box_metrics::lo(m.cx, th(wt));
+		c.fill(x, y0, x + th(wt), y1);
+	};
+	if (l != 0 && sel(l))
+		hband(l, 0, vhi);
+	if (r != 0 && sel(r))
+		hband(r, vlo, m.w);
+	if (u != 0 && sel(u))
+		vband(u, 0, hhi);
+	if (d != 0 && sel(d))
+		vband(d, hlo, m.h);
+}
+
+/*
+ * Double lines are the outline of a triple-thick stroke: draw the 3t bands,
+ * carve out the t-wide middle with the same rules, then add the single and
+ * heavy strokes on top. That yields the open corners and T-junctions of the
+ * ╔╦╬ family without per-character special cases.
+ */
+static glyph box_lines(const box_metrics &m, unsigned int arms)
+{
+	rowcanvas dbl(vfsize(m.w, m.h)), gap(dbl), single(dbl);
+	auto is_dbl = [](unsigned int wt) { return wt == 3; };
+	auto th = [&](unsigned int wt) { return m.thick(wt); };
+	box_draw_arms(dbl, m, arms, is_dbl, th);
+	box_draw_arms(gap, m, arms, is_dbl, [&](unsigned int) { return m.t; });
+	box_draw_arms(single, m, arms, [](unsigned int wt) { return wt != 3; }, th);
+	for (int y = 0; y < m.h; ++y)
+		dbl.row[y] = (dbl.row[y] & ~gap.row[y]) | single.row[y];
+	return dbl.to_glyph();
+}
+
+/* Knock @n - 1 gaps into a straight line, along x or y */
+static void box_dashes(rowcanvas &c, unsigned int n, bool vertical)
+{
+	int len = vertical ? c.h : c.w;
+	int gap = std::max(1, len / static_cast<int>(n) / 4);
+	uint64_t keep = 0;
+	std::vector<bool> on(len, true);
+	for (unsigned int i = 1; i <= n; ++i)
+		for (int p = i * len / n - gap; p < static_cast<int>(i * len / n); ++p)
+			on[p] = false;
+	if (vertical) {
+		for (int y = 0; y < c.h; ++y)
+			if (!on[y])
+				c.row[y] = 0;
+		return;
+	}
+	for (int x = 0; x < c.w; ++x)
+		if (on[x])
+			keep |= 1ULL << (c.w - 1 - x);
+	for (auto &r : c.row)
+		r &= keep;
+}
+
+/* Quarter circle joining a horizontal arm on side @sx and a vertical one on side @sy */
+static glyph box_arc(const box_metrics &m, int sx, int sy)
+{
+	rowcanvas c(vfsize(m.w, m.h));
+	double r = std::max(1, std::min(m.w, m.h) / 4);
+	double vc = box_metrics::lo(m.cx, m.t) + m.t / 2.0;
+	double hc = box_metrics::lo(m.cy, m.t) + m.t / 2.0;
+	double ax = vc + sx * r, ay = hc + sy * r;
+	for (int y = 0; y < m.h; ++y) {
+		for (int x = 0; x < m.w; ++x) {
+			double px = x + 0.5, py = y + 0.5;
+			if ((px - ax) * sx > 0 || (py - ay) * sy > 0)
+				continue;
+			if (std::abs(std::hypot(px - ax, py - ay) - r) < m.t / 2.0 + 0.25)
+				c.fill(x, y, x + 1, y + 1);
+		}
+	}
+	int xa = std::lround(ax), ya = std::lround(ay);
+	int y0 = box_metrics::lo(m.cy, m.t), x0 = box_metrics::lo(m.cx, m.t);
+	if (sx > 0)
+		c.fill(xa, y0, m.w, y0 + m.t);
+	else
+		c.fill(0, y0, xa, y0 + m.t);
+	if (sy > 0)
+		c.fill(x0, ya, x0 + m.t, m.h);
+	else
+		c.fill(x0, 0, x0 + m.t, ya);
+	return c.to_glyph();
+}
+
+/* Corner-to-corner diagonals; @mask bit 0: ╱, bit 1: ╲ */
+static glyph box_diagonal(const box_metrics &m, unsigned int mask)
+{
+	rowcanvas c(vfsize(m.w, m.h));
+	for (int y = 0; y < m.h; ++y) {
+		/* Horizontal run of the line within this row */
+		double a = static_cast<double>(y) * m.w / m.h;
+		double b = static_cast<double>(y + 1) * m.w / m.h;
+		int x0 = std::floor(a), x1 = std::max<int>(std::ceil(b), x0 + m.t);
+		if (mask & 2)
+			c.fill(x0, y, x1, y + 1);
+		if (mask & 1)
+			c.fill(m.w - x1, y, m.w - x0, y + 1);
+	}
+	return c.to_glyph();
+}
+
+static glyph block_element(const vfsize &sz, char32_t cp)
+{
+	rowcanvas c(sz);
+	int w = sz.w, h = sz.h;
+	auto eighth = [](int len, int n) { return (len * n + 4) / 8; };
+	/* UL, UR, LL, LR for U+2596..U+259F */
+	static const uint8_t quad[] = {4, 8, 1, 13, 9, 7, 11, 2, 6, 14};
+	if (cp == 0x2580) {
+		c.fill(0, 0, w, h / 2);
+	} else if (cp >= 0x2581 && cp <= 0x2588) {
+		c.fill(0, h - eighth(h, cp - 0x2580), w, h);
+	} else if (cp >= 0x2589 && cp <= 0x258F) {
+		c.fill(0, 0, eighth(w, 0x2590 - cp), h);
+	} else if (cp == 0x2590) {
+		c.fill(w / 2, 0, w, h);
+	} else if (cp >= 0x2591 && cp <= 0x2593) {
+		for (int y = 0; y < h; ++y)
+			for (int x = 0; x < w; ++x) {
+				bool light = y % 2 == 0 && (x + y / 2) % 2 == 0;
+				bool on = cp == 0x2591 ? light : cp == 0x2592 ?
+				          (x + y) % 2 == 0 : !light;
+				if (on)
+					c.fill(x, y, x + 1, y + 1);
+			}
+	} else if (cp == 0x2594) {
+		c.fill(0, 0, w, eighth(h, 1));
+	} else if (cp == 0x2595) {
+		c.fill(w - eighth(w, 1), 0, w, h);
+	} else if (cp >= 0x2596 && cp <= 0x259F) {
+		auto q = quad[cp - 0x2596];
+		if (q & 1)
+			c.fill(0, 0, w / 2, h / 2);
+		if (q & 2)
+			c.fill(w / 2, 0, w, h / 2);
+		if (q & 4)
+			c.fill(0, h / 2, w / 2, h);
+		if (q & 8)
+			c.fill(w / 2, h / 2, w, h);
+	}
+	return c.to_glyph();
+}
+
+/* U+2800+@dots: dots 1-3,7 in the left column, 4-6,8 in the right one */
+static glyph braille(const vfsize &sz, unsigned int dots)
+{
+	static const uint8_t col[] = {0, 0, 0, 1, 1, 1, 0, 1};
+	static const uint8_t lin[] = {0, 1, 2, 0, 1, 2, 3, 3};
+	rowcanvas c(sz);
+	int w = sz.w, h = sz.h;
+	int d = std::max(1, std::min(w, h / 2) / 4);
+	for (unsigned int i = 0; i < 8; ++i) {
+		if (!(dots & (1U << i)))
+			continue;
+		int x = w * (2 * col[i] + 1) / 4 - d / 2;
+		int y = h * (2 * lin[i] + 1) / 8 - d / 2;
+		c.fill(x, y, x + d, y + d);
+	}
+	return c.to_glyph();
+}
+
+/**
+ * Draw U+2500..U+259F (box drawing and block elements) and U+2800..U+28FF
+ * (braille patterns) for a cell of @sz. Line thickness scales with the cell
+ * (1 pixel up to 11 pixels wide, heavy lines twice that).
+ */
+glyph vfalib::synth_box_glyph(const vfsize &sz, char32_t cp)
+{
+	box_metrics m(sz);
+	if (sz.w == 0 || sz.h == 0 || sz.w > 57)
+		return glyph(sz);
+	if (cp >= 0x2800 && cp <= 0x28FF)
+		return braille(sz, cp - 0x2800);
+	if (cp >= 0x2580 && cp <= 0x259F)
+		return block_element(sz, cp);
+	if (cp < 0x2500 || cp > 0x257F)
+		return glyph(sz);
+	switch (cp) {
+	case 0x256D: return box_arc(m, 1, 1);
+	case 0x256E: return box_arc(m, -1, 1);
+	case 0x256F: return box_arc(m, -1, -1);
+	case 0x2570: return box_arc(m, 1, -1);
+	case 0x2571: return box_diagonal(m, 1);
+	case 0x2572: return box_diagonal(m, 2);
+	case 0x2573: return box_diagonal(m, 3);
+	}
+	auto g = box_lines(m, box_arms[cp - 0x2500]);
+	unsigned int n = 0;
+	if (cp >= 0x2504 && cp <= 0x250B)
+		n = cp <= 0x2507 ? 3 : 4;
+	else if (cp >= 0x254C && cp <= 0x254F)
+		n = 2;
+	if (n == 0)
+		return g;
+	rowcanvas c(sz);
+	for (unsigned int y = 0; y < sz.h; ++y)
+		c.row[y] = bits_get(g.m_data, y * sz.w, sz.w);
+	box_dashes(c, n, cp & 2);
+	return c.to_glyph();
+}
+
+/**
+ * Put generated box drawing, block and braille glyphs (see synth_box_glyph)
+ * into the font, in the cell size of its first glyph. Codepoints the font
+ * already has are only redrawn with @replace. Returns the number of glyphs
+ * written.
+ */
+int font::synth_boxes(bool replace)
+{
+	vfsize sz = m_glyph.size() > 0 ? m_glyph[0].m_size : vfsize(8, 16);
+	if (m_unicode_map == nullptr) {
+		if (m_glyph.size() > 0) {
+			fprintf(stderr, "This font has no unicode map, can't perform SYNTHBOX command.\n");
+			return -EINVAL;
+		}
+		m_unicode_map = std::make_shared<unicode_map>();
+	}
+	if (sz.w > 57) {
+		fprintf(stderr, "synthbox: cells wider than 57 pixels are not supported.\n");
+		return -EINVAL;
+	}
+	int n = 0;
+	auto gen = [&](char32_t cp) {
+		auto idx = m_unicode_map->to_index(cp);
+		if (idx >= 0 && !replace)
+			return;
+		auto g = synth_box_glyph(sz, cp);
+		if (idx >= 0) {
+			m_glyph[idx] = std::move(g);
+		} else {
+			m_unicode_map->add_i2u(m_glyph.size(), cp);
+			m_glyph.push_back(std::move(g));
+		}
+		++n;
+	};
+	for (char32_t cp = 0x2500; cp <= 0x259F; ++cp)
+		gen(cp);
+	for (char32_t cp = 0x2800; cp <= 0x28FF; ++cp)
+		gen(cp);
+	return n;
+}
+
 struct bdfglystate {
 	int uc = -1, w = 0, h = 0, of_left = 0, of_baseline = 0;
 	unsigned int dwidth = 0, lr = 0;
@@ -391,14 +1879,20 @@ static glyph bdfcomplete(const bdfglystate &cchar)
 
 #include "glynames.cpp"
 
-static std::string translate_charname(const char *s)
+/**
+ * Map a glyph name to "C<codepoint>" if possible. The result is stored in
+ * @out, so that its buffer is reused from one glyph to the next.
+ */
+static void translate_charname(const char *s, std::string &out)
 {
 	if (*s == 'C') {
 		const char *p;
 		for (p = s; HX_isdigit(*p) && *p != '\0'; ++p)
 			;
-		if (*p == '\0')
-			return s;
+		if (*p == '\0') {
+			out.assign(s);
+			return;
+		}
 	}
 	if (strncmp(s, "uni", 3) == 0) {
 		char *end = nullptr;
@@ -406,18 +1900,21 @@ static std::string translate_charname(const char *s)
 		if (end != nullptr && *end == '\0') {
 			char buf[16];
 			snprintf(buf, sizeof(buf), "C%lu", uc);
-			return buf;
+			out.assign(buf);
+			return;
 		}
 	}
 	auto it = std::lower_bound(std::cbegin(ff_glyph_names), std::cend(ff_glyph_names), s,
 	          [](const std::pair<const char *, uint32_t> &p, const char *q) {
 	          	return strcmp(p.first, q) < 0;
 	          });
-	if (it == std::cend(ff_glyph_names) || strcmp(it->first, s) != 0)
-		return s;
+	if (it == std::cend(ff_glyph_names) || strcmp(it->first, s) != 0) {
+		out.assign(s);
+		return;
+	}
 	char buf[16];
 	snprintf(buf, sizeof(buf), "C%u", it->second);
-	return buf;
+	out.assign(buf);
 }
 
 int font::load_bdf(const char *filename)
@@ -447,7 +1944,7 @@ int font::load_bdf(const char *filename)
 			if (strncmp(line, "STARTCHAR ", 10) == 0) {
 				cchar.reset();
 				cchar.font_height = cchar.font_ascent + cchar.font_descent;
-				cchar.name = translate_charname(line + 10);
+				translate_charname(line + 10, cchar.name);
 				state = BDF_CHAR;
 				continue;
 			}
@@ -512,7 +2009,206 @@ int font::load_bdf(const char *filename)
 	return 0;
 }
 
-int font::load_clt(const char *dirname)
+static int load_clt_glyph(FILE *fp, glyph &ng, hxmc_t *&line)
+{
+	if (HX_getl(&line, fp) == nullptr)
+		return -EINVAL;
+	HX_chomp(line);
+	if (strcmp(line, "PCLT") != 0)
+		return -EINVAL;
+	if (HX_getl(&line, fp) == nullptr)
+		return -EINVAL;
+	unsigned int width = 0, height = 0, y = 0;
+	if (sscanf(line, "%u %u", &width, &height) != 2)
+		return -EINVAL;
+
+	for (ng = glyph(vfsize(width, height)); HX_getl(&line, fp) != nullptr; ++y) {
+		unsigned int x = 0;
+		for (auto p = line; *p != '\0'; ++x) {
+			bitpos opos = y * width + x;
+			if (*p == '#')
+				ng.m_data[opos.byte] |= opos.mask;
+			++p;
+			if (*p != '\0')
+				++p;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Sidecar cache for load_clt. All integers are little-endian; all sections
+ * are 8-byte aligned.
+ *
+ *	clt_cache_header
+ *	clt_cache_entry[nentries]	sorted by name
+ *	string table			file names
+ *	bitmap data			glyph::m_data of each entry
+ */
+struct clt_cache_header {
+	char magic[8];
+	uint32_t version, nentries;
+	int64_t written_ns;
+	uint64_t str_off, str_size, data_off, data_size;
+};
+
+struct clt_cache_entry {
+	uint32_t name_off, name_len;
+	int64_t mtime_ns;
+	uint64_t size, hash, data_off;
+	uint16_t width, height;
+	uint32_t data_len;
+};
+
+static constexpr char clt_cache_magic[8] = {'V', 'F', 'A', 'C', 'L', 'T', 'C', '\0'};
+enum { CLT_CACHE_VERSION = 1 };
+
+namespace {
+
+struct clt_file {
+	char32_t uc;
+	std::string name;
+	int64_t mtime_ns = -1;
+	uint64_t size = 0, hash = 0;
+	/* Cache entry to take the bitmap from, if any */
+	const clt_cache_entry *cached = nullptr;
+	bool ok = false;
+};
+
+/* A cache file read into memory; entries are validated on load */
+struct clt_cache {
+	std::string raw;
+	const clt_cache_header *hdr = nullptr;
+	std::unordered_map<std::string_view, const clt_cache_entry *> by_name;
+
+	int load(const char *file);
+	glyph get(const clt_cache_entry &) const;
+};
+
+}
+
+int clt_cache::load(const char *file)
+{
+	std::unique_ptr<FILE, deleter> fp(fopen(file, "rb"));
+	if (fp == nullptr)
+		return -errno;
+	char buf[65536];
+	size_t rd;
+	while ((rd = fread(buf, 1, sizeof(buf), fp.get())) > 0)
+		raw.append(buf, rd);
+	if (raw.size() < sizeof(clt_cache_header))
+		return -EINVAL;
+	hdr = reinterpret_cast<const clt_cache_header *>(raw.data());
+	if (memcmp(hdr->magic, clt_cache_magic, sizeof(clt_cache_magic)) != 0 ||
+	    le32_to_cpu(hdr->version) != CLT_CACHE_VERSION)
+		return -EINVAL;
+	auto within = [&](uint64_t off, uint64_t len) {
+		return off <= raw.size() && len <= raw.size() - off;
+	};
+	uint64_t n = le32_to_cpu(hdr->nentries);
+	uint64_t str_off = le64_to_cpu(hdr->str_off), str_size = le64_to_cpu(hdr->str_size);
+	uint64_t data_off = le64_to_cpu(hdr->data_off), data_size = le64_to_cpu(hdr->data_size);
+	if (!within(sizeof(*hdr), n * sizeof(clt_cache_entry)) ||
+	    !within(str_off, str_size) || !within(data_off, data_size))
+		return -EINVAL;
+	auto ent = reinterpret_cast<const clt_cache_entry *>(raw.data() + sizeof(*hdr));
+	for (uint64_t i = 0; i < n; ++i) {
+		const auto &e = ent[i];
+		uint64_t no = le32_to_cpu(e.name_off), nl = le32_to_cpu(e.name_len);
+		uint64_t dof = le64_to_cpu(e.data_off), dl = le32_to_cpu(e.data_len);
+		vfsize sz(le16_to_cpu(e.width), le16_to_cpu(e.height));
+		if (no > str_size || nl > str_size - no || dof > data_size ||
+		    dl > data_size - dof || dl != bytes_per_glyph(sz))
+			return -EINVAL;
+		by_name.emplace(std::string_view(raw.data() + str_off + no, nl), &e);
+	}
+	return 0;
+}
+
+glyph clt_cache::get(const clt_cache_entry &e) const
+{
+	glyph g(vfsize(le16_to_cpu(e.width), le16_to_cpu(e.height)));
+	g.m_data.assign(raw.data() + le64_to_cpu(hdr->data_off) + le64_to_cpu(e.data_off),
+		le32_to_cpu(e.data_len));
+	return g;
+}
+
+/* FNV-1a */
+static uint64_t clt_hash(const std::string &s)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (unsigned char c : s)
+		h = (h ^ c) * 0x100000001b3ULL;
+	return h;
+}
+
+static int clt_cache_write(const char *file, int64_t now_ns,
+    const std::vector<clt_file> &files, const std::vector<glyph> &glyphs)
+{
+	std::vector<size_t> order;
+	for (size_t i = 0; i < files.size(); ++i)
+		if (files[i].ok)
+			order.push_back(i);
+	std::sort(order.begin(), order.end(),
+		[&](size_t a, size_t b) { return files[a].name < files[b].name; });
+	std::string ents, strtab, data;
+	for (auto i : order) {
+		const auto &f = files[i];
+		const auto &g = glyphs[i];
+		clt_cache_entry e{};
+		e.name_off = cpu_to_le32(strtab.size());
+		e.name_len = cpu_to_le32(f.name.size());
+		e.mtime_ns = cpu_to_le64(f.mtime_ns);
+		e.size     = cpu_to_le64(f.size);
+		e.hash     = cpu_to_le64(f.hash);
+		e.data_off = cpu_to_le64(data.size());
+		e.width    = cpu_to_le16(g.m_size.w);
+		e.height   = cpu_to_le16(g.m_size.h);
+		e.data_len = cpu_to_le32(g.m_data.size());
+		ents.append(reinterpret_cast<const char *>(&e), sizeof(e));
+		strtab += f.name;
+		data += g.m_data;
+	}
+	strtab.append((8 - strtab.size() % 8) % 8, '\0');
+	clt_cache_header hdr{};
+	memcpy(hdr.magic, clt_cache_magic, sizeof(hdr.magic));
+	hdr.version    = cpu_to_le32(CLT_CACHE_VERSION);
+	hdr.nentries   = cpu_to_le32(order.size());
+	hdr.written_ns = cpu_to_le64(now_ns);
+	hdr.str_off    = cpu_to_le64(sizeof(hdr) + ents.size());
+	hdr.str_size   = cpu_to_le64(strtab.size());
+	hdr.data_off   = cpu_to_le64(sizeof(hdr) + ents.size() + strtab.size());
+	hdr.data_size  = cpu_to_le64(data.size());
+
+	/* Write to a temporary file and rename, so readers never see half a cache */
+	auto tmp = std::string(file) + ".tmp";
+	std::unique_ptr<FILE, deleter> fp(fopen(tmp.c_str(), "wb"));
+	if (fp == nullptr)
+		return -errno;
+	if (fwrite(&hdr, sizeof(hdr), 1, fp.get()) != 1 ||
+	    (ents.size() > 0 && fwrite(ents.data(), ents.size(), 1, fp.get()) != 1) ||
+	    (strtab.size() > 0 && fwrite(strtab.data(), strtab.size(), 1, fp.get()) != 1) ||
+	    (data.size() > 0 && fwrite(data.data(), data.size(), 1, fp.get()) != 1) ||
+	    fflush(fp.get()) != 0) {
+		auto se = errno;
+		unlink(tmp.c_str());
+		return -se;
+	}
+	fp.reset();
+	if (rename(tmp.c_str(), file) < 0) {
+		auto se = errno;
+		unlink(tmp.c_str());
+		return -se;
+	}
+	return 0;
+}
+
+/**
+ * With @cache, files whose mtime and size match the cache are not read at
+ * all, and files whose content hash matches are not parsed; the cache is
+ * rewritten when anything differed. The glyph order is the same either way.
+ */
+int font::load_clt(const char *dirname, const char *cache, clt_stats *stats)
 {
 	std::unique_ptr<HXdir, deleter> dh(HXdir_open(dirname));
 	if (dh == nullptr)
@@ -521,7 +2217,7 @@ int font::load_clt(const char *dirname)
 		m_unicode_map = std::make_shared<unicode_map>();
 
 	const char *de;
-	glyph ng;
+	std::vector<clt_file> files;
 	while ((de = HXdir_read(dh.get())) != nullptr) {
 		if (*de == '.')
 			continue;
@@ -529,21 +2225,115 @@ int font::load_clt(const char *dirname)
 		char32_t uc = strtoul(de, &end, 16);
 		if (*end != '.' || end == de)
 			continue;
-		auto fn = dirname + std::string("/") + de;
-		std::unique_ptr<FILE, deleter> fp(::fopen(fn.c_str(), "r"));
-		if (fp == nullptr) {
-			fprintf(stderr, "Error opening %s: %s\n", fn.c_str(), strerror(errno));
-			return -errno;
+		files.push_back({uc, de});
+	}
+	dh.reset();
+
+	std::string dir = dirname;
+	std::vector<glyph> glyphs(files.size());
+	clt_cache old;
+	struct timespec now{};
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t now_ns = now.tv_sec * INT64_C(1000000000) + now.tv_nsec;
+	bool dirty = false;
+	if (cache != nullptr) {
+		auto ret = old.load(cache);
+		if (ret < 0 && ret != -ENOENT)
+			fprintf(stderr, "%s: %s (ignored)\n", cache, strerror(-ret));
+		int64_t written = ret == 0 ? le64_to_cpu(old.hdr->written_ns) : 0;
+		dirty = ret < 0;
+		parallel_for(files.size(), [&](size_t i) {
+			auto &f = files[i];
+			struct stat sb;
+			if (stat((dir + "/" + f.name).c_str(), &sb) == 0) {
+				f.mtime_ns = sb.st_mtim.tv_sec * INT64_C(1000000000) + sb.st_mtim.tv_nsec;
+				f.size = sb.st_size;
+			}
+			auto j = old.by_name.find(f.name);
+			if (j == old.by_name.end())
+				return;
+			f.cached = j->second;
+			/*
+			 * A file changed within the timestamp granularity of the
+			 * previous run could still carry its recorded mtime; only
+			 * trust stat for files older than that run.
+			 */
+			if (f.mtime_ns == static_cast<int64_t>(le64_to_cpu(f.cached->mtime_ns)) &&
+			    f.size == le64_to_cpu(f.cached->size) &&
+			    f.mtime_ns + INT64_C(2000000000) < written) {
+				f.hash = le64_to_cpu(f.cached->hash);
+				glyphs[i] = old.get(*f.cached);
+				f.ok = true;
+			}
+		});
+	}
+
+	/*
+	 * Keep a window of files being read ahead while the earlier ones are
+	 * parsed, in the same order as before.
+	 */
+	static constexpr size_t window = 256;
+	std::vector<size_t> todo;
+	for (size_t i = 0; i < files.size(); ++i)
+		if (!files[i].ok)
+			todo.push_back(i);
+	async_io io;
+	std::vector<size_t> ticket(todo.size());
+	size_t issued = 0, nparsed = 0;
+	std::string buf;
+	/* One line buffer for all the files */
+	hxmc_t *line = nullptr;
+	auto lineclean = make_scope_success([&]() { HXmc_free(line); });
+	for (size_t k = 0; k < todo.size(); ++k) {
+		for (; issued < todo.size() && issued < k + window; ++issued)
+			ticket[issued] = io.prefetch(dir + "/" + files[todo[issued]].name);
+		auto &f = files[todo[k]];
+		auto fn = dir + "/" + f.name;
+		auto ret = io.fetch(ticket[k], buf);
+		if (ret < 0) {
+			fprintf(stderr, "Error opening %s: %s\n", fn.c_str(), strerror(-ret));
+			return ret;
 		}
-		auto ret = load_clt_glyph(fp.get(), ng);
+		if (cache != nullptr) {
+			f.hash = clt_hash(buf);
+			if (f.cached != nullptr && f.hash == le64_to_cpu(f.cached->hash)) {
+				/* Same content, but the new mtime is to be recorded */
+				glyphs[todo[k]] = old.get(*f.cached);
+				f.ok = dirty = true;
+				continue;
+			}
+		}
+		std::unique_ptr<FILE, deleter> fp(buf.size() > 0 ?
+			fmemopen(&buf[0], buf.size(), "r") : nullptr);
+		ret = fp != nullptr ? load_clt_glyph(fp.get(), glyphs[todo[k]], line) : -EINVAL;
 		if (ret == -EINVAL) {
 			fprintf(stderr, "%s not recognized as a CLT file\n", fn.c_str());
 			continue;
 		}
 		if (ret < 0)
 			return ret;
-		m_unicode_map->add_i2u(m_glyph.size(), uc);
-		m_glyph.emplace_back(std::move(ng));
+		f.ok = true;
+		++nparsed;
+	}
+	size_t nok = std::count_if(files.cbegin(), files.cend(),
+	             [](const clt_file &f) { return f.ok; });
+	if (stats != nullptr) {
+		stats->parsed += nparsed;
+		stats->cached += nok - nparsed;
+	}
+
+	/* Rewrite on new content or when files disappeared */
+	if (cache != nullptr && (dirty || nparsed > 0 || nok != old.by_name.size())) {
+		auto ret = clt_cache_write(cache, now_ns, files, glyphs);
+		if (ret < 0)
+			fprintf(stderr, "Could not write %s: %s\n", cache, strerror(-ret));
+	}
+
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (!files[i].ok)
+			continue;
+		m_unicode_map->add_i2u(m_glyph.size(), files[i].uc);
+		m_glyph.emplace_back(std::move(glyphs[i]));
 		auto last_idx = m_glyph.size() - 1;
 		auto repl = m_unicode_map->m_u2i.find(last_idx);
 		if (repl != m_unicode_map->m_u2i.end()) {
@@ -555,36 +2345,6 @@ int font::load_clt(const char *dirname)
 	return 0;
 }
 
-int font::load_clt_glyph(FILE *fp, glyph &ng)
-{
-	hxmc_t *line = nullptr;
-	auto lineclean = make_scope_success([&]() { HXmc_free(line); });
-
-	if (HX_getl(&line, fp) == nullptr)
-		return -EINVAL;
-	HX_chomp(line);
-	if (strcmp(line, "PCLT") != 0)
-		return -EINVAL;
-	if (HX_getl(&line, fp) == nullptr)
-		return -EINVAL;
-	unsigned int width = 0, height = 0, y = 0;
-	if (sscanf(line, "%u %u", &width, &height) != 2)
-		return -EINVAL;
-
-	for (ng = glyph(vfsize(width, height)); HX_getl(&line, fp) != nullptr; ++y) {
-		unsigned int x = 0;
-		for (auto p = line; *p != '\0'; ++x) {
-			bitpos opos = y * width + x;
-			if (*p == '#')
-				ng.m_data[opos.byte] |= opos.mask;
-			++p;
-			if (*p != '\0')
-				++p;
-		}
-	}
-	return 0;
-}
-
 int font::load_fnt(const char *file, unsigned int width, unsigned int height)
 {
 	std::unique_ptr<FILE, deleter> fp(vfopen(file, "rb"));
@@ -632,15 +2392,15 @@ int font::load_hex(const char *file)
 			continue;
 		++end;
 
-		char gbits[32]{};
+		char gbits[64]{};
 		HX_chomp(line);
 		auto z = hexrunparse(gbits, ARRAY_SIZE(gbits), end);
-		if (z == 16)
-			m_glyph.emplace_back(glyph::create_from_rpad(vfsize(8, 16), gbits, z));
-		else if (z == 32)
-			m_glyph.emplace_back(glyph::create_from_rpad(vfsize(16, 16), gbits, z));
-		else
+		/* Always 16 rows; 8, 16, 24 or 32 columns */
+		if (z == 0 || z % 16 != 0) {
 			fprintf(stderr, "load_hex: unrecognized glyph size (%zu bytes) in line %zu\n", z, lnum);
+			continue;
+		}
+		m_glyph.emplace_back(glyph::create_from_rpad(vfsize(z / 2, 16), gbits, z));
 		m_unicode_map->add_i2u(m_glyph.size() - 1, cp);
 	}
 	HXmc_free(line);
@@ -708,19 +2468,13 @@ static int load_pcf_bitmaps(FILE *fp)
 	if (fread(&offsets[0], 4, numbitmaps, fp) != numbitmaps ||
 	    fread(&bmpsize[0], 4, glypadopts, fp) != glypadopts)
 		return -EINVAL;
-	for (unsigned int i = 0; i < numbitmaps; ++i) {
+	for (unsigned int i = 0; i < numbitmaps; ++i)
 		offsets[i] = be ? be32_to_cpu(offsets[i]) : le32_to_cpu(offsets[i]);
-		printf("bmp %u offset %u\n",
-			i, offsets[i]);
-	}
-	for (unsigned int i = 0; i < glypadopts; ++i) {
+	for (unsigned int i = 0; i < glypadopts; ++i)
 		bmpsize[i] = be ? be32_to_cpu(bmpsize[i]) : le32_to_cpu(bmpsize[i]);
-		printf("padopt %u size %u\n", i, bmpsize[i]);
-	}
 	std::string bmapbuf;
 	#define PCF_GLYPH_PAD_INDEX(f) ((f) & PCF_GLYPH_PAD_MASK)
 	bmapbuf.resize(bmpsize[PCF_GLYPH_PAD_INDEX(fmt)]);
-	fprintf(stderr, "buf %zu\n", bmapbuf.size());
 	if (fread(&bmapbuf[0], bmapbuf.size(), 1, fp) != 1)
 		return -EINVAL;
 	return 0;
@@ -754,8 +2508,6 @@ int font::load_pcf(const char *filename)
 			prop_table = &t;
 		else if (t.type == PCF_BITMAPS)
 			bmp_table = &t;
-		fprintf(stderr, "Table %zu: type %xh format %xh size %u offset %u\n",
-			i, t.type, t.format, t.size, t.offset);
 	}
 	if (prop_table == nullptr || fseek(fp.get(), prop_table->offset, SEEK_SET) != 0) {
 		fprintf(stderr, "pcf: no properties\n");
@@ -770,8 +2522,7 @@ int font::load_pcf(const char *filename)
 		fprintf(stderr, "pcf: no bitmaps\n");
 		return -EINVAL;
 	}
-	load_pcf_bitmaps(fp.get());
-	return 0;
+	return load_pcf_bitmaps(fp.get());
 }
 
 static char32_t nextutf8(FILE *fp)
@@ -886,6 +2637,60 @@ int font::load_psf(const char *file)
 	return 0;
 }
 
+/**
+ * Load @file with the loader its extension calls for: .bdf, .fnt, .hex,
+ * .pcf, .psf/.psfu, or a .clt directory (as is any other directory).
+ */
+int font::load_any(const char *file)
+{
+	struct stat sb;
+	if (stat(file, &sb) == 0 && S_ISDIR(sb.st_mode))
+		return load_clt(file);
+	auto ext = strrchr(file, '.');
+	if (ext == nullptr)
+		return -EINVAL;
+	else if (strcmp(ext, ".bdf") == 0)
+		return load_bdf(file);
+	else if (strcmp(ext, ".clt") == 0)
+		return load_clt(file);
+	else if (strcmp(ext, ".fnt") == 0)
+		return load_fnt(file);
+	else if (strcmp(ext, ".hex") == 0)
+		return load_hex(file);
+	else if (strcmp(ext, ".pcf") == 0)
+		return load_pcf(file);
+	else if (strcmp(ext, ".psf") == 0 || strcmp(ext, ".psfu") == 0)
+		return load_psf(file);
+	return -EINVAL;
+}
+
+/**
+ * Format records [0,@n) with @fmt(out, i) and write them to @fp in order.
+ * Records are grouped into chunks that are formatted concurrently, a few
+ * chunks per thread at a time, so the output stays the same as with a plain
+ * loop while memory is bounded by the chunks in flight.
+ */
+template<typename F> static int write_chunked(FILE *fp, size_t n, F &&fmt)
+{
+	static constexpr size_t chunk = 512;
+	size_t nthr = std::max(1U, std::thread::hardware_concurrency());
+	std::vector<std::string> buf(std::min((n + chunk - 1) / chunk, 4 * nthr));
+	for (size_t base = 0; base < n; base += buf.size() * chunk) {
+		auto nchunks = std::min(buf.size(), (n - base + chunk - 1) / chunk);
+		parallel_for(nchunks, [&](size_t c) {
+			auto &out = buf[c];
+			out.clear();
+			auto end = std::min(n, base + (c + 1) * chunk);
+			for (auto i = base + c * chunk; i < end; ++i)
+				fmt(out, i);
+		});
+		for (size_t c = 0; c < nchunks; ++c)
+			if (fwrite(buf[c].data(), buf[c].size(), 1, fp) != 1 && buf[c].size() > 0)
+				return -errno;
+	}
+	return 0;
+}
+
 int font::save_bdf(const char *file)
 {
 	std::unique_ptr<FILE, deleter> filep(vfopen(file, "w"));
@@ -895,28 +2700,28 @@ int font::save_bdf(const char *file)
 	vfsize sz0;
 	if (m_glyph.size() > 0)
 		sz0 = m_glyph[0].m_size;
-	std::string bfd_name = props["FullName"];
+	std::string bfd_name = prop("FullName");
 	/* X logical font description (XLFD) does not permit dashes */
 	std::replace(bfd_name.begin(), bfd_name.end(), '-', ' ');
 	fprintf(fp, "STARTFONT 2.1\n");
 	fprintf(fp, "FONT -misc-%s-medium-r-normal--%u-%u-75-75-c-%u-iso10646-1\n",
-		props["FontName"].c_str(), sz0.h, 10 * sz0.h, 10 * sz0.w);
+		prop("FontName").c_str(), sz0.h, 10 * sz0.h, 10 * sz0.w);
 	fprintf(fp, "SIZE %u 75 75\n", sz0.h);
 	fprintf(fp, "FONTBOUNDINGBOX %u %u 0 -%u\n", sz0.w, sz0.h, sz0.h / 4);
 	fprintf(fp, "STARTPROPERTIES 24\n");
 	fprintf(fp, "FONT_TYPE \"Bitmap\"\n");
 	fprintf(fp, "FONTNAME_REGISTRY \"\"\n");
 	fprintf(fp, "FOUNDRY \"misc\"\n");
-	fprintf(fp, "FAMILY_NAME \"%s\"\n", props["FamilyName"].c_str());
-	fprintf(fp, "WEIGHT_NAME \"%s\"\n", props["Weight"].c_str());
+	fprintf(fp, "FAMILY_NAME \"%s\"\n", prop("FamilyName").c_str());
+	fprintf(fp, "WEIGHT_NAME \"%s\"\n", prop("Weight").c_str());
 	fprintf(fp, "SLANT \"r\"\n");
 	fprintf(fp, "SETWIDTH_NAME \"normal\"\n");
 	fprintf(fp, "PIXEL_SIZE %u\n", sz0.h);
 	fprintf(fp, "POINT_SIZE %u\n", 10 * sz0.h);
 	fprintf(fp, "SPACING \"C\"\n");
 	fprintf(fp, "AVERAGE_WIDTH %u\n", 10 * sz0.w);
-	fprintf(fp, "FONT \"%s\"\n", props["FullName"].c_str());
-	fprintf(fp, "WEIGHT %s\n", props["TTFWeight"].c_str());
+	fprintf(fp, "FONT \"%s\"\n", prop("FullName").c_str());
+	fprintf(fp, "WEIGHT %s\n", prop("TTFWeight").c_str());
 	fprintf(fp, "RESOLUTION 75\n");
 	fprintf(fp, "RESOLUTION_X 75\n");
 	fprintf(fp, "RESOLUTION_Y 75\n");
@@ -933,90 +2738,500 @@ int font::save_bdf(const char *file)
 	fprintf(fp, "X_HEIGHT %u\n", sz0.h * 7 / 16);
 	fprintf(fp, "ENDPROPERTIES\n");
 
+	int ret;
 	if (m_unicode_map == nullptr) {
 		fprintf(fp, "CHARS %zu\n", m_glyph.size());
-		for (size_t idx = 0; idx < m_glyph.size(); ++idx)
-			save_bdf_glyph(fp, idx, idx);
+		ret = write_chunked(fp, m_glyph.size(), [&](std::string &out, size_t i) {
+			save_bdf_glyph(out, i, i);
+		});
 	} else {
 		fprintf(fp, "CHARS %zu\n", m_unicode_map->m_u2i.size());
-		for (const auto &pair : m_unicode_map->m_u2i)
-			save_bdf_glyph(fp, pair.second, pair.first);
+		std::vector<std::pair<char32_t, unsigned int>> cps(m_unicode_map->m_u2i.cbegin(), m_unicode_map->m_u2i.cend());
+		ret = write_chunked(fp, cps.size(), [&](std::string &out, size_t i) {
+			save_bdf_glyph(out, cps[i].second, cps[i].first);
+		});
+	}
+	if (ret < 0)
+		return ret;
+	fprintf(fp, "ENDFONT\n");
+	return 0;
+}
+
+void font::save_bdf_glyph(std::string &out, size_t idx, char32_t cp) const
+{
+	auto sz = m_glyph[idx].m_size;
+	char buf[160];
+	/* sz.h/4 is just a guess as to the descent of glyphs */
+	out.append(buf, snprintf(buf, sizeof(buf), "STARTCHAR U+%04x\n" "ENCODING %u\n"
+		"SWIDTH 1000 0\n" "DWIDTH %u 0\n" "BBX %u %u 0 -%u\n" "BITMAP\n",
+		static_cast<unsigned int>(cp), static_cast<unsigned int>(cp),
+		sz.w, sz.w, sz.h, sz.h / 4));
+
+	auto byteperline = (sz.w + 7) / 8;
+	unsigned int ctr = 0;
+	for (auto c : m_glyph[idx].as_rowpad()) {
+		out += vfhex[(c&0xF0)>>4];
+		out += vfhex[c&0x0F];
+		if (++ctr % byteperline == 0)
+			out += '\n';
+	}
+	out += "ENDCHAR\n";
+}
+
+/*
+ * The per-glyph savers queue their files on an async_io, so that encoding
+ * the next glyph overlaps with the writes of the previous ones.
+ */
+static int flush_glyph_files(async_io &io)
+{
+	std::string failed;
+	auto ret = io.flush(&failed);
+	if (ret < 0)
+		fprintf(stderr, "Could not write %s: %s\n", failed.c_str(), strerror(-ret));
+	return ret;
+}
+
+/**
+ * The files of the one-file-per-glyph formats, as codepoint -> glyph index.
+ * A codepoint listed under several glyphs goes to the last of them, so that
+ * every file is written exactly once.
+ */
+std::map<char32_t, size_t> font::glyph_files() const
+{
+	std::map<char32_t, size_t> out;
+	if (m_unicode_map == nullptr) {
+		for (size_t idx = 0; idx < m_glyph.size(); ++idx)
+			out.emplace_hint(out.end(), idx, idx);
+		return out;
+	}
+	for (size_t idx = 0; idx < m_glyph.size(); ++idx)
+		for (auto codepoint : m_unicode_map->to_unicode(idx))
+			out.insert_or_assign(codepoint, idx);
+	return out;
+}
+
+int font::save_clt(const char *dir)
+{
+	async_io io;
+	for (const auto &[codepoint, idx] : glyph_files())
+		save_clt_glyph(io, dir, idx, codepoint);
+	return flush_glyph_files(io);
+}
+
+void font::save_clt_glyph(async_io &io, const char *dir, size_t idx, char32_t codepoint)
+{
+	char name[24];
+	snprintf(name, sizeof(name), "/%04x.txt", static_cast<unsigned int>(codepoint));
+	io.write(dir + std::string(name), m_glyph[idx].as_pclt());
+}
+
+/**
+ * Bring the one-file-per-glyph directory @dir in line with the font: files
+ * whose bytes already match are left alone (mtime included), changed and new
+ * ones are written to a dotfile and renamed over the old, and files for
+ * codepoints the font no longer has are removed.
+ */
+int font::sync_glyph_files(const char *dir, const char *ext,
+    std::string (glyph::*encode)() const, sync_stats &st) const
+{
+	/* Same choice of glyph per codepoint as save_clt/save_pbm */
+	std::map<std::string, std::string> want;
+	char name[24];
+	for (const auto &[cp, idx] : glyph_files()) {
+		snprintf(name, sizeof(name), "%04x%s", static_cast<unsigned int>(cp), ext);
+		want.emplace(name, (m_glyph[idx].*encode)());
+	}
+
+	std::unique_ptr<HXdir, deleter> dh(HXdir_open(dir));
+	if (dh == nullptr)
+		return -errno;
+	std::vector<std::string> have, stale;
+	const char *de;
+	while ((de = HXdir_read(dh.get())) != nullptr) {
+		char *end;
+		strtoul(de, &end, 16);
+		if (*de == '.' || end == de || strcmp(end, ext) != 0)
+			continue;
+		if (want.find(de) != want.end())
+			have.emplace_back(de);
+		else
+			stale.emplace_back(de);
+	}
+	dh.reset();
+
+	std::string prefix = dir + std::string("/");
+	async_io io;
+	std::vector<size_t> ticket(have.size());
+	for (size_t i = 0; i < have.size(); ++i)
+		ticket[i] = io.prefetch(prefix + have[i]);
+	std::string buf;
+	for (size_t i = 0; i < have.size(); ++i) {
+		auto ret = io.fetch(ticket[i], buf);
+		auto it = want.find(have[i]);
+		if (ret < 0 || buf != it->second)
+			continue;
+		want.erase(it);
+		++st.unchanged;
+	}
+	for (const auto &[n, data] : want)
+		io.write_ref(prefix + "." + n + ".new", data.data(), data.size());
+	auto ret = flush_glyph_files(io);
+	if (ret < 0) {
+		for (const auto &e : want)
+			unlink((prefix + "." + e.first + ".new").c_str());
+		return ret;
+	}
+	for (const auto &e : want) {
+		auto &n = e.first;
+		if (rename((prefix + "." + n + ".new").c_str(), (prefix + n).c_str()) != 0) {
+			ret = -errno;
+			fprintf(stderr, "Could not rename to %s%s: %s\n",
+			        prefix.c_str(), n.c_str(), strerror(errno));
+			return ret;
+		}
+		++st.written;
+	}
+	for (const auto &n : stale) {
+		if (unlink((prefix + n).c_str()) != 0) {
+			ret = -errno;
+			fprintf(stderr, "Could not remove %s%s: %s\n",
+			        prefix.c_str(), n.c_str(), strerror(errno));
+			return ret;
+		}
+		++st.removed;
+	}
+	return 0;
+}
+
+int font::sync_clt(const char *dir, sync_stats &st) const
+{
+	return sync_glyph_files(dir, ".txt", &glyph::as_pclt, st);
+}
+
+int font::sync_pbm(const char *dir, sync_stats &st) const
+{
+	return sync_glyph_files(dir, ".pbm", &glyph::as_pbm, st);
+}
+
+int font::save_fnt(const char *file)
+{
+	std::unique_ptr<FILE, deleter> fp(vfopen(file, "wb"));
+	if (fp == nullptr)
+		return -errno;
+	for (const auto &glyph : m_glyph) {
+		auto ret = fwrite(glyph.m_data.c_str(), glyph.m_data.size(), 1, fp.get());
+		if (ret < 1)
+			break;
+	}
+	return 0;
+}
+
+/*
+ * Glyph kernels with one variant per instruction set; glyph_kernels()
+ * picks the best one for isa_active() on first use.
+ */
+static inline uint8_t bitrev8(uint8_t b)
+{
+	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+	return (b & 0xAA) >> 1 | (b & 0x55) << 1;
+}
+
+/* Mirror every @rowbytes-byte row of the @n bytes at @src into @dst */
+static void mirror_rows_scalar(uint8_t *dst, const uint8_t *src, size_t n,
+    unsigned int rowbytes)
+{
+	for (size_t r = 0; r < n; r += rowbytes)
+		for (unsigned int i = 0; i < rowbytes; ++i)
+			dst[r+i] = bitrev8(src[r+rowbytes-1-i]);
+}
+
+/**
+ * Append the uppercase hex form of the @n bytes at @src to @dst, four bytes
+ * at a time: the nibbles are spread into one byte each within a 64-bit word
+ * and turned into ASCII digits with a few adds, instead of a table lookup
+ * per nibble.
+ */
+static void hex_encode_scalar(char *dst, const uint8_t *src, size_t n)
+{
+	for (; n >= 4; n -= 4, src += 4, dst += 8) {
+		uint64_t x = static_cast<uint32_t>(src[0] << 24 | src[1] << 16 | src[2] << 8 | src[3]);
+		x = (x | x << 16) & 0x0000FFFF0000FFFFULL;
+		x = (x | x << 8)  & 0x00FF00FF00FF00FFULL;
+		x = (x | x << 4)  & 0x0F0F0F0F0F0F0F0FULL;
+		/* '0'+x, plus 7 more for x >= 10 to land on 'A' */
+		x += 0x3030303030303030ULL +
+		     (((x + 0x0606060606060606ULL) >> 4) & 0x0101010101010101ULL) * 7;
+		x = cpu_to_be64(x);
+		memcpy(dst, &x, sizeof(x));
+	}
+	static const char hx[] = "0123456789ABCDEF";
+	for (; n > 0; --n, ++src) {
+		*dst++ = hx[*src >> 4];
+		*dst++ = hx[*src & 0xF];
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+/*
+ * Rows of 1 to 16 bytes never straddle a 16-byte vector, so the row
+ * mirror is a byte reversal within each row plus a bit reversal within
+ * each byte. Other row lengths take the scalar path.
+ */
+static inline bool mirror_rows_vectorizable(unsigned int rowbytes)
+{
+	return rowbytes <= 16 && 16 % rowbytes == 0;
+}
+
+__attribute__((target("sse2"))) static inline __m128i bitrev8_sse2(__m128i x)
+{
+	auto m = _mm_set1_epi8(0x0F);
+	x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 4), m), _mm_slli_epi16(_mm_and_si128(x, m), 4));
+	m = _mm_set1_epi8(0x33);
+	x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 2), m), _mm_slli_epi16(_mm_and_si128(x, m), 2));
+	m = _mm_set1_epi8(0x55);
+	return _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 1), m), _mm_slli_epi16(_mm_and_si128(x, m), 1));
+}
+
+__attribute__((target("sse2"))) static void
+mirror_rows_sse2(uint8_t *dst, const uint8_t *src, size_t n, unsigned int rowbytes)
+{
+	if (n < 16 || !mirror_rows_vectorizable(rowbytes))
+		return mirror_rows_scalar(dst, src, n, rowbytes);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&src[i]));
+		/* Reverse bytes within rows: 64-bit halves, 16-bit words, bytes */
+		if (rowbytes == 16)
+			x = _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+		if (rowbytes >= 8) {
+			x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+			x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+		} else if (rowbytes == 4) {
+			x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+			x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+		}
+		if (rowbytes >= 2)
+			x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&dst[i]), bitrev8_sse2(x));
+	}
+	mirror_rows_scalar(&dst[i], &src[i], n - i, rowbytes);
+}
+
+/*
+ * Byte order within rows of 1, 2, 4, 8 and 16 bytes, for pshufb. Its wider
+ * forms shuffle each 128-bit lane on its own, so the pattern repeats every
+ * 16 bytes.
+ */
+struct mirror_masks {
+	uint8_t m[5][64];
+};
+
+static constexpr mirror_masks make_mirror_masks()
+{
+	mirror_masks r{};
+	for (unsigned int k = 0; k < 5; ++k)
+		for (unsigned int i = 0; i < 64; ++i) {
+			unsigned int rb = 1U << k, j = i % 16;
+			r.m[k][i] = j / rb * rb + rb - 1 - j % rb;
+		}
+	return r;
+}
+
+alignas(64) static constexpr mirror_masks mirror_mask = make_mirror_masks();
+
+/* Bit-reversed nibbles, once per 128-bit lane */
+alignas(64) static constexpr uint8_t nibble_bitrev[64] = {
+	0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE, 0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF,
+	0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE, 0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF,
+	0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE, 0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF,
+	0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE, 0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF,
+};
+
+__attribute__((target("ssse3"))) static void
+mirror_rows_ssse3(uint8_t *dst, const uint8_t *src, size_t n, unsigned int rowbytes)
+{
+	if (n < 16 || !mirror_rows_vectorizable(rowbytes))
+		return mirror_rows_scalar(dst, src, n, rowbytes);
+	auto order = _mm_load_si128(reinterpret_cast<const __m128i *>(mirror_mask.m[__builtin_ctz(rowbytes)]));
+	auto lut = _mm_load_si128(reinterpret_cast<const __m128i *>(nibble_bitrev));
+	auto lo4 = _mm_set1_epi8(0x0F);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&src[i]));
+		x = _mm_shuffle_epi8(x, order);
+		auto lo = _mm_shuffle_epi8(lut, _mm_and_si128(x, lo4));
+		auto hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(x, 4), lo4));
+		x = _mm_or_si128(_mm_slli_epi16(lo, 4), hi);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&dst[i]), x);
 	}
-	fprintf(fp, "ENDFONT\n");
-	return 0;
+	mirror_rows_scalar(&dst[i], &src[i], n - i, rowbytes);
 }
 
-void font::save_bdf_glyph(FILE *fp, size_t idx, char32_t cp)
+__attribute__((target("avx2"))) static void
+mirror_rows_avx2(uint8_t *dst, const uint8_t *src, size_t n, unsigned int rowbytes)
 {
-	auto sz = m_glyph[idx].m_size;
-	fprintf(fp, "STARTCHAR U+%04x\n" "ENCODING %u\n",
-		static_cast<unsigned int>(cp), static_cast<unsigned int>(cp));
-	fprintf(fp, "SWIDTH 1000 0\n");
-	fprintf(fp, "DWIDTH %u 0\n", sz.w);
-	/* sz.h/4 is just a guess as to the descent of glyphs */
-	fprintf(fp, "BBX %u %u 0 -%u\n", sz.w, sz.h, sz.h / 4);
-	fprintf(fp, "BITMAP\n");
+	if (n < 32 || !mirror_rows_vectorizable(rowbytes))
+		return mirror_rows_ssse3(dst, src, n, rowbytes);
+	auto order = _mm256_load_si256(reinterpret_cast<const __m256i *>(mirror_mask.m[__builtin_ctz(rowbytes)]));
+	auto lut = _mm256_load_si256(reinterpret_cast<const __m256i *>(nibble_bitrev));
+	auto lo4 = _mm256_set1_epi8(0x0F);
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&src[i]));
+		x = _mm256_shuffle_epi8(x, order);
+		auto lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, lo4));
+		auto hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), lo4));
+		x = _mm256_or_si256(_mm256_slli_epi16(lo, 4), hi);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(&dst[i]), x);
+	}
+	mirror_rows_ssse3(&dst[i], &src[i], n - i, rowbytes);
+}
 
-	auto byteperline = (sz.w + 7) / 8;
-	unsigned int ctr = 0;
-	for (auto c : m_glyph[idx].as_rowpad()) {
-		fputc(vfhex[(c&0xF0)>>4], fp);
-		fputc(vfhex[c&0x0F], fp);
-		if (++ctr % byteperline == 0)
-			fprintf(fp, "\n");
+__attribute__((target("avx512f,avx512bw"))) static void
+mirror_rows_avx512(uint8_t *dst, const uint8_t *src, size_t n, unsigned int rowbytes)
+{
+	if (n < 64 || !mirror_rows_vectorizable(rowbytes))
+		return mirror_rows_avx2(dst, src, n, rowbytes);
+	auto order = _mm512_load_si512(mirror_mask.m[__builtin_ctz(rowbytes)]);
+	auto lut = _mm512_load_si512(nibble_bitrev);
+	auto lo4 = _mm512_set1_epi8(0x0F);
+	size_t i = 0;
+	for (; i + 64 <= n; i += 64) {
+		auto x = _mm512_loadu_si512(&src[i]);
+		x = _mm512_shuffle_epi8(x, order);
+		auto lo = _mm512_shuffle_epi8(lut, _mm512_and_si512(x, lo4));
+		auto hi = _mm512_shuffle_epi8(lut, _mm512_and_si512(_mm512_srli_epi16(x, 4), lo4));
+		x = _mm512_or_si512(_mm512_slli_epi16(lo, 4), hi);
+		_mm512_storeu_si512(&dst[i], x);
 	}
-	fprintf(fp, "ENDCHAR\n");
+	mirror_rows_ssse3(&dst[i], &src[i], n - i, rowbytes);
 }
 
-int font::save_clt(const char *dir)
+/* Nibbles of 8 bytes to ASCII hex digits, 16 output bytes */
+__attribute__((target("sse2"))) static inline __m128i hex_digits_sse2(__m128i v)
 {
-	if (m_unicode_map == nullptr) {
-		for (size_t idx = 0; idx < m_glyph.size(); ++idx) {
-			auto ret = save_clt_glyph(dir, idx, idx);
-			if (ret < 0)
-				return ret;
-		}
-		return 0;
+	/* '0'+v, plus 7 more where v > 9 */
+	auto adj = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(9)), _mm_set1_epi8(7));
+	return _mm_add_epi8(_mm_add_epi8(v, _mm_set1_epi8('0')), adj);
+}
+
+__attribute__((target("sse2"))) static void
+hex_encode_sse2(char *dst, const uint8_t *src, size_t n)
+{
+	auto lo4 = _mm_set1_epi8(0x0F);
+	for (; n >= 16; n -= 16, src += 16, dst += 32) {
+		auto x  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		auto hi = _mm_and_si128(_mm_srli_epi16(x, 4), lo4);
+		auto lo = _mm_and_si128(x, lo4);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), hex_digits_sse2(_mm_unpacklo_epi8(hi, lo)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), hex_digits_sse2(_mm_unpackhi_epi8(hi, lo)));
 	}
-	for (size_t idx = 0; idx < m_glyph.size(); ++idx)
-		for (auto codepoint : m_unicode_map->to_unicode(idx)) {
-			auto ret = save_clt_glyph(dir, idx, codepoint);
-			if (ret < 0)
-				return ret;
-		}
-	return 0;
+	hex_encode_scalar(dst, src, n);
 }
 
-int font::save_clt_glyph(const char *dir, size_t idx, char32_t codepoint)
+__attribute__((target("ssse3"))) static void
+hex_encode_ssse3(char *dst, const uint8_t *src, size_t n)
 {
-	std::stringstream ss;
-	ss << dir << "/" << std::setfill('0') << std::setw(4) << std::hex << codepoint << ".txt";
-	auto outpath = ss.str();
-	std::unique_ptr<FILE, deleter> fp(vfopen(outpath.c_str(), "w"));
-	if (fp == nullptr) {
-		fprintf(stderr, "Could not open %s for writing: %s\n", outpath.c_str(), strerror(errno));
-		return -errno;
+	auto lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+	           '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+	auto lo4 = _mm_set1_epi8(0x0F);
+	for (; n >= 16; n -= 16, src += 16, dst += 32) {
+		auto x  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		auto hi = _mm_and_si128(_mm_srli_epi16(x, 4), lo4);
+		auto lo = _mm_and_si128(x, lo4);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_shuffle_epi8(lut, _mm_unpacklo_epi8(hi, lo)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_shuffle_epi8(lut, _mm_unpackhi_epi8(hi, lo)));
 	}
-	auto data = m_glyph[idx].as_pclt();
-	auto ret = fwrite(data.c_str(), data.size(), 1, fp.get());
-	if (ret < 0 || (data.size() > 0 && ret != 1)) {
-		fprintf(stderr, "fwrite %s: %s\n", outpath.c_str(), strerror(-errno));
-		return -errno;
+	hex_encode_scalar(dst, src, n);
+}
+
+__attribute__((target("avx2"))) static void
+hex_encode_avx2(char *dst, const uint8_t *src, size_t n)
+{
+	auto lut = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+	           '8', '9', 'A', 'B', 'C', 'D', 'E', 'F',
+	           '0', '1', '2', '3', '4', '5', '6', '7',
+	           '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+	auto lo4 = _mm256_set1_epi8(0x0F);
+	for (; n >= 32; n -= 32, src += 32, dst += 64) {
+		auto x  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+		auto hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), lo4);
+		auto lo = _mm256_and_si256(x, lo4);
+		/* Unpacking is per lane: a = bytes 0-7|16-23, b = 8-15|24-31 */
+		auto a = _mm256_shuffle_epi8(lut, _mm256_unpacklo_epi8(hi, lo));
+		auto b = _mm256_shuffle_epi8(lut, _mm256_unpackhi_epi8(hi, lo));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 32), _mm256_permute2x128_si256(a, b, 0x31));
 	}
-	return 0;
+	hex_encode_ssse3(dst, src, n);
 }
+#endif /* HAVE_X86_KERNELS */
 
-int font::save_fnt(const char *file)
+struct glyph_kernel_table {
+	void (*mirror_rows)(uint8_t *, const uint8_t *, size_t, unsigned int);
+	void (*hex_encode)(char *, const uint8_t *, size_t);
+};
+
+static const glyph_kernel_table &glyph_kernels()
 {
-	std::unique_ptr<FILE, deleter> fp(vfopen(file, "wb"));
+	static const glyph_kernel_table kt = []() -> glyph_kernel_table {
+		switch (isa_active()) {
+#ifdef HAVE_X86_KERNELS
+		case ISA_AVX512: return {mirror_rows_avx512, hex_encode_avx2};
+		case ISA_AVX2:   return {mirror_rows_avx2, hex_encode_avx2};
+		case ISA_SSSE3:  return {mirror_rows_ssse3, hex_encode_ssse3};
+		case ISA_SSE2:   return {mirror_rows_sse2, hex_encode_sse2};
+#endif
+		default:         return {mirror_rows_scalar, hex_encode_scalar};
+		}
+	}();
+	return kt;
+}
+
+static void hex_encode(std::string &out, const void *src, size_t n)
+{
+	auto base = out.size();
+	out.resize(base + 2 * n);
+	glyph_kernels().hex_encode(&out[base], static_cast<const uint8_t *>(src), n);
+}
+
+int font::save_hex(const char *file) const
+{
+	for (const auto &g : m_glyph) {
+		if (g.m_size.h == 16 && g.m_size.w % 8 == 0 &&
+		    g.m_size.w >= 8 && g.m_size.w <= 32)
+			continue;
+		fprintf(stderr, "save_hex: glyphs must be 8, 16, 24 or 32 pixels wide and 16 high, not %ux%u\n",
+		        g.m_size.w, g.m_size.h);
+		return -EINVAL;
+	}
+	std::unique_ptr<FILE, deleter> fp(vfopen(file, "w"));
 	if (fp == nullptr)
 		return -errno;
-	for (const auto &glyph : m_glyph) {
-		auto ret = fwrite(glyph.m_data.c_str(), glyph.m_data.size(), 1, fp.get());
-		if (ret < 1)
-			break;
+	std::vector<std::pair<char32_t, unsigned int>> cps;
+	if (m_unicode_map == nullptr) {
+		for (size_t i = 0; i < m_glyph.size(); ++i)
+			cps.emplace_back(i, i);
+	} else {
+		for (const auto &e : m_unicode_map->m_u2i)
+			if (e.second < m_glyph.size())
+				cps.push_back(e);
 	}
-	return 0;
+	/*
+	 * The widths in use are all byte multiples, so the packed bitmap
+	 * already is the row-padded form the format wants.
+	 */
+	auto ret = write_chunked(fp.get(), cps.size(), [&](std::string &out, size_t i) {
+		char buf[HXSIZEOF_Z32];
+		out.append(buf, snprintf(buf, sizeof(buf), "%04X:", static_cast<unsigned int>(cps[i].first)));
+		const auto &g = m_glyph[cps[i].second];
+		hex_encode(out, g.m_data.data(), g.m_size.w / 8 * g.m_size.h);
+		out += '\n';
+	});
+	if (ret < 0)
+		return ret;
+	return fflush(fp.get()) == 0 ? 0 : -errno;
 }
 
 int font::save_map(const char *file)
@@ -1026,50 +3241,147 @@ int font::save_map(const char *file)
 		return -errno;
 	if (m_unicode_map == nullptr)
 		return 0;
-	for (const auto &e : m_unicode_map->m_i2u) {
-		fprintf(fp.get(), "0x%02x\t", e.first);
-		for (auto uc : e.second)
-			fprintf(fp.get(), "U+%04x ", uc);
-		fprintf(fp.get(), "\n");
-	}
-	return 0;
+	std::vector<const std::pair<const unsigned int, std::set<char32_t>> *> ent;
+	for (const auto &e : m_unicode_map->m_i2u)
+		ent.push_back(&e);
+	return write_chunked(fp.get(), ent.size(), [&](std::string &out, size_t i) {
+		char buf[HXSIZEOF_Z32 + 4];
+		out.append(buf, snprintf(buf, sizeof(buf), "0x%02x\t", ent[i]->first));
+		for (auto uc : ent[i]->second)
+			out.append(buf, snprintf(buf, sizeof(buf), "U+%04x ", static_cast<unsigned int>(uc)));
+		out += '\n';
+	});
 }
 
 int font::save_pbm(const char *dir)
 {
-	if (m_unicode_map == nullptr) {
-		for (size_t idx = 0; idx < m_glyph.size(); ++idx) {
-			auto ret = save_pbm_glyph(dir, idx, idx);
-			if (ret < 0)
-				return ret;
+	async_io io;
+	for (const auto &[codepoint, idx] : glyph_files())
+		save_pbm_glyph(io, dir, idx, codepoint);
+	return flush_glyph_files(io);
+}
+
+void font::save_pbm_glyph(async_io &io, const char *dir, size_t idx, char32_t codepoint)
+{
+	char name[24];
+	snprintf(name, sizeof(name), "/%04x.pbm", static_cast<unsigned int>(codepoint));
+	io.write(dir + std::string(name), m_glyph[idx].as_pbm());
+}
+
+/**
+ * Horizontal runs of @g, with runs repeated in consecutive rows merged into
+ * one entry. Rows up to 57 pixels wide are scanned a word at a time with
+ * clz, others pixel by pixel.
+ */
+static void glyph_spans(const glyph &g, std::vector<span_entry> &out)
+{
+	unsigned int w = g.m_size.w;
+	size_t first = out.size(), prev_begin = first, prev_end = first;
+	for (unsigned int y = 0; y < g.m_size.h; ++y) {
+		size_t cur_begin = out.size();
+		auto emit = [&](unsigned int x, unsigned int len) {
+			for (auto i = prev_begin; i < prev_end; ++i) {
+				auto &e = out[i];
+				if (e.x == x && e.len == len && e.y + e.rows == y) {
+					++e.rows;
+					/* Keep it visible to the next row */
+					out.push_back(e);
+					out[i].rows = 0;
+					return;
+				}
+			}
+			out.push_back({static_cast<uint8_t>(y), static_cast<uint8_t>(x),
+				static_cast<uint8_t>(len), 1});
+		};
+		if (w <= 57) {
+			auto row = bits_get(g.m_data, y * w, w) << (64 - w);
+			unsigned int x = 0;
+			while (row != 0) {
+				auto skip = __builtin_clzll(row);
+				row <<= skip;
+				x += skip;
+				auto len = ~row == 0 ? 64 : __builtin_clzll(~row);
+				emit(x, len);
+				x += len;
+				row = len >= 64 ? 0 : row << len;
+			}
+		} else {
+			for (unsigned int x = 0; x < w; ) {
+				bitpos p = y * w + x;
+				if (!(g.m_data[p.byte] & p.mask)) {
+					++x;
+					continue;
+				}
+				unsigned int x0 = x;
+				for (; x < w; ++x) {
+					bitpos q = y * w + x;
+					if (!(g.m_data[q.byte] & q.mask))
+						break;
+				}
+				emit(x0, x - x0);
+			}
 		}
-		return 0;
+		prev_begin = cur_begin;
+		prev_end = out.size();
 	}
-	for (size_t idx = 0; idx < m_glyph.size(); ++idx)
-		for (auto codepoint : m_unicode_map->to_unicode(idx)) {
-			auto ret = save_pbm_glyph(dir, idx, codepoint);
-			if (ret < 0)
-				return ret;
-		}
-	return 0;
+	/* Drop the husks left behind by merging (in this glyph's entries only) */
+	out.erase(std::remove_if(out.begin() + first, out.end(),
+		[](const span_entry &e) { return e.rows == 0; }), out.end());
 }
 
-int font::save_pbm_glyph(const char *dir, size_t idx, char32_t codepoint)
+/**
+ * Write the glyphs as span lists (see struct span_header). A renderer draws
+ * a glyph with one memset per entry and row, and finds it by bisecting the
+ * codepoint index.
+ */
+int font::save_spans(const char *file)
 {
-	std::stringstream ss;
-	ss << dir << "/" << std::setfill('0') << std::setw(4) << std::hex << codepoint << ".pbm";
-	auto outpath = ss.str();
-	std::unique_ptr<FILE, deleter> fp(::fopen(outpath.c_str(), "w"));
-	if (fp == nullptr) {
-		fprintf(stderr, "Could not open %s for writing: %s\n", outpath.c_str(), strerror(errno));
-		return -errno;
+	if (m_glyph.size() == 0)
+		return -EINVAL;
+	auto sz = m_glyph[0].m_size;
+	if (sz.w > 255 || sz.h > 255)
+		return -E2BIG;
+	std::vector<uint32_t> cpidx;
+	if (m_unicode_map == nullptr) {
+		for (size_t idx = 0; idx < m_glyph.size(); ++idx) {
+			cpidx.push_back(cpu_to_le32(idx));
+			cpidx.push_back(cpu_to_le32(idx));
+		}
+	} else {
+		for (const auto &[cp, idx] : m_unicode_map->m_u2i) {
+			if (idx >= m_glyph.size())
+				continue;
+			cpidx.push_back(cpu_to_le32(cp));
+			cpidx.push_back(cpu_to_le32(idx));
+		}
 	}
-	auto data = m_glyph[idx].as_pbm();
-	auto ret = fwrite(data.c_str(), data.size(), 1, fp.get());
-	if (ret < 0 || (data.size() > 0 && ret != 1)) {
-		fprintf(stderr, "fwrite %s: %s\n", outpath.c_str(), strerror(-errno));
-		return -errno;
+	std::vector<uint32_t> offsets;
+	std::vector<span_entry> spans;
+	for (const auto &g : m_glyph) {
+		offsets.push_back(cpu_to_le32(spans.size()));
+		if (g.m_size.w == sz.w && g.m_size.h == sz.h &&
+		    g.m_data.size() >= bytes_per_glyph(sz))
+			glyph_spans(g, spans);
 	}
+	offsets.push_back(cpu_to_le32(spans.size()));
+
+	span_header hdr{{'v', 'f', 'a', 's', 'p', 'a', 'n', '1'}};
+	hdr.width      = cpu_to_le16(sz.w);
+	hdr.height     = cpu_to_le16(sz.h);
+	hdr.num_cps    = cpu_to_le32(cpidx.size() / 2);
+	hdr.num_glyphs = cpu_to_le32(m_glyph.size());
+	hdr.num_spans  = cpu_to_le32(spans.size());
+	std::unique_ptr<FILE, deleter> fp(vfopen(file, "wb"));
+	if (fp == nullptr)
+		return -errno;
+	/* A short write need not set errno; it is then reported as -EIO */
+	errno = 0;
+	if (fwrite(&hdr, sizeof(hdr), 1, fp.get()) != 1 ||
+	    (cpidx.size() > 0 && fwrite(cpidx.data(), sizeof(uint32_t), cpidx.size(), fp.get()) != cpidx.size()) ||
+	    fwrite(offsets.data(), sizeof(uint32_t), offsets.size(), fp.get()) != offsets.size() ||
+	    (spans.size() > 0 && fwrite(spans.data(), sizeof(span_entry), spans.size(), fp.get()) != spans.size()) ||
+	    fflush(fp.get()) != 0 || fclose(fp.release()) != 0)
+		return errno != 0 ? -errno : -EIO;
 	return 0;
 }
 
@@ -1115,6 +3427,209 @@ int font::save_psf(const char *file)
 	return 0;
 }
 
+/**
+ * Adopt @f as another strike. Its glyphs are rearranged to the set's glyph
+ * indices (codepoints the set does not know yet get new indices, blank in
+ * the other strikes), and it then shares the set's unicode_map. Unmapped
+ * fonts correspond by glyph index.
+ */
+int font_set::add(font &&f)
+{
+	if (f.m_glyph.size() == 0)
+		return -EINVAL;
+	auto sz = f.m_glyph[0].m_size;
+	for (const auto &s : m_strike)
+		if (s.m_glyph[0].m_size.w == sz.w && s.m_glyph[0].m_size.h == sz.h)
+			return -EEXIST;
+	if (m_strike.empty()) {
+		m_unicode_map = f.m_unicode_map;
+		m_strike.push_back(std::move(f));
+		return 0;
+	}
+	if ((m_unicode_map == nullptr) != (f.m_unicode_map == nullptr))
+		return -EINVAL;
+	auto nglyphs = m_strike[0].m_glyph.size();
+	if (m_unicode_map == f.m_unicode_map) {
+		auto n = std::max(nglyphs, f.m_glyph.size());
+		for (auto &s : m_strike)
+			s.m_glyph.resize(n, glyph(s.m_glyph[0].m_size));
+		f.m_glyph.resize(n, glyph(sz));
+		m_strike.push_back(std::move(f));
+		return 0;
+	}
+	std::vector<glyph> out(nglyphs, glyph(sz));
+	for (const auto &[cp, idx] : m_unicode_map->m_u2i) {
+		auto src = f.m_unicode_map->to_index(cp);
+		if (src >= 0 && static_cast<size_t>(src) < f.m_glyph.size() && idx < nglyphs)
+			out[idx] = f.m_glyph[src];
+	}
+	std::map<unsigned int, unsigned int> added;
+	for (const auto &[cp, src] : f.m_unicode_map->m_u2i) {
+		if (src >= f.m_glyph.size() || m_unicode_map->m_u2i.count(cp) > 0)
+			continue;
+		auto r = added.emplace(src, out.size());
+		if (r.second) {
+			out.push_back(f.m_glyph[src]);
+			for (auto &s : m_strike)
+				s.m_glyph.emplace_back(s.m_glyph[0].m_size);
+		}
+		m_unicode_map->add_i2u(r.first->second, cp);
+	}
+	f.m_glyph = std::move(out);
+	f.m_unicode_map = m_unicode_map;
+	m_strike.push_back(std::move(f));
+	return 0;
+}
+
+/* Writes @stem-WxH.bdf for every strike */
+int font_set::save_bdf(const char *stem)
+{
+	for (auto &s : m_strike) {
+		char buf[HXSIZEOF_Z32*2+8];
+		snprintf(buf, sizeof(buf), "-%ux%u.bdf", s.m_glyph[0].m_size.w, s.m_glyph[0].m_size.h);
+		auto ret = s.save_bdf((stem + std::string(buf)).c_str());
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Unicode equivalents of the pictographs that DOS codepages show at the
+ * control character positions 0x00..0x1F, and 0x7F.
+ */
+static const char32_t cpi_c0_glyphs[33] = {
+	0x0000, 0x263A, 0x263B, 0x2665, 0x2666, 0x2663, 0x2660, 0x2022,
+	0x25D8, 0x25CB, 0x25D9, 0x2642, 0x2640, 0x266A, 0x266B, 0x263C,
+	0x25BA, 0x25C4, 0x2195, 0x203C, 0x00B6, 0x00A7, 0x25AC, 0x21A8,
+	0x2191, 0x2193, 0x2192, 0x2190, 0x221F, 0x2194, 0x25B2, 0x25BC,
+	0x2302,
+};
+
+/**
+ * Resolve the 256 byte values of @codepage to glyph indices of the set
+ * (-1 for none), going through iconv's "CPnnn" tables. Without a Unicode
+ * map, bytes are taken as glyph indices.
+ */
+static int cpi_byte_map(const font_set &fs, unsigned int codepage,
+    std::array<ssize_t, 256> &idx)
+{
+	auto nglyphs = fs.m_strike[0].m_glyph.size();
+	if (fs.m_unicode_map == nullptr) {
+		for (unsigned int b = 0; b < idx.size(); ++b)
+			idx[b] = b < nglyphs ? b : -1;
+		return 0;
+	}
+	char name[HXSIZEOF_Z32+3];
+	snprintf(name, sizeof(name), "CP%u", codepage);
+	auto cd = iconv_open("UTF-32LE", name);
+	if (cd == reinterpret_cast<iconv_t>(-1)) {
+		fprintf(stderr, "save_cpi: codepage %u not known to iconv\n", codepage);
+		return -EINVAL;
+	}
+	auto cdclean = make_scope_success([&]() { iconv_close(cd); });
+	const auto &map = *fs.m_unicode_map;
+	for (unsigned int b = 0; b < idx.size(); ++b) {
+		idx[b] = -1;
+		if (b < 0x20 || b == 0x7F) {
+			idx[b] = map.to_index(cpi_c0_glyphs[b < 0x20 ? b : 0x20]);
+			if (idx[b] >= 0)
+				continue;
+		}
+		char ib = b, *inbuf = &ib, *outbuf;
+		uint32_t uc;
+		size_t iblen = 1, oblen = sizeof(uc);
+		outbuf = reinterpret_cast<char *>(&uc);
+		if (iconv(cd, &inbuf, &iblen, &outbuf, &oblen) == static_cast<size_t>(-1) ||
+		    oblen != 0)
+			continue;
+		idx[b] = map.to_index(le32_to_cpu(uc));
+	}
+	for (auto &i : idx)
+		if (i >= 0 && static_cast<size_t>(i) >= nglyphs)
+			i = -1;
+	return 0;
+}
+
+template<typename T> static void cpi_put(std::string &out, size_t off, const T &v)
+{
+	memcpy(&out[off], &v, sizeof(v));
+}
+
+/**
+ * Write a DOS screen font file (FONT format) with one EGA entry per
+ * @codepages element, each carrying all strikes.
+ */
+int font_set::save_cpi(const char *file, const std::vector<unsigned int> &codepages) const
+{
+	if (m_strike.empty() || codepages.empty())
+		return -EINVAL;
+	for (const auto &s : m_strike) {
+		auto &sz = s.m_glyph[0].m_size;
+		if (sz.w % 8 == 0 && sz.w <= 255 && sz.h <= 255)
+			continue;
+		fprintf(stderr, "save_cpi: cannot store %ux%u glyphs\n", sz.w, sz.h);
+		return -EINVAL;
+	}
+	std::string out(sizeof(cpi_fontfile_header) + sizeof(cpi_fontinfo_header), '\0');
+	cpi_fontfile_header ffh{};
+	ffh.id0  = 0xFF;
+	memcpy(ffh.id, "FONT   ", sizeof(ffh.id));
+	ffh.pnum = cpu_to_le16(1);
+	ffh.ptyp = 1;
+	ffh.fih_offset = cpu_to_le32(sizeof(ffh));
+	cpi_put(out, 0, ffh);
+	cpi_fontinfo_header fih{};
+	fih.num_codepages = cpu_to_le16(codepages.size());
+	cpi_put(out, sizeof(ffh), fih);
+
+	for (size_t i = 0; i < codepages.size(); ++i) {
+		std::array<ssize_t, 256> idx;
+		auto ret = cpi_byte_map(*this, codepages[i], idx);
+		if (ret < 0)
+			return ret;
+		auto cpe_off = out.size();
+		auto cpih_off = cpe_off + sizeof(cpi_cpentry_header);
+		out.resize(cpih_off + sizeof(cpi_cpinfo_header));
+		for (const auto &s : m_strike) {
+			auto &sz = s.m_glyph[0].m_size;
+			cpi_screenfont_header sfh{};
+			sfh.height    = sz.h;
+			sfh.width     = sz.w;
+			sfh.num_chars = cpu_to_le16(idx.size());
+			out.append(reinterpret_cast<const char *>(&sfh), sizeof(sfh));
+			/* Byte-multiple widths: packed bitmap == row-padded bitmap */
+			glyph blank(sz);
+			for (auto gi : idx)
+				out += gi >= 0 ? s.m_glyph[gi].m_data : blank.m_data;
+		}
+		auto fontsize = out.size() - cpih_off - sizeof(cpi_cpinfo_header);
+		if (fontsize > UINT16_MAX) {
+			fprintf(stderr, "save_cpi: strikes of codepage %u exceed 64 KB\n", codepages[i]);
+			return -E2BIG;
+		}
+		cpi_cpentry_header cpeh{};
+		cpeh.cpeh_size   = cpu_to_le16(sizeof(cpeh));
+		cpeh.next_cpeh_offset = cpu_to_le32(i + 1 < codepages.size() ? out.size() : 0);
+		cpeh.device_type = cpu_to_le16(DEVTYPE_SCREEN);
+		memcpy(cpeh.device_name, "EGA     ", sizeof(cpeh.device_name));
+		cpeh.codepage    = cpu_to_le16(codepages[i]);
+		cpeh.cpih_offset = cpu_to_le32(cpih_off);
+		cpi_put(out, cpe_off, cpeh);
+		cpi_cpinfo_header cpih{};
+		cpih.version   = cpu_to_le16(1);
+		cpih.num_fonts = cpu_to_le16(m_strike.size());
+		cpih.size      = cpu_to_le16(fontsize);
+		cpi_put(out, cpih_off, cpih);
+	}
+	std::unique_ptr<FILE, deleter> fp(vfopen(file, "wb"));
+	if (fp == nullptr)
+		return -errno;
+	if (fwrite(out.data(), out.size(), 1, fp.get()) != 1 || fflush(fp.get()) != 0)
+		return -errno;
+	return 0;
+}
+
 std::pair<int, int> font::find_ascent_descent() const
 {
 	std::pair<int, int> asds{0, 0};
@@ -1150,9 +3665,9 @@ static unsigned int ttfweight_to_panose(const char *s)
 	return 6;
 }
 
-static void name_reminder(font::propmap_t &props)
+static void name_reminder(const font &f)
 {
-	auto &a = props["FontName"], &b = props["FamilyName"], &c = props["FullName"];
+	auto &a = f.prop("FontName"), &b = f.prop("FamilyName"), &c = f.prop("FullName");
 	auto x = a.empty() || a == "vfontas-output";
 	auto y = b.empty() || b == "vfontas output";
 	auto z = c.empty() || c == "vfontas output";
@@ -1177,6 +3692,132 @@ static void name_reminder(font::propmap_t &props)
 		        "This is the name with \"Bold\", \"Italic\", etc. suffix.\n");
 }
 
+namespace {
+
+struct sfd_component {
+	ssize_t ref = -1; /* index into the save list */
+	int dy = 0; /* rows the referenced glyph is moved down */
+	glyph residual;
+};
+
+struct comp_rows {
+	std::vector<uint64_t> row;
+	unsigned int ink = 0;
+	int y0 = 0, y1 = -1;
+	bool ok = false;
+};
+
+}
+
+static uint64_t row_window_hash(const uint64_t *row, unsigned int n)
+{
+	uint64_t h = 0;
+	for (unsigned int i = 0; i < n; ++i)
+		h = (h ^ row[i]) * 0x9E3779B97F4A7C15ULL + (h >> 29);
+	return h;
+}
+
+/**
+ * For every entry of @list (codepoint, glyph index), look for another entry
+ * whose glyph is wholly contained in this one, possibly moved vertically,
+ * so that only the remaining pixels need outlines. Candidates are found by
+ * hashing the top and bottom three ink rows of every glyph and looking up
+ * all three-row windows of the glyph at hand; hits are then verified row by
+ * row. A glyph only refers to one with less ink, or to an identical one
+ * earlier in the list, so references cannot form a cycle.
+ */
+static std::vector<sfd_component> find_components(const std::vector<glyph> &glyphs,
+    const std::vector<std::pair<char32_t, size_t>> &list)
+{
+	static constexpr unsigned int K = 3, min_ink = 6;
+	std::vector<sfd_component> comp(list.size());
+	if (list.size() == 0)
+		return comp;
+	auto sz = glyphs[list[0].second].m_size;
+	if (sz.w == 0 || sz.w > 57 || sz.h < K)
+		return comp;
+	std::vector<comp_rows> rows(list.size());
+	std::unordered_map<size_t, size_t> first_of_idx;
+	std::unordered_multimap<uint64_t, std::pair<size_t, int>> index;
+	for (size_t i = 0; i < list.size(); ++i) {
+		auto fi = first_of_idx.emplace(list[i].second, i);
+		if (!fi.second) {
+			/* Another codepoint for the same glyph */
+			comp[i].ref = fi.first->second;
+			comp[i].residual = glyph(sz);
+			continue;
+		}
+		const auto &g = glyphs[list[i].second];
+		auto &r = rows[i];
+		if (g.m_size.w != sz.w || g.m_size.h != sz.h ||
+		    g.m_data.size() < bytes_per_glyph(sz))
+			continue;
+		r.ok = true;
+		r.row.resize(sz.h);
+		r.y0 = sz.h;
+		for (unsigned int y = 0; y < sz.h; ++y) {
+			r.row[y] = bits_get(g.m_data, y * sz.w, sz.w);
+			if (r.row[y] == 0)
+				continue;
+			r.ink += __builtin_popcountll(r.row[y]);
+			r.y0 = std::min(r.y0, static_cast<int>(y));
+			r.y1 = y;
+		}
+		if (r.ink < min_ink || r.y1 - r.y0 + 1 < static_cast<int>(K))
+			continue;
+		index.emplace(row_window_hash(&r.row[r.y0], K), std::make_pair(i, r.y0));
+		if (r.y1 + 1 - K != static_cast<unsigned int>(r.y0))
+			index.emplace(row_window_hash(&r.row[r.y1 + 1 - K], K),
+				std::make_pair(i, r.y1 + 1 - static_cast<int>(K)));
+	}
+
+	parallel_for(list.size(), [&](size_t a) {
+		const auto &ra = rows[a];
+		if (!ra.ok || comp[a].ref >= 0 || ra.ink <= min_ink)
+			return;
+		ssize_t best = -1;
+		int best_dy = 0;
+		for (unsigned int p = 0; p + K <= sz.h; ++p) {
+			if (ra.row[p] == 0)
+				continue;
+			auto range = index.equal_range(row_window_hash(&ra.row[p], K));
+			for (auto it = range.first; it != range.second; ++it) {
+				auto b = it->second.first;
+				const auto &rb = rows[b];
+				if (b == a || rb.ink > ra.ink || (rb.ink == ra.ink && b > a) ||
+				    (best >= 0 && rb.ink <= rows[best].ink))
+					continue;
+				int dy = p - it->second.second;
+				if (rb.y0 + dy < 0 || rb.y1 + dy >= static_cast<int>(sz.h))
+					continue;
+				bool inside = true;
+				for (int y = rb.y0; y <= rb.y1 && inside; ++y)
+					inside = (ra.row[y+dy] & rb.row[y]) == rb.row[y];
+				if (!inside)
+					continue;
+				best = b;
+				best_dy = dy;
+			}
+		}
+		if (best < 0)
+			return;
+		auto &c = comp[a];
+		const auto &rb = rows[best];
+		c.ref = best;
+		c.dy = best_dy;
+		c.residual = glyph(sz);
+		for (unsigned int y = 0; y < sz.h; ++y) {
+			int sy = y - best_dy;
+			auto rest = ra.row[y];
+			if (sy >= 0 && sy < static_cast<int>(sz.h))
+				rest &= ~rb.row[sy];
+			if (rest != 0)
+				bits_or(c.residual.m_data, y * sz.w, sz.w, rest);
+		}
+	});
+	return comp;
+}
+
 int font::save_sfd(const char *file, enum vectoalg vt)
 {
 	std::unique_ptr<FILE, deleter> filep(vfopen(file, "w"));
@@ -1184,7 +3825,9 @@ int font::save_sfd(const char *file, enum vectoalg vt)
 		return -errno;
 	auto fp = filep.get();
 	auto asds = find_ascent_descent();
-	name_reminder(props);
+	name_reminder(*this);
+	/* Per-call, so that concurrent saves of one font do not interfere */
+	int sfx = 2, sfy = 2;
 	auto it = props.find("ssf");
 	if (it != props.end()) {
 		char *end = nullptr;
@@ -1196,42 +3839,42 @@ int font::save_sfd(const char *file, enum vectoalg vt)
 			if (b == 0) {
 				fprintf(stderr, "What garbage is \"%s\"? Ignored -setprop request.\n", it->second.c_str());
 			} else {
-				m_ssfx = 2 * a;
-				m_ssfy = 2 * b;
+				sfx = 2 * a;
+				sfy = 2 * b;
 			}
 		}
 	}
 	fprintf(fp, "SplineFontDB: 3.0\n");
-	fprintf(fp, "FontName: %s\n", props["FontName"].c_str());
-	fprintf(fp, "FullName: %s\n", props["FullName"].c_str());
-	fprintf(fp, "FamilyName: %s\n", props["FamilyName"].c_str());
-	fprintf(fp, "Weight: %s\n", props["Weight"].c_str());
+	fprintf(fp, "FontName: %s\n", prop("FontName").c_str());
+	fprintf(fp, "FullName: %s\n", prop("FullName").c_str());
+	fprintf(fp, "FamilyName: %s\n", prop("FamilyName").c_str());
+	fprintf(fp, "Weight: %s\n", prop("Weight").c_str());
 	fprintf(fp, "Version: 001.000\n");
 	fprintf(fp, "ItalicAngle: 0\n");
 	fprintf(fp, "UnderlinePosition: -3\n");
 	fprintf(fp, "UnderlineWidth: 1\n");
-	fprintf(fp, "Ascent: %d\n", asds.first * m_ssfy);
-	fprintf(fp, "Descent: %d\n", asds.second * m_ssfy);
+	fprintf(fp, "Ascent: %d\n", asds.first * sfy);
+	fprintf(fp, "Descent: %d\n", asds.second * sfy);
 	fprintf(fp, "NeedsXUIDChange: 1\n");
 	fprintf(fp, "FSType: 0\n");
 	fprintf(fp, "PfmFamily: 49\n");
-	fprintf(fp, "TTFWeight: %s\n", props["TTFWeight"].c_str());
+	fprintf(fp, "TTFWeight: %s\n", prop("TTFWeight").c_str());
 	fprintf(fp, "TTFWidth: 5\n");
-	fprintf(fp, "Panose: 2 0 %u 9 9 0 0 0 0 0\n", ttfweight_to_panose(props["TTFWeight"].c_str()));
+	fprintf(fp, "Panose: 2 0 %u 9 9 0 0 0 0 0\n", ttfweight_to_panose(prop("TTFWeight").c_str()));
 	fprintf(fp, "LineGap: 0\n");
 	fprintf(fp, "VLineGap: 0\n");
-	fprintf(fp, "OS2TypoAscent: %d\n", asds.first * m_ssfy);
+	fprintf(fp, "OS2TypoAscent: %d\n", asds.first * sfy);
 	fprintf(fp, "OS2TypoAOffset: 0\n");
-	fprintf(fp, "OS2TypoDescent: %d\n", -asds.second * m_ssfy);
+	fprintf(fp, "OS2TypoDescent: %d\n", -asds.second * sfy);
 	fprintf(fp, "OS2TypoDOffset: 0\n");
 	fprintf(fp, "OS2TypoLinegap: 0\n");
-	fprintf(fp, "OS2WinAscent: %d\n", asds.first * m_ssfy);
+	fprintf(fp, "OS2WinAscent: %d\n", asds.first * sfy);
 	fprintf(fp, "OS2WinAOffset: 0\n");
-	fprintf(fp, "OS2WinDescent: %d\n", asds.second * m_ssfy);
+	fprintf(fp, "OS2WinDescent: %d\n", asds.second * sfy);
 	fprintf(fp, "OS2WinDOffset: 0\n");
-	fprintf(fp, "HheadAscent: %d\n", asds.first * m_ssfy);
+	fprintf(fp, "HheadAscent: %d\n", asds.first * sfy);
 	fprintf(fp, "HheadAOffset: 0\n");
-	fprintf(fp, "HheadDescent: %d\n", -asds.second * m_ssfy);
+	fprintf(fp, "HheadDescent: %d\n", -asds.second * sfy);
 	fprintf(fp, "HheadDOffset: 0\n");
 	fprintf(fp, "Encoding: UnicodeBmp\n");
 	fprintf(fp, "UnicodeInterp: none\n");
@@ -1242,12 +3885,34 @@ int font::save_sfd(const char *file, enum vectoalg vt)
 	fprintf(fp, "TeXData: 1 0 0 346030 173015 115343 0 1048576 115343 783286 444596 497025 792723 393216 433062 380633 303038 157286 324010 404750 52429 2506097 1059062 262144\n");
 	fprintf(fp, "BeginChars: 65536 %zu\n\n", m_glyph.size());
 
+	std::vector<std::pair<char32_t, size_t>> list;
 	if (m_unicode_map == nullptr) {
 		for (size_t idx = 0; idx < m_glyph.size(); ++idx)
-			save_sfd_glyph(fp, idx, idx, asds.first, asds.second, vt);
+			list.emplace_back(idx, idx);
 	} else {
 		for (const auto &pair : m_unicode_map->m_u2i)
-			save_sfd_glyph(fp, pair.second, pair.first, asds.first, asds.second, vt);
+			if (pair.second < m_glyph.size())
+				list.emplace_back(pair.first, pair.second);
+	}
+	if (strtoul(prop("sfdrefs").c_str(), nullptr, 0) == 0) {
+		for (const auto &[cp, idx] : list)
+			save_sfd_glyph(fp, m_glyph[idx], cp, asds.first, asds.second, sfx, sfy, vt);
+	} else {
+		auto comp = find_components(m_glyph, list);
+		char refer[80];
+		for (size_t i = 0; i < list.size(); ++i) {
+			const auto &c = comp[i];
+			if (c.ref < 0) {
+				save_sfd_glyph(fp, m_glyph[list[i].second], list[i].first,
+					asds.first, asds.second, sfx, sfy, vt);
+				continue;
+			}
+			unsigned int rcp = list[c.ref].first;
+			snprintf(refer, sizeof(refer), "Refer: %u %u N 1 0 0 1 0 %d 2\n",
+			         rcp, rcp, -c.dy * sfy);
+			save_sfd_glyph(fp, c.residual, list[i].first, asds.first,
+				asds.second, sfx, sfy, vt, refer);
+		}
 	}
 	fprintf(fp, "EndChars\n");
 	fprintf(fp, "EndSplineFont\n");
@@ -1268,8 +3933,9 @@ static inline bool testbit_u(const glyph &g, int x, int y)
 	return g.m_data[bp.byte] & bp.mask;
 }
 
-vectorizer::vectorizer(const glyph &g, int desc) :
-	m_glyph(g), m_descent(desc)
+vectorizer::vectorizer(const glyph &g, int desc,
+    std::pmr::memory_resource *scratch, std::pmr::memory_resource *out) :
+	m_glyph(g), m_descent(desc), m_scratch(scratch), m_out(out), emap(scratch)
 {}
 
 /**
@@ -1323,6 +3989,7 @@ void vectorizer::internal_edge_delete()
 	 * orientation. In other words, after this edge removal, the remaining
 	 * set of edges forms a new set of abstract polygons.
 	 */
+	m_edges += emap.size();
 	for (auto edge = emap.begin(); edge != emap.end(); ) {
 		auto twin = emap.find({edge->end_vtx, edge->start_vtx});
 		if (twin == emap.cend()) {
@@ -1342,7 +4009,7 @@ void vectorizer::internal_edge_delete()
  * Find the next edges (up to two) for @tail.
  */
 unsigned int vectorizer::neigh_edges(unsigned int cur_dir, const vertex &tail,
-    std::set<edge>::iterator &inward, std::set<edge>::iterator &outward) const
+    edge_set::iterator &inward, edge_set::iterator &outward) const
 {
 	inward = emap.lower_bound({tail, {INT_MIN, INT_MIN}});
 	if (inward == emap.end() || inward->start_vtx != tail) {
@@ -1359,11 +4026,11 @@ unsigned int vectorizer::neigh_edges(unsigned int cur_dir, const vertex &tail,
 	return 2;
 }
 
-std::set<edge>::iterator vectorizer::next_edge(unsigned int cur_dir,
+vectorizer::edge_set::iterator vectorizer::next_edge(unsigned int cur_dir,
     const edge &cur_edge, unsigned int flags) const
 {
 	const auto &tail = cur_edge.end_vtx;
-	std::set<edge>::iterator inward, outward;
+	edge_set::iterator inward, outward;
 	auto ret = neigh_edges(cur_dir, tail, inward, outward);
 	if (!(flags & P_ISTHMUS) || ret <= 1)
 		return inward;
@@ -1450,9 +4117,9 @@ std::set<edge>::iterator vectorizer::next_edge(unsigned int cur_dir,
  * edge and following the path with "right turns only" until we see the same
  * edge again, that will be our polygon.
  */
-std::vector<edge> vectorizer::pop_poly(unsigned int flags)
+polygon vectorizer::pop_poly(unsigned int flags)
 {
-	std::vector<edge> poly;
+	polygon poly(m_out);
 	if (emap.size() == 0)
 		return poly;
 	poly.push_back(*emap.begin());
@@ -1488,11 +4155,11 @@ std::vector<edge> vectorizer::pop_poly(unsigned int flags)
 	return poly;
 }
 
-std::vector<std::vector<edge>> vectorizer::simple()
+std::pmr::vector<polygon> vectorizer::simple()
 {
 	make_squares();
 	internal_edge_delete();
-	std::vector<std::vector<edge>> pmap;
+	std::pmr::vector<polygon> pmap(m_out);
 	while (true) {
 		auto poly = pop_poly(P_SIMPLIFY_LINES);
 		if (poly.size() == 0)
@@ -1502,7 +4169,7 @@ std::vector<std::vector<edge>> vectorizer::simple()
 	return pmap;
 }
 
-std::vector<std::vector<edge>> vectorizer::n1()
+std::pmr::vector<polygon> vectorizer::n1()
 {
 	auto &g = m_glyph;
 	const auto &sz = g.m_size;
@@ -1558,7 +4225,7 @@ std::vector<std::vector<edge>> vectorizer::n1()
 	}
 
 	internal_edge_delete();
-	std::vector<std::vector<edge>> pmap;
+	std::pmr::vector<polygon> pmap(m_out);
 	while (true) {
 		auto poly = pop_poly(P_SIMPLIFY_LINES);
 		if (poly.size() == 0)
@@ -1568,11 +4235,12 @@ std::vector<std::vector<edge>> vectorizer::n1()
 	return pmap;
 }
 
-static void n2_angle(std::vector<edge> &poly, unsigned int sx, unsigned int sy)
+static void n2_angle(polygon &poly, unsigned int sx, unsigned int sy,
+    std::pmr::memory_resource *scratch)
 {
 	static const unsigned int M_HEAD = 0x20, M_TAIL = 0x02,
 		M_XHEAD = 0x10, M_XTAIL = 0x01;
-	std::vector<unsigned int> flags(poly.size());
+	std::pmr::vector<unsigned int> flags(poly.size(), scratch);
 
 	/*
 	 * It's a closed polygon and so it does not matter which edge
@@ -1730,42 +4398,37 @@ static void n2_angle(std::vector<edge> &poly, unsigned int sx, unsigned int sy)
 	}
 }
 
-std::vector<std::vector<edge>> vectorizer::n2(unsigned int flags)
+std::pmr::vector<polygon> vectorizer::n2(unsigned int flags)
 {
 	flags &= P_ISTHMUS;
 	make_squares();
 	internal_edge_delete();
-	std::vector<std::vector<edge>> pmap;
+	std::pmr::vector<polygon> pmap(m_out);
 	while (true) {
 		/* Have all edges retain length 1 */
 		auto poly = pop_poly(flags);
 		if (poly.size() == 0)
 			break;
-		n2_angle(poly, scale_factor_x / 2, scale_factor_y / 2);
+		n2_angle(poly, scale_factor_x / 2, scale_factor_y / 2, m_scratch);
 		pmap.push_back(std::move(poly));
 	}
 	return pmap;
 }
 
-void font::save_sfd_glyph(FILE *fp, size_t idx, char32_t cp, int asc, int desc,
-    enum vectoalg vt)
+/**
+ * Convert a glyph to outlines with the chosen algorithm. @sfx/@sfy are the
+ * font units per pixel. If @nedges is given, the number of edges that went
+ * through overlap removal is added to it. The result is allocated from @out;
+ * intermediate data lives in the thread's scratch arena.
+ */
+std::pmr::vector<polygon> vfalib::vectorize(const glyph &g, enum vectoalg vt,
+    int desc, int sfx, int sfy, size_t *nedges, std::pmr::memory_resource *out)
 {
-	unsigned int cpx = cp;
-	if (idx >= m_glyph.size())
-		return;
-	const auto &g = m_glyph[idx];
-	const auto &sz = g.m_size;
-	fprintf(fp, "StartChar: %04x\n", cpx);
-	fprintf(fp, "Encoding: %u %u %u\n", cpx, cpx, cpx);
-	fprintf(fp, "Width: %u\n", sz.w * m_ssfx);
-	fprintf(fp, "Flags: MW\n");
-	fprintf(fp, "Fore\n");
-	fprintf(fp, "SplineSet\n");
-
-	std::vector<std::vector<edge>> pmap;
-	vectorizer vct(m_glyph[idx], desc);
-	vct.scale_factor_x = m_ssfx;
-	vct.scale_factor_y = m_ssfy;
+	scratch_scope scratch;
+	std::pmr::vector<polygon> pmap(out);
+	vectorizer vct(g, desc, scratch, out);
+	vct.scale_factor_x = sfx;
+	vct.scale_factor_y = sfy;
 	if (vt == V_SIMPLE)
 		pmap = vct.simple();
 	else if (vt == V_N1)
@@ -1774,6 +4437,26 @@ void font::save_sfd_glyph(FILE *fp, size_t idx, char32_t cp, int asc, int desc,
 		pmap = vct.n2();
 	else if (vt == V_N2EV)
 		pmap = vct.n2(vectorizer::P_ISTHMUS);
+	if (nedges != nullptr)
+		*nedges += vct.m_edges;
+	return pmap;
+}
+
+void font::save_sfd_glyph(FILE *fp, const glyph &g, char32_t cp, int asc,
+    int desc, int sfx, int sfy, enum vectoalg vt, const char *refer) const
+{
+	unsigned int cpx = cp;
+	const auto &sz = g.m_size;
+	fprintf(fp, "StartChar: %04x\n", cpx);
+	fprintf(fp, "Encoding: %u %u %u\n", cpx, cpx, cpx);
+	fprintf(fp, "Width: %u\n", sz.w * sfx);
+	fprintf(fp, "Flags: MW\n");
+	fprintf(fp, "Fore\n");
+	fprintf(fp, "SplineSet\n");
+
+	/* Polygons only live until they are printed */
+	scratch_scope scratch;
+	auto pmap = vectorize(g, vt, desc, sfx, sfy, nullptr, scratch);
 	for (const auto &poly : pmap) {
 		const auto &v1 = poly.cbegin()->start_vtx;
 		fprintf(fp, "%d %d m 25\n", v1.x, v1.y);
@@ -1781,6 +4464,8 @@ void font::save_sfd_glyph(FILE *fp, size_t idx, char32_t cp, int asc, int desc,
 			fprintf(fp, " %d %d l 25\n", edge.end_vtx.x, edge.end_vtx.y);
 	}
 	fprintf(fp, "EndSplineSet\n");
+	if (refer != nullptr)
+		fputs(refer, fp);
 	fprintf(fp, "EndChar\n");
 }
 
@@ -1832,6 +4517,66 @@ glyph glyph::copy_rect_to(const vfrect &sof, const glyph &other,
 	return out;
 }
 
+vfrect glyph::ink_bounds() const
+{
+	unsigned int w = m_size.w, y0 = m_size.h, y1 = 0;
+	if (w == 0 || w > 57 || m_data.size() < bytes_per_glyph(m_size)) {
+		unsigned int x0 = w, x1 = 0;
+		for (unsigned int y = 0; y < m_size.h; ++y) {
+			for (unsigned int x = 0; x < w; ++x) {
+				bitpos pos = y * w + x;
+				if (!(m_data[pos.byte] & pos.mask))
+					continue;
+				x0 = std::min(x0, x);
+				x1 = std::max(x1, x);
+				y0 = std::min(y0, y);
+				y1 = y;
+			}
+		}
+		return x0 > x1 ? vfrect() : vfrect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+	}
+	uint64_t cols = 0;
+	for (unsigned int y = 0; y < m_size.h; ++y) {
+		auto row = bits_get(m_data, y * w, w);
+		if (row == 0)
+			continue;
+		cols |= row;
+		y0 = std::min(y0, y);
+		y1 = y;
+	}
+	if (cols == 0)
+		return {};
+	unsigned int x0 = __builtin_clzll(cols) - (64 - w);
+	unsigned int x1 = w - 1 - __builtin_ctzll(cols);
+	return vfrect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+/**
+ * OR @src, moved by (@dx,@dy), into this glyph. For equal sizes up to 57
+ * pixels wide, this goes a row at a time with shifts.
+ */
+void glyph::blit_or(const glyph &src, int dx, int dy)
+{
+	unsigned int w = m_size.w;
+	if (src.m_size.w != w || src.m_size.h != m_size.h || w == 0 || w > 57 ||
+	    src.m_data.size() < bytes_per_glyph(m_size) ||
+	    m_data.size() < bytes_per_glyph(m_size) || std::abs(dx) >= static_cast<int>(w)) {
+		*this = src.copy_rect_to(vfpos() | src.m_size, *this,
+		        vfpos(dx, dy) | m_size, false);
+		return;
+	}
+	uint64_t mask = (~0ULL) >> (64 - w);
+	for (unsigned int y = 0; y < m_size.h; ++y) {
+		int oy = y + dy;
+		if (oy < 0 || oy >= static_cast<int>(m_size.h))
+			continue;
+		auto row = bits_get(src.m_data, y * w, w);
+		row = dx >= 0 ? row >> dx : (row << -dx) & mask;
+		if (row != 0)
+			bits_or(m_data, oy * w, w, row);
+	}
+}
+
 int glyph::find_baseline() const
 {
 	for (int y = m_size.h - 1; y >= 0; --y) {
@@ -1847,6 +4592,21 @@ int glyph::find_baseline() const
 glyph glyph::flip(bool flipx, bool flipy) const
 {
 	glyph ng(m_size);
+	if (m_size.w % CHAR_BIT == 0) {
+		/* Whole-byte rows: mirror with the row kernel, flip by row order */
+		auto rowbytes = m_size.w / CHAR_BIT;
+		auto dst = reinterpret_cast<uint8_t *>(ng.m_data.data());
+		auto n = static_cast<size_t>(rowbytes) * m_size.h;
+		if (flipx)
+			glyph_kernels().mirror_rows(dst, reinterpret_cast<const uint8_t *>(m_data.data()), n, rowbytes);
+		else
+			memcpy(dst, m_data.data(), n);
+		if (flipy)
+			for (unsigned int y = 0; y < m_size.h / 2; ++y)
+				std::swap_ranges(&dst[y * rowbytes], &dst[(y + 1) * rowbytes],
+					&dst[(m_size.h - y - 1) * rowbytes]);
+		return ng;
+	}
 	for (unsigned int y = 0; y < m_size.h; ++y) {
 		for (unsigned int x = 0; x < m_size.w; ++x) {
 			bitpos ipos = y * m_size.w + x;
@@ -1877,20 +4637,58 @@ void glyph::invert()
 	std::transform(m_data.begin(), m_data.end(), m_data.begin(), [](char c) { return ~c; });
 }
 
-void glyph::lge(unsigned int adj)
+/**
+ * Copy column @sx to column @dx (sx < dx) in every row of a glyph.
+ *
+ * When rows are whole bytes and both columns sit in the same byte of a row,
+ * this is a lane-wise shift-and-mask on 64-bit words covering several rows at
+ * once, which is the case for 8/16/32/64-wide glyphs and the usual lge
+ * adjustments. Other geometries go bit by bit.
+ */
+static void column_copy(std::string &data, const vfsize &size,
+    unsigned int sx, unsigned int dx)
 {
-	if (m_size.w < adj + 1)
+	auto rowbytes = size.w / CHAR_BIT;
+	if (size.w % CHAR_BIT == 0 && 8 % rowbytes == 0 &&
+	    sx / CHAR_BIT == dx / CHAR_BIT) {
+		/* Memory-order mask, so the lane layout does not depend on endianness */
+		uint8_t mb[8]{};
+		for (unsigned int i = dx / CHAR_BIT; i < 8; i += rowbytes)
+			mb[i] = 0x80 >> (dx % CHAR_BIT);
+		uint64_t mask, word;
+		memcpy(&mask, mb, sizeof(mask));
+		auto shift = dx - sx;
+		auto total = size.h * rowbytes;
+		size_t i = 0;
+		for (; i + 8 <= total; i += 8) {
+			memcpy(&word, &data[i], sizeof(word));
+			word = (word & ~mask) | ((word >> shift) & mask);
+			memcpy(&data[i], &word, sizeof(word));
+		}
+		uint8_t dmask = 0x80 >> (dx % CHAR_BIT);
+		for (i += dx / CHAR_BIT; i < total; i += rowbytes) {
+			uint8_t b = data[i];
+			data[i] = (b & ~dmask) | ((b >> shift) & dmask);
+		}
 		return;
-	for (unsigned int y = 0; y < m_size.h; ++y) {
-		bitpos ipos = (y + 1) * m_size.w - 1 - adj;
-		bitpos opos = (y + 1) * m_size.w - 1;
-		if (m_data[ipos.byte] & ipos.mask)
-			m_data[opos.byte] |= opos.mask;
+	}
+	for (unsigned int y = 0; y < size.h; ++y) {
+		bitpos ipos = y * size.w + sx;
+		bitpos opos = y * size.w + dx;
+		if (data[ipos.byte] & ipos.mask)
+			data[opos.byte] |= opos.mask;
 		else
-			m_data[opos.byte] &= ~opos.mask;
+			data[opos.byte] &= ~opos.mask;
 	}
 }
 
+void glyph::lge(unsigned int adj)
+{
+	if (m_size.w < adj + 1 || adj == 0)
+		return;
+	column_copy(m_data, m_size, m_size.w - 1 - adj, m_size.w - 1);
+}
+
 glyph glyph::overstrike(unsigned int px) const
 {
 	glyph composite(m_size);
@@ -1906,16 +4704,19 @@ std::string glyph::as_pbm() const
 	if (m_data.size() < bpg)
 		return {};
 
-	std::stringstream ss;
-	ss << "P1\n" << m_size.w << " " << m_size.h << "\n";
+	char hdr[32];
+	auto hz = snprintf(hdr, sizeof(hdr), "P1\n%u %u\n", m_size.w, m_size.h);
+	std::string out;
+	out.reserve(hz + (m_size.w + 1) * m_size.h);
+	out.append(hdr, hz);
 	for (unsigned int y = 0; y < m_size.h; ++y) {
 		for (unsigned int x = 0; x < m_size.w; ++x) {
 			bitpos pos = y * m_size.w + x;
-			ss << ((m_data[pos.byte] & pos.mask) ? "1" : "0");
+			out += (m_data[pos.byte] & pos.mask) ? '1' : '0';
 		}
-		ss << "\n";
+		out += '\n';
 	}
-	return ss.str();
+	return out;
 }
 
 std::string glyph::as_pclt() const
@@ -1924,16 +4725,19 @@ std::string glyph::as_pclt() const
 	if (m_data.size() < bpc)
 		return {};
 
-	std::stringstream ss;
-	ss << "PCLT\n" << m_size.w << " " << m_size.h << "\n";
+	char hdr[32];
+	auto hz = snprintf(hdr, sizeof(hdr), "PCLT\n%u %u\n", m_size.w, m_size.h);
+	std::string out;
+	out.reserve(hz + (2 * m_size.w + 1) * m_size.h);
+	out.append(hdr, hz);
 	for (unsigned int y = 0; y < m_size.h; ++y) {
 		for (unsigned int x = 0; x < m_size.w; ++x) {
 			bitpos pos = y * m_size.w + x;
-			ss << ((m_data[pos.byte] & pos.mask) ? "##" : "..");
+			out.append((m_data[pos.byte] & pos.mask) ? "##" : "..", 2);
 		}
-		ss << "\n";
+		out += '\n';
 	}
-	return ss.str();
+	return out;
 }
 
 std::vector<uint32_t> glyph::as_rgba() const
@@ -1,10 +1,15 @@
 #ifndef VFALIB_HPP
 #define VFALIB_HPP 1
 
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <memory>
+#include <memory_resource>
 #include <set>
 #include <stdexcept>
+#include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 #include <cstdint>
@@ -37,6 +42,54 @@
 
 namespace vfalib {
 
+/* CPI: see http://www.seasip.info/DOS/CPI/cpi.html */
+struct cpi_fontfile_header {
+	uint8_t id0;
+	char id[7], reserved[8];
+	uint16_t pnum;
+	uint8_t ptyp;
+	uint32_t fih_offset;
+} __attribute__((packed));
+
+struct cpi_fontinfo_header {
+	uint16_t num_codepages;
+} __attribute__((packed));
+
+enum cpi_device_type {
+	DEVTYPE_SCREEN = 1,
+	DEVTYPE_PRINTER,
+};
+
+/**
+ * @device_name:	for screens, usually "EGA", or perhaps "LCD".
+ * 			for printers, usually "4201", "4208", "5202",
+ * 			"1050", "EPS", "PPDS"
+ */
+struct cpi_cpentry_header {
+	uint16_t cpeh_size;
+	uint32_t next_cpeh_offset;
+	uint16_t device_type;
+	char device_name[8];
+	uint16_t codepage;
+	char reserved[6];
+	uint32_t cpih_offset;
+} __attribute__((packed));
+
+struct cpi_cpinfo_header {
+	uint16_t version;
+	uint16_t num_fonts;
+	uint16_t size;
+} __attribute__((packed));
+
+struct cpi_screenfont_header {
+	uint8_t height, width, yaspect, xaspect;
+	uint16_t num_chars;
+} __attribute__((packed));
+
+struct cpi_printfont_header {
+	uint16_t printer_type, escape_length;
+} __attribute__((packed));
+
 struct vfpos {
 	vfpos() = default;
 	vfpos(int a, int b) : x(a), y(b) {}
@@ -64,6 +117,7 @@ struct unicode_map {
 	std::set<char32_t> to_unicode(unsigned int idx) const;
 	ssize_t to_index(char32_t uc) const;
 	void swap_idx(unsigned int, unsigned int);
+	void permute(const std::vector<unsigned int> &);
 };
 
 struct vertex {
@@ -88,6 +142,41 @@ enum vectoalg {
 	V_N2EV,
 };
 
+using polygon = std::pmr::vector<edge>;
+
+enum aio_backend {
+	AIO_AUTO = 0,
+	AIO_URING,
+	AIO_THREADS,
+	AIO_SYNC,
+};
+
+/**
+ * Whole-file reads and writes that proceed in the background. Reads are
+ * started with prefetch() and collected with fetch(); writes are queued with
+ * write() and completed by flush() or the destructor. AIO_AUTO uses io_uring
+ * when the kernel has it, else a thread pool. An instance must only be used
+ * from one thread.
+ */
+class async_io {
+	public:
+	async_io(enum aio_backend = AIO_AUTO);
+	~async_io();
+	enum aio_backend backend() const;
+	size_t prefetch(std::string path);
+	int fetch(size_t ticket, std::string &out);
+	void write(std::string path, std::string data);
+	/* Like write(), but @buf must stay valid until flush() */
+	void write_ref(std::string path, const char *buf, size_t size);
+	int flush(std::string *failed_path = nullptr);
+
+	struct impl;
+
+	private:
+	void write_job(std::string &&, const char *, size_t);
+	std::unique_ptr<impl> m_impl;
+};
+
 class glyph {
 	public:
 	glyph() = default;
@@ -98,6 +187,8 @@ class glyph {
 	std::string as_rowpad() const;
 	glyph copy_rect_to(const vfrect &src, const glyph &other, const vfrect &dst, bool overwrite = true) const;
 	int find_baseline() const;
+	vfrect ink_bounds() const;
+	void blit_or(const glyph &, int dx, int dy);
 	glyph flip(bool x, bool y) const;
 	void invert();
 	glyph upscale(const vfsize &factor) const;
@@ -112,23 +203,41 @@ class glyph {
 	std::string m_data;
 };
 
+/* Outcome of font::load_clt with a cache: glyphs taken from it, files parsed */
+struct clt_stats {
+	size_t cached = 0, parsed = 0;
+};
+
+/* Outcome of font::sync_clt/sync_pbm */
+struct sync_stats {
+	size_t written = 0, unchanged = 0, removed = 0;
+};
+
 class font {
 	public:
 	font();
 	void init_256_blanks();
+	int load_any(const char *file);
 	int load_bdf(const char *file);
-	int load_clt(const char *dir);
+	int load_clt(const char *dir, const char *cache = nullptr, clt_stats * = nullptr);
 	int load_fnt(const char *file, unsigned int width_hint = -1, unsigned int height_hint = -1);
 	int load_hex(const char *file);
 	int load_pcf(const char *file);
 	int load_psf(const char *file);
 	int save_bdf(const char *file);
 	int save_fnt(const char *file);
+	int save_hex(const char *file) const;
 	int save_map(const char *file);
 	int save_pbm(const char *dir);
 	int save_psf(const char *file);
 	int save_sfd(const char *file, enum vectoalg);
+	int save_spans(const char *file);
 	int save_clt(const char *dir);
+	int sync_clt(const char *dir, sync_stats &) const;
+	int sync_pbm(const char *dir, sync_stats &) const;
+	vfrect ink_bounds() const;
+	vfrect ink_bounds(const vfsize &) const;
+	void autocrop(bool keep_base = false);
 	void copy_rect(const vfrect &src, const vfrect &dst)
 		{ for (auto &g : m_glyph) g = g.copy_rect_to(src, g, dst); }
 	void copy_to_blank(const vfrect &src, const vfrect &dst)
@@ -140,21 +249,32 @@ class font {
 	void upscale(const vfsize &factor)
 		{ for (auto &g : m_glyph) g = g.upscale(factor); }
 	void lge();
+	void lge(char32_t first, char32_t last, unsigned int adj = 1);
 	void lgeu();
 	void lgeuf();
 	void overstrike(unsigned int px);
+	void reorder();
+	int compose(const char *unicodedata = nullptr);
+	int synth_boxes(bool replace = false);
 
 	using propmap_t = std::map<std::string, std::string, std::less<>>;
+	/* Value of a property, or the empty string; does not add the key */
+	const std::string &prop(const char *key) const;
 	propmap_t props;
 
 	private:
+	struct lge_range {
+		char32_t first, last;
+		unsigned int adj;
+	};
+	void lge_ranges(const lge_range *, size_t);
 	std::pair<int, int> find_ascent_descent() const;
-	int load_clt_glyph(FILE *, glyph &);
-	void save_bdf_glyph(FILE *, size_t idx, char32_t cp);
-	int save_clt_glyph(const char *dir, size_t n, char32_t cp);
-	int save_pbm_glyph(const char *dir, size_t n, char32_t cp);
-	void save_sfd_glyph(FILE *, size_t idx, char32_t cp, int, int, enum vectoalg);
-	int m_ssfx = 2, m_ssfy = 2;
+	std::map<char32_t, size_t> glyph_files() const;
+	void save_bdf_glyph(std::string &, size_t idx, char32_t cp) const;
+	void save_clt_glyph(async_io &, const char *dir, size_t n, char32_t cp);
+	void save_pbm_glyph(async_io &, const char *dir, size_t n, char32_t cp);
+	void save_sfd_glyph(FILE *, const glyph &, char32_t cp, int, int, int, int, enum vectoalg, const char *refer = nullptr) const;
+	int sync_glyph_files(const char *dir, const char *ext, std::string (glyph::*)() const, sync_stats &) const;
 
 	public:
 	std::vector<glyph> m_glyph;
@@ -188,6 +308,49 @@ template<typename F> scope_success<F> make_scope_success(F &&f)
 	return scope_success<F>(std::move(f));
 }
 
+/**
+ * Run @func(i) for every i in [0,@n) on up to @nthr threads (0: one per CPU).
+ * Indices are handed out one at a time, so uneven items balance out.
+ */
+template<typename F> void parallel_for(size_t n, F &&func, unsigned int nthr = 0)
+{
+	if (nthr == 0)
+		nthr = std::max(1U, std::thread::hardware_concurrency());
+	nthr = std::min<size_t>(nthr, n);
+	std::atomic<size_t> next{0};
+	auto worker = [&]() {
+		for (size_t i; (i = next++) < n; )
+			func(i);
+	};
+	std::vector<std::thread> thr;
+	for (unsigned int i = 1; i < nthr; ++i)
+		thr.emplace_back(worker);
+	worker();
+	for (auto &t : thr)
+		t.join();
+}
+
+/**
+ * Several strikes (cell sizes) of one typeface. All strikes use the same
+ * glyph indices and share one unicode_map, so codepoint lookups are
+ * resolved once for the whole set.
+ */
+class font_set {
+	public:
+	int add(font &&);
+	/* Run @func on every strike, concurrently */
+	template<typename F> void each(F &&func)
+		{ parallel_for(m_strike.size(), [&](size_t i) { func(m_strike[i]); }); }
+	int save_bdf(const char *stem);
+	int save_cpi(const char *file, const std::vector<unsigned int> &codepages) const;
+
+	std::vector<font> m_strike;
+	std::shared_ptr<unicode_map> m_unicode_map;
+};
+
+extern glyph synth_box_glyph(const vfsize &, char32_t);
+extern std::pmr::vector<polygon> vectorize(const glyph &, enum vectoalg, int descent = 0, int sfx = 2, int sfy = 2, size_t *nedges = nullptr, std::pmr::memory_resource * = std::pmr::get_default_resource());
+
 inline vfrect operator|(const vfpos &p, const vfsize &s)
 {
 	return vfrect(p.x, p.y, s.w, s.h);
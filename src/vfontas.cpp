@@ -5,82 +5,91 @@
  */
 #include "config.h"
 #include <algorithm>
+#include <atomic>
 #include <memory>
+#include <set>
 #include <string>
 #include <utility>
+#include <vector>
+#include <cerrno>
+#include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <getopt.h>
+#include <glob.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <libHX/defs.h>
 #include <libHX/io.h>
 #include <libHX/string.h>
+#include "cpuisa.hpp"
 #include "vfalib.hpp"
 #define MMAP_NONE reinterpret_cast<void *>(-1)
 
 using namespace vfalib;
 
-/* CPI: see http://www.seasip.info/DOS/CPI/cpi.html */
-struct cpi_fontfile_header {
-	uint8_t id0;
-	char id[7], reserved[8];
-	uint16_t pnum;
-	uint8_t ptyp;
-	uint32_t fih_offset;
-} __attribute__((packed));
-
-struct cpi_fontinfo_header {
-	uint16_t num_codepages;
-} __attribute__((packed));
-
-enum cpi_device_type {
-	DEVTYPE_SCREEN = 1,
-	DEVTYPE_PRINTER,
+namespace {
+
+/* Codepage and cell size selection for -xcpi; empty sets match everything */
+struct cpi_filter {
+	std::set<unsigned int> codepages;
+	std::set<std::pair<unsigned int, unsigned int>> sizes;
+	bool match(unsigned int cp, unsigned int w, unsigned int h) const {
+		return (codepages.empty() || codepages.count(cp) > 0) &&
+		       (sizes.empty() || sizes.count({w, h}) > 0);
+	}
 };
 
 /**
- * @device_name:	for screens, usually "EGA", or perhaps "LCD".
- * 			for printers, usually "4201", "4208", "5202",
- * 			"1050", "EPS", "PPDS"
+ * Settings that commands leave for later commands of the same invocation
+ *
+ * @strikes:	fonts collected with -addstrike; transforms apply to these too
  */
-struct cpi_cpentry_header {
-	uint16_t cpeh_size;
-	uint32_t next_cpeh_offset;
-	uint16_t device_type;
-	char device_name[8];
-	uint16_t codepage;
-	char reserved[6];
-	uint32_t cpih_offset;
-} __attribute__((packed));
-
-struct cpi_cpinfo_header {
-	uint16_t version;
-	uint16_t num_fonts;
-	uint16_t size;
-} __attribute__((packed));
-
-struct cpi_screenfont_header {
-	uint8_t height, width, yaspect, xaspect;
-	uint16_t num_chars;
-} __attribute__((packed));
-
-struct cpi_printfont_header {
-	uint16_t printer_type, escape_length;
-} __attribute__((packed));
-
-static std::string cpi_separator;
-
-static bool vf_blankfnt(font &f, char **args)
+struct vf_state {
+	std::string cpi_separator;
+	cpi_filter cpi_select;
+	font_set strikes;
+	bool reorder_on_save = false;
+};
+
+}
+
+static bool vf_addstrike(font &f, vf_state &st, char **args)
+{
+	auto ret = st.strikes.add(std::move(f));
+	if (ret == -EEXIST) {
+		fprintf(stderr, "addstrike: the set already has a strike of this size\n");
+		return false;
+	} else if (ret < 0) {
+		fprintf(stderr, "addstrike: font is empty, or only some strikes have a Unicode map\n");
+		return false;
+	}
+	f = font();
+	return true;
+}
+
+static bool vf_autocrop(font &f, char **args)
+{
+	f.autocrop();
+	return true;
+}
+
+static bool vf_autocrop_bl(font &f, char **args)
+{
+	f.autocrop(true);
+	return true;
+}
+
+static bool vf_blankfnt(font &f, vf_state &st, char **args)
 {
 	f.init_256_blanks();
 	return true;
 }
 
-static bool vf_canvas(font &f, char **args)
+static bool vf_canvas(font &f, vf_state &st, char **args)
 {
 	auto x = strtol(args[0], nullptr, 0);
 	auto y = strtol(args[1], nullptr, 0);
@@ -93,13 +102,33 @@ static bool vf_canvas(font &f, char **args)
 	return true;
 }
 
-static bool vf_clearmap(font &f, char **args)
+static bool vf_clearmap(font &f, vf_state &st, char **args)
 {
 	f.m_unicode_map.reset();
 	return true;
 }
 
-static bool vf_copy(font &f, char **args)
+static bool vf_compose_ret(int ret)
+{
+	if (ret < 0) {
+		fprintf(stderr, "compose: %s\n", strerror(-ret));
+		return false;
+	}
+	printf("compose: %d glyphs synthesized\n", ret);
+	return true;
+}
+
+static bool vf_compose(font &f, vf_state &st, char **args)
+{
+	return vf_compose_ret(f.compose());
+}
+
+static bool vf_composeud(font &f, vf_state &st, char **args)
+{
+	return vf_compose_ret(f.compose(args[0]));
+}
+
+static bool vf_copy(font &f, vf_state &st, char **args)
 {
 	auto x = strtol(args[0], nullptr, 0);
 	auto y = strtol(args[1], nullptr, 0);
@@ -120,13 +149,13 @@ static bool vf_copy(font &f, char **args)
 	return true;
 }
 
-static bool vf_cpisep(font &f, char **args)
+static bool vf_cpisep(font &f, vf_state &st, char **args)
 {
-	cpi_separator = args[0];
+	st.cpi_separator = args[0];
 	return true;
 }
 
-static bool vf_crop(font &f, char **args)
+static bool vf_crop(font &f, vf_state &st, char **args)
 {
 	auto x = strtol(args[0], nullptr, 0);
 	auto y = strtol(args[1], nullptr, 0);
@@ -169,6 +198,13 @@ static bool vf_lge(font &f, char **args)
 	return true;
 }
 
+static bool vf_lger(font &f, char **args)
+{
+	f.lge(strtoul(args[0], nullptr, 0), strtoul(args[1], nullptr, 0),
+	      strtoul(args[2], nullptr, 0));
+	return true;
+}
+
 static bool vf_lgeu(font &f, char **args)
 {
 	f.lgeu();
@@ -181,7 +217,7 @@ static bool vf_lgeuf(font &f, char **args)
 	return true;
 }
 
-static bool vf_loadbdf(font &f, char **args)
+static bool vf_loadbdf(font &f, vf_state &st, char **args)
 {
 	auto ret = f.load_bdf(args[0]);
 	if (ret >= 0)
@@ -190,7 +226,7 @@ static bool vf_loadbdf(font &f, char **args)
 	return false;
 }
 
-static bool vf_loadclt(font &f, char **args)
+static bool vf_loadclt(font &f, vf_state &st, char **args)
 {
 	auto ret = f.load_clt(args[0]);
 	if (ret >= 0)
@@ -199,7 +235,21 @@ static bool vf_loadclt(font &f, char **args)
 	return false;
 }
 
-static bool vf_loadfnt(font &f, char **args)
+/* Like loadclt, with a sidecar cache in the directory */
+static bool vf_loadclt_cache(font &f, vf_state &st, char **args)
+{
+	auto cache = std::string(args[0]) + "/.loadclt.cache";
+	clt_stats cs;
+	auto ret = f.load_clt(args[0], cache.c_str(), &cs);
+	if (ret < 0) {
+		fprintf(stderr, "Error loading %s: %s\n", args[0], strerror(-ret));
+		return false;
+	}
+	printf("%s: %zu glyphs from cache, %zu parsed\n", args[0], cs.cached, cs.parsed);
+	return true;
+}
+
+static bool vf_loadfnt(font &f, vf_state &st, char **args)
 {
 	auto ret = f.load_fnt(args[0]);
 	if (ret >= 0)
@@ -208,7 +258,7 @@ static bool vf_loadfnt(font &f, char **args)
 	return false;
 }
 
-static bool vf_loadraw(font &f, char **args)
+static bool vf_loadraw(font &f, vf_state &st, char **args)
 {
 	auto ret = f.load_fnt(args[0], atoi(args[1]), atoi(args[2]));
 	if (ret >= 0)
@@ -217,7 +267,7 @@ static bool vf_loadraw(font &f, char **args)
 	return false;
 }
 
-static bool vf_loadhex(font &f, char **args)
+static bool vf_loadhex(font &f, vf_state &st, char **args)
 {
 	auto ret = f.load_hex(args[0]);
 	if (ret >= 0)
@@ -226,7 +276,7 @@ static bool vf_loadhex(font &f, char **args)
 	return false;
 }
 
-static bool vf_loadmap(font &f, char **args)
+static bool vf_loadmap(font &f, vf_state &st, char **args)
 {
 	if (f.m_unicode_map == nullptr)
 		f.m_unicode_map = std::make_shared<unicode_map>();
@@ -237,7 +287,7 @@ static bool vf_loadmap(font &f, char **args)
 	return false;
 }
 
-static bool vf_loadpcf(font &f, char **args)
+static bool vf_loadpcf(font &f, vf_state &st, char **args)
 {
 	auto ret = f.load_pcf(args[0]);
 	if (ret >= 0)
@@ -246,7 +296,7 @@ static bool vf_loadpcf(font &f, char **args)
 	return false;
 }
 
-static bool vf_loadpsf(font &f, char **args)
+static bool vf_loadpsf(font &f, vf_state &st, char **args)
 {
 	auto ret = f.load_psf(args[0]);
 	if (ret >= 0)
@@ -271,8 +321,22 @@ static bool vf_overstrike(font &f, char **args)
 	return true;
 }
 
-static bool vf_savebdf(font &f, char **args)
+static bool vf_reorder(font &f, vf_state &st, char **args)
 {
+	f.reorder();
+	return true;
+}
+
+static bool vf_reorder_auto(font &f, vf_state &st, char **args)
+{
+	st.reorder_on_save = true;
+	return true;
+}
+
+static bool vf_savebdf(font &f, vf_state &st, char **args)
+{
+	if (st.reorder_on_save)
+		f.reorder();
 	auto ret = f.save_bdf(args[0]);
 	if (ret >= 0)
 		return true;
@@ -280,7 +344,40 @@ static bool vf_savebdf(font &f, char **args)
 	return false;
 }
 
-static bool vf_saveclt(font &f, char **args)
+static bool vf_savebdfset(font &f, vf_state &st, char **args)
+{
+	auto ret = st.strikes.save_bdf(args[0]);
+	if (ret >= 0)
+		return true;
+	fprintf(stderr, "Error saving %s-*.bdf: %s\n", args[0], strerror(-ret));
+	return false;
+}
+
+static bool vf_savecpi(font &f, vf_state &st, char **args)
+{
+	std::vector<unsigned int> cplist;
+	for (auto s = args[1]; *s != '\0'; ) {
+		char *end;
+		auto cp = strtoul(s, &end, 0);
+		if (end == s || cp == 0 || cp > UINT16_MAX || (*end != ',' && *end != '\0')) {
+			fprintf(stderr, "savecpi: unparsable codepage list \"%s\"\n", args[1]);
+			return false;
+		}
+		cplist.push_back(cp);
+		s = *end == ',' ? end + 1 : end;
+	}
+	if (st.strikes.m_strike.empty()) {
+		fprintf(stderr, "savecpi: no strikes; use -addstrike first\n");
+		return false;
+	}
+	auto ret = st.strikes.save_cpi(args[0], cplist);
+	if (ret >= 0)
+		return true;
+	fprintf(stderr, "Error saving %s: %s\n", args[0], strerror(-ret));
+	return false;
+}
+
+static bool vf_saveclt(font &f, vf_state &st, char **args)
 {
 	auto ret = f.save_clt(args[0]);
 	if (ret >= 0)
@@ -289,7 +386,7 @@ static bool vf_saveclt(font &f, char **args)
 	return false;
 }
 
-static bool vf_savefnt(font &f, char **args)
+static bool vf_savefnt(font &f, vf_state &st, char **args)
 {
 	auto ret = f.save_fnt(args[0]);
 	if (ret >= 0)
@@ -298,7 +395,18 @@ static bool vf_savefnt(font &f, char **args)
 	return false;
 }
 
-static bool vf_savemap(font &f, char **args)
+static bool vf_savehex(font &f, vf_state &st, char **args)
+{
+	if (st.reorder_on_save)
+		f.reorder();
+	auto ret = f.save_hex(args[0]);
+	if (ret >= 0)
+		return true;
+	fprintf(stderr, "Error saving %s: %s\n", args[0], strerror(-ret));
+	return false;
+}
+
+static bool vf_savemap(font &f, vf_state &st, char **args)
 {
 	auto ret = f.save_map(args[0]);
 	if (ret >= 0)
@@ -307,7 +415,7 @@ static bool vf_savemap(font &f, char **args)
 	return false;
 }
 
-static bool vf_savepbm(font &f, char **args)
+static bool vf_savepbm(font &f, vf_state &st, char **args)
 {
 	auto ret = f.save_pbm(args[0]);
 	if (ret >= 0)
@@ -316,7 +424,7 @@ static bool vf_savepbm(font &f, char **args)
 	return false;
 }
 
-static bool vf_savepsf(font &f, char **args)
+static bool vf_savepsf(font &f, vf_state &st, char **args)
 {
 	auto ret = f.save_psf(args[0]);
 	if (ret >= 0)
@@ -325,8 +433,10 @@ static bool vf_savepsf(font &f, char **args)
 	return false;
 }
 
-static bool vf_savesfd(font &f, char **args)
+static bool vf_savesfd(font &f, vf_state &st, char **args)
 {
+	if (st.reorder_on_save)
+		f.reorder();
 	auto ret = f.save_sfd(args[0], vectoalg::V_SIMPLE);
 	if (ret >= 0)
 		return true;
@@ -334,8 +444,10 @@ static bool vf_savesfd(font &f, char **args)
 	return false;
 }
 
-static bool vf_saven1(font &f, char **args)
+static bool vf_saven1(font &f, vf_state &st, char **args)
 {
+	if (st.reorder_on_save)
+		f.reorder();
 	auto ret = f.save_sfd(args[0], vectoalg::V_N1);
 	if (ret >= 0)
 		return true;
@@ -343,8 +455,10 @@ static bool vf_saven1(font &f, char **args)
 	return false;
 }
 
-static bool vf_saven2(font &f, char **args)
+static bool vf_saven2(font &f, vf_state &st, char **args)
 {
+	if (st.reorder_on_save)
+		f.reorder();
 	auto ret = f.save_sfd(args[0], vectoalg::V_N2);
 	if (ret >= 0)
 		return true;
@@ -352,8 +466,10 @@ static bool vf_saven2(font &f, char **args)
 	return false;
 }
 
-static bool vf_saven2ev(font &f, char **args)
+static bool vf_saven2ev(font &f, vf_state &st, char **args)
 {
+	if (st.reorder_on_save)
+		f.reorder();
 	auto ret = f.save_sfd(args[0], vectoalg::V_N2EV);
 	if (ret >= 0)
 		return true;
@@ -361,6 +477,17 @@ static bool vf_saven2ev(font &f, char **args)
 	return false;
 }
 
+static bool vf_savespan(font &f, vf_state &st, char **args)
+{
+	if (st.reorder_on_save)
+		f.reorder();
+	auto ret = f.save_spans(args[0]);
+	if (ret >= 0)
+		return true;
+	fprintf(stderr, "Error saving %s: %s\n", args[0], strerror(-ret));
+	return false;
+}
+
 static bool vf_setbold(font &f, char **args)
 {
 	f.props.insert_or_assign("TTFWeight", "700");
@@ -387,6 +514,47 @@ static bool vf_setprop(font &f, char **args)
 	return true;
 }
 
+static bool vf_sync(const char *dir, int ret, const sync_stats &ss)
+{
+	if (ret < 0) {
+		fprintf(stderr, "Error saving %s/: %s\n", dir, strerror(-ret));
+		return false;
+	}
+	printf("%s: %zu written, %zu unchanged, %zu removed\n", dir,
+	       ss.written, ss.unchanged, ss.removed);
+	return true;
+}
+
+static bool vf_syncclt(font &f, vf_state &st, char **args)
+{
+	sync_stats ss;
+	return vf_sync(args[0], f.sync_clt(args[0], ss), ss);
+}
+
+static bool vf_syncpbm(font &f, vf_state &st, char **args)
+{
+	sync_stats ss;
+	return vf_sync(args[0], f.sync_pbm(args[0], ss), ss);
+}
+
+static bool vf_synthbox_ret(int ret)
+{
+	if (ret < 0)
+		return false;
+	printf("synthbox: %d glyphs drawn\n", ret);
+	return true;
+}
+
+static bool vf_synthbox(font &f, vf_state &st, char **args)
+{
+	return vf_synthbox_ret(f.synth_boxes());
+}
+
+static bool vf_synthbox_all(font &f, vf_state &st, char **args)
+{
+	return vf_synthbox_ret(f.synth_boxes(true));
+}
+
 static bool vf_upscale(font &f, char **args)
 {
 	auto xf = strtol(args[0], nullptr, 0);
@@ -399,170 +567,445 @@ static bool vf_upscale(font &f, char **args)
 	return true;
 }
 
+namespace {
+
+struct deleter {
+	void operator()(FILE *f) { fclose(f); }
+};
+
+/* One output file; @data points into the input mapping */
+struct cpi_member {
+	std::string name;
+	const char *data;
+	size_t size;
+};
+
+struct cpi_input {
+	cpi_input() = default;
+	cpi_input(cpi_input &&) = delete;
+	~cpi_input() { if (map != MMAP_NONE) munmap(map, size); }
+
+	/* @dest: output location, for the log only */
+	std::string file, dest, prefix, log;
+	void *map = MMAP_NONE;
+	size_t size = 0;
+	time_t mtime = 0;
+	std::vector<cpi_member> members;
+	int err = 0;
+};
+
+}
+
+static bool vf_cpifilter(font &f, vf_state &st, char **args)
+{
+	cpi_filter nf;
+	for (auto s = args[0]; *s != '\0'; ) {
+		char *end;
+		unsigned int w = strtoul(s, &end, 0), h;
+		if (end == s) {
+			fprintf(stderr, "cpifilter: unparsable \"%s\"\n", s);
+			return false;
+		}
+		if (*end == 'x') {
+			s = end + 1;
+			h = strtoul(s, &end, 0);
+			if (end == s) {
+				fprintf(stderr, "cpifilter: unparsable \"%s\"\n", s);
+				return false;
+			}
+			nf.sizes.emplace(w, h);
+		} else {
+			nf.codepages.emplace(w);
+		}
+		s = end;
+		if (*s == ',')
+			++s;
+		else if (*s != '\0') {
+			fprintf(stderr, "cpifilter: unparsable \"%s\"\n", s);
+			return false;
+		}
+	}
+	st.cpi_select = std::move(nf);
+	return true;
+}
+
 static uint32_t xlate_segoff(uint32_t x)
 {
 	return (x >> 12) + (x & 0xFFFF);
 }
 
-static void vf_extract_sfh(const char *sfhblk, unsigned int num_fonts,
-    const std::string &tpl_dir, const char *dev, const char *cpg)
+static std::string cpi_logf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static std::string cpi_logf(const char *fmt, ...)
 {
+	char buf[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	return buf;
+}
+
+static int vf_extract_sfh(cpi_input &in, const vf_state &st, size_t off,
+    unsigned int num_fonts, const char *dev, const char *cpg, unsigned int codepage)
+{
+	auto vdata = static_cast<const char *>(in.map);
 	for (unsigned int i = 0; i < num_fonts; ++i) {
-		struct cpi_screenfont_header sfh;
-		memcpy(&sfh, sfhblk, sizeof(sfh));
-		sfh.num_chars = le16_to_cpu(sfh.num_chars);
-		printf("SFH: %ux%u pixels x %u chars\n", sfh.width, sfh.height,
-		       sfh.num_chars);
-		if (sfh.width == 0 || sfh.height == 0 || sfh.num_chars == 0)
+		if (off + sizeof(cpi_screenfont_header) > in.size)
+			return -EINVAL;
+		auto sfh = reinterpret_cast<const cpi_screenfont_header *>(vdata + off);
+		unsigned int num_chars = le16_to_cpu(sfh->num_chars);
+		size_t length = sfh->width * sfh->height / 8 * num_chars;
+		off += sizeof(*sfh);
+		if (length > in.size - off)
+			return -EINVAL;
+		in.log += cpi_logf("SFH: %ux%u pixels x %u chars\n", sfh->width,
+		          sfh->height, num_chars);
+		if (sfh->width == 0 || sfh->height == 0 || num_chars == 0 ||
+		    !st.cpi_select.match(codepage, sfh->width, sfh->height)) {
 			/* Avoid producing empty files */
-			continue;
-
-		char buf[HXSIZEOF_Z32*3];
-		snprintf(buf, sizeof(buf), "%ux%u.fnt", sfh.width, sfh.height);
-		auto out_dir = tpl_dir;
-		auto out_file = tpl_dir;
-		if (cpi_separator.size() > 0) {
-			out_file += std::string("/") + dev + cpi_separator +
-			            cpg + cpi_separator + buf;
-		} else {
-			out_dir += std::string("/") + dev + "/" + cpg;
-			out_file = out_dir + "/" + buf;
-		}
-		printf("Writing to %s\n", out_file.c_str());
-		HX_mkdir(out_dir.c_str(), S_IRWXUGO);
-		auto out_fd = open(out_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUGO | S_IWUGO);
-		if (out_fd < 0) {
-			fprintf(stderr, "Error writing to %s: %s\n", out_file.c_str(), strerror(errno));
+			off += length;
 			continue;
 		}
 
-		auto length = sfh.width * sfh.height / 8 * sfh.num_chars;
-		write(out_fd, sfhblk + sizeof(sfh), length);
-		close(out_fd);
-		sfhblk += sizeof(sfh) + length;
+		char buf[HXSIZEOF_Z32*3];
+		snprintf(buf, sizeof(buf), "%ux%u.fnt", sfh->width, sfh->height);
+		auto name = in.prefix;
+		auto &sep = st.cpi_separator;
+		if (sep.size() > 0)
+			name += dev + sep + cpg + sep + buf;
+		else
+			name += std::string(dev) + "/" + cpg + "/" + buf;
+		in.log += "Writing to " + in.dest + name + "\n";
+		in.members.push_back({std::move(name), vdata + off, length});
+		off += length;
 	}
+	return 0;
 }
 
-static void vf_extract_pfh(const char *pfhblk)
+static void vf_extract_pfh(cpi_input &in, size_t off)
 {
-	struct cpi_printfont_header pfh;
-	memcpy(&pfh, pfhblk, sizeof(pfh));
-	pfh.printer_type = le16_to_cpu(pfh.printer_type);
-	pfh.escape_length = le16_to_cpu(pfh.escape_length);
-	printf("PFH: printer_type=%u escape_len=%u\n",
-	       pfh.printer_type, pfh.escape_length);
+	if (off + sizeof(cpi_printfont_header) > in.size)
+		return;
+	auto pfh = reinterpret_cast<const cpi_printfont_header *>(static_cast<const char *>(in.map) + off);
+	in.log += cpi_logf("PFH: printer_type=%u escape_len=%u\n",
+	          le16_to_cpu(pfh->printer_type), le16_to_cpu(pfh->escape_length));
 }
 
-static int vf_extract_cpi2(const char *vdata, size_t vsize,
-    const char *directory, bool seg_mode)
+/**
+ * Walk the headers in place (the structs are packed, so they are read
+ * straight from the mapping) and collect the screen fonts to be written.
+ */
+static int vf_extract_cpi2(cpi_input &in, const vf_state &st, bool seg_mode)
 {
-	struct cpi_fontfile_header ffh;
-	struct cpi_fontinfo_header fih;
-
-	memcpy(&ffh, vdata, sizeof(ffh));
-	ffh.pnum = le16_to_cpu(ffh.pnum);
-	ffh.fih_offset = le32_to_cpu(ffh.fih_offset);
+	auto vdata = static_cast<const char *>(in.map);
+	auto vsize = in.size;
+	if (vsize < sizeof(cpi_fontfile_header))
+		return -EINVAL;
+	auto ffh = reinterpret_cast<const cpi_fontfile_header *>(vdata);
+	size_t fih_offset = le32_to_cpu(ffh->fih_offset);
 
-	if (ffh.id0 != 0xFF || strncmp(ffh.id, "FONT    ", sizeof(ffh.id)) != 0 ||
-	    ffh.pnum != 1 || ffh.ptyp != 1)
+	if (ffh->id0 != 0xFF || strncmp(ffh->id, "FONT    ", sizeof(ffh->id)) != 0 ||
+	    le16_to_cpu(ffh->pnum) != 1 || ffh->ptyp != 1)
 		return -EINVAL;
-	if (ffh.fih_offset + sizeof(fih) >= vsize)
+	if (fih_offset + sizeof(cpi_fontinfo_header) >= vsize)
 		return -EINVAL;
 
-	memcpy(&fih, vdata + ffh.fih_offset, sizeof(fih));
-	fih.num_codepages = le16_to_cpu(fih.num_codepages);
-
-	const char *cpeblk = vdata + ffh.fih_offset + sizeof(fih);
-	for (unsigned int i = 0; i < fih.num_codepages; ++i) {
-		struct cpi_cpentry_header cpeh;
-		struct cpi_cpinfo_header cpih;
-
-		if (cpeblk - vdata + sizeof(cpeh) >= vsize)
+	auto fih = reinterpret_cast<const cpi_fontinfo_header *>(vdata + fih_offset);
+	unsigned int num_codepages = le16_to_cpu(fih->num_codepages);
+	size_t cpe_offset = fih_offset + sizeof(*fih);
+	for (unsigned int i = 0; i < num_codepages; ++i) {
+		if (cpe_offset + sizeof(cpi_cpentry_header) >= vsize)
 			return -EINVAL;
-		memcpy(&cpeh, cpeblk, sizeof(cpeh));
-		cpeh.cpeh_size        = le16_to_cpu(cpeh.cpeh_size);
-		if (cpeh.cpeh_size != sizeof(cpeh))
+		auto cpeh = reinterpret_cast<const cpi_cpentry_header *>(vdata + cpe_offset);
+		if (le16_to_cpu(cpeh->cpeh_size) != sizeof(*cpeh))
 			return -EINVAL;
-		cpeh.next_cpeh_offset = seg_mode ?
-		                        xlate_segoff(le32_to_cpu(cpeh.next_cpeh_offset)) :
-		                        le32_to_cpu(cpeh.next_cpeh_offset);
-		cpeh.device_type      = le16_to_cpu(cpeh.device_type);
-		cpeh.codepage         = le16_to_cpu(cpeh.codepage);
-		cpeh.cpih_offset      = seg_mode ?
-		                        xlate_segoff(le32_to_cpu(cpeh.cpih_offset)) :
-		                        le32_to_cpu(cpeh.cpih_offset);
-		cpeblk = vdata + cpeh.next_cpeh_offset;
-
-		printf("CPEH #%u: Name: %.*s, Codepage: %u, Device: %.*s, DType: %u\n",
-		       i, static_cast<int>(sizeof(cpeh.device_name)),
-		       cpeh.device_name, cpeh.codepage,
-		       static_cast<int>(std::size(cpeh.device_name)),
-		       cpeh.device_name, cpeh.device_type);
-
-		if (cpeh.next_cpeh_offset + sizeof(cpeh) >= vsize)
+		size_t next_cpeh_offset = seg_mode ?
+		                          xlate_segoff(le32_to_cpu(cpeh->next_cpeh_offset)) :
+		                          le32_to_cpu(cpeh->next_cpeh_offset);
+		unsigned int device_type = le16_to_cpu(cpeh->device_type);
+		unsigned int codepage    = le16_to_cpu(cpeh->codepage);
+		size_t cpih_offset = seg_mode ?
+		                     xlate_segoff(le32_to_cpu(cpeh->cpih_offset)) :
+		                     le32_to_cpu(cpeh->cpih_offset);
+		cpe_offset = next_cpeh_offset;
+
+		in.log += cpi_logf("CPEH #%u: Name: %.*s, Codepage: %u, Device: %.*s, DType: %u\n",
+		          i, static_cast<int>(sizeof(cpeh->device_name)),
+		          cpeh->device_name, codepage,
+		          static_cast<int>(std::size(cpeh->device_name)),
+		          cpeh->device_name, device_type);
+
+		if (next_cpeh_offset + sizeof(cpi_cpentry_header) >= vsize)
 			return -EINVAL;
-		if (cpeh.cpih_offset + sizeof(cpih) >= vsize)
+		if (cpih_offset + sizeof(cpi_cpinfo_header) >= vsize)
 			return -EINVAL;
-		memcpy(&cpih, vdata + cpeh.cpih_offset, sizeof(cpih));
-		cpih.version   = le16_to_cpu(cpih.version);
-		cpih.num_fonts = le16_to_cpu(cpih.num_fonts);
-		cpih.size      = le16_to_cpu(cpih.size);
-		printf("CPIH: version=%u fonts=%u size=%u\n", cpih.version,
-		       cpih.num_fonts, cpih.size);
-		if (cpih.version != 1)
+		auto cpih = reinterpret_cast<const cpi_cpinfo_header *>(vdata + cpih_offset);
+		unsigned int version = le16_to_cpu(cpih->version);
+		unsigned int num_fonts = le16_to_cpu(cpih->num_fonts);
+		in.log += cpi_logf("CPIH: version=%u fonts=%u size=%u\n", version,
+		          num_fonts, le16_to_cpu(cpih->size));
+		if (version != 1)
 			continue;
 
 		char dev[HXSIZEOF_Z32*2], cpg[HXSIZEOF_Z32*2];
 		*dev = '\0';
-		HX_strlncat(dev, cpeh.device_name, std::size(dev), std::size(cpeh.device_name));
+		HX_strlncat(dev, cpeh->device_name, std::size(dev), std::size(cpeh->device_name));
 		HX_strrtrim(dev);
-		snprintf(cpg, std::size(cpg), "%u", cpeh.codepage);
-		if (cpeh.device_type == DEVTYPE_SCREEN)
-			vf_extract_sfh(vdata + cpeh.cpih_offset + sizeof(cpih),
-				cpih.num_fonts, directory, dev, cpg);
-		else if (cpeh.device_type == DEVTYPE_PRINTER)
-			vf_extract_pfh(vdata + cpeh.cpih_offset + sizeof(cpih));
+		snprintf(cpg, std::size(cpg), "%u", codepage);
+		if (device_type == DEVTYPE_SCREEN) {
+			auto ret = vf_extract_sfh(in, st, cpih_offset + sizeof(*cpih),
+			           num_fonts, dev, cpg, codepage);
+			if (ret < 0)
+				return ret;
+		} else if (device_type == DEVTYPE_PRINTER) {
+			vf_extract_pfh(in, cpih_offset + sizeof(*cpih));
+		}
 	}
-	return true;
+	return 0;
 }
 
-static bool vf_xcpi(font &f, char **args, bool seg_mode)
+static int cpi_map(cpi_input &in)
 {
-	auto in_fd = open(args[0], O_RDONLY);
-	if (in_fd < 0) {
-		fprintf(stderr, "Could not open %s: %s\n", args[0], strerror(errno));
-		return false;
-	}
-	auto fdclean = make_scope_success([&]() { close(in_fd); });
+	auto fd = open(in.file.c_str(), O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	auto fdclean = make_scope_success([&]() { close(fd); });
 	struct stat sb;
-	if (fstat(in_fd, &sb) < 0) {
-		fprintf(stderr, "fstat: %s\n", strerror(errno));
+	if (fstat(fd, &sb) < 0)
+		return -errno;
+	if (sb.st_size == 0)
+		return -EINVAL;
+	auto mapping = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping == MMAP_NONE)
+		return -errno;
+	in.map   = mapping;
+	in.size  = sb.st_size;
+	in.mtime = sb.st_mtime;
+	return 0;
+}
+
+static void tar_octal(char *field, size_t fsize, unsigned long long v)
+{
+	snprintf(field, fsize, "%0*llo", static_cast<int>(fsize - 1), v);
+}
+
+/* A short write need not set errno; it is then reported as -EIO */
+static int tar_put(FILE *fp, const void *buf, size_t size)
+{
+	errno = 0;
+	if (size == 0 || fwrite(buf, size, 1, fp) == 1)
+		return 0;
+	return errno != 0 ? -errno : -EIO;
+}
+
+/**
+ * Put @name into the ustar header @hdr. Names longer than the 100-byte name
+ * field are split at a slash, with the leading part going to the 155-byte
+ * prefix field.
+ */
+static bool tar_name(char *hdr, const std::string &name)
+{
+	if (name.size() <= 100) {
+		memcpy(hdr, name.c_str(), name.size());
+		return true;
+	}
+	auto p = name.find('/', name.size() - 101);
+	if (p == name.npos || p > 155 || p + 1 == name.size())
 		return false;
+	memcpy(hdr, &name[p+1], name.size() - p - 1);
+	memcpy(&hdr[345], name.c_str(), p);
+	return true;
+}
+
+/**
+ * Write all members into one ustar archive.
+ */
+static int cpi_write_tar(const char *file, const std::vector<std::unique_ptr<cpi_input>> &inputs)
+{
+	std::unique_ptr<FILE, deleter> fp(fopen(file, "wb"));
+	if (fp == nullptr)
+		return -errno;
+	static const char zero[512]{};
+	for (const auto &in : inputs) {
+		for (const auto &m : in->members) {
+			char hdr[512]{};
+			if (!tar_name(hdr, m.name)) {
+				fprintf(stderr, "%s: name too long for archive\n", m.name.c_str());
+				return -ENAMETOOLONG;
+			}
+			tar_octal(&hdr[100], 8, 0644);
+			tar_octal(&hdr[108], 8, 0);
+			tar_octal(&hdr[116], 8, 0);
+			tar_octal(&hdr[124], 12, m.size);
+			tar_octal(&hdr[136], 12, in->mtime);
+			memset(&hdr[148], ' ', 8);
+			hdr[156] = '0';
+			memcpy(&hdr[257], "ustar", 6);
+			memcpy(&hdr[263], "00", 2);
+			unsigned int sum = 0;
+			for (auto c : hdr)
+				sum += static_cast<unsigned char>(c);
+			snprintf(&hdr[148], 8, "%06o", sum);
+			auto pad = (512 - m.size % 512) % 512;
+			auto ret = tar_put(fp.get(), hdr, sizeof(hdr));
+			if (ret == 0)
+				ret = tar_put(fp.get(), m.data, m.size);
+			if (ret == 0)
+				ret = tar_put(fp.get(), zero, pad);
+			if (ret < 0)
+				return ret;
+		}
 	}
+	auto ret = tar_put(fp.get(), zero, sizeof(zero));
+	if (ret == 0)
+		ret = tar_put(fp.get(), zero, sizeof(zero));
+	errno = 0;
+	if (ret == 0 && fflush(fp.get()) != 0)
+		ret = errno != 0 ? -errno : -EIO;
+	return ret;
+}
 
-	auto mapping = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, in_fd, 0);
-	if (mapping == MMAP_NONE) {
-		fprintf(stderr, "mmap: %s\n", strerror(errno));
-		return false;
+/**
+ * Write all members below @outdir. Directories are made up front; the files
+ * are then queued on an async_io straight from the input mappings.
+ */
+static bool cpi_write_dir(const std::string &outdir, const std::vector<std::unique_ptr<cpi_input>> &inputs)
+{
+	std::set<std::string> dirs{outdir};
+	for (const auto &in : inputs) {
+		for (const auto &m : in->members) {
+			auto p = m.name.rfind('/');
+			if (p != m.name.npos)
+				dirs.emplace(outdir + "/" + m.name.substr(0, p));
+		}
+	}
+	for (const auto &d : dirs) {
+		auto ret = HX_mkdir(d.c_str(), S_IRWXUGO);
+		if (ret < 0) {
+			fprintf(stderr, "Could not create %s: %s\n", d.c_str(), strerror(-ret));
+			return false;
+		}
 	}
-	auto mapclean = make_scope_success([&]() { munmap(mapping, sb.st_size); });
-	auto ret = vf_extract_cpi2(static_cast<const char *>(mapping),
-	           sb.st_size, args[1], seg_mode);
-	if (ret == -EINVAL) {
-		fprintf(stderr, "xcpi: file \"%s\" not recognized\n", args[0]);
+	async_io io;
+	for (const auto &in : inputs)
+		for (const auto &m : in->members)
+			io.write_ref(outdir + "/" + m.name, m.data, m.size);
+	std::string failed;
+	auto ret = io.flush(&failed);
+	if (ret < 0) {
+		fprintf(stderr, "Error writing to %s: %s\n", failed.c_str(), strerror(-ret));
 		return false;
 	}
-	return ret >= 0;
+	return true;
 }
 
-static bool vf_xcpi_flat(font &f, char **args)
+/**
+ * Output subdirectory for each of several inputs: the path below the
+ * directory they all share, so that a/ega.cpi and b/ega.cpi stay apart.
+ * Paths with "." or ".." components fall back to the file name; names
+ * that are already taken get a ".N" suffix.
+ */
+static void cpi_prefixes(std::vector<std::unique_ptr<cpi_input>> &inputs)
 {
-	return vf_xcpi(f, args, false);
+	if (inputs.size() < 2)
+		return;
+	auto &first = inputs[0]->file;
+	auto common = first.substr(0, first.rfind('/') + 1);
+	for (const auto &in : inputs) {
+		while (!common.empty() && in->file.compare(0, common.size(), common) != 0) {
+			auto p = common.size() >= 2 ? common.rfind('/', common.size() - 2) : common.npos;
+			common.erase(p == common.npos ? 0 : p + 1);
+		}
+	}
+	std::set<std::string> used;
+	for (auto &in : inputs) {
+		auto rel = in->file.substr(common.size());
+		auto chk = "/" + rel + "/";
+		if (chk.find("/./") != chk.npos || chk.find("/../") != chk.npos ||
+		    chk.find("//") != chk.npos)
+			rel = rel.substr(rel.rfind('/') + 1);
+		auto name = rel;
+		for (unsigned int n = 2; !used.emplace(name).second; ++n)
+			name = rel + "." + std::to_string(n);
+		in->prefix = std::move(name) + "/";
+	}
 }
 
-static bool vf_xcpi_seg(font &f, char **args)
+/**
+ * @args[0] may be a glob pattern, unless it names an existing file; with more
+ * than one match, each file's fonts go into a subdirectory per file, named
+ * as per cpi_prefixes. If @args[1] ends in ".tar", a single archive is
+ * written instead of a directory tree.
+ */
+static bool vf_xcpi(font &f, const vf_state &st, char **args, bool seg_mode)
 {
-	return vf_xcpi(f, args, true);
+	std::vector<std::unique_ptr<cpi_input>> inputs;
+	struct stat sb;
+	if (strpbrk(args[0], "*?[{") == nullptr || stat(args[0], &sb) == 0) {
+		/* Existing files are taken literally, metacharacters or not */
+		inputs.emplace_back(std::make_unique<cpi_input>());
+		inputs.back()->file = args[0];
+	} else {
+		glob_t gl;
+		int gflags = GLOB_NOCHECK;
+#ifdef GLOB_BRACE
+		gflags |= GLOB_BRACE;
+#endif
+		if (glob(args[0], gflags, nullptr, &gl) != 0) {
+			fprintf(stderr, "xcpi: cannot expand \"%s\"\n", args[0]);
+			return false;
+		}
+		for (size_t i = 0; i < gl.gl_pathc; ++i) {
+			inputs.emplace_back(std::make_unique<cpi_input>());
+			inputs.back()->file = gl.gl_pathv[i];
+		}
+		globfree(&gl);
+	}
+	cpi_prefixes(inputs);
+
+	std::string outdir = args[1];
+	bool to_tar = outdir.size() > 4 && outdir.compare(outdir.size() - 4, 4, ".tar") == 0;
+	for (auto &in : inputs)
+		in->dest = outdir + (to_tar ? ":" : "/");
+	parallel_for(inputs.size(), [&](size_t i) {
+		auto &in = *inputs[i];
+		in.err = cpi_map(in);
+		if (in.err == 0)
+			in.err = vf_extract_cpi2(in, st, seg_mode);
+		if (in.err < 0)
+			in.members.clear();
+	});
+
+	bool ok = true;
+	for (const auto &in : inputs) {
+		fputs(in->log.c_str(), stdout);
+		if (in->err == -EINVAL) {
+			fprintf(stderr, "xcpi: file \"%s\" not recognized\n", in->file.c_str());
+			ok = false;
+		} else if (in->err < 0) {
+			fprintf(stderr, "Could not open %s: %s\n", in->file.c_str(), strerror(-in->err));
+			ok = false;
+		}
+	}
+	if (to_tar) {
+		auto ret = cpi_write_tar(outdir.c_str(), inputs);
+		if (ret < 0) {
+			fprintf(stderr, "Error writing to %s: %s\n", outdir.c_str(), strerror(-ret));
+			return false;
+		}
+		return ok;
+	}
+	return cpi_write_dir(outdir, inputs) && ok;
+}
+
+static bool vf_xcpi_flat(font &f, vf_state &st, char **args)
+{
+	return vf_xcpi(f, st, args, false);
+}
+
+static bool vf_xcpi_seg(font &f, vf_state &st, char **args)
+{
+	return vf_xcpi(f, st, args, true);
 }
 
 static bool vf_xlat(font &f, char **args)
@@ -577,33 +1020,51 @@ static bool vf_xlat(font &f, char **args)
 static const struct vf_command {
 	const char *cmd;
 	unsigned int nargs;
-	bool (*func)(font &f, char **args);
+	bool (*func)(font &f, vf_state &st, char **args);
+	/*
+	 * Commands that only touch the font they are given; run on the main
+	 * font and on every strike of the set, concurrently
+	 */
+	bool (*font_func)(font &f, char **args);
 } vf_commlist[] = {
+	{"addstrike", 0, vf_addstrike},
+	{"autocrop", 0, nullptr, vf_autocrop},
+	{"autocrop.bl", 0, nullptr, vf_autocrop_bl},
 	{"blankfnt", 0, vf_blankfnt},
 	{"canvas", 2, vf_canvas},
 	{"clearmap", 0, vf_clearmap},
+	{"compose", 0, vf_compose},
+	{"composeud", 1, vf_composeud},
 	{"copy", 6, vf_copy},
+	{"cpifilter", 1, vf_cpifilter},
 	{"cpisep", 1, vf_cpisep},
 	{"crop", 4, vf_crop},
-	{"fliph", 0, vf_fliph},
-	{"flipv", 0, vf_flipv},
-	{"invert", 0, vf_invert},
-	{"lge", 0, vf_lge},
-	{"lgeu", 0, vf_lgeu},
-	{"lgeuf", 0, vf_lgeuf},
+	{"fliph", 0, nullptr, vf_fliph},
+	{"flipv", 0, nullptr, vf_flipv},
+	{"invert", 0, nullptr, vf_invert},
+	{"lge", 0, nullptr, vf_lge},
+	{"lger", 3, nullptr, vf_lger},
+	{"lgeu", 0, nullptr, vf_lgeu},
+	{"lgeuf", 0, nullptr, vf_lgeuf},
 	{"loadbdf", 1, vf_loadbdf},
 	{"loadclt", 1, vf_loadclt},
+	{"loadclt.cache", 1, vf_loadclt_cache},
 	{"loadfnt", 1, vf_loadfnt},
 	{"loadhex", 1, vf_loadhex},
 	{"loadmap", 1, vf_loadmap},
 	{"loadpcf", 1, vf_loadpcf},
 	{"loadpsf", 1, vf_loadpsf},
 	{"loadraw", 3, vf_loadraw},
-	{"move", 2, vf_move},
-	{"overstrike", 1, vf_overstrike},
+	{"move", 2, nullptr, vf_move},
+	{"overstrike", 1, nullptr, vf_overstrike},
+	{"reorder", 0, vf_reorder},
+	{"reorder.auto", 0, vf_reorder_auto},
 	{"savebdf", 1, vf_savebdf},
+	{"savebdfset", 1, vf_savebdfset},
 	{"saveclt", 1, vf_saveclt},
+	{"savecpi", 2, vf_savecpi},
 	{"savefnt", 1, vf_savefnt},
+	{"savehex", 1, vf_savehex},
 	{"savemap", 1, vf_savemap},
 	{"saven1", 1, vf_saven1},
 	{"saven2", 1, vf_saven2},
@@ -611,15 +1072,41 @@ static const struct vf_command {
 	{"savepbm", 1, vf_savepbm},
 	{"savepsf", 1, vf_savepsf},
 	{"savesfd", 1, vf_savesfd},
-	{"setbold", 0, vf_setbold},
-	{"setname", 1, vf_setname},
-	{"setprop", 2, vf_setprop},
-	{"upscale", 2, vf_upscale},
+	{"savespan", 1, vf_savespan},
+	{"setbold", 0, nullptr, vf_setbold},
+	{"setname", 1, nullptr, vf_setname},
+	{"setprop", 2, nullptr, vf_setprop},
+	{"syncclt", 1, vf_syncclt},
+	{"syncpbm", 1, vf_syncpbm},
+	{"synthbox", 0, vf_synthbox},
+	{"synthbox.all", 0, vf_synthbox_all},
+	{"upscale", 2, nullptr, vf_upscale},
 	{"xcpi", 2, vf_xcpi_flat},
 	{"xcpi.ice", 2, vf_xcpi_seg},
-	{"xlat", 2, vf_xlat},
+	{"xlat", 2, nullptr, vf_xlat},
 };
 
+/*
+ * Per-strike transforms like autocrop or upscale can give two strikes the
+ * same cell size, which addstrike would have refused.
+ */
+static bool strikes_distinct(const font_set &set, const char *cmd)
+{
+	const auto &v = set.m_strike;
+	for (size_t i = 0; i < v.size(); ++i) {
+		auto a = v[i].m_glyph[0].m_size;
+		for (size_t j = 0; j < i; ++j) {
+			auto b = v[j].m_glyph[0].m_size;
+			if (a.w == b.w && a.h == b.h) {
+				fprintf(stderr, "%s: two strikes of the set ended up as %ux%u\n",
+				        cmd, a.w, a.h);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
 int main(int argc, char **argv)
 {
 	--argc;
@@ -628,7 +1115,16 @@ int main(int argc, char **argv)
 		fprintf(stderr, "You should specify some commlist.\n");
 		return EXIT_FAILURE;
 	}
+	/* Kernel tables are set up on first use, so only before the commands */
+	for (; argc > 0 && strncmp(argv[0], "--kernels=", 10) == 0; --argc, ++argv) {
+		auto ret = isa_select(&argv[0][10]);
+		if (ret < 0) {
+			fprintf(stderr, "%s: %s\n", argv[0], strerror(-ret));
+			return EXIT_FAILURE;
+		}
+	}
 	font f;
+	vf_state st;
 	while (argc > 0) {
 		if (argv[0][0] == '-')
 			++argv[0];
@@ -645,8 +1141,20 @@ int main(int argc, char **argv)
 			fprintf(stderr, "Error: Command \"%s\" requires %u arguments.\n", argv[0], ce->nargs);
 			return EXIT_FAILURE;
 		}
-		if (!ce->func(f, ++argv))
+		++argv;
+		if (ce->font_func != nullptr) {
+			if (!ce->font_func(f, argv))
+				return EXIT_FAILURE;
+			std::atomic<bool> ok{true};
+			st.strikes.each([&](font &strike) {
+				if (!ce->font_func(strike, argv))
+					ok = false;
+			});
+			if (!ok || !strikes_distinct(st.strikes, ce->cmd))
+				return EXIT_FAILURE;
+		} else if (!ce->func(f, st, argv)) {
 			return EXIT_FAILURE;
+		}
 		argc -= ce->nargs;
 		argv += ce->nargs;
 	}